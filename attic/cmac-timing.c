@@ -5,6 +5,11 @@
  * This is just the CMAC timing.
  * It doesn't include the copy or compare or finding the right key.
  *
+ * The "CMAC" section is the old ntpd way: key schedule every packet.
+ * The "CMAC copy" section is what ntpd does now: CMAC_Init once when
+ * the key is loaded, then CMAC_CTX_copy for each packet.
+ * "EVP_MAC dup" is the OpenSSL 3 equivalent using EVP_MAC_CTX_dup().
+ *
  * Beware of overflows in the timing computations.
  *
  * Disable AES-NI (Intel hardware: NI == New Instruction) with:
@@ -152,6 +157,76 @@ static void DoCMAC(
 	printf("\n");
 }
 
+static size_t One_CMAC_copy(
+  CMAC_CTX *keyed,          /* context with key already set */
+  uint8_t *pkt,             /* packet pointer */
+  int     pktlength         /* packet length */
+) {
+	size_t len;
+	if (1 != CMAC_CTX_copy(cmac, keyed)) {
+                unsigned long err = ERR_get_error();
+                char * str = ERR_error_string(err, NULL);
+                printf("## Oops, CMAC_CTX_copy() failed:\n    %s.\n", str);
+                return 0;
+	}
+	if (1 != CMAC_Update(cmac, pkt, pktlength)) {
+                unsigned long err = ERR_get_error();
+                char * str = ERR_error_string(err, NULL);
+                printf("## Oops, CMAC_Update() failed:\n    %s.\n", str);
+                return 0;
+	}
+	if (1 != CMAC_Final(cmac, answer, &len)) {
+                unsigned long err = ERR_get_error();
+                char * str = ERR_error_string(err, NULL);
+                printf("## Oops, CMAC_Final() failed:\n    %s.\n", str);
+                return 0;
+	}
+	return len;
+}
+
+
+static void DoCMACCopy(
+  const char *name,       /* name of cipher */
+  uint8_t *key,           /* key pointer */
+  int     keylength,      /* key length */
+  uint8_t *pkt,           /* packet pointer */
+  int     pktlength       /* packet length */
+)
+{
+	const EVP_CIPHER *cipher = CheckCipher(name);
+	struct timespec start, stop;
+	double fast;
+	unsigned long digestlength = 0;
+	CMAC_CTX *keyed;
+
+	if (NULL == cipher) {
+		return;
+	}
+
+	keyed = CMAC_CTX_new();
+	if (1 != CMAC_Init(keyed, key, keylength, cipher, NULL)) {
+                unsigned long err = ERR_get_error();
+                char * str = ERR_error_string(err, NULL);
+                printf("## Oops, CMAC_Init() failed:\n    %s.\n", str);
+		CMAC_CTX_free(keyed);
+                return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < NUM; i++) {
+		digestlength = One_CMAC_copy(keyed, pkt, pktlength);
+		if (0 == digestlength)
+			break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	fast = (stop.tv_sec-start.tv_sec)*1E9 + (stop.tv_nsec-start.tv_nsec);
+	printf("%12s  %2d %2d %2lu %6.0f  %6.3f",
+	       name, keylength, pktlength, digestlength, fast/NUM,  fast/1E9);
+	PrintHex(answer, digestlength);
+	printf("\n");
+	CMAC_CTX_free(keyed);
+}
+
 #if OPENSSL_VERSION_NUMBER > 0x10101000L
 static size_t One_PKEY(
   EVP_PKEY *pkey,
@@ -244,7 +319,7 @@ static size_t One_EVP_MAC(
 		return 0;
 	}
 
-	if (0 == EVP_MAC_init(ctx)) {
+	if (0 == EVP_MAC_init(ctx, NULL, 0, NULL)) {
 		unsigned long err = ERR_get_error();
 		char * str = ERR_error_string(err, NULL);
 		printf("## Oops, EVP_MAC_init() failed: %s.\n", str);
@@ -305,7 +380,7 @@ static size_t One_EVP_MAC2(
 ) {
 	size_t len = EVP_MAX_MD_SIZE;
 
-	if (0 == EVP_MAC_init(ctx)) {
+	if (0 == EVP_MAC_init(ctx, NULL, 0, NULL)) {
 		unsigned long err = ERR_get_error();
 		char * str = ERR_error_string(err, NULL);
 		printf("## Oops, EVP_MAC_init() failed: %s.\n", str);
@@ -372,6 +447,79 @@ if (0 == digestlength) break;
 	PrintHex(answer, digestlength);
 	printf("\n");
 }
+
+static size_t One_EVP_MAC_dup(
+  EVP_MAC_CTX *keyed,       /* context with cipher and key set */
+  uint8_t *pkt,             /* packet pointer */
+  int     pktlength         /* packet length */
+) {
+	size_t len = EVP_MAX_MD_SIZE;
+	EVP_MAC_CTX *ctx = EVP_MAC_CTX_dup(keyed);
+
+	if (NULL == ctx) {
+		unsigned long err = ERR_get_error();
+		char * str = ERR_error_string(err, NULL);
+		printf("## Oops, EVP_MAC_CTX_dup() failed: %s.\n", str);
+		return 0;
+	}
+	if (0 == EVP_MAC_update(ctx, pkt, pktlength)) {
+		unsigned long err = ERR_get_error();
+		char * str = ERR_error_string(err, NULL);
+		printf("## Oops, EVP_MAC_update() failed: %s.\n", str);
+		len = 0;
+	} else if (0 == EVP_MAC_final(ctx, answer, &len, sizeof(answer))) {
+		unsigned long err = ERR_get_error();
+		char * str = ERR_error_string(err, NULL);
+		printf("## Oops, EVP_MAC_final() failed: %s.\n", str);
+		len = 0;
+	}
+	EVP_MAC_CTX_free(ctx);
+	return len;
+}
+
+
+static void Do_EVP_MAC_dup(
+  const char *name,       /* name of cipher */
+  uint8_t *key,           /* key pointer */
+  int     keylength,      /* key length */
+  uint8_t *pkt,           /* packet pointer */
+  int     pktlength       /* packet length */
+)
+{
+	struct timespec start, stop;
+	double fast;
+	unsigned long digestlength = 0;
+	char cbc[100];
+	const EVP_CIPHER *cipher = CheckCipher(name);
+	OSSL_PARAM params[2];
+
+	if (NULL == cipher) {
+		return;
+	}
+	snprintf(cbc, sizeof(cbc), "%s-CBC", name);
+
+	params[0] =
+          OSSL_PARAM_construct_utf8_string("cipher", cbc, 0);
+	params[1] = OSSL_PARAM_construct_end();
+	if (0 == EVP_MAC_init(evp, key, keylength, params)) {
+		unsigned long err = ERR_get_error();
+		char * str = ERR_error_string(err, NULL);
+		printf("## Oops, EVP_MAC_init() failed: %s.\n", str);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < NUM; i++) {
+		digestlength = One_EVP_MAC_dup(evp, pkt, pktlength);
+if (0 == digestlength) break;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	fast = (stop.tv_sec-start.tv_sec)*1E9 + (stop.tv_nsec-start.tv_nsec);
+	printf("%12s  %2d %2d %2lu %6.0f  %6.3f",
+	       name, keylength, pktlength, digestlength, fast/NUM,  fast/1E9);
+	PrintHex(answer, digestlength);
+	printf("\n");
+}
 #endif
 
 int main(int argc, char *argv[])
@@ -415,6 +563,28 @@ int main(int argc, char *argv[])
 	DoCMAC("ARIA-192",     key, 24, packet, PACKET_LENGTH);
 	DoCMAC("ARIA-256",     key, 32, packet, PACKET_LENGTH);
 
+	printf("\n");
+	printf("# KL=key length, PL=packet length, CL=CMAC length\n");
+	printf("# CMAC copy   KL PL CL  ns/op sec/run\n");
+
+#if OPENSSL_VERSION_NUMBER < 0x20000000L
+	DoCMACCopy("DES",          key,  8, packet, PACKET_LENGTH);
+#endif
+	DoCMACCopy("DES-EDE",      key, 16, packet, PACKET_LENGTH);
+	DoCMACCopy("DES-EDE3",     key, 24, packet, PACKET_LENGTH);
+#ifndef OPENSSL_NO_SM4
+	DoCMACCopy("SM4",          key, 16, packet, PACKET_LENGTH);
+#endif
+	DoCMACCopy("AES-128",      key, 16, packet, PACKET_LENGTH);
+	DoCMACCopy("AES-192",      key, 24, packet, PACKET_LENGTH);
+	DoCMACCopy("AES-256",      key, 32, packet, PACKET_LENGTH);
+	DoCMACCopy("CAMELLIA-128", key, 16, packet, PACKET_LENGTH);
+	DoCMACCopy("CAMELLIA-192", key, 24, packet, PACKET_LENGTH);
+	DoCMACCopy("CAMELLIA-256", key, 32, packet, PACKET_LENGTH);
+	DoCMACCopy("ARIA-128",     key, 16, packet, PACKET_LENGTH);
+	DoCMACCopy("ARIA-192",     key, 24, packet, PACKET_LENGTH);
+	DoCMACCopy("ARIA-256",     key, 32, packet, PACKET_LENGTH);
+
 #if OPENSSL_VERSION_NUMBER > 0x10101000L
 	printf("\n");
 	printf("# KL=key length, PL=packet length, CL=CMAC length\n");
@@ -475,6 +645,24 @@ int main(int argc, char *argv[])
 	Do_EVP_MAC2("ARIA-128",     key, 16, packet, PACKET_LENGTH);
 	Do_EVP_MAC2("ARIA-192",     key, 24, packet, PACKET_LENGTH);
 	Do_EVP_MAC2("ARIA-256",     key, 32, packet, PACKET_LENGTH);
+
+	printf("\n");
+	printf("# KL=key length, PL=packet length, CL=CMAC length\n");
+	printf("# EVP_MAC dup KL PL CL  ns/op sec/run\n");
+	Do_EVP_MAC_dup("DES-EDE",      key, 16, packet, PACKET_LENGTH);
+	Do_EVP_MAC_dup("DES-EDE3",     key, 24, packet, PACKET_LENGTH);
+#ifndef OPENSSL_NO_SM4
+	Do_EVP_MAC_dup("SM4",          key, 16, packet, PACKET_LENGTH);
+#endif
+	Do_EVP_MAC_dup("AES-128",      key, 16, packet, PACKET_LENGTH);
+	Do_EVP_MAC_dup("AES-192",      key, 24, packet, PACKET_LENGTH);
+	Do_EVP_MAC_dup("AES-256",      key, 32, packet, PACKET_LENGTH);
+	Do_EVP_MAC_dup("CAMELLIA-128", key, 16, packet, PACKET_LENGTH);
+	Do_EVP_MAC_dup("CAMELLIA-192", key, 24, packet, PACKET_LENGTH);
+	Do_EVP_MAC_dup("CAMELLIA-256", key, 32, packet, PACKET_LENGTH);
+	Do_EVP_MAC_dup("ARIA-128",     key, 16, packet, PACKET_LENGTH);
+	Do_EVP_MAC_dup("ARIA-192",     key, 24, packet, PACKET_LENGTH);
+	Do_EVP_MAC_dup("ARIA-256",     key, 32, packet, PACKET_LENGTH);
 #endif
 
 	return 0;
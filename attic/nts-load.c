@@ -0,0 +1,431 @@
+/*
+ * nts-load.c - load generator for an NTS server
+ * Copyright the NTPsec project contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Hack to measure how much NTS work a server can do.
+ *
+ * Phase 1: -c threads each do -k NTS-KE handshakes, back to back.
+ * Phase 2: every session from phase 1 keeps one NTS-protected
+ * mode 3 request outstanding for -t seconds.  That's closed loop:
+ * the next request goes out when the reply to the last one comes in.
+ *
+ * The packets are made and checked by the same code ntpd uses:
+ * nts_client_send_request_core(), nts_client_process_response_core(),
+ * extens_client_send() and extens_client_recv() from ntpd/, so this
+ * also exercises nts_extens.c and nts_cookie.c on the server.
+ *
+ * Run it against a local ntpd, something like:
+ *   nts enable cert /tmp/cert.pem key /tmp/key.pem
+ *   restrict 127.0.0.1
+ * and
+ *   nts-load -n -c 16 -k 20 -t 10 127.0.0.1
+ * Use -n with a self signed certificate.
+ * The built in default restriction includes "limited", which will
+ * drop nearly all the NTP requests, hence the restrict line.
+ * Watch ntpd's CPU usage; with a fast server this will saturate
+ * before the server does.  Run several copies.
+ *
+ * Handshake latency includes the TCP connect.  Lost NTP requests
+ * are retried after a second with a fresh cookie.  A session
+ * that runs out of cookies drops out.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <openssl/ssl.h>
+
+#include "ntp_stdlib.h"
+#include "ntpd.h"
+#include "nts.h"
+#include "nts2.h"
+#include "ntp_dns.h"
+#include "timespecops.h"
+
+/* Not in a header, see tests/ntpd/nts_client.c */
+SSL_CTX* make_ssl_client_ctx(const char *filename);
+void set_hostname(SSL *ssl, struct peer *peer, const char *hostname);
+bool check_certificate(SSL *ssl, struct peer *peer);
+bool check_aead(SSL *ssl, struct peer *peer, const char *hostname);
+bool nts_client_send_request(SSL *ssl, struct peer *peer);
+bool nts_client_process_response(SSL *ssl, struct peer *peer);
+
+#define LOST_TIMEOUT	1.0	/* seconds before an NTP request is lost */
+
+struct session {
+	struct peer peer;
+	pthread_t tid;
+	int fd;				/* UDP, connected to the server */
+	bool busy;			/* request outstanding */
+	l_fp_w xmt;			/* comes back in org */
+	struct timespec sent;
+	/* phase 1 results, written by this session's thread */
+	int ke_good, ke_bad;
+	double *ke_times;
+};
+
+/* latencies in microseconds */
+struct samples {
+	double *v;
+	size_t count, size;
+};
+
+const char *progname = "nts-load";
+
+static const char *hostname = "localhost";
+static sockaddr_u ke_addr;		/* NTS-KE server */
+static sockaddr_u ntp_addr;		/* NTP server, unless KE says otherwise */
+static SSL_CTX *ctx;
+static int handshakes = 10;
+static bool noval = false;
+
+static double
+elapsed(struct timespec start, struct timespec finish) {
+	return tspec_to_d(sub_tspec(finish, start));
+}
+
+static void
+add_sample(struct samples *s, double v) {
+	if (s->count == s->size) {
+		s->size = s->size ? 2 * s->size : 1024;
+		s->v = realloc(s->v, s->size * sizeof(*s->v));
+		if (NULL == s->v) {
+			fprintf(stderr, "nts-load: out of memory\n");
+			exit(1);
+		}
+	}
+	s->v[s->count++] = v;
+}
+
+static int
+cmp_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void
+report(const char *what, struct samples *s, double secs, int bad) {
+	size_t n = s->count;
+
+	printf("%-8s %8lu good %6d bad %10.1f /s", what,
+	       (unsigned long)n, bad, n / secs);
+	if (0 < n) {
+		qsort(s->v, n, sizeof(*s->v), cmp_double);
+		printf("  p50 %8.1f  p99 %8.1f  p999 %8.1f usec",
+		       s->v[n / 2], s->v[n * 99 / 100], s->v[n * 999 / 1000]);
+	}
+	printf("\n");
+}
+
+/* One NTS-KE exchange, the way nts_probe() does it. */
+static bool
+ke_once(struct session *s) {
+	SSL *ssl;
+	int fd;
+	bool ok = false;
+
+	fd = socket(AF(&ke_addr), SOCK_STREAM, 0);
+	if (0 > fd)
+		return false;
+	if (0 > connect(fd, &ke_addr.sa, SOCKLEN(&ke_addr))) {
+		close(fd);
+		return false;
+	}
+	ssl = SSL_new(ctx);
+	set_hostname(ssl, &s->peer, hostname);
+	SSL_set_fd(ssl, fd);
+	s->peer.nts_state.addr = ntp_addr;
+
+	if (1 == SSL_connect(ssl) &&
+	    check_certificate(ssl, &s->peer) &&
+	    check_aead(ssl, &s->peer, hostname) &&
+	    nts_client_send_request(ssl, &s->peer) &&
+	    nts_client_process_response(ssl, &s->peer)) {
+		s->peer.nts_state.keylen =
+			nts_get_key_length(s->peer.nts_state.aead);
+		ok = nts_make_keys(ssl, s->peer.nts_state.aead,
+				   s->peer.nts_state.c2s,
+				   s->peer.nts_state.s2c,
+				   s->peer.nts_state.keylen);
+	}
+	if (!ok)
+		s->peer.nts_state.count = 0;
+	SSL_shutdown(ssl);
+	SSL_free(ssl);
+	close(fd);
+	return ok;
+}
+
+static void *
+ke_thread(void *arg) {
+	struct session *s = arg;
+	struct timespec start, finish;
+
+	for (int i = 0; i < handshakes; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (ke_once(s)) {
+			clock_gettime(CLOCK_MONOTONIC, &finish);
+			s->ke_times[s->ke_good++] = 1e6 * elapsed(start, finish);
+		} else
+			s->ke_bad++;
+	}
+	return NULL;
+}
+
+/* Send the next request for s.  Uses up a cookie. */
+static bool
+ntp_send(struct session *s) {
+	struct pkt xpkt;
+	int len;
+
+	if (0 >= s->peer.nts_state.count) {
+		s->busy = false;
+		return false;
+	}
+	ZERO(xpkt);
+	xpkt.li_vn_mode = PKT_LI_VN_MODE(LEAP_NOTINSYNC, NTP_VERSION,
+					 MODE_CLIENT);
+	ntp_RAND_bytes((unsigned char *)&s->xmt, sizeof(s->xmt));
+	xpkt.xmt = s->xmt;
+	len = LEN_PKT_NOMAC + extens_client_send(&s->peer, &xpkt);
+	clock_gettime(CLOCK_MONOTONIC, &s->sent);
+	s->busy = true;
+	if (len != send(s->fd, &xpkt, (size_t)len, 0)) {
+		s->busy = false;
+		return false;
+	}
+	return true;
+}
+
+/* Returns true if buf is a good reply to s's outstanding request. */
+static bool
+ntp_recv(struct session *s, uint8_t *buf, int len) {
+	struct pkt *rpkt = (struct pkt *)buf;
+
+	if (!s->busy || LEN_PKT_NOMAC >= len ||
+	    MODE_SERVER != PKT_MODE(rpkt->li_vn_mode) ||
+	    0 != memcmp(&rpkt->org, &s->xmt, sizeof(s->xmt)))
+		return false;
+	return extens_client_recv(&s->peer, buf, len);
+}
+
+static void
+usage(void) {
+	fprintf(stderr,
+		"usage: nts-load [-d] [-n] [-a ca] [-c sessions] "
+		"[-k handshakes] [-t seconds] [server[:port]]\n"
+		"  -d  log ntpd's NTS messages to stderr\n"
+		"  -n  don't check the server's certificate\n");
+	exit(1);
+}
+
+/* Look up hostname, fills in ke_addr and ntp_addr. */
+static void
+lookup(void) {
+	char host[256], *port, *tmp;
+	char keport[] = NTS_KE_PORTA_OLD;
+	struct addrinfo hints, *answer;
+	int rc;
+
+	strlcpy(host, hostname, sizeof(host));
+	tmp = strchr(host, ']');
+	port = strchr(tmp ? tmp : host, ':');
+	if (NULL != port)
+		*port++ = '\0';
+	else
+		port = keport;
+	if ('[' == host[0] && NULL != tmp) {
+		*tmp = '\0';
+		memmove(host, host + 1, strlen(host));
+	}
+	ZERO(hints);
+	hints.ai_socktype = SOCK_STREAM;
+	rc = getaddrinfo(host, port, &hints, &answer);
+	if (0 != rc) {
+		fprintf(stderr, "nts-load: %s: %s\n", hostname, gai_strerror(rc));
+		exit(1);
+	}
+	memcpy(&ke_addr, answer->ai_addr, answer->ai_addrlen);
+	freeaddrinfo(answer);
+	ntp_addr = ke_addr;
+	SET_PORT(&ntp_addr, NTP_PORT);
+}
+
+int
+main(int argc, char *argv[]) {
+	struct session *sessions;
+	struct pollfd *fds;
+	struct samples ke = {NULL, 0, 0}, ntp = {NULL, 0, 0};
+	struct timespec start, finish, now;
+	double duration = 10.0, secs;
+	int nsessions = 8, ke_bad = 0, ntp_bad = 0, lost = 0, live;
+	const char *ca = NULL;
+	bool debug = false;
+	int c;
+
+	while (-1 != (c = getopt(argc, argv, "a:c:dk:nt:"))) {
+		switch (c) {
+		    case 'a':
+			ca = optarg;
+			break;
+		    case 'c':
+			nsessions = atoi(optarg);
+			break;
+		    case 'd':
+			debug = true;
+			break;
+		    case 'k':
+			handshakes = atoi(optarg);
+			break;
+		    case 'n':
+			noval = true;
+			break;
+		    case 't':
+			duration = atof(optarg);
+			break;
+		    default:
+			usage();
+		}
+	}
+	if (optind < argc)
+		hostname = argv[optind++];
+	if (optind != argc || 1 > nsessions || 1 > handshakes)
+		usage();
+
+	syslogit = false;
+	termlogit = debug;
+	lookup();
+	extens_init();
+	ctx = make_ssl_client_ctx(ca);
+	if (NULL == ctx) {
+		fprintf(stderr, "nts-load: can't make SSL_CTX\n");
+		exit(1);
+	}
+
+	sessions = calloc((size_t)nsessions, sizeof(*sessions));
+	fds = calloc((size_t)nsessions, sizeof(*fds));
+	if (NULL == sessions || NULL == fds) {
+		fprintf(stderr, "nts-load: out of memory\n");
+		exit(1);
+	}
+
+	/* Phase 1: NTS-KE */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < nsessions; i++) {
+		struct session *s = &sessions[i];
+
+		s->peer.srcadr = ntp_addr;
+		if (noval)
+			s->peer.cfg.flags |= FLAG_NTS_NOVAL;
+		s->ke_times = calloc((size_t)handshakes, sizeof(double));
+		if (NULL == s->ke_times ||
+		    0 != pthread_create(&s->tid, NULL, ke_thread, s)) {
+			fprintf(stderr, "nts-load: can't start thread\n");
+			exit(1);
+		}
+	}
+	for (int i = 0; i < nsessions; i++) {
+		struct session *s = &sessions[i];
+
+		pthread_join(s->tid, NULL);
+		for (int j = 0; j < s->ke_good; j++)
+			add_sample(&ke, s->ke_times[j]);
+		ke_bad += s->ke_bad;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &finish);
+	report("NTS-KE", &ke, elapsed(start, finish), ke_bad);
+
+	/* Phase 2: NTP with NTS */
+	live = 0;
+	for (int i = 0; i < nsessions; i++) {
+		struct session *s = &sessions[i];
+		sockaddr_u *to = &s->peer.nts_state.addr;
+
+		fds[i].fd = -1;
+		fds[i].events = POLLIN;
+		if (0 >= s->peer.nts_state.count)
+			continue;
+		s->fd = socket(AF(to), SOCK_DGRAM, 0);
+		if (0 > s->fd || 0 > connect(s->fd, &to->sa, SOCKLEN(to))) {
+			perror("nts-load: UDP socket");
+			exit(1);
+		}
+		fds[i].fd = s->fd;
+		live++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < nsessions; i++)
+		if (0 <= fds[i].fd)
+			ntp_send(&sessions[i]);
+	now = start;
+	while (0 < live && elapsed(start, now) < duration) {
+		if (0 > poll(fds, (nfds_t)nsessions, 100) && EINTR != errno) {
+			perror("nts-load: poll");
+			exit(1);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for (int i = 0; i < nsessions; i++) {
+			struct session *s = &sessions[i];
+			uint8_t buf[sizeof(struct pkt)];
+			ssize_t len;
+
+			if (0 > fds[i].fd)
+				continue;
+			if (fds[i].revents & POLLIN) {
+				len = recv(s->fd, buf, sizeof(buf), 0);
+				if (0 < len && ntp_recv(s, buf, (int)len))
+					add_sample(&ntp, 1e6 * elapsed(s->sent, now));
+				else
+					ntp_bad++;
+				if (!ntp_send(s)) {
+					fds[i].fd = -1;
+					live--;
+				}
+			} else if (s->busy &&
+				   elapsed(s->sent, now) > LOST_TIMEOUT) {
+				lost++;
+				if (!ntp_send(s)) {
+					fds[i].fd = -1;
+					live--;
+				}
+			}
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &finish);
+	report("NTP-NTS", &ntp, elapsed(start, finish), ntp_bad);
+	secs = elapsed(start, finish);
+	if (0 < lost || live < nsessions)
+		printf("%d lost, %d of %d sessions still had cookies after %.1f sec\n",
+		       lost, live, nsessions, secs);
+
+	return 0;
+}
+
+/* Hacks to keep linker happy */
+
+#ifdef HAVE_SECCOMP_H
+void setup_SIGSYS_trap(void) {
+	return;		/* dummy to keep linker happy */
+}
+#endif
+
+void dns_take_server(struct peer *a, sockaddr_u *b) {
+	UNUSED_ARG(a);
+	UNUSED_ARG(b);
+}
+
+void dns_take_status(struct peer *a, DNS_Status b) {
+	UNUSED_ARG(a);
+	UNUSED_ARG(b);
+}
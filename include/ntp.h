@@ -258,6 +258,7 @@ struct peer {
 	uint8_t	cast_flags;	/* additional flags */
 	uint8_t	last_event;	/* last peer error code */
 	uint8_t	num_events;	/* number of error events */
+	uint8_t	dns_fails;	/* DNS/NTS-KE failures in a row */
 	struct ntsclient_t nts_state;	/* per-peer NTS state */
 
 	/*
@@ -609,7 +610,7 @@ struct pkt {
  */
 typedef struct mon_data	mon_entry;
 struct mon_data {
-	mon_entry *	hash_next;	/* next structure in hash list */
+	mon_entry *	free_next;	/* next structure on free list */
 	DECL_DLIST_LINK(mon_entry, mru);/* MRU list link pointers */
 	endpt *		lcladr;		/* address on which this arrived */
 	l_fp		first;		/* first time seen */
@@ -619,6 +620,7 @@ struct mon_data {
 	float		score;		/* recent packets/second */
 	unsigned short	flags;		/* restrict flags */
 	uint8_t		vn_mode;	/* packet mode & version */
+	bool		referenced;	/* seen since placed in MRU order */
 	sockaddr_u	rmtadr;		/* address of remote host */
 };
 
@@ -24,6 +24,12 @@ struct auth_data {
 	unsigned short	key_size;		/* secret length */
 	const EVP_MD *	digest;			/* Digest mode only */
 	const EVP_CIPHER *cipher;		/* CMAC mode only */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	EVP_MAC_CTX *	cmac_ctx;		/* keyed once, dup'd per packet */
+#else
+	CMAC_CTX *	cmac_ctx;		/* keyed once, copied per packet */
+#endif
+	EVP_MD_CTX *	digest_ctx;		/* key prefix already hashed */
 };
 
 extern  void    auth_init       (void);
@@ -62,6 +62,7 @@ struct ntp_control {
 #define CTL_OP_READ_MRU		10	/* retrieve MRU (mrulist) */
 #define CTL_OP_READ_ORDLIST_A	11	/* ordered list req. auth. */
 #define CTL_OP_REQ_NONCE	12	/* request a client nonce */
+#define CTL_OP_READ_MRU_BIN	13	/* MRU snapshot, binary records */
 #define	CTL_OP_UNSETTRAP	31	/* unset trap (obsolete, unused) */
 
 /*
@@ -174,4 +175,25 @@ struct ntp_control {
  */
 #define NONCE_TIMEOUT	16
 
+/*
+ * Each CTL_OP_READ_MRU row takes more than 64 octets, so a response
+ * of frags datagrams holds no more than frags * MRU_ROWS_PER_FRAG.
+ */
+#define MRU_ROWS_PER_FRAG	(CTL_MAX_DATA_LEN / 64)
+
+/*
+ * CTL_OP_READ_MRU_BIN responses are a header and fixed-width records,
+ * everything in network byte order.  See docs/mode6.adoc for the layout.
+ * A new dump gets a snapshot younger than MRU_BIN_REUSE seconds if
+ * there is one, so the MRU list is copied at most that often.  At most
+ * MRU_BIN_SNAPS snapshots are kept, and one nobody has asked for in
+ * MRU_BIN_IDLE seconds is dropped.
+ */
+#define MRU_BIN_VERSION	1
+#define MRU_BIN_HDRLEN	28
+#define MRU_BIN_RECLEN	52
+#define MRU_BIN_IDLE	60
+#define MRU_BIN_REUSE	5
+#define MRU_BIN_SNAPS	4
+
 #endif /* GUARD_NTP_CONTROL_H */
@@ -8,9 +8,12 @@
 
 typedef enum {DNS_good, DNS_temp, DNS_error} DNS_Status;
 
-/* start DNS query (unless busy) */
+/* start DNS query (false if busy) */
 extern bool dns_probe(struct peer*);
 
+/* limit on lookups in flight */
+extern void dns_set_workers(int);
+
 /* called by main thread to do callbacks */
 extern void dns_check(void);
 
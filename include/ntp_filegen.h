@@ -8,6 +8,8 @@
 #ifndef GUARD_NTP_FILEGEN_H
 #define GUARD_NTP_FILEGEN_H
 
+#include <string.h>
+
 #include "ntp_types.h"
 
 /*
@@ -27,10 +29,76 @@
  */
 
 #define FGEN_FLAG_LINK		0x01 /* make a link to base name */
+#define FGEN_FLAG_BINARY	0x02 /* fixed-width binary records */
 
 #define FGEN_FLAG_ENABLED	0x80 /* set this to really create files	  */
 				     /* without this, open is suppressed */
 
+/*
+ * Binary generation files hold a FGEN_BIN_HDRLEN byte header, then
+ * fixed-width records.  The header names the columns and indexes the
+ * first record of each day.  All numbers are little-endian; the first
+ * column is always "time", Unix seconds as a double.  The file name
+ * gets a ".bin" after the prefix, so text and binary never mix.
+ *
+ * header:	magic[8] version[2] hdrlen[2] reclen[2] ncols[2]
+ *		days[2] used[2], reserved up to FGEN_BIN_COLUMNS
+ * column:	name[16] offset[2] type[1] size[1], pad to FGEN_BIN_COLLEN
+ * day index:	day[4] (Unix days) first record[4], at FGEN_BIN_INDEX
+ */
+#define FGEN_BIN_MAGIC		"NTPSTATS"
+#define FGEN_BIN_VERSION	1
+#define FGEN_BIN_HDRLEN		4096
+#define FGEN_BIN_USED		18	/* offset of index entries used */
+#define FGEN_BIN_COLUMNS	32
+#define FGEN_BIN_COLLEN		24
+#define FGEN_BIN_MAXCOLS	32
+#define FGEN_BIN_INDEX		(FGEN_BIN_COLUMNS + \
+				 FGEN_BIN_MAXCOLS * FGEN_BIN_COLLEN)
+#define FGEN_BIN_DAYS		366	/* index entries */
+
+struct filegen_column {
+	const char *	name;		/* NULL ends the list */
+	char		type;		/* d double, l l_fp, i int32, b int8,
+					 * u uint32, x uint32 shown in hex,
+					 * s NUL-padded string */
+	uint8_t		size;		/* bytes */
+};
+
+static inline uint8_t *
+fgen_put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+	return p + 4;
+}
+
+static inline uint8_t *
+fgen_put_u64(uint8_t *p, uint64_t v)
+{
+	p = fgen_put_u32(p, (uint32_t)v);
+	return fgen_put_u32(p, (uint32_t)(v >> 32));
+}
+
+static inline uint8_t *
+fgen_put_double(uint8_t *p, double d)
+{
+	uint64_t v;
+
+	memcpy(&v, &d, sizeof(v));
+	return fgen_put_u64(p, v);
+}
+
+static inline uint8_t *
+fgen_put_str(uint8_t *p, const char *s, size_t size)
+{
+	memset(p, 0, size);
+	memcpy(p, s, strnlen(s, size - 1));
+	return p + size;
+}
+
 typedef struct filegen_tag {
 	FILE *	fp;	/* file referring to current generation */
 	char *	dir;	/* currently always statsdir */
@@ -40,12 +108,22 @@ typedef struct filegen_tag {
 	time_t	id_hi;	/* upper bound of ident value */
 	uint8_t	type;	/* type of file generation */
 	uint8_t	flag;	/* flags modifying processing of file generation */
+	/* binary format, see above */
+	const struct filegen_column *cols;	/* NULL if text only */
+	uint16_t reclen;	/* bytes per record */
+	uint16_t ndays;		/* day index entries used */
+	uint32_t lastday;	/* day of the last entry */
+	uint32_t nrec;		/* records in the open file */
 } FILEGEN;
 
 extern	void	filegen_setup	(FILEGEN *, time_t);
 extern	void	filegen_config	(FILEGEN *, const char *, const char *,
 				 unsigned int, unsigned int);
 extern	void	filegen_statsdir(void);
+extern	void	filegen_layout	(FILEGEN *, const struct filegen_column *);
+extern	bool	filegen_write_binary(FILEGEN *, time_t, const void *, size_t);
+extern	void	filegen_lock	(void);
+extern	void	filegen_unlock	(void);
 extern	FILEGEN *filegen_get	(const char *);
 extern	void	filegen_register (const char *, const char *, FILEGEN *);
 #ifdef DEBUG
@@ -43,6 +43,18 @@ typedef uint32_t uptime_t;	/* seconds since startup */
  */
 #define COUNTOF(arr)	(sizeof(arr) / sizeof((arr)[0]))
 
+/*
+ * COUNT_INC(var), COUNT_ADD(var, n), COUNT_CLEAR(var) - bump or reset
+ * a statistics counter that server workers update as well as the main
+ * thread.  Only the total has to come out right, so nothing is
+ * ordered around it.
+ */
+#define COUNT_ADD(var, n) \
+	((void)__atomic_fetch_add(&(var), (n), __ATOMIC_RELAXED))
+#define COUNT_INC(var)	COUNT_ADD(var, 1)
+#define COUNT_CLEAR(var) \
+	__atomic_store_n(&(var), 0, __ATOMIC_RELAXED)
+
 /*
  * We now assume the platform supports a 64-bit scalar type (the ISC
  * library wouldn't compile otherwise).
@@ -48,6 +48,7 @@ extern	unsigned short ctlpeerstatus	(struct peer *);
 extern	void	init_control	(void);
 extern	void	process_control (struct recvbuf *, int);
 extern	void	report_event	(int, struct peer *, const char *);
+extern	void	mru_snapshot_expire	(void);
 extern	int	mprintf_event	(int, struct peer *, const char *, ...)
 			NTP_PRINTF(3, 4);
 
@@ -81,6 +82,14 @@ extern	void	set_sys_var (const char *, unsigned long, unsigned short);
 extern	const char *	get_ext_sys_var(const char *tag);
 
 /* ntp_io.c */
+#if defined(HAVE_EPOLL_CREATE1) && defined(HAVE_SIGNALFD)
+# define USE_EPOLL	/* epoll() event loop, pselect() otherwise */
+#endif
+#if defined(USE_EPOLL) && defined(HAVE_TIMERFD_CREATE) && \
+    defined(HAVE_TIMER_CREATE)
+# define USE_TIMERFD	/* timer tick delivered through the event loop */
+#endif
+
 typedef struct interface_info {
 	endpt *	ep;
 	uint8_t	action;
@@ -99,6 +108,10 @@ extern	void	init_io		(void);
 extern	void	io_open_sockets	(void);
 extern	void	io_clr_stats	(void);
 extern	void	sendpkt		(sockaddr_u *, endpt *, void *, unsigned int);
+extern	void	queuepkt	(struct recvbuf *, void *, unsigned int);
+extern	bool	io_watch_timer	(int);
+extern	void	io_set_workers	(int);
+extern	void	io_start_workers(void);
 extern const char * latoa(endpt *);
 extern  uint64_t dropped_count(void);
 extern  uint64_t ignored_count(void);
@@ -109,6 +122,24 @@ extern  uint64_t notsent_count(void);
 extern  uint64_t handler_calls_count(void);
 extern  uint64_t handler_pkts_count(void);
 extern  uptime_t counter_reset_time(void);
+#define RECV_BATCH_BUCKETS	7	/* 1, 2-3, 4-7, ... 64 packets */
+extern	void	io_set_recvbatch(int);
+extern  uint64_t rbatch_count(void);
+extern  uint64_t rbatch_pkts_count(void);
+extern  uint64_t rbatch_hist_count(int);
+extern	void	io_set_sendbatch(int);
+extern  uint64_t xbatch_count(void);
+extern  uint64_t xbatch_pkts_count(void);
+extern  unsigned int worker_count(void);
+extern  uint64_t worker_served_count(void);
+extern  uint64_t worker_handoff_count(void);
+#define WORKERS_MAX	64	/* most serverworkers we accept */
+#define HANDOFF_MAX	256	/* most packets waiting for the main thread */
+/* for the unit tests of the server workers */
+extern	void	io_workers_ut_pristine(void);
+extern	unsigned int io_workers_ut_count(void);
+extern	int	io_worker_ut_read(SOCKET, endpt *);
+extern	void	io_handoff_ut_drain(void);
 
 /* ntp_loopfilter.c */
 extern	void	init_loopfilter(void);
@@ -131,6 +162,16 @@ extern	unsigned short	ntp_monitor	(struct recvbuf *, unsigned short);
 extern	void	mon_clearinterface(endpt *interface);
 extern  int	mon_get_oldest_age(l_fp);
 extern  mon_entry *mon_get_slot(sockaddr_u *);
+extern  void	mon_sort_mru(void);
+extern  void	mon_lock_all(void);
+extern  void	mon_unlock_all(void);
+struct mon_shard_stats;
+extern  void	mon_shard_stats(unsigned int, struct mon_shard_stats *);
+struct mon_walk;
+extern  void	mon_walk_start(struct mon_walk *, mon_entry *);
+extern  mon_entry *mon_walk_next(struct mon_walk *);
+typedef void	(*mon_scanner_t)(const mon_entry *, void *);
+extern  void	mon_scan_shard(unsigned int, mon_scanner_t, void *);
 
 /* ntp_peer.c */
 extern	void	init_peer	(void);
@@ -156,8 +197,10 @@ extern	void	peer_cleanup	(void);
 /* ntp_proto.c */
 extern	void	transmit	(struct peer *);
 extern	void	receive		(struct recvbuf *);
+extern	void	screen_request	(struct recvbuf *);
 extern	void	peer_clear	(struct peer *, const char *, const bool);
 extern	void	set_sys_leap	(uint8_t);
+extern	void	publish_reply_template(void);
 
 extern	int	sys_orphan;
 extern	double	sys_mindist;
@@ -196,10 +239,12 @@ extern	unsigned short	restrictions	(sockaddr_u *);
 extern	void	hack_restrict	(int, sockaddr_u *, sockaddr_u *,
 				 unsigned short, unsigned short, unsigned long);
 extern	void	restrict_source	(sockaddr_u *, bool, unsigned long);
+extern	void	restrict_expire	(void);
 
 /* ntp_timer.c */
 extern	void	init_timer	(void);
 extern	void	reinit_timer	(void);
+extern	void	timer_fd_expired (void);
 extern	void	timer		(void);
 extern	void	timer_clr_stats (void);
 extern	void	timer_interfacetimeout (uptime_t);
@@ -237,6 +282,14 @@ extern void record_ref_stats(
     );
 
 extern	void	check_leap_file	(bool is_daily_check, time_t systime);
+extern	uint64_t	stats_written	(void);
+extern	unsigned int	stats_hiwater	(void);
+extern	uint64_t	stats_overflow	(void);
+extern	uint64_t	stats_dropped	(void);
+/* for the unit tests of the statistics writer */
+extern	void	stats_ut_pristine(void);
+extern	void	stats_ut_shutdown(void);
+extern	unsigned int	stats_ut_depth	(void);
 
 /* NTS */
 extern	void	check_cert_file	(void);
@@ -322,19 +375,30 @@ struct clock_state_machine {
 extern struct clock_state_machine clkstate;
 
 /* ntp_monitor.c */
+#define MON_SHARD_BITS	4		/* log2 of the hash table shards */
+#define MON_SHARDS	(1U << MON_SHARD_BITS)
+
+struct mon_shard_stats {
+	uint64_t	entries;	/* entries in the shard */
+	uint64_t	exists;		/* lookups that found an entry */
+	uint64_t	waits;		/* times the shard lock was busy */
+};
+
+/* where a merged walk of the shard MRU lists has got to in each */
+struct mon_walk {
+	mon_entry *	next[MON_SHARDS];
+};
+
 struct monitor_data {
-	uint8_t	mon_hash_bits;		/* log2 size of hash table */
 	/*
-	 * Pointers to the hash table and the MRU list.  Memory for the hash
-	 * table is allocated only if monitoring is enabled.
+	 * The MRU lists live in the hash table shards, whose memory is
+	 * allocated only if monitoring is enabled.
 	 * Total size can easily exceed 32 bits (4 GB)
 	 * Total count is unlikely to exceed 32 bits in 2017
 	 *   but memories keep growing.
 	 */
-	mon_entry ** mon_hash;		/* MRU hash table */
-	mon_entry mon_mru_list;		/* mru listhead */
 	uint64_t	mru_entries;		/* mru list count */
-	uint64_t	mru_hashslots;		/* hash slots in use */
+	uint64_t	mru_hashslots;		/* hash table size in slots */
 	/*
 	 * Initialization state.  We may be monitoring, we may not.  If
 	 * we aren't, we may not even have allocated any memory yet.
@@ -351,7 +415,6 @@ struct monitor_data {
 	int		mru_minage;		/* recycle if older & full */
 	uint64_t	mru_maxdepth;		/* MRU size hard limit */
 /* Slot (re)allocation counters */
-	uint64_t	mru_exists;		/* slot already exists */
 	uint64_t	mru_new;		/* allocated new slot */
 	uint64_t	mru_recycleold;		/* age > maxage */
 	uint64_t	mru_recyclefull;	/* full & age > minage */
@@ -454,12 +517,15 @@ int extens_client_send(struct peer *peer, struct pkt *xpkt);
 bool extens_server_recv(struct ntspacket_t *ntspacket, uint8_t *pkt, int lng);
 int extens_server_send(struct ntspacket_t *ntspacket, struct pkt *xpkt);
 bool extens_client_recv(struct peer *peer, uint8_t *pkt, int lng);
+bool nts_cookies_low(struct peer *peer);
 
 /* nts.c */
 void nts_init(void);   /* Before sandbox() */
 void nts_init2(void);  /* After sandbox() */
 bool nts_probe(struct peer *peer);
 bool nts_check(struct peer *peer);
+void nts_client_forget(struct peer *peer);
+bool nts_next_ke_server(struct peer *peer);
 void nts_timer(void);
 
 /* ntp_sandbox.c */
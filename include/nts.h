@@ -10,6 +10,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "ntp_net.h"
+
 /* default file names */
 #define NTS_CERT_FILE "/etc/ntp/cert-chain.pem"
 #define NTS_KEY_FILE "/etc/ntp/key.pem"
@@ -21,6 +23,9 @@
 #define NTS_KE_PORTA_OLD	"123"
 
 #define NTS_KE_TIMEOUT		3
+#define NTS_KE_TICKET_LIFETIME	(24*60*60)	/* see nts_server.c */
+#define NTS_KE_WORKERS		2	/* NTS-KE server threads */
+#define NTS_KE_MAXCONNS		64	/* handshakes in progress */
 
 bool nts_server_init(void);
 bool nts_client_init(void);
@@ -30,17 +35,30 @@ bool nts_cookie_init2(void);
 
 void nts_cert_timer(void);
 void nts_cookie_timer(void);
+void nts_ticket_keys_update(void);
 
 bool nts_read_cookie_keys(void);
 void nts_make_cookie_key(void);
 bool nts_write_cookie_keys(void);
+#define NTS_SEED_LENGTH		32	/* ratchet seed in the keys file */
+void nts_ratchet_cookie_key(unsigned long day);
+#define NTS_DERIVED_LENGTH	32	/* SHA256 */
+void nts_cookie_derive(bool old, const char *label, uint8_t *out);
 
+int nts_cookie_length(int keylen);
 int nts_make_cookie(uint8_t *cookie,
   uint16_t aead,
   uint8_t *c2s, uint8_t *s2c, int keylen);
+/* count cookies for one key set, stride bytes apart */
+int nts_make_cookies(uint8_t *cookies, int count, int stride,
+  uint16_t aead,
+  uint8_t *c2s, uint8_t *s2c, int keylen);
+void nts_get_nonces(uint8_t *nonces, int count);
+void nts_nonce_refill(void);
+/* c2s and s2c are set to point into plain */
 bool nts_unpack_cookie(uint8_t *cookie, int cookielen,
-  uint16_t *aead,
-  uint8_t *c2s, uint8_t *s2c, int *keylen);
+  uint8_t *plain, uint16_t *aead,
+  uint8_t **c2s, uint8_t **s2c, int *keylen);
 
 /* working finger into a buffer - updated by append/unpack routines */
 struct BufCtl_t {
@@ -66,6 +84,9 @@ bool nts_ke_setup_send(struct BufCtl_t *buf, int aead,
  * buffer is wire format, not host format.
  */
 
+/* 2 byte type, 2 byte length */
+#define NTS_KE_HDR_LNG 4
+#define NTS_KE_U16_LNG 2
 
 /* xxx_append_record_foo makes whole record with one foo */
 /* append_foo appends foo to existing partial record */
@@ -94,6 +115,9 @@ uint16_t next_bytes(BufCtl* buf, uint8_t *data, int length);
 #define NTS_MAX_COOKIES		8	/* RFC 4.1.6 */
 #define NTS_UID_LENGTH		32	/* RFC 5.3 */
 #define NTS_UID_MAX_LENGTH	64
+#define NTS_MAX_KESERVERS	4	/* keserver options per server */
+/* inside of a cookie: AEAD, C2S, S2C */
+#define NTS_COOKIE_PLAINLEN	(4 + 2 * NTS_MAX_KEYLEN)
 
 
 /* Client side configuration data for an NTS association
@@ -105,6 +129,9 @@ struct ntscfg_t {
 	char *cert;		/* client certificate  */
 	char *aead;		/* AEAD algorithms on wire */
 	uint32_t expire;
+	/* more NTS-KE servers for the same NTP service */
+	char *keservers[NTS_MAX_KESERVERS];
+	int nkeservers;
 };
 
 /* Client-side state per connection to server */
@@ -120,17 +147,32 @@ struct ntsclient_t {
 	int count;			/* -1 if not in NTS mode */
 	int cookielen;
 	uint8_t cookies[NTS_MAX_COOKIES][NTS_MAX_COOKIELEN];
+	/* cookie pool manager, see nts_cookies_low() */
+	bool pending;			/* last request not answered */
+	uint8_t loss;			/* requests recently lost, /256 */
+	/* NTS-KE server to use, 0 is the server itself,
+	 * then the keserver options */
+	int keidx;
+	int ketries;			/* KE servers failed in a row */
+	/* TLS session to resume the next NTS-KE with, or NULL */
+	struct ssl_session_st *session;
+	/* NTP server from the last NTS-KE, valid if addrOK */
+	sockaddr_u addr;
+	bool addrOK;
 };
 
-/* Server-side state per packet */
+/* Server-side state per packet
+ * Lives in the recvbuf with the request, so uid points into it.
+ */
 struct ntspacket_t {
 	bool valid;
 	int uidlen;
-	uint8_t UID[NTS_UID_MAX_LENGTH];
+	uint8_t *uid;			/* in the request */
 	int needed;
 	uint16_t aead;
 	int keylen;
-	uint8_t c2s[NTS_MAX_KEYLEN], s2c[NTS_MAX_KEYLEN];
+	uint8_t *c2s, *s2c;		/* in plain */
+	uint8_t plain[NTS_COOKIE_PLAINLEN];	/* the unpacked cookie */
 };
 
 
@@ -145,6 +187,10 @@ struct ntsconfig_t {
 	const char *KI;		/* file holding K/I for making cookies */
 	const char *ca;		/* root cert dir/file */
 	const char *aead;	/* AEAD algorithms on wire */
+	int keworkers;		/* NTS-KE server threads */
+	int kemaxconns;		/* max NTS-KE connections in progress */
+	bool tlsresume;		/* TLS session resumption for NTS-KE */
+	bool ratchet;		/* derive cookie keys from a shared seed */
 };
 
 
@@ -237,9 +283,22 @@ extern uint64_t nts_cookie_decode;
 extern uint64_t nts_cookie_decode_old;
 extern uint64_t nts_cookie_decode_too_old;
 extern uint64_t nts_cookie_decode_error;
+extern uint64_t nts_nonce_refills;
+extern uint64_t nts_nonce_stalls;
 extern uint64_t nts_ke_serves_good;
 extern uint64_t nts_ke_serves_bad;
 extern uint64_t nts_ke_probes_good;
 extern uint64_t nts_ke_probes_bad;
+extern uint64_t nts_ke_active;
+extern uint64_t nts_ke_active_max;
+extern uint64_t nts_ke_timeouts;
+extern uint64_t nts_ke_full;
+extern uint64_t nts_ke_handshakes;
+extern double nts_ke_hs_time;
+extern double nts_ke_hs_max;
+extern uint64_t nts_ke_resume_hits;
+extern uint64_t nts_ke_resume_misses;
+extern uint64_t nts_ke_probe_resume_hits;
+extern uint64_t nts_ke_probe_resume_misses;
 
 #endif /* GUARD_NTS_H */
@@ -32,14 +32,19 @@
 
 
 typedef struct recvbuf recvbuf_t;
+struct server_worker;
 
 struct recvbuf {
 	recvbuf_t *	link;		/* next in list */
 	sockaddr_u	recv_srcadr;	/* where packet came from */
 	struct netendpt *	dstadr;	/* address pkt arrived on */
 	SOCKET		fd;		/* fd on which it was received */
+	struct server_worker *	worker;	/* reading thread, NULL for main */
 	l_fp		recv_time;	/* time of arrival */
 	size_t		recv_length;	/* number of octets received */
+	bool		screened;	/* restrictions and rate limit done */
+	bool		restricted;	/* screened out by restrictions */
+	unsigned short	restrict_mask;	/* screening result */
 	uint8_t		recv_buffer[RX_BUFF_SIZE];
 	struct parsed_pkt pkt;  /* host-order copy of data from wire */
 	int used;		/* reference count */
@@ -53,8 +58,29 @@ struct recvbuf {
 #endif /* REFCLOCK */
 };
 
+/*
+ * A free list of receive buffers.  The main thread's list is behind
+ * get_free_recv_buffer() and freerecvbuf(); other threads that read
+ * packets keep their own so they never contend for buffers.  A buffer
+ * must go back to the list it came from.
+ */
+typedef struct recvbuf_list {
+	recvbuf_t *	free_list;
+	unsigned long	free;		/* buffers on free_list */
+	unsigned long	total;		/* buffers belonging to the list */
+	unsigned long	allocs;		/* buffers handed out */
+	unsigned long	hiwater;	/* most ever in use at once */
+} recvbuf_list_t;
+
+extern	void	grow_recvbuf_list(recvbuf_list_t *, unsigned int);
+extern	recvbuf_t *recvbuf_list_get(recvbuf_list_t *);
+extern	void	recvbuf_list_put(recvbuf_list_t *, recvbuf_t *);
+
 extern	void	init_recvbuff(unsigned int); /* not really pure */
 
+/* make sure at least this many buffers exist, e.g. for a receive batch */
+extern	void	reserve_recvbuffs(unsigned int);
+
 /* freerecvbuf - make a single recvbuf available for reuse
  */
 extern	void	freerecvbuf(struct recvbuf *);
@@ -74,5 +100,7 @@ extern	struct recvbuf *get_free_recv_buffer(void);
 extern unsigned long free_recvbuffs(void);    /* not really pure */
 extern unsigned long total_recvbuffs(void);   /* not really pure */
 extern unsigned long lowater_additions(void); /* not really pure */
+extern unsigned long recvbuf_allocs(void);    /* not really pure */
+extern unsigned long recvbuf_hiwater(void);   /* not really pure */
 
 #endif	/* GUARD_RECVBUFF_H */
@@ -592,3 +592,107 @@ int AES_SIV_Decrypt(AES_SIV_CTX *ctx, unsigned char *out, size_t *out_len,
         debug("plaintext", out, *out_len);
         return 1;
 }
+
+/* Gets ctx ready for the next job of a batch.  A job that has the
+   same key as the one before it, or a NULL key, skips AES_SIV_Init():
+   the expanded keys in cipher_ctx and cmac_ctx_init are still good,
+   so only the S2V state has to go back to CMAC(zero), which is kept
+   in *d0. */
+static int batch_key(AES_SIV_CTX *ctx, AES_SIV_JOB const *job,
+                     AES_SIV_JOB const *prev, block *d0, int *keyed) {
+        if (job->key != NULL &&
+            (prev == NULL || prev->key == NULL ||
+             prev->key_len != job->key_len ||
+             (prev->key != job->key &&
+              CRYPTO_memcmp(prev->key, job->key, job->key_len) != 0))) {
+                *keyed = AES_SIV_Init(ctx, job->key, job->key_len);
+                memcpy(d0, &ctx->d, sizeof *d0);
+        } else {
+                memcpy(&ctx->d, d0, sizeof ctx->d);
+        }
+        return *keyed;
+}
+
+static int batch_ad(AES_SIV_CTX *ctx, AES_SIV_JOB const *job) {
+        if (UNLIKELY(AES_SIV_AssociateData(ctx, job->ad, job->ad_len) != 1)) {
+                return 0;
+        }
+        if (job->nonce != NULL &&
+            UNLIKELY(AES_SIV_AssociateData(ctx, job->nonce, job->nonce_len)
+                     != 1)) {
+                return 0;
+        }
+        return 1;
+}
+
+int AES_SIV_EncryptBatch(AES_SIV_CTX *ctx, AES_SIV_JOB *jobs, size_t count) {
+        block d0;
+        int keyed = 1;
+        int ret = 1;
+        size_t i;
+
+        memcpy(&d0, &ctx->d, sizeof d0);
+        for (i = 0; i < count; i++) {
+                AES_SIV_JOB *job = &jobs[i];
+
+                job->ret = 0;
+                if (UNLIKELY(batch_key(ctx, job, i > 0 ? &jobs[i - 1] : NULL,
+                                       &d0, &keyed) != 1)) {
+                        ret = 0;
+                        continue;
+                }
+                if (UNLIKELY(job->out_len < job->in_len + 16)) {
+                        ret = 0;
+                        continue;
+                }
+                job->out_len = job->in_len + 16;
+                if (UNLIKELY(batch_ad(ctx, job) != 1) ||
+                    UNLIKELY(AES_SIV_EncryptFinal(ctx, job->out, job->out + 16,
+                                                  job->in, job->in_len)
+                             != 1)) {
+                        ret = 0;
+                        continue;
+                }
+                debug("IV || C", job->out, job->out_len);
+                job->ret = 1;
+        }
+        /* Leave ctx as AES_SIV_Init() would, for the next batch */
+        memcpy(&ctx->d, &d0, sizeof ctx->d);
+        return ret;
+}
+
+int AES_SIV_DecryptBatch(AES_SIV_CTX *ctx, AES_SIV_JOB *jobs, size_t count) {
+        block d0;
+        int keyed = 1;
+        int ret = 1;
+        size_t i;
+
+        memcpy(&d0, &ctx->d, sizeof d0);
+        for (i = 0; i < count; i++) {
+                AES_SIV_JOB *job = &jobs[i];
+
+                job->ret = 0;
+                if (UNLIKELY(batch_key(ctx, job, i > 0 ? &jobs[i - 1] : NULL,
+                                       &d0, &keyed) != 1)) {
+                        ret = 0;
+                        continue;
+                }
+                if (UNLIKELY(job->in_len < 16) ||
+                    UNLIKELY(job->out_len < job->in_len - 16)) {
+                        ret = 0;
+                        continue;
+                }
+                job->out_len = job->in_len - 16;
+                if (UNLIKELY(batch_ad(ctx, job) != 1) ||
+                    UNLIKELY(AES_SIV_DecryptFinal(ctx, job->out, job->in,
+                                                  job->in + 16, job->out_len)
+                             != 1)) {
+                        ret = 0;
+                        continue;
+                }
+                debug("plaintext", job->out, job->out_len);
+                job->ret = 1;
+        }
+        memcpy(&ctx->d, &d0, sizeof ctx->d);
+        return ret;
+}
@@ -49,6 +49,25 @@ int AES_SIV_Decrypt(AES_SIV_CTX *ctx, unsigned char *out, size_t *out_len,
                     unsigned char const *ciphertext, size_t ciphertext_len,
                     unsigned char const *ad, size_t ad_len);
 
+/* One message for AES_SIV_EncryptBatch() or AES_SIV_DecryptBatch().
+   A NULL key means the same key as the job before it. */
+typedef struct AES_SIV_JOB_st {
+        unsigned char *out;
+        size_t out_len;         /* room at out; set to the length used */
+        unsigned char const *key;
+        size_t key_len;
+        unsigned char const *nonce;
+        size_t nonce_len;
+        unsigned char const *in;
+        size_t in_len;
+        unsigned char const *ad;
+        size_t ad_len;
+        int ret;                /* 1 on success, 0 on failure */
+} AES_SIV_JOB;
+
+int AES_SIV_EncryptBatch(AES_SIV_CTX *ctx, AES_SIV_JOB *jobs, size_t count);
+int AES_SIV_DecryptBatch(AES_SIV_CTX *ctx, AES_SIV_JOB *jobs, size_t count);
+
 
 #ifdef __cplusplus
 }
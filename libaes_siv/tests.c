@@ -571,6 +571,95 @@ static void test_decrypt_failure(void) {
         AES_SIV_CTX_free(ctx);
 }
 
+static void test_batch(void) {
+        static const unsigned char key1[32] = {1};
+        static const unsigned char key2[64] = {2};
+        static const unsigned char ad[24] = {3};
+        static const unsigned char nonce[16] = {4};
+        static const unsigned char plaintext[48] = {5};
+
+        AES_SIV_JOB jobs[4];
+        unsigned char expect[4][64];
+        unsigned char ciphertext[4][64];
+        unsigned char plaintext_out[4][64];
+        size_t expect_len;
+        AES_SIV_CTX *ctx;
+        int ret;
+        size_t i;
+
+        printf("Test batch interface:\n");
+
+        ctx = AES_SIV_CTX_new();
+        assert(ctx != NULL);
+
+        /* Two under one key, one under another, and one that carries
+           on with the second key through a NULL key */
+        memset(jobs, 0, sizeof jobs);
+        for (i = 0; i < 4; i++) {
+                jobs[i].out = ciphertext[i];
+                jobs[i].out_len = sizeof ciphertext[i];
+                jobs[i].in = plaintext;
+                jobs[i].in_len = sizeof plaintext - i;
+                jobs[i].ad = ad;
+                jobs[i].ad_len = sizeof ad;
+        }
+        jobs[0].key = key1;
+        jobs[0].key_len = sizeof key1;
+        jobs[1].key = key1;
+        jobs[1].key_len = sizeof key1;
+        jobs[1].nonce = nonce;
+        jobs[1].nonce_len = sizeof nonce;
+        jobs[2].key = key2;
+        jobs[2].key_len = sizeof key2;
+        jobs[3].key_len = sizeof key2;
+
+        ret = AES_SIV_EncryptBatch(ctx, jobs, 4);
+        assert(ret == 1);
+        for (i = 0; i < 4; i++) {
+                expect_len = sizeof expect[i];
+                ret = AES_SIV_Encrypt(ctx, expect[i], &expect_len,
+                                      i < 2 ? key1 : key2,
+                                      i < 2 ? sizeof key1 : sizeof key2,
+                                      jobs[i].nonce, jobs[i].nonce_len,
+                                      plaintext, jobs[i].in_len,
+                                      ad, sizeof ad);
+                assert(ret == 1);
+                assert(jobs[i].ret == 1);
+                assert(jobs[i].out_len == expect_len);
+                assert(!memcmp(expect[i], ciphertext[i], expect_len));
+        }
+
+        /* A batch may start with a NULL key after AES_SIV_Init() */
+        ret = AES_SIV_Init(ctx, key2, sizeof key2);
+        assert(ret == 1);
+        jobs[3].out = ciphertext[0];
+        jobs[3].out_len = sizeof ciphertext[0];
+        ret = AES_SIV_EncryptBatch(ctx, &jobs[3], 1);
+        assert(ret == 1);
+        assert(!memcmp(expect[3], ciphertext[0], jobs[3].out_len));
+        memcpy(ciphertext[0], expect[0], sizeof expect[0]);
+        ciphertext[2][20] ^= 1;
+        for (i = 0; i < 4; i++) {
+                jobs[i].in = ciphertext[i];
+                jobs[i].in_len = sizeof plaintext - i + 16;
+                jobs[i].out = plaintext_out[i];
+                jobs[i].out_len = sizeof plaintext_out[i];
+        }
+        ret = AES_SIV_DecryptBatch(ctx, jobs, 4);
+        assert(ret == 0);
+        for (i = 0; i < 4; i++) {
+                assert(jobs[i].ret == (i != 2));
+                if (i != 2) {
+                        assert(jobs[i].out_len == sizeof plaintext - i);
+                        assert(!memcmp(plaintext, plaintext_out[i],
+                                       jobs[i].out_len));
+                }
+        }
+
+        AES_SIV_CTX_free(ctx);
+        printf("OK\n");
+}
+
 int main(void) {
         test_malloc_failure();
 	test_cleanup_before_free();
@@ -582,5 +671,6 @@ int main(void) {
         test_copy();
         test_bad_key();
         test_decrypt_failure();
+        test_batch();
         return 0;
 }
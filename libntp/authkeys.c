@@ -14,6 +14,17 @@
 #include "ntp_stdlib.h"
 #include "ntp_auth.h"
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
+
+#ifndef EVP_MD_CTX_new
+/* Slightly older version of OpenSSL */
+/* Similar hack in pymodule.c */
+#define EVP_MD_CTX_new() EVP_MD_CTX_create()
+#define EVP_MD_CTX_free(ctx) EVP_MD_CTX_destroy(ctx)
+#endif
 
 /* define the payload region of auth_data beyond the list pointers */
 #define auth_info_payload	keyid
@@ -38,6 +49,8 @@ static void	alloc_auth_info(auth_info **, keyid_t,	AUTH_Type,
 				    const char *,
 				    unsigned short, unsigned short, uint8_t *);
 static void	free_auth_info(auth_info *, auth_info **);
+static void	auth_setup_ctx(auth_info *);
+static void	auth_clear_ctx(auth_info *);
 #ifdef DEBUG
 static void	free_auth_mem(void);
 #endif
@@ -53,6 +66,11 @@ static unsigned short authhashbuckets = INIT_AUTHHASHSIZE;
 static unsigned short authhashmask = INIT_AUTHHASHSIZE - 1;
 static auth_info **key_hash;
 
+/*
+ * Keys are only set up from the configuration, before ntpd starts any
+ * server worker, so lookups need no lock.  The workers do share the
+ * counters below.
+ */
 unsigned int authnumkeys;	/* number of active keys */
 unsigned int authnumfreekeys;	/* number of free keys */
 unsigned long authkeylookups;	/* calls to lookup keys */
@@ -117,16 +135,16 @@ auth_init(void)
 void
 auth_reset_stats(uptime_t reset_time)
 {
-	authkeylookups = 0;
-	authkeynotfound = 0;
-	authencryptions = 0;
-	authdigestencrypt = 0;
-	authcmacencrypt = 0;
-	authdecryptions = 0;
-	authdigestdecrypt = 0;
-	authdigestfail = 0;
-	authcmacdecrypt = 0;
-	authcmacfail = 0;
+	COUNT_CLEAR(authkeylookups);
+	COUNT_CLEAR(authkeynotfound);
+	COUNT_CLEAR(authencryptions);
+	COUNT_CLEAR(authdigestencrypt);
+	COUNT_CLEAR(authcmacencrypt);
+	COUNT_CLEAR(authdecryptions);
+	COUNT_CLEAR(authdigestdecrypt);
+	COUNT_CLEAR(authdigestfail);
+	COUNT_CLEAR(authcmacdecrypt);
+	COUNT_CLEAR(authcmacfail);
 	auth_timereset = reset_time;
 }
 
@@ -306,6 +324,7 @@ alloc_auth_info(
 		msyslog(LOG_ERR, "BUG: alloc_auth_info: bogus type %u", type);
 		exit(1);
 	}
+	auth_setup_ctx(auth);
 	LINK_SLIST(*bucket, auth, hlink);
 	LINK_TAIL_DLIST(key_listhead, auth, llink);
 	authnumfreekeys--;
@@ -313,6 +332,100 @@ alloc_auth_info(
 }
 
 
+/*
+ * auth_setup_ctx - key a MAC context once so each packet only has to
+ * copy it.  For CMAC that skips the key schedule and subkey
+ * derivation, for the old digests it skips hashing the key prefix.
+ * If keying fails the context stays NULL and the MAC code falls back
+ * to doing it per packet, which logs the failure.
+ */
+static void
+auth_setup_ctx(
+	auth_info *	auth
+	)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	static EVP_MAC *cmac;
+	OSSL_PARAM params[2];
+	char cipher[32];
+#endif
+
+	switch (auth->type) {
+	  case AUTH_CMAC:
+		if (NULL == auth->cipher)
+			break;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		if (NULL == cmac)
+			cmac = EVP_MAC_fetch(NULL, "CMAC", NULL);
+		if (NULL == cmac)
+			break;
+		auth->cmac_ctx = EVP_MAC_CTX_new(cmac);
+		if (NULL == auth->cmac_ctx)
+			break;
+		strlcpy(cipher, EVP_CIPHER_get0_name(auth->cipher),
+			sizeof(cipher));
+		params[0] = OSSL_PARAM_construct_utf8_string(
+			OSSL_MAC_PARAM_CIPHER, cipher, 0);
+		params[1] = OSSL_PARAM_construct_end();
+		if (!EVP_MAC_init(auth->cmac_ctx, auth->key, auth->key_size,
+				  params)) {
+			EVP_MAC_CTX_free(auth->cmac_ctx);
+			auth->cmac_ctx = NULL;
+		}
+#else
+		auth->cmac_ctx = CMAC_CTX_new();
+		if (NULL == auth->cmac_ctx)
+			break;
+		if (!CMAC_Init(auth->cmac_ctx, auth->key, auth->key_size,
+			       auth->cipher, NULL)) {
+			CMAC_CTX_free(auth->cmac_ctx);
+			auth->cmac_ctx = NULL;
+		}
+#endif
+		break;
+	  case AUTH_DIGEST:
+		if (NULL == auth->digest)
+			break;
+		auth->digest_ctx = EVP_MD_CTX_new();
+		if (NULL == auth->digest_ctx)
+			break;
+		if (!EVP_DigestInit_ex(auth->digest_ctx, auth->digest, NULL) ||
+		    !EVP_DigestUpdate(auth->digest_ctx, auth->key,
+				      auth->key_size)) {
+			EVP_MD_CTX_free(auth->digest_ctx);
+			auth->digest_ctx = NULL;
+		}
+		break;
+	  case AUTH_NONE:
+	  default:
+		break;
+	}
+}
+
+
+/*
+ * auth_clear_ctx - drop the keyed contexts; they hold key material.
+ */
+static void
+auth_clear_ctx(
+	auth_info *	auth
+	)
+{
+	if (NULL != auth->cmac_ctx) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		EVP_MAC_CTX_free(auth->cmac_ctx);
+#else
+		CMAC_CTX_free(auth->cmac_ctx);
+#endif
+		auth->cmac_ctx = NULL;
+	}
+	if (NULL != auth->digest_ctx) {
+		EVP_MD_CTX_free(auth->digest_ctx);
+		auth->digest_ctx = NULL;
+	}
+}
+
+
 /*
  * free_auth_info - common code to remove a auth_info and recycle its entry.
  */
@@ -324,6 +437,7 @@ free_auth_info(
 {
 	auth_info *	unlinked;
 
+	auth_clear_ctx(auth);
 	if (NULL != auth->key) {
 		memset(auth->key, '\0', auth->key_size);
 		free(auth->key);
@@ -397,7 +511,7 @@ authlookup(
         auth_info *     auth;
         auth_info **    bucket;
 
-	authkeylookups++;
+	COUNT_INC(authkeylookups);
         bucket = &key_hash[KEYHASH(keyno)];
         for (auth = *bucket; NULL != auth; auth = auth->hlink) {
                 if (keyno == auth->keyid)
@@ -409,7 +523,7 @@ authlookup(
 		if (0) msyslog(LOG_INFO, "DEBUG: authlookup fail: key %u, %s, auth: %s",
 			keyno, needtrust? "T" : "F",
 			(NULL == auth)? "NULL:" : "Ok");
-                authkeynotfound++;
+                COUNT_INC(authkeynotfound);
                 return NULL;
         }
         return auth;
@@ -464,6 +578,8 @@ auth_setkey(
 			auth->key_size = (unsigned short)key_size;
                         auth->key = emalloc(key_size);
 			memcpy(auth->key, key, key_size);
+			auth_clear_ctx(auth);
+			auth_setup_ctx(auth);
 			return;
 		}
 	}
@@ -502,6 +618,7 @@ auth_delkeys(void)
 		 * Don't lose info as to which keys are trusted.
 		 */
 		if (KEY_TRUSTED & auth->flags) {
+			auth_clear_ctx(auth);
 			if (NULL != auth->key) {
 				memset(auth->key, '\0', auth->key_size);
 				free(auth->key);
@@ -535,14 +652,14 @@ authencrypt(
 	 * That logic has been pushed up a layer.  2018-June
 	 */
 
-	authencryptions++;
+	COUNT_INC(authencryptions);
 	pkt[length / 4] = htonl(auth->keyid);
 	switch (auth->type) {
 	    case AUTH_DIGEST:
-		authdigestencrypt++;
+		COUNT_INC(authdigestencrypt);
 		return digest_encrypt(auth, pkt, length);
 	    case AUTH_CMAC:
-		authcmacencrypt++;
+		COUNT_INC(authcmacencrypt);
 		return cmac_encrypt(auth, pkt, length);
 	    default:
 		msyslog(LOG_ERR, "BUG: authencrypt: bogus type %u", auth->type);
@@ -571,17 +688,17 @@ authdecrypt(
 	 * That logic has been pushed up a layer.  2018-June
 	 */
 
-	authdecryptions++;
+	COUNT_INC(authdecryptions);
 	switch (auth->type) {
 	    case AUTH_DIGEST:
-		authdigestdecrypt++;
+		COUNT_INC(authdigestdecrypt);
 		answer = digest_decrypt(auth, pkt, length, size);
-		if (!answer) authdigestfail++;
+		if (!answer) COUNT_INC(authdigestfail);
 		return answer;
 	    case AUTH_CMAC:
-		authcmacdecrypt++;
+		COUNT_INC(authcmacdecrypt);
 		answer = cmac_decrypt(auth, pkt, length, size);
-		if (!answer) authcmacfail++;
+		if (!answer) COUNT_INC(authcmacfail);
 		return answer;
 	    default:
 		msyslog(LOG_ERR, "BUG: authdecrypt: bogus type %u", auth->type);
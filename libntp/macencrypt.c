@@ -7,6 +7,8 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
 
 #include <openssl/evp.h>	/* provides OpenSSL digest API */
 #include <openssl/md5.h>
@@ -18,13 +20,53 @@
 
 #ifndef EVP_MD_CTX_reset
 /* Slightly older version of OpenSSL */
-/* Similar hack in ssl_init.c and attic/digest-timing.c */
+/* Similar hack in pymodule.c and attic/digest-timing.c */
 #define EVP_MD_CTX_reset(ctx) EVP_MD_CTX_init(ctx)
 #endif
 
-/* Need one per thread. */
-extern EVP_MD_CTX *digest_ctx;
-extern CMAC_CTX *cmac_ctx;
+/* Scratch contexts for computing a MAC.  Server workers answer
+ * authenticated requests too, so every thread has its own.
+ */
+struct mac_ctxs {
+	EVP_MD_CTX *	digest;
+	CMAC_CTX *	cmac;
+};
+static pthread_key_t mac_ctxs_key;
+static pthread_once_t mac_ctxs_once = PTHREAD_ONCE_INIT;
+
+static void mac_ctxs_free(void *arg) {
+	struct mac_ctxs *ctxs = arg;
+
+	EVP_MD_CTX_destroy(ctxs->digest);
+	CMAC_CTX_free(ctxs->cmac);
+	free(ctxs);
+}
+
+static void mac_ctxs_key_init(void) {
+	if (0 != pthread_key_create(&mac_ctxs_key, mac_ctxs_free)) {
+		msyslog(LOG_ERR, "MAC: Can't create mac_ctxs_key");
+		exit(1);
+	}
+}
+
+/* This thread's scratch contexts */
+static struct mac_ctxs *mac_ctxs_get(void) {
+	struct mac_ctxs *ctxs;
+
+	pthread_once(&mac_ctxs_once, mac_ctxs_key_init);
+	ctxs = pthread_getspecific(mac_ctxs_key);
+	if (NULL == ctxs) {
+		ctxs = emalloc_zero(sizeof(*ctxs));
+		ctxs->digest = EVP_MD_CTX_create();
+		ctxs->cmac = CMAC_CTX_new();
+		if (NULL == ctxs->digest || NULL == ctxs->cmac) {
+			msyslog(LOG_ERR, "MAC: Can't init mac_ctxs");
+			exit(1);
+		}
+		pthread_setspecific(mac_ctxs_key, ctxs);
+	}
+	return ctxs;
+}
 
 /* ctmemeq - test two blocks memory for equality without leaking
  * timing information.
@@ -48,6 +90,64 @@ static bool ctmemeq(const void *s1, const void *s2, size_t n) {
 	return accum == 0;
 }
 
+/*
+ * cmac_compute - CMAC of the packet with auth's key.
+ *
+ * Returns false, after logging, if any step fails.
+ */
+static bool
+cmac_compute(
+	auth_info *	auth,
+	uint32_t *	pkt,		/* packet pointer */
+	int		length,		/* packet length */
+	uint8_t *	mac,		/* CMAC_MAX_MAC_LENGTH */
+	size_t *	len,
+	const char *	what		/* "encrypt" or "decrypt" */
+	)
+{
+	CMAC_CTX *ctx = mac_ctxs_get()->cmac;
+
+	if (NULL != auth->cmac_ctx) {
+		/* keyed in auth_setkey(), skip the key schedule */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		EVP_MAC_CTX *keyed = EVP_MAC_CTX_dup(auth->cmac_ctx);
+		bool ok;
+
+		if (NULL == keyed) {
+			msyslog(LOG_ERR, "CMAC: %s: context dup failed, %u",
+				what, auth->keyid);
+			return false;
+		}
+		ok = EVP_MAC_update(keyed, (uint8_t *)pkt, (size_t)length)
+		    && EVP_MAC_final(keyed, mac, len, CMAC_MAX_MAC_LENGTH);
+		EVP_MAC_CTX_free(keyed);
+		if (!ok)
+			msyslog(LOG_ERR, "CMAC: %s: CMAC failed, %u",
+				what, auth->keyid);
+		return ok;
+#else
+		if (!CMAC_CTX_copy(ctx, auth->cmac_ctx)) {
+			msyslog(LOG_ERR, "CMAC: %s: context copy failed, %u",
+				what, auth->keyid);
+			return false;
+		}
+#endif
+	} else {
+		CMAC_resume(ctx);
+		if (!CMAC_Init(ctx, auth->key, auth->key_size,
+			       auth->cipher, NULL)) {
+			/* Shouldn't happen.  Does if wrong key_size. */
+			msyslog(LOG_ERR,
+			    "CMAC: %s: CMAC init failed, %u, %u",
+				what, auth->keyid, auth->key_size);
+			return false;
+		}
+	}
+	CMAC_Update(ctx, (uint8_t *)pkt, (unsigned int)length);
+	CMAC_Final(ctx, mac, len);
+	return true;
+}
+
 /*
  * cmac_encrypt - generate CMAC authenticator
  *
@@ -62,18 +162,9 @@ cmac_encrypt(
 {
 	uint8_t	mac[CMAC_MAX_MAC_LENGTH];
 	size_t	len;
-	CMAC_CTX *ctx = cmac_ctx;
-
-	CMAC_resume(ctx);
-	if (!CMAC_Init(ctx, auth->key, auth->key_size, auth->cipher, NULL)) {
-		/* Shouldn't happen.  Does if wrong key_size. */
-		msyslog(LOG_ERR,
-		    "CMAC: encrypt: CMAC init failed, %u, %u",
-			auth->keyid, auth->key_size);
+
+	if (!cmac_compute(auth, pkt, length, mac, &len, "encrypt"))
 		return (0);
-	}
-	CMAC_Update(ctx, (uint8_t *)pkt, (unsigned int)length);
-	CMAC_Final(ctx, mac, &len);
 	if (MAX_BARE_MAC_LENGTH < len)
 		len = MAX_BARE_MAC_LENGTH;
 	memmove((uint8_t *)pkt + length + 4, mac, len);
@@ -96,18 +187,9 @@ cmac_decrypt(
 {
 	uint8_t	mac[CMAC_MAX_MAC_LENGTH];
 	size_t	len;
-	CMAC_CTX *ctx = cmac_ctx;
-
-	CMAC_resume(ctx);
-	if (!CMAC_Init(ctx, auth->key, auth->key_size, auth->cipher, NULL)) {
-		/* Shouldn't happen.  Does if wrong key_size. */
-		msyslog(LOG_ERR,
-		    "CMAC: decrypt: CMAC init failed, %u, %u",
-			auth->keyid, auth->key_size);
+
+	if (!cmac_compute(auth, pkt, length, mac, &len, "decrypt"))
 		return false;
-	}
-	CMAC_Update(ctx, (uint8_t *)pkt, (unsigned int)length);
-	CMAC_Final(ctx, mac, &len);
 	if (MAX_BARE_MAC_LENGTH < len)
 		len = MAX_BARE_MAC_LENGTH;
 	if ((unsigned int)size != len + 4) {
@@ -137,20 +219,29 @@ digest_encrypt(
 {
 	uint8_t	digest[EVP_MAX_MD_SIZE];
 	unsigned int	len;
-	EVP_MD_CTX *ctx = digest_ctx;
+	EVP_MD_CTX *ctx = mac_ctxs_get()->digest;
 
 	/*
 	 * Compute digest of key concatenated with packet. Note: the
 	 * key type and digest type have been verified when the key
 	 * was created.
 	 */
-	EVP_MD_CTX_reset(ctx);
-	if (!EVP_DigestInit_ex(ctx, auth->digest, NULL)) {
-		msyslog(LOG_ERR,
-		    "MAC: encrypt: digest init failed");
-		return (0);
+	if (NULL != auth->digest_ctx) {
+		/* key prefix hashed once in auth_setkey() */
+		if (!EVP_MD_CTX_copy_ex(ctx, auth->digest_ctx)) {
+			msyslog(LOG_ERR,
+			    "MAC: encrypt: digest copy failed");
+			return (0);
+		}
+	} else {
+		EVP_MD_CTX_reset(ctx);
+		if (!EVP_DigestInit_ex(ctx, auth->digest, NULL)) {
+			msyslog(LOG_ERR,
+			    "MAC: encrypt: digest init failed");
+			return (0);
+		}
+		EVP_DigestUpdate(ctx, auth->key, auth->key_size);
 	}
-	EVP_DigestUpdate(ctx, auth->key, auth->key_size);
 	EVP_DigestUpdate(ctx, (uint8_t *)pkt, (unsigned int)length);
 	EVP_DigestFinal_ex(ctx, digest, &len);
 	if (MAX_BARE_MAC_LENGTH < len)
@@ -175,20 +266,29 @@ digest_decrypt(
 {
 	uint8_t	digest[EVP_MAX_MD_SIZE];
 	unsigned int	len;
-	EVP_MD_CTX *ctx = digest_ctx;
+	EVP_MD_CTX *ctx = mac_ctxs_get()->digest;
 
 	/*
 	 * Compute digest of key concatenated with packet. Note: the
 	 * key type and digest type have been verified when the key
 	 * was created.
 	 */
-	EVP_MD_CTX_reset(ctx);
-	if (!EVP_DigestInit_ex(ctx, auth->digest, NULL)) {
-		msyslog(LOG_ERR,
-		    "MAC: decrypt: digest init failed");
-		return false;
+	if (NULL != auth->digest_ctx) {
+		/* key prefix hashed once in auth_setkey() */
+		if (!EVP_MD_CTX_copy_ex(ctx, auth->digest_ctx)) {
+			msyslog(LOG_ERR,
+			    "MAC: decrypt: digest copy failed");
+			return false;
+		}
+	} else {
+		EVP_MD_CTX_reset(ctx);
+		if (!EVP_DigestInit_ex(ctx, auth->digest, NULL)) {
+			msyslog(LOG_ERR,
+			    "MAC: decrypt: digest init failed");
+			return false;
+		}
+		EVP_DigestUpdate(ctx, auth->key, auth->key_size);
 	}
-	EVP_DigestUpdate(ctx, auth->key, auth->key_size);
 	EVP_DigestUpdate(ctx, (uint8_t *)pkt, (unsigned int)length);
 	EVP_DigestFinal_ex(ctx, digest, &len);
 	if (MAX_BARE_MAC_LENGTH < len)
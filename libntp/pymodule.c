@@ -9,10 +9,15 @@
 
 #include "config.h"
 
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+
 #include "ntp_machine.h"
 #include "ntpd.h"
 #include "ntp_io.h"
 #include "ntp_fp.h"
+#include "ntp_calendar.h"
 #include "ntp_stdlib.h"
 #include "ntp_syslog.h"
 #include "timespecops.h"
@@ -151,7 +156,7 @@ ntpc_step_systime(PyObject *self, PyObject *args)
  */
 
 /* Slightly older version of OpenSSL */
-/* Similar hack in ssl_init.c and attic/digest-timing.c */
+/* Similar hack in authkeys.c, macencrypt.c and attic/digest-timing.c */
 #ifndef EVP_MD_CTX_new
 #define EVP_MD_CTX_new() EVP_MD_CTX_create()
 #endif
@@ -303,6 +308,442 @@ ntpc_mac(PyObject *self, PyObject *args)
 #endif
 }
 
+/* --------------------------------------------------------------- */
+/* Stats file helpers for ntpviz.
+ * pylib/statfiles.py and ntpviz use these when this module has them,
+ * and fall back to their own Python loops otherwise.  Each matches
+ * the Python it replaces, down to the strings it builds.
+ */
+
+#if PY_MAJOR_VERSION >= 3
+#define STAT_AS_STRING(o, s, n)	\
+	(((*(s)) = PyUnicode_AsUTF8AndSize((o), (n))) != NULL)
+#define STAT_FROM_STRING(s, n)	PyUnicode_DecodeUTF8((s), (n), NULL)
+#else
+#define STAT_AS_STRING(o, s, n)	\
+	(PyString_AsStringAndSize((o), (char **)(s), (n)) == 0)
+#define STAT_FROM_STRING(s, n)	PyString_FromStringAndSize((s), (n))
+#endif
+
+struct stat_field {
+	const char *	start;
+	Py_ssize_t	len;
+};
+
+/* split on whitespace like str.split(), growing *fields as needed */
+static int
+stat_split(
+	const char *		line,
+	Py_ssize_t		len,
+	struct stat_field **	fields,
+	int *			cap
+	)
+{
+	const char *end = line + len;
+	int n = 0;
+
+	for (;;) {
+		const char *p;
+
+		while (line < end && isspace((unsigned char)*line))
+			line++;
+		if (line == end)
+			return n;
+		for (p = line; p < end && !isspace((unsigned char)*p); p++)
+			continue;
+		if (n == *cap) {
+			struct stat_field *bigger;
+
+			bigger = PyMem_Realloc(*fields,
+					       2 * (size_t)*cap * sizeof(**fields));
+			if (NULL == bigger) {
+				PyErr_NoMemory();
+				return -1;
+			}
+			*fields = bigger;
+			*cap *= 2;
+		}
+		(*fields)[n].start = line;
+		(*fields)[n].len = p - line;
+		n++;
+		line = p;
+	}
+}
+
+/* whole-field conversions, failing where int() and float() would */
+static bool
+stat_long(const struct stat_field *f, long long *v)
+{
+	char buf[32], *ep;
+
+	if (f->len >= (Py_ssize_t)sizeof(buf))
+		return false;
+	memcpy(buf, f->start, (size_t)f->len);
+	buf[f->len] = '\0';
+	errno = 0;
+	*v = strtoll(buf, &ep, 10);
+	return ep != buf && '\0' == *ep && 0 == errno;
+}
+
+static bool
+stat_double(const struct stat_field *f, double *v)
+{
+	char buf[64], *ep;
+
+	if (f->len >= (Py_ssize_t)sizeof(buf)
+	    || memchr(f->start, 'x', (size_t)f->len) != NULL
+	    || memchr(f->start, 'X', (size_t)f->len) != NULL)
+		return false;
+	memcpy(buf, f->start, (size_t)f->len);
+	buf[f->len] = '\0';
+	*v = strtod(buf, &ep);
+	return ep != buf && '\0' == *ep;
+}
+
+/* str(t) */
+static PyObject *
+stat_time_str(double t)
+{
+#if PY_MAJOR_VERSION >= 3
+	char *buf;
+	PyObject *ret;
+
+	buf = PyOS_double_to_string(t, 'r', 0, Py_DTSF_ADD_DOT_0, NULL);
+	if (NULL == buf)
+		return NULL;
+	ret = PyUnicode_FromString(buf);
+	PyMem_Free(buf);
+	return ret;
+#else
+	PyObject *f = PyFloat_FromDouble(t);
+	PyObject *ret;
+
+	if (NULL == f)
+		return NULL;
+	ret = PyObject_Str(f);
+	Py_DECREF(f);
+	return ret;
+#endif
+}
+
+/* rows = ntp.ntpc.statrows(lines, starttime, endtime, unixtime)
+ *
+ * NTPStats.unixize() when unixtime is false: the first two fields
+ * are MJD and seconds, and become integer milliseconds and str() of
+ * the Unix time.  Otherwise the first field is Unix time, lines need
+ * three fields, and the milliseconds are put in front, as for the
+ * temps and gpsd logs.  Lines that don't parse are skipped.
+ */
+static PyObject *
+ntpc_statrows(PyObject *self, PyObject *args)
+{
+	PyObject *lines, *seq, *rows;
+	double starttime, endtime;
+	int unixtime = 0;
+	struct stat_field *fields;
+	int cap = 32;
+	Py_ssize_t i, count;
+
+	UNUSED_ARG(self);
+	if (!PyArg_ParseTuple(args, "Odd|i", &lines, &starttime, &endtime,
+			      &unixtime))
+		return NULL;
+	seq = PySequence_Fast(lines, "lines must be a sequence");
+	if (NULL == seq)
+		return NULL;
+	rows = PyList_New(0);
+	fields = PyMem_Malloc((size_t)cap * sizeof(*fields));
+	if (NULL == rows || NULL == fields) {
+		PyErr_NoMemory();
+		goto fail;
+	}
+
+	count = PySequence_Fast_GET_SIZE(seq);
+	for (i = 0; i < count; i++) {
+		PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+		PyObject *row, *obj;
+		const char *line;
+		Py_ssize_t len;
+		long long mjd;
+		double t, second;
+		int n, f, col, first;
+
+		if (!STAT_AS_STRING(item, &line, &len))
+			goto fail;
+		n = stat_split(line, len, &fields, &cap);
+		if (n < 0)
+			goto fail;
+		if (unixtime) {
+			if (n < 3 || !stat_double(&fields[0], &t))
+				continue;
+			first = 0;
+		} else {
+			if (n < 2 || !stat_long(&fields[0], &mjd)
+			    || !stat_double(&fields[1], &second))
+				continue;
+			/* warning: 32 bit overflows */
+			t = (double)(SECSPERDAY * mjd) + second - 3506716800.0;
+			first = 2;
+		}
+		if (!(starttime <= t && t <= endtime))
+			continue;
+
+		row = PyList_New(2 + n - first - (unixtime ? 1 : 0));
+		if (NULL == row)
+			goto fail;
+		obj = PyLong_FromLongLong((long long)(t * 1000));
+		if (NULL == obj) {
+			Py_DECREF(row);
+			goto fail;
+		}
+		PyList_SET_ITEM(row, 0, obj);
+		col = 1;
+		if (!unixtime) {
+			obj = stat_time_str(t);
+			if (NULL == obj) {
+				Py_DECREF(row);
+				goto fail;
+			}
+			PyList_SET_ITEM(row, col++, obj);
+		}
+		for (f = first; f < n; f++) {
+			obj = STAT_FROM_STRING(fields[f].start, fields[f].len);
+			if (NULL == obj) {
+				Py_DECREF(row);
+				goto fail;
+			}
+			PyList_SET_ITEM(row, col++, obj);
+		}
+		if (PyList_Append(rows, row) != 0) {
+			Py_DECREF(row);
+			goto fail;
+		}
+		Py_DECREF(row);
+	}
+	PyMem_Free(fields);
+	Py_DECREF(seq);
+	return rows;
+
+    fail:
+	PyMem_Free(fields);
+	Py_XDECREF(rows);
+	Py_DECREF(seq);
+	return NULL;
+}
+
+/* groups = ntp.ntpc.statgroup(rows, index)
+ *
+ * Map row[index] to the list of rows that have it, skipping short
+ * rows, as NTPStats.peersplit() does.
+ */
+static PyObject *
+ntpc_statgroup(PyObject *self, PyObject *args)
+{
+	PyObject *rows, *seq, *groups;
+	Py_ssize_t index, i, count;
+
+	UNUSED_ARG(self);
+	if (!PyArg_ParseTuple(args, "On", &rows, &index))
+		return NULL;
+	seq = PySequence_Fast(rows, "rows must be a sequence");
+	if (NULL == seq)
+		return NULL;
+	groups = PyDict_New();
+	if (NULL == groups) {
+		Py_DECREF(seq);
+		return NULL;
+	}
+
+	count = PySequence_Fast_GET_SIZE(seq);
+	for (i = 0; i < count; i++) {
+		PyObject *row = PySequence_Fast_GET_ITEM(seq, i);
+		PyObject *key, *group;
+
+		key = PySequence_GetItem(row, index);
+		if (NULL == key) {
+			if (!PyErr_ExceptionMatches(PyExc_IndexError))
+				goto fail;
+			PyErr_Clear();
+			continue;
+		}
+		group = PyDict_GetItem(groups, key);
+		if (NULL == group) {
+			group = PyList_New(0);
+			if (NULL == group || PyDict_SetItem(groups, key, group)) {
+				Py_XDECREF(group);
+				Py_DECREF(key);
+				goto fail;
+			}
+			Py_DECREF(group);	/* the dict holds it */
+		}
+		Py_DECREF(key);
+		if (PyList_Append(group, row) != 0)
+			goto fail;
+	}
+	Py_DECREF(seq);
+	return groups;
+
+    fail:
+	Py_DECREF(groups);
+	Py_DECREF(seq);
+	return NULL;
+}
+
+struct stat_text {
+	char *		buf;
+	size_t		len;
+	size_t		size;
+};
+
+static bool
+stat_append(struct stat_text *text, const char *s, Py_ssize_t len)
+{
+	if (text->len + (size_t)len > text->size) {
+		size_t size = 2 * text->size + (size_t)len;
+		char *bigger = PyMem_Realloc(text->buf, size);
+
+		if (NULL == bigger) {
+			PyErr_NoMemory();
+			return false;
+		}
+		text->buf = bigger;
+		text->size = size;
+	}
+	memcpy(text->buf + text->len, s, (size_t)len);
+	text->len += (size_t)len;
+	return true;
+}
+
+/* the value of row[index] as a float and a string; false and no
+ * exception for a short row */
+static bool
+stat_item(PyObject *row, Py_ssize_t index, PyObject *values,
+	  const char **s, Py_ssize_t *len)
+{
+	PyObject *item, *value;
+
+	item = PySequence_GetItem(row, index);
+	if (NULL == item) {
+		if (PyErr_ExceptionMatches(PyExc_IndexError))
+			PyErr_Clear();
+		return false;
+	}
+	value = PyNumber_Float(item);
+	if (NULL == value || PyList_Append(values, value) != 0) {
+		Py_XDECREF(value);
+		Py_DECREF(item);
+		return false;
+	}
+	Py_DECREF(value);
+	/* the row keeps the string alive */
+	Py_DECREF(item);
+	if (!STAT_AS_STRING(item, s, len))
+		return false;
+	return true;
+}
+
+/* (plot_data, values1[, values2]) =
+ *	ntp.ntpc.statslice(rows, item1, item2=None)
+ *
+ * ntpviz's plot_slice(): the gnuplot data for the time and one or
+ * two fields, with a blank line at gaps of more than 2200 seconds,
+ * and the fields as floats for the percentiles.
+ */
+static PyObject *
+ntpc_statslice(PyObject *self, PyObject *args)
+{
+	PyObject *rows, *seq, *item2obj = Py_None;
+	PyObject *values1 = NULL, *values2 = NULL, *plot, *ret = NULL;
+	Py_ssize_t item1, item2 = 0, i, count;
+	struct stat_text text = { NULL, 0, 0 };
+	long long last_time = 0;
+	int two;
+
+	UNUSED_ARG(self);
+	if (!PyArg_ParseTuple(args, "On|O", &rows, &item1, &item2obj))
+		return NULL;
+	two = PyObject_IsTrue(item2obj);
+	if (two < 0)
+		return NULL;
+	if (two) {
+		item2 = PyNumber_AsSsize_t(item2obj, PyExc_IndexError);
+		if (-1 == item2 && PyErr_Occurred())
+			return NULL;
+	}
+	seq = PySequence_Fast(rows, "rows must be a sequence");
+	if (NULL == seq)
+		return NULL;
+	values1 = PyList_New(0);
+	values2 = PyList_New(0);
+	if (NULL == values1 || NULL == values2)
+		goto done;
+
+	count = PySequence_Fast_GET_SIZE(seq);
+	for (i = 0; i < count; i++) {
+		PyObject *row = PySequence_Fast_GET_ITEM(seq, i);
+		PyObject *stamp, *label;
+		const char *s1, *s2 = NULL, *ts;
+		Py_ssize_t len1, len2 = 0, tslen;
+		long long now;
+
+		if (!stat_item(row, item1, values1, &s1, &len1)) {
+			if (PyErr_Occurred())
+				goto done;
+			continue;
+		}
+		if (two && !stat_item(row, item2, values2, &s2, &len2)) {
+			if (PyErr_Occurred())
+				goto done;
+			continue;
+		}
+		stamp = PySequence_GetItem(row, 0);
+		if (NULL == stamp)
+			goto done;
+		now = PyLong_AsLongLong(stamp);
+		Py_DECREF(stamp);
+		if (-1 == now && PyErr_Occurred())
+			goto done;
+		label = PySequence_GetItem(row, 1);
+		if (NULL == label)
+			goto done;
+		Py_DECREF(label);	/* the row keeps it alive */
+		if (!STAT_AS_STRING(label, &ts, &tslen))
+			goto done;
+
+		if (2200000 < now - last_time) {
+			/* more than 2,200 seconds between points
+			 * data loss, add a break in the plot line */
+			if (!stat_append(&text, "\n", 1))
+				goto done;
+		}
+		if (!stat_append(&text, ts, tslen)
+		    || !stat_append(&text, " ", 1)
+		    || !stat_append(&text, s1, len1)
+		    || (two && (!stat_append(&text, " ", 1)
+				|| !stat_append(&text, s2, len2)))
+		    || !stat_append(&text, "\n", 1))
+			goto done;
+		last_time = now;
+	}
+	if (!stat_append(&text, "e\n", 2))
+		goto done;
+
+	plot = STAT_FROM_STRING(text.buf, (Py_ssize_t)text.len);
+	if (NULL == plot)
+		goto done;
+	if (two)
+		ret = Py_BuildValue("(NOO)", plot, values1, values2);
+	else
+		ret = Py_BuildValue("(NO)", plot, values1);
+
+    done:
+	PyMem_Free(text.buf);
+	Py_XDECREF(values1);
+	Py_XDECREF(values2);
+	Py_DECREF(seq);
+	return ret;
+}
+
 /* List of functions defined in the module */
 
 static PyMethodDef ntpc_methods[] = {
@@ -324,6 +765,12 @@ static PyMethodDef ntpc_methods[] = {
      PyDoc_STR("Check if name is a valid algorithm name")},
     {"mac",             ntpc_mac,   		METH_VARARGS,
      PyDoc_STR("Compute HMAC or CMAC from data, key, and algorithm name")},
+    {"statrows",        ntpc_statrows,   	METH_VARARGS,
+     PyDoc_STR("Split stats log lines into time-filtered rows")},
+    {"statgroup",       ntpc_statgroup,   	METH_VARARGS,
+     PyDoc_STR("Group stats rows by the value of one field")},
+    {"statslice",       ntpc_statslice,   	METH_VARARGS,
+     PyDoc_STR("Gnuplot data and float values for one or two fields")},
     {NULL,		NULL, 0, NULL}		/* sentinel */
 };
 
@@ -9,21 +9,12 @@
 #include <stdbool.h>
 #include <openssl/ssl.h>
 #include <openssl/evp.h>
-#include <openssl/cmac.h>
-
-#ifndef EVP_MD_CTX_new
-/* Slightly older version of OpenSSL */
-/* Similar hack in macencrypt.c and attic/digest-timing.c */
-#define EVP_MD_CTX_new() EVP_MD_CTX_create()
-#endif
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
 static void	atexit_ssl_cleanup(void);
 #endif
 
 static bool ssl_init_done;
-EVP_MD_CTX *digest_ctx;
-CMAC_CTX *cmac_ctx;
 
 void
 ssl_init(void)
@@ -48,8 +39,6 @@ ssl_init(void)
 	/* RAND_poll in OpenSSL on Raspbian needs get{u,g,eu,eg}id() */
 	ntp_RAND_bytes(&dummy, 1);
 
-	digest_ctx = EVP_MD_CTX_new();
-	cmac_ctx = CMAC_CTX_new();
 	ssl_init_done = true;
 }
 
@@ -1209,7 +1209,7 @@ usage: config_from_file <configuration filename>
 
     def do_mrulist(self, line):
         """display the list of most recently seen source addresses,
-           tags mincount=... resall=0x... resany=0x..."""
+           tags mincount=... resall=0x... resany=0x... bin"""
         cmdvars = {}
         for item in line.split(" "):
             if not item:
@@ -1436,7 +1436,7 @@ usage: sysstats
         "display monitor (mrulist) counters and limits"
         monstats = (
             ("mru_enabled",     "enabled:              ", NTP_INT),
-            ("mru_hashslots",   "hash slots in use:    ", NTP_INT),
+            ("mru_hashslots",   "hash table slots:     ", NTP_INT),
             ("mru_depth",       "addresses in use:     ", NTP_INT),
             ("mru_deepest",     "peak addresses:       ", NTP_INT),
             ("mru_maxdepth",    "maximum addresses:    ", NTP_INT),
@@ -1451,6 +1451,9 @@ usage: sysstats
             ("mru_recyclefull", "alloc: recycle full:  ", NTP_INT),
             ("mru_none",        "alloc: none:          ", NTP_INT),
             ("mru_oldest_age",  "age of oldest slot:   ", NTP_INT),
+            ("mru_shards",      "hash shards:          ", NTP_INT),
+            ("mru_shardfill",   "shard entries:        ", NTP_STR),
+            ("mru_shardwaits",  "shard lock waits:     ", NTP_STR),
         )
         self.collect_display(associd=0, variables=monstats, decodestatus=False)
 
@@ -1507,10 +1510,22 @@ usage: authinfo
    ("nts_cookie_decode_old",     "NTS decode cookies old:    ", NTP_INT),
    ("nts_cookie_decode_too_old", "NTS decode cookies too old:", NTP_INT),
    ("nts_cookie_decode_error",   "NTS decode cookies error:  ", NTP_INT),
+   ("nts_nonce_refills",         "NTS nonce pool refills:    ", NTP_INT),
+   ("nts_nonce_stalls",          "NTS nonce pool ran dry:    ", NTP_INT),
    ("nts_ke_probes_good",        "NTS KE probes good:        ", NTP_INT),
    ("nts_ke_probes_bad",         "NTS KE probes_bad:         ", NTP_INT),
+   ("nts_ke_probe_resume_hits",  "NTS KE probes resumed:     ", NTP_INT),
+   ("nts_ke_probe_resume_misses","NTS KE probes not resumed: ", NTP_INT),
    ("nts_ke_serves_good",        "NTS KE serves good:        ", NTP_INT),
    ("nts_ke_serves_bad",         "NTS KE serves_bad:         ", NTP_INT),
+   ("nts_ke_resume_hits",        "NTS KE serves resumed:     ", NTP_INT),
+   ("nts_ke_resume_misses",      "NTS KE serves not resumed: ", NTP_INT),
+   ("nts_ke_active",             "NTS KE serving now:        ", NTP_INT),
+   ("nts_ke_active_max",         "NTS KE serving max:        ", NTP_INT),
+   ("nts_ke_full",               "NTS KE at kemaxconns:      ", NTP_INT),
+   ("nts_ke_timeouts",           "NTS KE timeouts:           ", NTP_INT),
+   ("nts_ke_hs_avg",             "NTS KE handshake avg ms:   ", NTP_FLOAT),
+   ("nts_ke_hs_max",             "NTS KE handshake max ms:   ", NTP_FLOAT),
   )
         self.collect_display(associd=0, variables=ntsinfo, decodestatus=False)
 
@@ -1531,6 +1546,8 @@ usage: ntsinfo
             ("free_rbuf", "free receive buffers: ", NTP_INT),
             ("used_rbuf", "used receive buffers: ", NTP_INT),
             ("rbuf_lowater", "low water refills:    ", NTP_INT),
+            ("rbuf_allocs", "buffer allocations:   ", NTP_INT),
+            ("rbuf_hiwater", "most buffers in use:  ", NTP_INT),
             ("io_dropped", "dropped packets:      ", NTP_INT),
             ("io_ignored", "ignored packets:      ", NTP_INT),
             ("io_received", "received packets:     ", NTP_INT),
@@ -1538,6 +1555,24 @@ usage: ntsinfo
             ("io_sendfailed", "packet send failures: ", NTP_INT),
             ("io_wakeups", "input wakeups:        ", NTP_INT),
             ("io_goodwakeups", "useful input wakeups: ", NTP_INT),
+            ("io_rbatches", "batched reads:        ", NTP_INT),
+            ("io_rbatchpkts", "batched packets:      ", NTP_INT),
+            ("io_rbatch1", "batches of 1:         ", NTP_INT),
+            ("io_rbatch2", "batches of 2-3:       ", NTP_INT),
+            ("io_rbatch4", "batches of 4-7:       ", NTP_INT),
+            ("io_rbatch8", "batches of 8-15:      ", NTP_INT),
+            ("io_rbatch16", "batches of 16-31:     ", NTP_INT),
+            ("io_rbatch32", "batches of 32-63:     ", NTP_INT),
+            ("io_rbatch64", "batches of 64:        ", NTP_INT),
+            ("io_xbatches", "batched sends:        ", NTP_INT),
+            ("io_xbatchpkts", "batched sent packets: ", NTP_INT),
+            ("io_workers", "server workers:       ", NTP_INT),
+            ("io_wserved", "worker requests:      ", NTP_INT),
+            ("io_whandoffs", "worker hand-offs:     ", NTP_INT),
+            ("stats_written", "stats lines written:  ", NTP_INT),
+            ("stats_hiwater", "most stats queued:    ", NTP_INT),
+            ("stats_overflow", "stats queue overflows:", NTP_INT),
+            ("stats_dropped", "stats lines dropped:  ", NTP_INT),
         )
         self.collect_display(associd=0, variables=iostats, decodestatus=False)
 
@@ -44,6 +44,7 @@ import binascii
 import collections
 import csv
 import datetime
+import gc
 import math
 import re
 import os
@@ -116,6 +117,7 @@ class UTC(datetime.tzinfo):
 
 
 try:
+    import ntp.ntpc
     import ntp.statfiles
     import ntp.util
 except ImportError as e:
@@ -460,18 +462,24 @@ set rmargin 10
 """
 
     def __init__(self, statsdir,
-                 sitename=None, period=None, starttime=None, endtime=None):
+                 sitename=None, period=None, starttime=None, endtime=None,
+                 cachedir=None):
         ntp.statfiles.NTPStats.__init__(self, statsdir=statsdir,
                                         sitename=sitename,
                                         period=period,
                                         starttime=starttime,
-                                        endtime=endtime)
+                                        endtime=endtime,
+                                        cachedir=cachedir)
 
     def plot_slice(self, rows, item1, item2=None):
         "slice 0,item1, maybe item2, from rows, ready for gnuplot"
         # speed up by only sending gnuplot the data it will actually use
         # WARNING: this is hot code, only modify if you profile
         # since we are looping the data, get the values too
+        statslice = getattr(ntp.ntpc, "statslice", None)
+        if statslice is not None:
+            # the same loop in C
+            return statslice(rows, item1, item2)
         plot_data = ''
         last_time = 0
         values1 = []
@@ -1403,6 +1411,11 @@ Python by ESR, concept and gnuplot code by Dan Drown.
                         action="store_true",
                         dest='clip',
                         help="Clip plots at 1%% and 99%%")
+    parser.add_argument('-C', '--cache',
+                        default=None,
+                        dest='cachedir',
+                        help="directory to cache parsed log files in",
+                        type=str)
     parser.add_argument('-d', '--datadir',
                         default="/var/log/ntpstats",
                         dest='statsdirs',
@@ -1559,6 +1572,8 @@ Python by ESR, concept and gnuplot code by Dan Drown.
         args.endtime = ntp.statfiles.iso_to_posix(args.endtime)
     if args.starttime is not None:
         args.starttime = ntp.statfiles.iso_to_posix(args.starttime)
+    if args.cachedir is not None:
+        args.cachedir = os.path.expanduser(args.cachedir)
 
     args.statsdirs = [os.path.expanduser(path)
                       for path in args.statsdirs.split(",")]
@@ -1626,15 +1641,23 @@ Python by ESR, concept and gnuplot code by Dan Drown.
 
     plot = None
 
+    # Loading makes millions of small row lists, none of them in a
+    # cycle, and the cyclic garbage collector would walk them over and
+    # over for nothing.  Keep it off while loading, then freeze what
+    # was loaded so later collections skip it.
+    gc.disable()
     if 1 == len(args.statsdirs):
         statlist = [NTPViz(statsdir=args.statsdirs[0], sitename=args.sitename,
                            period=args.period, starttime=args.starttime,
-                           endtime=args.endtime)]
+                           endtime=args.endtime, cachedir=args.cachedir)]
     else:
         statlist = [NTPViz(statsdir=d, sitename=d,
                            period=args.period, starttime=args.starttime,
-                           endtime=args.endtime)
+                           endtime=args.endtime, cachedir=args.cachedir)
                     for d in args.statsdirs]
+    if hasattr(gc, "freeze"):
+        gc.freeze()
+    gc.enable()
 
     if len(statlist) == 1:
         stats = statlist[0]
@@ -31,6 +31,7 @@ struct key_tok ntp_keywords[] = {
 { "cookie",		T_Cookie,		FOLLBY_TOKEN },
 { "ctl",		T_Ctl,			FOLLBY_TOKEN },
 { "disable",		T_Disable,		FOLLBY_TOKEN },
+{ "dnsworkers",		T_Dnsworkers,	FOLLBY_TOKEN },
 { "driftfile",		T_Driftfile,		FOLLBY_STRING },
 { "dscp",		T_Dscp,			FOLLBY_TOKEN },
 { "enable",		T_Enable,		FOLLBY_TOKEN },
@@ -51,11 +52,14 @@ struct key_tok ntp_keywords[] = {
 { "pidfile",		T_Pidfile,		FOLLBY_STRING },
 { "pool",		T_Pool,			FOLLBY_STRING },
 { "ppspath",		T_Ppspath,		FOLLBY_STRING },
+{ "recvbatch",		T_Recvbatch,		FOLLBY_TOKEN },
 { "reset",		T_Reset,		FOLLBY_TOKEN },
 { "restrict",		T_Restrict,		FOLLBY_TOKEN },
 { "refclock",		T_Refclock,		FOLLBY_STRING },
 { "rlimit",		T_Rlimit,		FOLLBY_TOKEN },
+{ "sendbatch",		T_Sendbatch,		FOLLBY_TOKEN },
 { "server",		T_Server,		FOLLBY_STRING },
+{ "serverworkers",	T_Serverworkers,	FOLLBY_TOKEN },
 { "setvar",		T_Setvar,		FOLLBY_STRING },
 { "statistics",		T_Statistics,		FOLLBY_TOKEN },
 { "statsdir",		T_Statsdir,		FOLLBY_STRING },
@@ -100,9 +104,11 @@ struct key_tok ntp_keywords[] = {
 { "sysstats", 		T_Sysstats,		FOLLBY_TOKEN },
 { "usestats",		T_Usestats,		FOLLBY_TOKEN },
 /* filegen_option */
+{ "binary",		T_Binary,		FOLLBY_TOKEN },
 { "file",		T_File,			FOLLBY_STRING },
 { "link",		T_Link,			FOLLBY_TOKEN },
 { "nolink",		T_Nolink,		FOLLBY_TOKEN },
+{ "text",		T_Text,			FOLLBY_TOKEN },
 { "type",		T_Type,			FOLLBY_TOKEN },
 /* filegen_type */
 { "age",		T_Age,			FOLLBY_TOKEN },
@@ -200,6 +206,7 @@ struct key_tok ntp_keywords[] = {
 { "nts",		T_Nts,			FOLLBY_TOKEN },
 { "ask",		T_Ask,			FOLLBY_STRING },
 { "require",		T_Require,		FOLLBY_STRING },
+{ "keserver",		T_Keserver,		FOLLBY_STRING },
 { "noval",		T_Noval,		FOLLBY_TOKEN },
 { "expire",		T_Expire,		FOLLBY_TOKEN },
 { "cert",		T_Cert,			FOLLBY_TOKEN },
@@ -207,6 +214,10 @@ struct key_tok ntp_keywords[] = {
 { "mintls",		T_Mintls,		FOLLBY_TOKEN },
 { "maxtls",		T_Maxtls,		FOLLBY_TOKEN },
 { "tlsciphersuites",	T_Tlsciphersuites,	FOLLBY_STRING },
+{ "keworkers",		T_Keworkers,		FOLLBY_TOKEN },
+{ "kemaxconns",		T_Kemaxconns,		FOLLBY_TOKEN },
+{ "tlsresume",		T_Tlsresume,		FOLLBY_TOKEN },
+{ "ratchet",		T_Ratchet,		FOLLBY_TOKEN },
 };
 
 typedef struct big_scan_state_tag {
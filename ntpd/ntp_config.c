@@ -720,6 +720,18 @@ create_peer_node(
 			my_node->ctl.nts_cfg.server = estrdup(option->value.s);
 			break;
 
+		case T_Keserver:
+			if (my_node->ctl.nts_cfg.nkeservers >= NTS_MAX_KESERVERS) {
+				msyslog(LOG_ERR, "CONFIG: keserver: more than %d",
+					NTS_MAX_KESERVERS);
+				errflag = true;
+			} else {
+				my_node->ctl.nts_cfg.keservers[
+				    my_node->ctl.nts_cfg.nkeservers++] =
+					estrdup(option->value.s);
+			}
+			break;
+
 #ifdef REFCLOCK
 		case T_Path:
 			my_node->ctl.path = estrdup(option->value.s);
@@ -1411,6 +1423,20 @@ config_monitor(
 					filegen_flag &= ~FGEN_FLAG_LINK;
 					break;
 
+				case T_Text:
+					filegen_flag &= ~FGEN_FLAG_BINARY;
+					break;
+
+				case T_Binary:
+					if (NULL == filegen->cols) {
+						msyslog(LOG_ERR,
+							"CONFIG: filegen %s has no binary format",
+							filegen_string);
+						break;
+					}
+					filegen_flag |= FGEN_FLAG_BINARY;
+					break;
+
 				case T_Enable:
 					filegen_flag |= FGEN_FLAG_ENABLED;
 					break;
@@ -1993,6 +2019,14 @@ config_nts(
 			ntsconfig.ntsenable = true;
 			break;
 
+		case T_Kemaxconns:
+			ntsconfig.kemaxconns = nts->value.i;
+			break;
+
+		case T_Keworkers:
+			ntsconfig.keworkers = nts->value.i;
+			break;
+
 		case T_Key:
 			ntsconfig.key = estrdup(nts->value.s);
 			break;
@@ -2008,6 +2042,14 @@ config_nts(
 		case T_Tlsciphersuites:
 			ntsconfig.tlsciphersuites = estrdup(nts->value.s);
 			break;
+
+		case T_Tlsresume:
+			ntsconfig.tlsresume = true;
+			break;
+
+		case T_Ratchet:
+			ntsconfig.ratchet = true;
+			break;
 #endif
 		}
 	}
@@ -2554,6 +2596,22 @@ config_vars(
 			qos = curr_var->value.i << 2;
 			break;
 
+		case T_Dnsworkers:
+			dns_set_workers(curr_var->value.i);
+			break;
+
+		case T_Recvbatch:
+			io_set_recvbatch(curr_var->value.i);
+			break;
+
+		case T_Sendbatch:
+			io_set_sendbatch(curr_var->value.i);
+			break;
+
+		case T_Serverworkers:
+			io_set_workers(curr_var->value.i);
+			break;
+
 		case T_WanderThreshold:		/* FALLTHROUGH */
 		case T_Nonvolatile:
 			wander_threshold = curr_var->value.d;
@@ -94,6 +94,7 @@ static	void	send_mru_entry	(mon_entry *, int);
 static	void	send_random_tag_value(int);
 #endif /* USE_RANDOMIZE_RESPONSES */
 static	void	read_mru_list	(struct recvbuf *, int);
+static	void	read_mru_bin	(struct recvbuf *, int);
 static	void	send_ifstats_entry(endpt *, unsigned int);
 static	void	read_ifstats	(struct recvbuf *);
 static	void	sockaddrs_from_restrict_u(sockaddr_u *,	sockaddr_u *,
@@ -118,6 +119,7 @@ static const struct ctl_proc control_codes[] = {
 	{ CTL_OP_READ_MRU,		NOAUTH,	read_mru_list },
 	{ CTL_OP_READ_ORDLIST_A,	AUTH,	read_ordlist },
 	{ CTL_OP_REQ_NONCE,		NOAUTH,	req_nonce },
+	{ CTL_OP_READ_MRU_BIN,		NOAUTH,	read_mru_bin },
 	{ NO_REQUEST,			0,	NULL }
 };
 
@@ -384,6 +386,80 @@ static const struct ctl_var sys_var[] = {
 #define CS_MRU_HASHSLOTS	106
 	{ CS_MRU_HASHSLOTS,		RO, "mru_hashslots" },
 #endif
+#define CS_IO_RBATCHES		(CS_MRU_HASHSLOTS + 1)
+	{ CS_IO_RBATCHES,	RO, "io_rbatches" },
+#define CS_IO_RBATCHPKTS	(CS_MRU_HASHSLOTS + 2)
+	{ CS_IO_RBATCHPKTS,	RO, "io_rbatchpkts" },
+/* batch size histogram, one slot per power of two */
+#define CS_IO_RBATCH1		(CS_MRU_HASHSLOTS + 3)
+	{ CS_IO_RBATCH1,	RO, "io_rbatch1" },
+#define CS_IO_RBATCH2		(CS_MRU_HASHSLOTS + 4)
+	{ CS_IO_RBATCH2,	RO, "io_rbatch2" },
+#define CS_IO_RBATCH4		(CS_MRU_HASHSLOTS + 5)
+	{ CS_IO_RBATCH4,	RO, "io_rbatch4" },
+#define CS_IO_RBATCH8		(CS_MRU_HASHSLOTS + 6)
+	{ CS_IO_RBATCH8,	RO, "io_rbatch8" },
+#define CS_IO_RBATCH16		(CS_MRU_HASHSLOTS + 7)
+	{ CS_IO_RBATCH16,	RO, "io_rbatch16" },
+#define CS_IO_RBATCH32		(CS_MRU_HASHSLOTS + 8)
+	{ CS_IO_RBATCH32,	RO, "io_rbatch32" },
+#define CS_IO_RBATCH64		(CS_MRU_HASHSLOTS + 9)
+	{ CS_IO_RBATCH64,	RO, "io_rbatch64" },
+#define CS_IO_XBATCHES		(CS_MRU_HASHSLOTS + 10)
+	{ CS_IO_XBATCHES,	RO, "io_xbatches" },
+#define CS_IO_XBATCHPKTS	(CS_MRU_HASHSLOTS + 11)
+	{ CS_IO_XBATCHPKTS,	RO, "io_xbatchpkts" },
+#define CS_IO_WORKERS		(CS_MRU_HASHSLOTS + 12)
+	{ CS_IO_WORKERS,	RO, "io_workers" },
+#define CS_IO_WSERVED		(CS_MRU_HASHSLOTS + 13)
+	{ CS_IO_WSERVED,	RO, "io_wserved" },
+#define CS_IO_WHANDOFFS		(CS_MRU_HASHSLOTS + 14)
+	{ CS_IO_WHANDOFFS,	RO, "io_whandoffs" },
+#define CS_RBUF_ALLOCS		(CS_MRU_HASHSLOTS + 15)
+	{ CS_RBUF_ALLOCS,	RO, "rbuf_allocs" },
+#define CS_RBUF_HIWATER		(CS_MRU_HASHSLOTS + 16)
+	{ CS_RBUF_HIWATER,	RO, "rbuf_hiwater" },
+#define CS_MRU_SHARDS		(CS_MRU_HASHSLOTS + 17)
+	{ CS_MRU_SHARDS,	RO, "mru_shards" },
+#define CS_MRU_SHARDFILL	(CS_MRU_HASHSLOTS + 18)
+	{ CS_MRU_SHARDFILL,	RO, "mru_shardfill" },
+#define CS_MRU_SHARDWAITS	(CS_MRU_HASHSLOTS + 19)
+	{ CS_MRU_SHARDWAITS,	RO, "mru_shardwaits" },
+#define CS_STATS_WRITTEN	(CS_MRU_HASHSLOTS + 20)
+	{ CS_STATS_WRITTEN,	RO, "stats_written" },
+#define CS_STATS_HIWATER	(CS_MRU_HASHSLOTS + 21)
+	{ CS_STATS_HIWATER,	RO, "stats_hiwater" },
+#define CS_STATS_OVERFLOW	(CS_MRU_HASHSLOTS + 22)
+	{ CS_STATS_OVERFLOW,	RO, "stats_overflow" },
+#define CS_STATS_DROPPED	(CS_MRU_HASHSLOTS + 23)
+	{ CS_STATS_DROPPED,	RO, "stats_dropped" },
+#ifndef DISABLE_NTS
+#define CS_nts_ke_active	(CS_MRU_HASHSLOTS + 24)
+	{ CS_nts_ke_active,	RO, "nts_ke_active" },
+#define CS_nts_ke_active_max	(CS_MRU_HASHSLOTS + 25)
+	{ CS_nts_ke_active_max,	RO, "nts_ke_active_max" },
+#define CS_nts_ke_timeouts	(CS_MRU_HASHSLOTS + 26)
+	{ CS_nts_ke_timeouts,	RO, "nts_ke_timeouts" },
+#define CS_nts_ke_full		(CS_MRU_HASHSLOTS + 27)
+	{ CS_nts_ke_full,	RO, "nts_ke_full" },
+/* handshake latency, ms */
+#define CS_nts_ke_hs_avg	(CS_MRU_HASHSLOTS + 28)
+	{ CS_nts_ke_hs_avg,	RO, "nts_ke_hs_avg" },
+#define CS_nts_ke_hs_max	(CS_MRU_HASHSLOTS + 29)
+	{ CS_nts_ke_hs_max,	RO, "nts_ke_hs_max" },
+#define CS_nts_nonce_refills	(CS_MRU_HASHSLOTS + 30)
+	{ CS_nts_nonce_refills,	RO, "nts_nonce_refills" },
+#define CS_nts_nonce_stalls	(CS_MRU_HASHSLOTS + 31)
+	{ CS_nts_nonce_stalls,	RO, "nts_nonce_stalls" },
+#define CS_nts_ke_resume_hits	(CS_MRU_HASHSLOTS + 32)
+	{ CS_nts_ke_resume_hits,	RO, "nts_ke_resume_hits" },
+#define CS_nts_ke_resume_misses	(CS_MRU_HASHSLOTS + 33)
+	{ CS_nts_ke_resume_misses,	RO, "nts_ke_resume_misses" },
+#define CS_nts_ke_probe_resume_hits	(CS_MRU_HASHSLOTS + 34)
+	{ CS_nts_ke_probe_resume_hits,	RO, "nts_ke_probe_resume_hits" },
+#define CS_nts_ke_probe_resume_misses	(CS_MRU_HASHSLOTS + 35)
+	{ CS_nts_ke_probe_resume_misses, RO, "nts_ke_probe_resume_misses" },
+#endif
 #define	CS_MAXCODE		((sizeof(sys_var)/sizeof(sys_var[0])) - 1)
 	{ 0,                    EOV, "" }
 };
@@ -1645,9 +1721,17 @@ ctl_putsys(
 		break;
 		}
 
-	case CS_MRU_EXISTS:
-		ctl_putuint(sys_var[varid].text, mon_data.mru_exists);
+	case CS_MRU_EXISTS: {
+		struct mon_shard_stats stats;
+		uint64_t exists = 0;
+
+		for (unsigned int i = 0; i < MON_SHARDS; i++) {
+			mon_shard_stats(i, &stats);
+			exists += stats.exists;
+		}
+		ctl_putuint(sys_var[varid].text, exists);
 		break;
+		}
 
 	case CS_MRU_NEW:
 		ctl_putuint(sys_var[varid].text, mon_data.mru_new);
@@ -1721,7 +1805,8 @@ ctl_putsys(
 		break;
 
 	case CS_AUTHDELAY:
-		dtemp = lfptod(sys_authdelay);
+		dtemp = lfptod(__atomic_load_n(&sys_authdelay,
+					       __ATOMIC_RELAXED));
 		ctl_putdbl(sys_var[varid].text, dtemp * MS_PER_S);
 		break;
 
@@ -1909,6 +1994,53 @@ ctl_putsys(
 		ctl_putuint(sys_var[varid].text, lowater_additions());
 		break;
 
+	case CS_RBUF_ALLOCS:
+		ctl_putuint(sys_var[varid].text, recvbuf_allocs());
+		break;
+
+	case CS_RBUF_HIWATER:
+		ctl_putuint(sys_var[varid].text, recvbuf_hiwater());
+		break;
+
+	case CS_MRU_SHARDS:
+		ctl_putuint(sys_var[varid].text, MON_SHARDS);
+		break;
+
+	case CS_STATS_WRITTEN:
+		ctl_putuint(sys_var[varid].text, stats_written());
+		break;
+
+	case CS_STATS_HIWATER:
+		ctl_putuint(sys_var[varid].text, stats_hiwater());
+		break;
+
+	case CS_STATS_OVERFLOW:
+		ctl_putuint(sys_var[varid].text, stats_overflow());
+		break;
+
+	case CS_STATS_DROPPED:
+		ctl_putuint(sys_var[varid].text, stats_dropped());
+		break;
+
+	case CS_MRU_SHARDFILL:
+	case CS_MRU_SHARDWAITS: {
+		/* one number per shard, separated by spaces */
+		struct mon_shard_stats stats;
+		char buf[MON_SHARDS * 21];
+		size_t len = 0;
+
+		buf[0] = '\0';
+		for (unsigned int i = 0; i < MON_SHARDS; i++) {
+			mon_shard_stats(i, &stats);
+			len += (size_t)snprintf(buf + len, sizeof(buf) - len,
+				"%s%" PRIu64, i ? " " : "",
+				(CS_MRU_SHARDFILL == varid)
+				    ? stats.entries : stats.waits);
+		}
+		ctl_putstr(sys_var[varid].text, buf, len);
+		break;
+		}
+
 	case CS_IO_DROPPED:
         ctl_putuint(sys_var[varid].text, dropped_count());
 		break;
@@ -1937,6 +2069,45 @@ ctl_putsys(
         ctl_putuint(sys_var[varid].text, handler_pkts_count());
 		break;
 
+	case CS_IO_RBATCHES:
+		ctl_putuint(sys_var[varid].text, rbatch_count());
+		break;
+
+	case CS_IO_RBATCHPKTS:
+		ctl_putuint(sys_var[varid].text, rbatch_pkts_count());
+		break;
+
+	case CS_IO_RBATCH1:
+	case CS_IO_RBATCH2:
+	case CS_IO_RBATCH4:
+	case CS_IO_RBATCH8:
+	case CS_IO_RBATCH16:
+	case CS_IO_RBATCH32:
+	case CS_IO_RBATCH64:
+		ctl_putuint(sys_var[varid].text,
+			    rbatch_hist_count(varid - CS_IO_RBATCH1));
+		break;
+
+	case CS_IO_XBATCHES:
+		ctl_putuint(sys_var[varid].text, xbatch_count());
+		break;
+
+	case CS_IO_XBATCHPKTS:
+		ctl_putuint(sys_var[varid].text, xbatch_pkts_count());
+		break;
+
+	case CS_IO_WORKERS:
+		ctl_putuint(sys_var[varid].text, worker_count());
+		break;
+
+	case CS_IO_WSERVED:
+		ctl_putuint(sys_var[varid].text, worker_served_count());
+		break;
+
+	case CS_IO_WHANDOFFS:
+		ctl_putuint(sys_var[varid].text, worker_handoff_count());
+		break;
+
 	case CS_TIMERSTATS_RESET:
 		ctl_putuint(sys_var[varid].text,
 			    current_time - timer_timereset);
@@ -2041,6 +2212,55 @@ ctl_putsys(
 	case CS_nts_ke_probes_bad:
 		ctl_putuint(sys_var[varid].text, nts_ke_probes_bad);
 		break;
+
+	case CS_nts_ke_active:
+		ctl_putuint(sys_var[varid].text, nts_ke_active);
+		break;
+
+	case CS_nts_ke_active_max:
+		ctl_putuint(sys_var[varid].text, nts_ke_active_max);
+		break;
+
+	case CS_nts_ke_timeouts:
+		ctl_putuint(sys_var[varid].text, nts_ke_timeouts);
+		break;
+
+	case CS_nts_ke_full:
+		ctl_putuint(sys_var[varid].text, nts_ke_full);
+		break;
+
+	case CS_nts_ke_hs_avg:
+		ctl_putdbl(sys_var[varid].text, nts_ke_handshakes ?
+			   nts_ke_hs_time * MS_PER_S / nts_ke_handshakes : 0);
+		break;
+
+	case CS_nts_ke_hs_max:
+		ctl_putdbl(sys_var[varid].text, nts_ke_hs_max * MS_PER_S);
+		break;
+
+	case CS_nts_nonce_refills:
+		ctl_putuint(sys_var[varid].text, nts_nonce_refills);
+		break;
+
+	case CS_nts_nonce_stalls:
+		ctl_putuint(sys_var[varid].text, nts_nonce_stalls);
+		break;
+
+	case CS_nts_ke_resume_hits:
+		ctl_putuint(sys_var[varid].text, nts_ke_resume_hits);
+		break;
+
+	case CS_nts_ke_resume_misses:
+		ctl_putuint(sys_var[varid].text, nts_ke_resume_misses);
+		break;
+
+	case CS_nts_ke_probe_resume_hits:
+		ctl_putuint(sys_var[varid].text, nts_ke_probe_resume_hits);
+		break;
+
+	case CS_nts_ke_probe_resume_misses:
+		ctl_putuint(sys_var[varid].text, nts_ke_probe_resume_misses);
+		break;
 #endif
 
         default:
@@ -3473,7 +3693,11 @@ static void read_mru_list(
 	size_t			i;
 	int			priors;
 	mon_entry *		mon;
-	mon_entry *		prior_mon;
+	mon_entry		older;
+	mon_entry *		rows;
+	unsigned int		nrows;
+	bool			walked_all;
+	struct mon_walk		walk;
 	l_fp			now;
 
 	if (RES_NOMRULIST & restrict_mask) {
@@ -3633,6 +3857,16 @@ static void read_mru_list(
 	} else if (0 != limit && 0 == frags)
 		frags = MRU_FRAGS_LIMIT;
 
+	/*
+	 * Hits only mark entries referenced, catch the MRU lists up so
+	 * that everything modified since the prior request lies past
+	 * its starting point in the merged walk.  That is done shard by
+	 * shard first, so the updates held off below while the lists
+	 * are walked have little left to merge.
+	 */
+	mon_sort_mru();
+	mon_lock_all();
+
 	/*
 	 * Find the starting point if one was provided.
 	 */
@@ -3650,36 +3884,36 @@ static void read_mru_list(
 		/* and none could be found unmodified... */
 		if (NULL == mon) {
 			/* tell ntpq to try again with older entries */
+			mon_unlock_all();
 			ctl_error(CERR_UNKNOWNVAR);
 			return;
 		}
-		/* confirm the prior entry used as starting point */
-		ctl_putts("last.older", &mon->last);
-		pch = sockporttoa(&mon->rmtadr);
-		ctl_putunqstr("addr.older", pch, strlen(pch));
+		older = *mon;
 
 		/*
 		 * Move on to the first entry the client doesn't have,
 		 * except in the special case of a limit of one.  In
 		 * that case return the starting point entry.
 		 */
+		mon_walk_start(&walk, mon);
 		if (limit > 1)
-			mon = PREV_DLIST(mon_data.mon_mru_list, mon, mru);
+			mon_walk_next(&walk);
 	} else {	/* start with the oldest */
-		mon = TAIL_DLIST(mon_data.mon_mru_list, mru);
+		mon_walk_start(&walk, NULL);
 		countdown = mon_data.mru_entries;
 	}
+	mon = mon_walk_next(&walk);
 
 	/*
-	 * send up to limit= entries in up to frags= datagrams
+	 * Copy out up to limit= entries, no more than frags= datagrams
+	 * can hold, so none is sent with the monitor held off.
 	 */
 	get_systime(&now);
-	generate_nonce(rbufp, buf, sizeof(buf));
-	ctl_putunqstr("nonce", buf, strlen(buf));
-	prior_mon = NULL;
-	for (count = 0;
-	     mon != NULL && res_frags < frags && count < limit;
-	     mon = PREV_DLIST(mon_data.mon_mru_list, mon, mru)) {
+	rows = eallocarray(min(limit, frags * MRU_ROWS_PER_FRAG),
+			   sizeof(*rows));
+	for (nrows = 0;
+	     mon != NULL && nrows < min(limit, frags * MRU_ROWS_PER_FRAG);
+	     mon = mon_walk_next(&walk)) {
 
 		if (mon->count < mincount)
 			continue;
@@ -3701,20 +3935,36 @@ static void read_mru_list(
 			continue;
 		if (recent != 0 && countdown-- > recent)
 			continue;
-		send_mru_entry(mon, (int)count);
+		rows[nrows++] = *mon;
+	}
+	walked_all = (NULL == mon);
+	mon_unlock_all();
+
+	if (priors) {
+		/* confirm the prior entry used as starting point */
+		ctl_putts("last.older", &older.last);
+		pch = sockporttoa(&older.rmtadr);
+		ctl_putunqstr("addr.older", pch, strlen(pch));
+	}
+
+	/*
+	 * send up to limit= entries in up to frags= datagrams
+	 */
+	generate_nonce(rbufp, buf, sizeof(buf));
+	ctl_putunqstr("nonce", buf, strlen(buf));
+	for (count = 0; count < nrows && res_frags < frags; count++) {
+		send_mru_entry(&rows[count], (int)count);
 #ifdef USE_RANDOMIZE_RESPONSES
 		if (!count)
 			send_random_tag_value(0);
 #endif /* USE_RANDOMIZE_RESPONSES */
-		count++;
-		prior_mon = mon;
 	}
 
 	/*
 	 * If this batch completes the MRU list, say so explicitly with
 	 * a now= l_fp timestamp.
 	 */
-	if (NULL == mon) {
+	if (walked_all && count == nrows) {
 #ifdef USE_RANDOMIZE_RESPONSES
 		if (count > 1) {
 			send_random_tag_value((int)count - 1);
@@ -3722,9 +3972,370 @@ static void read_mru_list(
 #endif /* USE_RANDOMIZE_RESPONSES */
 		ctl_putts("now", &now);
 		/* if any entries were returned confirm the last */
-		if (prior_mon != NULL)
-			ctl_putts("last.newest", &prior_mon->last);
+		if (count > 0)
+			ctl_putts("last.newest", &rows[count - 1].last);
+	}
+	free(rows);
+	ctl_flushpkt(0);
+}
+
+/*
+ * Point-in-time copies of the MRU list for CTL_OP_READ_MRU_BIN, already
+ * packed as wire records, oldest first.  Each shard is copied under
+ * its own lock and the copies merged by last-seen time, so the rest of
+ * the monitor is never held off while one is taken.  Dumps starting within
+ * MRU_BIN_REUSE seconds of each other share one.  A snapshot stays
+ * until nobody has asked for it in MRU_BIN_IDLE seconds.  Requests
+ * carry no reader identity, and a client may fetch the last records
+ * again after a lost reply, so there is no telling when a dump is
+ * done with it.  A new dump never pulls one out from under another.
+ */
+struct mru_snapshot {
+	uint8_t *	recs;		/* NULL if the slot is free */
+	unsigned int	count;
+	uint32_t	id;
+	l_fp		taken;
+	uptime_t	built;		/* for reuse */
+	uptime_t	used;		/* last request, for expiry */
+};
+
+static struct mru_snapshot mru_snaps[MRU_BIN_SNAPS];
+
+static void
+put_u16(
+	uint8_t *	p,
+	uint16_t	v
+	)
+{
+	v = htons(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static void
+put_u32(
+	uint8_t *	p,
+	uint32_t	v
+	)
+{
+	v = htonl(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+/*
+ * Pack one MRU entry:
+ *
+ *	 0  family (4 or 6)	 1  mode and version
+ *	 2  restrict flags	 4  port
+ *	 6  reserved		 8  address, 16 octets
+ *	24  first (l_fp)	32  last (l_fp)
+ *	40  count		44  dropped
+ *	48  score (IEEE 754 single)
+ */
+static void
+pack_mru_entry(
+	uint8_t *		rec,
+	const mon_entry *	mon
+	)
+{
+	uint32_t	score;
+
+	memset(rec, 0, MRU_BIN_RECLEN);
+	if (IS_IPV6(&mon->rmtadr)) {
+		rec[0] = 6;
+		memcpy(rec + 8, NSRCADR6(&mon->rmtadr), 16);
+	} else {
+		rec[0] = 4;
+		memcpy(rec + 8, &NSRCADR(&mon->rmtadr), 4);
+	}
+	rec[1] = mon->vn_mode;
+	put_u16(rec + 2, mon->flags);
+	put_u16(rec + 4, SRCPORT(&mon->rmtadr));
+	put_u32(rec + 24, lfpuint(mon->first));
+	put_u32(rec + 28, lfpfrac(mon->first));
+	put_u32(rec + 32, lfpuint(mon->last));
+	put_u32(rec + 36, lfpfrac(mon->last));
+	put_u32(rec + 40, (uint32_t)mon->count);
+	put_u32(rec + 44, mon->dropped);
+	memcpy(&score, &mon->score, sizeof(score));
+	put_u32(rec + 48, score);
+}
+
+/*
+ * find_mru_snapshot - look up a snapshot by ID
+ */
+static struct mru_snapshot *
+find_mru_snapshot(
+	uint32_t	id
+	)
+{
+	for (unsigned int i = 0; i < COUNTOF(mru_snaps); i++)
+		if (NULL != mru_snaps[i].recs && id == mru_snaps[i].id)
+			return &mru_snaps[i];
+	return NULL;
+}
+
+/* entries copied out of the shards for a snapshot */
+struct mru_copy {
+	mon_entry *	rows;
+	size_t		count;
+	size_t		size;
+};
+
+static void
+copy_mru_entry(
+	const mon_entry *	mon,
+	void *			arg
+	)
+{
+	struct mru_copy *	copy = arg;
+
+	if (copy->count == copy->size) {
+		copy->size = copy->size ? 2 * copy->size : 64;
+		copy->rows = ereallocarray(copy->rows, copy->size,
+					   sizeof(*copy->rows));
+	}
+	copy->rows[copy->count++] = *mon;
+}
+
+/*
+ * take_mru_snapshot - copy the whole MRU list in one go, so the
+ * client pages through a list that holds still.
+ */
+static void
+take_mru_snapshot(
+	struct mru_snapshot *	snap
+	)
+{
+	struct mru_copy	copy = { NULL, 0, 0 };
+	size_t		next[MON_SHARDS];
+	size_t		end[MON_SHARDS];
+	unsigned int	pick;
+	uint32_t	id;
+
+	for (unsigned int i = 0; i < MON_SHARDS; i++) {
+		next[i] = copy.count;
+		mon_scan_shard(i, copy_mru_entry, &copy);
+		end[i] = copy.count;
+	}
+
+	/* each shard came oldest first, merge them */
+	snap->recs = emalloc((copy.count + 1) * MRU_BIN_RECLEN);
+	snap->count = 0;
+	for (;;) {
+		pick = MON_SHARDS;
+		for (unsigned int i = 0; i < MON_SHARDS; i++)
+			if (next[i] < end[i] &&
+			    (MON_SHARDS == pick ||
+			     copy.rows[next[i]].last <
+			     copy.rows[next[pick]].last))
+				pick = i;
+		if (MON_SHARDS == pick)
+			break;
+		pack_mru_entry(snap->recs +
+			       (size_t)snap->count * MRU_BIN_RECLEN,
+			       &copy.rows[next[pick]++]);
+		snap->count++;
+	}
+	free(copy.rows);
+	do {
+		id = (uint32_t)random();
+	} while (0 == id || NULL != find_mru_snapshot(id));
+	snap->id = id;
+	get_systime(&snap->taken);
+	snap->built = current_time;
+}
+
+/*
+ * get_mru_snapshot - snapshot for a new dump.  Share the newest one
+ * if it is recent, or if there is no room for another; otherwise
+ * take a new one.
+ */
+static struct mru_snapshot *
+get_mru_snapshot(void)
+{
+	struct mru_snapshot *	newest = NULL;
+	struct mru_snapshot *	spare = NULL;
+	struct mru_snapshot *	snap;
+
+	for (unsigned int i = 0; i < COUNTOF(mru_snaps); i++) {
+		snap = &mru_snaps[i];
+		if (NULL == snap->recs) {
+			if (NULL == spare)
+				spare = snap;
+		} else if (NULL == newest || snap->built > newest->built) {
+			newest = snap;
+		}
+	}
+	if (NULL != newest &&
+	    (NULL == spare || current_time - newest->built < MRU_BIN_REUSE))
+		snap = newest;
+	else {
+		snap = spare;
+		take_mru_snapshot(snap);
+	}
+	return snap;
+}
+
+static void
+free_mru_snapshot(
+	struct mru_snapshot *	snap
+	)
+{
+	free(snap->recs);
+	ZERO(*snap);
+}
+
+/*
+ * mru_snapshot_expire - called once a second from timer(), drops
+ * snapshots nobody has asked for in MRU_BIN_IDLE seconds.
+ */
+void
+mru_snapshot_expire(void)
+{
+	struct mru_snapshot *	snap;
+
+	for (unsigned int i = 0; i < COUNTOF(mru_snaps); i++) {
+		snap = &mru_snaps[i];
+		if (NULL == snap->recs)
+			continue;
+		if (current_time - snap->used >= MRU_BIN_IDLE)
+			free_mru_snapshot(snap);
+	}
+}
+
+/*
+ * read_mru_bin - bulk MRU export for ntpq mrulist on busy servers.
+ *
+ * The first request gets a snapshot of the MRU list, shared with any
+ * other dump started in the last MRU_BIN_REUSE seconds.  The client
+ * then pages through it by record index, so unlike CTL_OP_READ_MRU
+ * there is no chasing of entries that move while the list is read.
+ *
+ * input parameters:
+ *	nonce=		as for CTL_OP_READ_MRU, required on every request
+ *	frags=		limit on datagrams in response, default and
+ *			maximum MRU_FRAGS_LIMIT
+ *	snap=		snapshot ID from an earlier response, absent or
+ *			0 to start a new dump
+ *	cursor=		index of the first record wanted
+ *
+ * The response is binary: a MRU_BIN_HDRLEN header
+ *
+ *	 0  MRU_BIN_VERSION	 1  MRU_BIN_RECLEN
+ *	 2  reserved		 4  snapshot ID
+ *	 8  records in snapshot	12  index of first record here
+ *	16  records here	20  time of snapshot (l_fp)
+ *
+ * followed by that many records as packed by pack_mru_entry().  An
+ * unknown or expired snap= gets CERR_UNKNOWNVAR; start over.
+ */
+static void
+read_mru_bin(
+	struct recvbuf *rbufp,
+	int restrict_mask
+	)
+{
+	static const char	nulltxt[1] = 		{ '\0' };
+	static const char	nonce_text[] =		"nonce";
+	static const char	frags_text[] =		"frags";
+	static const char	snap_text[] =		"snap";
+	static const char	cursor_text[] =		"cursor";
+
+	struct ctl_var *	in_parms;
+	const struct ctl_var *	v;
+	const char *		val;
+	char *			pnonce;
+	unsigned short		frags;
+	struct mru_snapshot *	snap;
+	uint32_t		snapid;
+	unsigned int		cursor;
+	unsigned int		n;
+	uint8_t			hdr[MRU_BIN_HDRLEN];
+	bool			bad;
+
+	if (RES_NOMRULIST & restrict_mask) {
+		ctl_error(CERR_PERMISSION);
+		NLOG(NLOG_SYSINFO)
+			msyslog(LOG_NOTICE,
+				"MODE6: mrulist from %s rejected due to"
+                                " nomrulist restriction",
+				socktoa(&rbufp->recv_srcadr));
+		increment_restricted();
+		return;
+	}
+
+	in_parms = NULL;
+	set_var(&in_parms, nonce_text, sizeof(nonce_text), 0);
+	set_var(&in_parms, frags_text, sizeof(frags_text), 0);
+	set_var(&in_parms, snap_text, sizeof(snap_text), 0);
+	set_var(&in_parms, cursor_text, sizeof(cursor_text), 0);
+
+	pnonce = NULL;
+	frags = MRU_FRAGS_LIMIT;
+	snapid = 0;
+	cursor = 0;
+	bad = false;
+	while (!bad && NULL != (v = ctl_getitem(in_parms, (void*)&val)) &&
+	       !(EOV & v->flags)) {
+		if (NULL == val)
+			val = nulltxt;
+		if (!strcmp(nonce_text, v->text)) {
+			free(pnonce);
+			pnonce = (*val) ? estrdup(val) : NULL;
+		} else if (!strcmp(frags_text, v->text)) {
+			bad = (1 != sscanf(val, "%hu", &frags));
+		} else if (!strcmp(snap_text, v->text)) {
+			bad = (1 != sscanf(val, "%u", &snapid));
+		} else if (!strcmp(cursor_text, v->text)) {
+			bad = (1 != sscanf(val, "%u", &cursor));
+		}
+	}
+	free_varlist(in_parms);
+
+	/* return no responses until the nonce is validated */
+	if (NULL == pnonce)
+		return;
+	if (!validate_nonce(pnonce, rbufp)) {
+		free(pnonce);
+		return;
+	}
+	free(pnonce);
+
+	if (bad || 0 == frags || frags > MRU_FRAGS_LIMIT) {
+		ctl_error(CERR_BADVALUE);
+		return;
+	}
+	if (0 == snapid) {
+		snap = get_mru_snapshot();
+		cursor = 0;
+	} else if (NULL == (snap = find_mru_snapshot(snapid))) {
+		ctl_error(CERR_UNKNOWNVAR);
+		return;
+	}
+	if (cursor > snap->count) {
+		ctl_error(CERR_BADVALUE);
+		return;
 	}
+	snap->used = current_time;
+
+	n = ((unsigned int)frags * CTL_MAX_DATA_LEN - MRU_BIN_HDRLEN) /
+	    MRU_BIN_RECLEN;
+	n = min(n, snap->count - cursor);
+
+	memset(hdr, 0, sizeof(hdr));
+	hdr[0] = MRU_BIN_VERSION;
+	hdr[1] = MRU_BIN_RECLEN;
+	put_u32(hdr + 4, snap->id);
+	put_u32(hdr + 8, snap->count);
+	put_u32(hdr + 12, cursor);
+	put_u32(hdr + 16, n);
+	put_u32(hdr + 20, lfpuint(snap->taken));
+	put_u32(hdr + 24, lfpfrac(snap->taken));
+	ctl_putdata((const char *)hdr, sizeof(hdr), true);
+	if (n > 0)
+		ctl_putdata((const char *)snap->recs +
+			    (size_t)cursor * MRU_BIN_RECLEN,
+			    n * MRU_BIN_RECLEN, true);
 	ctl_flushpkt(0);
 }
 
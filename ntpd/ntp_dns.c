@@ -24,7 +24,11 @@
 
   This module also handles the start of NTS-KE.
 
-  Only one DNS/NTS lookup active at a time
+  Lookups run on a small pool of worker threads so a config file
+  with many servers doesn't have to wait for them one at a time.
+  At most dnsworkers lookups are in flight, and at most one per peer.
+  A worker puts each finished job on the done queue and raises
+  SIGDNS; dns_check() in the main thread empties the queue.
 
   peer->srcadr holds IPv4/IPv6/UNSPEC flag
   peer->hmode holds DNS retry time (log 2)
@@ -36,91 +40,153 @@
   Pool case makes new peer slots.
 */
 
-static struct peer* active = NULL;  /* busy flag */
-static pthread_t worker;
-static int gai_rc;
-static struct addrinfo *answer;
+#define DNS_WORKERS	4	/* default lookups in flight */
+#define DNS_WORKERS_MAX	32
 
-static void* dns_lookup(void* arg);
+struct dns_job {
+	struct dns_job *link;	/* todo or done queue */
+	struct peer *pp;	/* NULL if slot free */
+	int gai_rc;
+	struct addrinfo *answer;
+};
+
+/* Slots are only taken and freed by the main thread.
+ * The queues are shared with the workers, under dns_lock.
+ */
+static struct dns_job jobs[DNS_WORKERS_MAX];
+static unsigned int dns_workers = DNS_WORKERS;
+static unsigned int dns_inflight;	/* slots in use */
+static unsigned int dns_threads;	/* workers started */
+static pthread_mutex_t dns_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dns_cond = PTHREAD_COND_INITIALIZER;
+static DECL_FIFO_ANCHOR(struct dns_job) dns_todo;
+static DECL_FIFO_ANCHOR(struct dns_job) dns_done;
+
+static void* dns_worker(void* arg);
+static void dns_lookup(struct dns_job *job);
+static void dns_finish(struct dns_job *job);
+
+void dns_set_workers(int count)
+{
+	if (count < 1)
+		count = 1;
+	if (count > DNS_WORKERS_MAX)
+		count = DNS_WORKERS_MAX;
+	dns_workers = (unsigned int)count;
+	msyslog(LOG_INFO, "DNS: %d lookups in flight", count);
+}
+
+/* Enough workers that no queued job waits for one.
+ * They never exit; an idle one just sleeps on dns_cond.
+ */
+static bool dns_start_worker(void)
+{
+	pthread_t thread;
+	sigset_t block_mask, saved_sig_mask;
+	int rc;
+
+	sigfillset(&block_mask);
+	pthread_sigmask(SIG_BLOCK, &block_mask, &saved_sig_mask);
+	rc = pthread_create(&thread, NULL, dns_worker, NULL);
+	pthread_sigmask(SIG_SETMASK, &saved_sig_mask, NULL);
+	if (rc) {
+		msyslog(LOG_ERR, "DNS: dns_probe: error from pthread_create: %s",
+			strerror(rc));
+		return false;
+	}
+	pthread_detach(thread);
+	dns_threads++;
+	return true;
+}
 
 /* Initially, this was only used for DNS where pp=>hostname was valid.
  * With NTS, it also gets used for numerical IP Addresses.
+ *
+ * Returns false if all the slots are busy.
  */
 bool dns_probe(struct peer* pp)
 {
-	int rc;
-        sigset_t        block_mask, saved_sig_mask;
-	const char	* busy = "";
+	struct dns_job *job = NULL;
 	const char	*hostname = pp->hostname;
 
-	/* Comment out the next two lines to get (much) more
-	 * printout when we are busy.
-	 */
-        if (NULL != active)
+	for (unsigned int i = 0; i < COUNTOF(jobs); i++) {
+		if (pp == jobs[i].pp)
+			return true;	/* already on its way */
+		if (NULL == job && NULL == jobs[i].pp)
+			job = &jobs[i];
+	}
+	if (dns_inflight >= dns_workers)
 		return false;
 
-	if (NULL != active) {
-		busy = ", busy";
-	}
 	if (NULL == hostname) {
 		hostname = socktoa(&pp->srcadr);
 	}
 
-	msyslog(LOG_INFO, "DNS: dns_probe: %s, cast_flags:%x, flags:%x%s",
-		hostname, pp->cast_flags, pp->cfg.flags, busy);
-        if (NULL != active)	/* normally redundant */
-		return false;
+	msyslog(LOG_INFO, "DNS: dns_probe: %s, cast_flags:%x, flags:%x, %u busy",
+		hostname, pp->cast_flags, pp->cfg.flags, dns_inflight);
 
-	active = pp;
-
-        sigfillset(&block_mask);
-        pthread_sigmask(SIG_BLOCK, &block_mask, &saved_sig_mask);
-	rc = pthread_create(&worker, NULL, dns_lookup, pp);
-        if (rc) {
-	  msyslog(LOG_ERR, "DNS: dns_probe: error from pthread_create: %s, %s",
-	      hostname, strerror(rc));
-          pthread_sigmask(SIG_SETMASK, &saved_sig_mask, NULL);
-	  return true;  /* don't try again */
+	if (dns_threads <= dns_inflight && !dns_start_worker()) {
+		if (0 == dns_threads)
+			return true;  /* don't try again */
+		/* else the workers we have will get to it */
 	}
-        pthread_sigmask(SIG_SETMASK, &saved_sig_mask, NULL);
+
+	job->pp = pp;
+	job->gai_rc = 0;
+	job->answer = NULL;
+	dns_inflight++;
+
+	pthread_mutex_lock(&dns_lock);
+	LINK_FIFO(dns_todo, job, link);
+	pthread_cond_signal(&dns_cond);
+	pthread_mutex_unlock(&dns_lock);
 
 	return true;
 }
 
 void dns_check(void)
 {
-	int rc;
+	struct dns_job *job;
+
+	for (;;) {
+		pthread_mutex_lock(&dns_lock);
+		UNLINK_FIFO(job, dns_done, link);
+		pthread_mutex_unlock(&dns_lock);
+		if (NULL == job)
+			break;
+		dns_finish(job);
+		job->pp = NULL;
+		dns_inflight--;
+	}
+}
+
+static void dns_finish(struct dns_job *job)
+{
+	struct peer *pp = job->pp;
 	struct addrinfo *ai;
-	const char      *hostname = active->hostname;
+	const char      *hostname = pp->hostname;
 	DNS_Status status;
 
 	if (NULL == hostname) {
-		hostname = socktoa(&active->srcadr);
+		hostname = socktoa(&pp->srcadr);
 	}
 	msyslog(LOG_INFO, "DNS: dns_check: processing %s, %x, %x",
-		hostname, active->cast_flags, (unsigned int)active->cfg.flags);
-
-	rc = pthread_join(worker, NULL);
-	if (0 != rc) {
-		msyslog(LOG_ERR, "DNS: dns_check: join failed %s", strerror(rc));
-		return;  /* leaves active set */
-	}
+		hostname, pp->cast_flags, (unsigned int)pp->cfg.flags);
 
 #ifndef DISABLE_NTS
-	if (active->cfg.flags & FLAG_NTS) {
-		nts_check(active);
-		active = NULL;
+	if (pp->cfg.flags & FLAG_NTS) {
+		nts_check(pp);
 		return;
 	}
 #endif
 
-	if (0 != gai_rc) {
+	if (0 != job->gai_rc) {
 		msyslog(LOG_INFO, "DNS: dns_check: DNS error: %d, %s",
-			gai_rc, gai_strerror(gai_rc));
-		answer = NULL;
+			job->gai_rc, gai_strerror(job->gai_rc));
+		job->answer = NULL;
 	}
 
-	for (ai = answer; NULL != ai; ai = ai->ai_next) {
+	for (ai = job->answer; NULL != ai; ai = ai->ai_next) {
 		sockaddr_u sockaddr;
 		if (sizeof(sockaddr_u) < ai->ai_addrlen)
 			continue;  /* Weird */
@@ -128,13 +194,13 @@ void dns_check(void)
 		/* Both dns_take_pool and dns_take_server log something. */
 		// msyslog(LOG_INFO, "DNS: Take %s=>%s",
 		//		socktoa(ai->ai_addr), socktoa(&sockaddr));
-		if (active->cast_flags & MDF_POOL)
-			dns_take_pool(active, &sockaddr);
+		if (pp->cast_flags & MDF_POOL)
+			dns_take_pool(pp, &sockaddr);
 		else
-			dns_take_server(active, &sockaddr);
+			dns_take_server(pp, &sockaddr);
 	}
 
-	switch (gai_rc) {
+	switch (job->gai_rc) {
 		case 0:
 			status = DNS_good;
 			break;
@@ -150,27 +216,51 @@ void dns_check(void)
 			status = DNS_error;
 	}
 
-	dns_take_status(active, status);
+	dns_take_status(pp, status);
 
-	if (NULL != answer) {
-		freeaddrinfo(answer);
+	if (NULL != job->answer) {
+		freeaddrinfo(job->answer);
 	}
-	active = NULL;
 }
 
-/* Beware: no calls to msyslog from here.
- * It's not thread safe.
- * This is the only other thread in ntpd.
- */
-static void* dns_lookup(void* arg)
+static void* dns_worker(void* arg)
 {
-	struct peer *pp = (struct peer *) arg;
-	struct addrinfo hints;
+	struct dns_job *job;
 
+	UNUSED_ARG(arg);
 #ifdef HAVE_SECCOMP_H
         setup_SIGSYS_trap();      /* enable trap for this thread */
 #endif
 
+	for (;;) {
+		pthread_mutex_lock(&dns_lock);
+		while (NULL == HEAD_FIFO(dns_todo))
+			pthread_cond_wait(&dns_cond, &dns_lock);
+		UNLINK_FIFO(job, dns_todo, link);
+		pthread_mutex_unlock(&dns_lock);
+
+		dns_lookup(job);
+
+		pthread_mutex_lock(&dns_lock);
+		LINK_FIFO(dns_done, job, link);
+		pthread_mutex_unlock(&dns_lock);
+		kill(getpid(), SIGDNS);
+	}
+
+	/* Prevent compiler warning.
+	 * More portable than an attribute or directive
+	 */
+	return (void *)NULL;
+}
+
+/* Runs on a worker, so beware of the main thread's data.
+ * The peer is ours until dns_check() takes the job back.
+ */
+static void dns_lookup(struct dns_job *job)
+{
+	struct peer *pp = job->pp;
+	struct addrinfo hints;
+
 #ifdef HAVE_RES_INIT
 	/* Reload DNS servers from /etc/resolv.conf in case DHCP has updated it.
 	 * We only need to do this occasionally, but it's not expensive
@@ -190,15 +280,7 @@ static void* dns_lookup(void* arg)
 		hints.ai_protocol = IPPROTO_UDP;
 		hints.ai_socktype = SOCK_DGRAM;
 		hints.ai_family = AF(&pp->srcadr);
-		gai_rc = getaddrinfo(pp->hostname, NTP_PORTA, &hints, &answer);
+		job->gai_rc = getaddrinfo(pp->hostname, NTP_PORTA, &hints,
+					  &job->answer);
 	}
-
-	kill(getpid(), SIGDNS);
-	pthread_exit(NULL);
-
-	/* Prevent compiler warning.
-	 * More portable than an attribute or directive
-	 */
-	return (void *)NULL;
 }
-
@@ -12,11 +12,15 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "ntpd.h"
+#include "ntp_assert.h"
 #include "ntp_io.h"
 #include "ntp_calendar.h"
 #include "ntp_filegen.h"
@@ -40,9 +44,12 @@
 #define SUFFIX_SEP '.'
 
 static	void	filegen_open	(FILEGEN *, const time_t);
+static	FILE *	filegen_open_binary(FILEGEN *, const char *);
 static	int	valid_fileref	(const char *, const char *)
 			         __attribute__((pure));
 static	void	filegen_init	(const char *, const char *, FILEGEN *);
+static	void	filegen_reconfig(FILEGEN *, const char *, const char *,
+				 unsigned int, unsigned int);
 #ifdef	DEBUG
 static	void	filegen_uninit		(FILEGEN *);
 #endif	/* DEBUG */
@@ -66,6 +73,8 @@ filegen_init(
 	fgp->id_hi = 0;
 	fgp->type = FILEGEN_DAY;
 	fgp->flag = FGEN_FLAG_LINK; /* not yet enabled !!*/
+	fgp->cols = NULL;
+	fgp->reclen = 0;
 }
 
 
@@ -108,7 +117,8 @@ filegen_open(
 	filename = emalloc(len);
 	fullname = emalloc(len);
 	savename = NULL;
-	snprintf(filename, len, "%s%s", gen->dir, gen->fname);
+	snprintf(filename, len, "%s%s%s", gen->dir, gen->fname,
+		 (gen->flag & FGEN_FLAG_BINARY) ? ".bin" : "");
 
 	/* where to place suffix */
 	suflen = strlcpy(fullname, filename, len);
@@ -270,7 +280,10 @@ filegen_open(
 	DPRINT(4, ("opening filegen (type=%d/stamp=%lld) \"%s\"\n",
 		   gen->type, (long long)stamp, fullname));
 
-	fp = fopen(fullname, "a");
+	if (gen->flag & FGEN_FLAG_BINARY)
+		fp = filegen_open_binary(gen, fullname);
+	else
+		fp = fopen(fullname, "a");
 
 	if (NULL == fp)	{
 		/* open failed -- keep previous state
@@ -315,6 +328,173 @@ filegen_open(
 	return;
 }
 
+/*
+ * filegen_open_binary - open a binary generation file for appending,
+ * writing its header if it is new.  An existing file must have the
+ * same columns; a torn record at its end is cut off.
+ */
+static FILE *
+filegen_open_binary(
+	FILEGEN *	gen,
+	const char *	name
+	)
+{
+	uint8_t	want[FGEN_BIN_INDEX];
+	uint8_t	have[FGEN_BIN_HDRLEN];
+	const struct filegen_column *col;
+	struct stat st;
+	uint16_t off, ncols, used;
+	FILE *	fp;
+	int	fd;
+
+	memset(want, 0, sizeof(want));
+	memcpy(want, FGEN_BIN_MAGIC, 8);
+	ncols = 0;
+	off = 0;
+	for (col = gen->cols; col->name != NULL; col++) {
+		uint8_t *p = want + FGEN_BIN_COLUMNS + ncols * FGEN_BIN_COLLEN;
+
+		strlcpy((char *)p, col->name, 16);
+		p[16] = (uint8_t)off;
+		p[17] = (uint8_t)(off >> 8);
+		p[18] = (uint8_t)col->type;
+		p[19] = col->size;
+		off += col->size;
+		ncols++;
+	}
+	want[8] = FGEN_BIN_VERSION;
+	want[10] = (uint8_t)FGEN_BIN_HDRLEN;
+	want[11] = (uint8_t)(FGEN_BIN_HDRLEN >> 8);
+	want[12] = (uint8_t)gen->reclen;
+	want[13] = (uint8_t)(gen->reclen >> 8);
+	want[14] = (uint8_t)ncols;
+	want[16] = (uint8_t)FGEN_BIN_DAYS;
+	want[17] = (uint8_t)(FGEN_BIN_DAYS >> 8);
+
+	fd = open(name, O_RDWR | O_CREAT, 0666);
+	if (fd < 0)
+		return NULL;
+	fp = fdopen(fd, "r+b");
+	if (NULL == fp) {
+		close(fd);
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0)
+		goto fail;
+
+	if (0 == st.st_size) {
+		memset(have, 0, sizeof(have));
+		memcpy(have, want, sizeof(want));
+		if (fwrite(have, sizeof(have), 1, fp) != 1)
+			goto fail;
+		gen->ndays = 0;
+		gen->lastday = 0;
+		gen->nrec = 0;
+		return fp;
+	}
+
+	/* the index entries used may differ, nothing else */
+	if (st.st_size < FGEN_BIN_HDRLEN
+	    || fread(have, sizeof(have), 1, fp) != 1
+	    || memcmp(have, want, FGEN_BIN_USED) != 0
+	    || memcmp(have + FGEN_BIN_USED + 2, want + FGEN_BIN_USED + 2,
+		      sizeof(want) - FGEN_BIN_USED - 2) != 0) {
+		msyslog(LOG_ERR, "LOG: %s is not a matching binary stats file",
+			name);
+		fclose(fp);
+		errno = EINVAL;
+		return NULL;
+	}
+	used = (uint16_t)(have[FGEN_BIN_USED] | have[FGEN_BIN_USED + 1] << 8);
+	if (used > FGEN_BIN_DAYS)
+		used = FGEN_BIN_DAYS;
+	gen->ndays = used;
+	gen->lastday = 0;
+	if (used > 0) {
+		const uint8_t *e = have + FGEN_BIN_INDEX + (used - 1) * 8;
+
+		gen->lastday = (uint32_t)e[0] | (uint32_t)e[1] << 8 |
+			       (uint32_t)e[2] << 16 | (uint32_t)e[3] << 24;
+	}
+	gen->nrec = (uint32_t)((st.st_size - FGEN_BIN_HDRLEN) / gen->reclen);
+	if ((st.st_size - FGEN_BIN_HDRLEN) % gen->reclen != 0 &&
+	    ftruncate(fd, FGEN_BIN_HDRLEN +
+		      (off_t)gen->nrec * gen->reclen) != 0)
+		goto fail;
+	if (fseek(fp, 0, SEEK_END) != 0)
+		goto fail;
+	return fp;
+
+    fail:
+	fclose(fp);
+	return NULL;
+}
+
+
+/*
+ * filegen_layout - give gen a binary record format
+ */
+void
+filegen_layout(
+	FILEGEN *	gen,
+	const struct filegen_column *cols
+	)
+{
+	const struct filegen_column *col;
+
+	gen->cols = cols;
+	gen->reclen = 0;
+	for (col = cols; col->name != NULL; col++)
+		gen->reclen += col->size;
+	INSIST(col - cols <= FGEN_BIN_MAXCOLS);
+}
+
+
+/*
+ * filegen_write_binary - append one record to the binary file opened
+ * by filegen_setup(), starting a day index entry if it is the first
+ * record of a new day.  stamp is the record time.
+ */
+bool
+filegen_write_binary(
+	FILEGEN *	gen,
+	time_t		stamp,
+	const void *	rec,
+	size_t		len
+	)
+{
+	uint32_t day = (uint32_t)(stamp / SECSPERDAY);
+
+	if (NULL == gen->fp || !(gen->flag & FGEN_FLAG_BINARY)
+	    || len != gen->reclen)
+		return false;
+
+	if ((0 == gen->ndays || day != gen->lastday)
+	    && gen->ndays < FGEN_BIN_DAYS) {
+		uint8_t entry[8];
+		uint8_t used[2];
+		bool ok;
+
+		fgen_put_u32(fgen_put_u32(entry, day), gen->nrec);
+		used[0] = (uint8_t)(gen->ndays + 1);
+		used[1] = (uint8_t)((gen->ndays + 1) >> 8);
+		ok = fseek(gen->fp, FGEN_BIN_INDEX + gen->ndays * 8,
+			   SEEK_SET) == 0
+		     && fwrite(entry, sizeof(entry), 1, gen->fp) == 1
+		     && fseek(gen->fp, FGEN_BIN_USED, SEEK_SET) == 0
+		     && fwrite(used, sizeof(used), 1, gen->fp) == 1;
+		if (fseek(gen->fp, 0, SEEK_END) != 0 || !ok)
+			return false;
+		gen->ndays++;
+		gen->lastday = day;
+	}
+
+	if (fwrite(rec, len, 1, gen->fp) != 1)
+		return false;
+	gen->nrec++;
+	return true;
+}
+
 /*
  * this function sets up gen->fp to point to the correct
  * generation of the file for the time specified by 'now'
@@ -371,6 +551,26 @@ filegen_setup(
 }
 
 
+/*
+ * The statistics writer thread opens, rotates and writes the files;
+ * the main thread only changes their settings.  filegen_lock()
+ * covers both.
+ */
+static pthread_mutex_t filegen_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void
+filegen_lock(void)
+{
+	pthread_mutex_lock(&filegen_mutex);
+}
+
+void
+filegen_unlock(void)
+{
+	pthread_mutex_unlock(&filegen_mutex);
+}
+
+
 /*
  * change settings for filegen files
  */
@@ -382,6 +582,21 @@ filegen_config(
 	unsigned int	type,
 	unsigned int	flag
 	)
+{
+	filegen_lock();
+	filegen_reconfig(gen, dir, fname, type, flag);
+	filegen_unlock();
+}
+
+
+static void
+filegen_reconfig(
+	FILEGEN *	gen,
+	const char *	dir,
+	const char *	fname,
+	unsigned int	type,
+	unsigned int	flag
+	)
 {
 	bool file_existed;
 
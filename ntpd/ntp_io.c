@@ -11,6 +11,7 @@
 # define FNM_CASEFOLD FNM_IGNORECASE
 #endif
 #include <sys/uio.h>
+#include <pthread.h>
 
 #include "ntp_machine.h"
 #include "ntpd.h"
@@ -25,6 +26,17 @@
 #include "isc_interfaceiter.h"
 #include "isc_netaddr.h"
 
+#ifdef USE_EPOLL
+# include <sys/epoll.h>
+# include <sys/signalfd.h>
+#endif
+
+#if defined(USE_EPOLL) && defined(HAVE_EVENTFD) && \
+    defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(SO_REUSEPORT)
+# define USE_WORKERS
+# include <sys/eventfd.h>
+#endif
+
 #ifdef HAVE_NET_ROUTE_H
 # define USE_ROUTING_SOCKET
 # include <net/route.h>
@@ -96,10 +108,53 @@ struct packet_counters {
 	/* It's not needed now that the kernel time stamps packets. */
 	uint64_t handler_calls;	/* number of calls to interrupt handler */
 	uint64_t handler_pkts;	/* number of pkts received by handler */
+	uint64_t rbatches;	/* recvmmsg() calls that returned data */
+	uint64_t rbatch_pkts;	/* packets received by those calls */
+	/* rbatch_hist[n] counts batches of 2^n to 2^(n+1)-1 packets */
+	uint64_t rbatch_hist[RECV_BATCH_BUCKETS];
+	uint64_t xbatches;	/* sendmmsg() queue flushes */
+	uint64_t xbatch_pkts;	/* packets sent by those flushes */
 	uptime_t io_timereset;	/* time counters were reset */
 };
 volatile struct packet_counters pkt_count;
 
+/*
+ * Batched receive.  When recv_batch is more than 1 and the system
+ * has recvmmsg(), up to recv_batch datagrams are read from a socket
+ * with a single system call.  Each datagram still gets its own
+ * recvbuf and its own control buffer, so kernel receive timestamps
+ * stay per packet.
+ */
+#define RECV_BATCH_MAX	64	/* largest recvbatch we accept */
+static unsigned int recv_batch = 1;	/* datagrams per read, 1 = none */
+
+/*
+ * Batched transmit.  While a receive batch is being processed,
+ * replies handed to queuepkt() are held and then sent with a single
+ * sendmmsg() at the end of the batch, or as soon as send_batch of
+ * them are waiting.  All replies in the queue leave through the
+ * same endpoint; a reply for another one flushes the queue first.
+ */
+#define SEND_BATCH_MAX	RECV_BATCH_MAX
+static unsigned int send_batch = 16;	/* flush threshold, 1 = none */
+static bool	xmit_deferred;		/* inside a receive batch */
+struct xmit_queue {
+	SOCKET		fd;		/* where the queue goes out */
+	endpt *		ep;		/* and whose counters it bumps */
+	unsigned int	count;		/* packets waiting */
+	struct pkt *	pkt;		/* send_batch slots, on demand */
+	sockaddr_u	dest[SEND_BATCH_MAX];
+	unsigned int	len[SEND_BATCH_MAX];
+};
+static struct xmit_queue xmitq;		/* the main thread's */
+
+/* Space for the receive time stamp plus overhead */
+#define RECV_CONTROL_SIZE	100
+union recv_control {
+	struct cmsghdr	align;	/* keep each slot cmsg aligned */
+	char		buf[RECV_CONTROL_SIZE];
+};
+
 /*
  * Interface stuff
  */
@@ -107,6 +162,7 @@ struct ntp_io_data io_data;
 static int ninterfaces;			/* total # of interfaces */
 
 extern  SOCKET  open_socket     (sockaddr_u *, bool, endpt *);
+static	SOCKET	open_bound_socket (sockaddr_u *, bool, endpt *);
 
 static bool
 netaddr_eqprefix(const isc_netaddr_t *, const isc_netaddr_t *,
@@ -172,11 +228,16 @@ static void print_interface	(const endpt *, const char *, const char *);
 
 typedef struct vsock vsock_t;
 enum desc_type { FD_TYPE_SOCKET, FD_TYPE_FILE };
+/* what is read from a descriptor, for dispatch without list walks */
+enum desc_use { FD_USE_ENDPT, FD_USE_REFCLOCK, FD_USE_ASYNCIO,
+		FD_USE_SIGNAL, FD_USE_TIMER, FD_USE_HANDOFF };
 
 struct vsock {
 	vsock_t	*	link;
 	SOCKET		fd;
 	enum desc_type	type;
+	enum desc_use	use;
+	void *		owner;	/* endpt, refclockio or asyncio_reader */
 };
 
 static vsock_t	*fd_list;
@@ -227,7 +288,8 @@ static endpt *	wildipv6;
 
 static const int accept_wildcard_if_for_winnt = false;
 
-static void	add_fd_to_list		(SOCKET, enum desc_type);
+static void	add_fd_to_list		(SOCKET, enum desc_type,
+					 enum desc_use, void *);
 static endpt *	find_addr_in_list	(sockaddr_u *);
 static void	delete_interface_from_list(endpt *);
 static void	close_and_delete_fd_from_list(SOCKET);
@@ -248,14 +310,110 @@ static void		calc_addr_distance(sockaddr_u *,
 static int		cmp_addr_distance(const sockaddr_u *,
 					  const sockaddr_u *);
 static void		maintain_activefds(int fd, bool closing);
+static void		watch_fd	(vsock_t *);
+static void		unwatch_fd	(SOCKET);
+
+#ifdef USE_EPOLL
+/*
+ * epoll() event loop.  Each descriptor is registered with its vsock
+ * as the event data, so a ready descriptor goes straight to its
+ * endpt, refclock or reader.  Signals stay blocked and are taken from
+ * a signalfd in the same wait, as is the timer tick when ntp_timer.c
+ * gets a timerfd.  If any of this can't be set up we fall back to
+ * pselect().
+ */
+#define EPOLL_MAX_EVENTS	64
+static int	epoll_fd = -1;
+static vsock_t	signal_vsock = { NULL, -1, FD_TYPE_FILE, FD_USE_SIGNAL, NULL };
+static vsock_t	timer_vsock = { NULL, -1, FD_TYPE_FILE, FD_USE_TIMER, NULL };
+static struct epoll_event ready_events[EPOLL_MAX_EVENTS];
+static int	ready_count;	/* events in the batch being dispatched */
+
+static void	init_event_loop	(void);
+static void	epoll_handler	(void);
+static void	read_signalfd	(int);
+#endif
+
+#ifdef USE_WORKERS
+/*
+ * Server workers.  With serverworkers N, every endpoint socket is
+ * opened with SO_REUSEPORT and each of N threads gets a socket of its
+ * own bound to the same address, so the kernel spreads the incoming
+ * load.  A worker answers client (mode 3) requests end to end and
+ * hands everything else to the main thread through handoff_fifo, so
+ * associations are only ever touched by the main thread.
+ *
+ * A client request takes no lock held by the main thread.  What the
+ * workers share with it has its own guard: restrictions are behind a
+ * read-write lock, the MRU list is sharded, the system variables come
+ * from the reply template, keys don't change once the workers run,
+ * MAC and NTS contexts are per thread and the statistics counters are
+ * bumped atomically.  Requests for Samba's signing daemon block, so
+ * they go to the main thread with everything else.
+ *
+ * wsock_lock keeps the worker sockets alive: a worker holds it for
+ * reading while it works on a batch, and the main thread takes it for
+ * writing to close the sockets of a departing endpoint.
+ */
+typedef struct wsock wsock_t;
+struct wsock {
+	wsock_t *		link;
+	SOCKET			fd;
+	endpt *			ep;	/* endpoint it mirrors */
+	struct server_worker *	worker;	/* thread it belongs to */
+};
+
+struct server_worker {
+	pthread_t		tid;
+	int			epfd;	/* its own epoll set */
+	unsigned int		batch;	/* datagrams per read */
+	recvbuf_list_t		rbufs;	/* its own free buffers */
+	struct xmit_queue	xmitq;	/* replies for one batch */
+	uint64_t		served;	/* client requests answered */
+	uint64_t		handoffs; /* packets given to the main thread */
+};
+
+static unsigned int		server_workers;	/* threads configured, then running */
+static struct server_worker *	workers;
+static bool			workers_running;
+static pthread_rwlock_t		wsock_lock;
+static unsigned long		wsock_gen;	/* bumped when sockets close */
+static wsock_t *		wsock_list;	/* main thread only */
+
+static pthread_mutex_t		handoff_lock = PTHREAD_MUTEX_INITIALIZER;
+static DECL_FIFO_ANCHOR(recvbuf_t) handoff_fifo;
+static unsigned int		handoff_count;
+static vsock_t	handoff_vsock = { NULL, -1, FD_TYPE_FILE, FD_USE_HANDOFF, NULL };
+
+static void *	worker_main		(void *);
+static int	worker_read		(struct server_worker *, wsock_t *);
+static void	worker_handoff		(struct server_worker *,
+					 struct recvbuf *);
+static void	drain_handoff		(void);
+static void	open_worker_sockets	(sockaddr_u *, bool, endpt *);
+static void	close_worker_sockets	(endpt *);
+static void	drop_workers		(unsigned int);
+#endif /* USE_WORKERS */
 
 /*
  * Routines to read the ntp packets
  */
 static int	read_network_packet	(SOCKET, endpt *);
+static void	deliver_network_packet	(SOCKET, endpt *, struct recvbuf *,
+					 struct msghdr *);
+#ifdef HAVE_RECVMMSG
+static int	read_network_batch	(SOCKET, endpt *, struct recvbuf *);
+#endif
+#ifdef HAVE_SENDMMSG
+static void	enqueue_xmit		(struct xmit_queue *, SOCKET, endpt *,
+					 sockaddr_u *, void *, unsigned int);
+static unsigned int send_xmit_queue	(struct xmit_queue *, unsigned int *);
+static void	flush_xmit_queue	(struct xmit_queue *);
+#endif
 static void input_handler (fd_set *);
 #ifdef REFCLOCK
 static int	read_refclock_packet	(SOCKET, struct refclockio *);
+static void	input_refclock		(struct refclockio *);
 #endif
 
 /*
@@ -353,7 +511,88 @@ init_io(void)
 	sigaddset(&blockMask, SIGTERM);
 	sigaddset(&blockMask, SIGHUP);
 
+#ifdef USE_EPOLL
+	init_event_loop();
+#endif
+}
+
+
+#ifdef USE_EPOLL
+/*
+ * init_event_loop - switch the I/O loop over to epoll()
+ */
+static void
+init_event_loop(void)
+{
+	sigset_t		sigs;
+	struct epoll_event	ev;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		msyslog(LOG_WARNING, "INIT: epoll_create1() failed: %s, using pselect()",
+			strerror(errno));
+		return;
+	}
+
+	sigs = blockMask;
+	sigaddset(&sigs, SIGDNS);
+	signal_vsock.fd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+	ZERO(ev);
+	ev.events = EPOLLIN;
+	ev.data.ptr = &signal_vsock;
+	if (signal_vsock.fd < 0 ||
+	    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_vsock.fd, &ev) < 0) {
+		msyslog(LOG_WARNING, "INIT: signalfd setup failed: %s, using pselect()",
+			strerror(errno));
+		if (signal_vsock.fd >= 0)
+			close(signal_vsock.fd);
+		signal_vsock.fd = -1;
+		close(epoll_fd);
+		epoll_fd = -1;
+		return;
+	}
+
+	/* From here on these signals are only taken from the signalfd */
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+	msyslog(LOG_INFO, "INIT: Using epoll() event loop");
+}
+
+
+/*
+ * io_watch_timer - have the event loop read the timer tick from fd
+ *
+ * Returns false when there is no event loop to hand it to.
+ */
+bool
+io_watch_timer(
+	int fd
+	)
+{
+	struct epoll_event ev;
+
+	if (epoll_fd < 0)
+		return false;
+	ZERO(ev);
+	ev.events = EPOLLIN;
+	ev.data.ptr = &timer_vsock;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		msyslog(LOG_ERR, "IO: epoll_ctl(ADD) of timer fd %d failed: %s",
+			fd, strerror(errno));
+		return false;
+	}
+	timer_vsock.fd = fd;
+	return true;
+}
+#else
+bool
+io_watch_timer(
+	int fd
+	)
+{
+	UNUSED_ARG(fd);
+	return false;
 }
+#endif /* USE_EPOLL */
 
 
 /*
@@ -493,7 +732,7 @@ add_asyncio_reader(
 	enum desc_type		type)
 {
 	LINK_SLIST(asyncio_reader_list, reader, link);
-	add_fd_to_list(reader->fd, type);
+	add_fd_to_list(reader->fd, type, FD_USE_ASYNCIO, reader);
 }
 
 /*
@@ -789,6 +1028,9 @@ remove_interface(
 			ep->sent,
 			ep->notsent,
 			current_time - ep->starttime);
+#ifdef USE_WORKERS
+		close_worker_sockets(ep);
+#endif
 		close_and_delete_fd_from_list(ep->fd);
 		ep->fd = INVALID_SOCKET;
 	}
@@ -1225,6 +1467,9 @@ refresh_interface(
 {
 #ifdef  OS_MISSES_SPECIFIC_ROUTE_UPDATES
 	if (interface->fd != INVALID_SOCKET) {
+#ifdef USE_WORKERS
+		close_worker_sockets(interface);
+#endif
 		close_and_delete_fd_from_list(interface->fd);
 
 		/* create new socket picking up a new first hop binding
@@ -1841,6 +2086,38 @@ open_socket(
 	)
 {
 	SOCKET	fd;
+
+	fd = open_bound_socket(addr, turn_off_reuse, interf);
+	if (INVALID_SOCKET == fd)
+		return fd;
+
+	add_fd_to_list(fd, FD_TYPE_SOCKET, FD_USE_ENDPT, interf);
+
+#ifdef F_GETFL
+	/* F_GETFL may not be defined if the underlying OS isn't really Unix */
+	DPRINT(4, ("flags for fd %d: 0x%x\n", fd,
+		   (unsigned)fcntl(fd, F_GETFL, 0)));
+#endif
+
+#ifdef USE_WORKERS
+	open_worker_sockets(addr, turn_off_reuse, interf);
+#endif
+
+	return fd;
+}
+
+
+/*
+ * open_bound_socket - create, set up and bind a nonblocking socket
+ */
+static SOCKET
+open_bound_socket(
+	sockaddr_u *	addr,
+	bool		turn_off_reuse,
+	endpt *		interf
+	)
+{
+	SOCKET	fd;
 	int	errval;
 	/*
 	 * int is OK for REUSEADR per
@@ -1899,6 +2176,17 @@ open_socket(
 		close(fd);
 		return INVALID_SOCKET;
 	}
+#ifdef USE_WORKERS
+	/* the server workers bind their own sockets to the same address */
+	if (server_workers > 0 &&
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))) {
+		msyslog(LOG_ERR,
+			"IO: setsockopt SO_REUSEPORT fails for address %s: %s",
+			socktoa(addr), strerror(errno));
+		close(fd);
+		return INVALID_SOCKET;
+	}
+#endif
 #ifdef SO_EXCLUSIVEADDRUSE
 	/*
 	 * setting SO_EXCLUSIVEADDRUSE on the wildcard we open
@@ -1988,14 +2276,6 @@ open_socket(
 
 	make_socket_nonblocking(fd);
 
-	add_fd_to_list(fd, FD_TYPE_SOCKET);
-
-#ifdef F_GETFL
-	/* F_GETFL may not be defined if the underlying OS isn't really Unix */
-	DPRINT(4, ("flags for fd %d: 0x%x\n", fd,
-		   (unsigned)fcntl(fd, F_GETFL, 0)));
-#endif
-
 	return fd;
 }
 
@@ -2034,15 +2314,162 @@ sendpkt(
 	cc = sendto(src->fd, pkt, (unsigned int)len, 0,
 		    &dest->sa, SOCKLEN(dest));
 	if (cc == -1) {
-		src->notsent++;
-		pkt_count.notsent++;
+		COUNT_INC(src->notsent);
+		COUNT_INC(pkt_count.notsent);
 	} else	{
-		src->sent++;
-		pkt_count.sent++;
+		COUNT_INC(src->sent);
+		COUNT_INC(pkt_count.sent);
+	}
+}
+
+
+
+/*
+ * queuepkt - send the reply to rbufp.  Inside a batched receive the
+ * packet is queued and goes out with the rest of the batch's
+ * replies; everywhere else this is just sendpkt().  Replies to
+ * packets a server worker read always go on that worker's queue.
+ */
+void
+queuepkt(
+	struct recvbuf *	rbufp,
+	void *			pkt,
+	unsigned int		len
+	)
+{
+	sockaddr_u *	dest = &rbufp->recv_srcadr;
+	endpt *		src = rbufp->dstadr;
+
+#ifdef USE_WORKERS
+	/* One reply per request, so a batch never overflows */
+	if (NULL != rbufp->worker && len <= sizeof(struct pkt)) {
+		enqueue_xmit(&rbufp->worker->xmitq, rbufp->fd, src,
+			     dest, pkt, len);
+		return;
+	}
+#endif
+#ifdef HAVE_SENDMMSG
+	if (xmit_deferred && send_batch > 1 && NULL != src
+	    && len <= sizeof(struct pkt)) {
+		if (NULL == xmitq.pkt)
+			xmitq.pkt = eallocarray(send_batch,
+						sizeof(*xmitq.pkt));
+		if (xmitq.count > 0 && xmitq.ep != src)
+			flush_xmit_queue(&xmitq);
+		enqueue_xmit(&xmitq, src->fd, src, dest, pkt, len);
+		if (xmitq.count >= send_batch)
+			flush_xmit_queue(&xmitq);
+		return;
+	}
+#endif
+	sendpkt(dest, src, pkt, len);
+}
+
+
+#ifdef HAVE_SENDMMSG
+/*
+ * enqueue_xmit - add a packet to a transmit queue
+ */
+static void
+enqueue_xmit(
+	struct xmit_queue *	q,
+	SOCKET			fd,
+	endpt *			ep,
+	sockaddr_u *		dest,
+	void *			pkt,
+	unsigned int		len
+	)
+{
+	unsigned int	slot = q->count++;
+
+	q->fd = fd;
+	q->ep = ep;
+	q->dest[slot] = *dest;
+	q->len[slot] = len;
+	memcpy(&q->pkt[slot], pkt, len);
+	DPRINT(2, ("queuepkt(%d, dst=%s, src=%s, len=%u) slot %u\n",
+		   fd, socktoa(dest), socktoa(&ep->sin), len, slot));
+}
+
+
+/*
+ * send_xmit_queue - send everything on a transmit queue and empty it.
+ * Returns the number sent, the number that failed goes in *notsent.
+ *
+ * sendmmsg() stops at the first message that fails, so keep going
+ * from there; a call that fails outright has failed on exactly one
+ * message.  That keeps the sent/notsent counters exact.
+ */
+static unsigned int
+send_xmit_queue(
+	struct xmit_queue *	q,
+	unsigned int *		notsent
+	)
+{
+	struct mmsghdr	msgs[SEND_BATCH_MAX];
+	struct iovec	iovecs[SEND_BATCH_MAX];
+	unsigned int	i, done, sent;
+	int		cc;
+
+	*notsent = 0;
+	if (0 == q->count)
+		return 0;
+
+	memset(msgs, '\0', q->count * sizeof(msgs[0]));
+	for (i = 0; i < q->count; i++) {
+		iovecs[i].iov_base = &q->pkt[i];
+		iovecs[i].iov_len = q->len[i];
+		msgs[i].msg_hdr.msg_name = &q->dest[i].sa;
+		msgs[i].msg_hdr.msg_namelen = SOCKLEN(&q->dest[i]);
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	DPRINT(2, ("flush_xmit_queue(%d, src=%s, count=%u)\n",
+		   q->fd, socktoa(&q->ep->sin), q->count));
+
+	sent = 0;
+	for (done = 0; done < q->count; ) {
+		cc = sendmmsg(q->fd, &msgs[done], q->count - done, 0);
+		if (cc < 0 && EINTR == errno)
+			continue;
+		if (cc <= 0) {
+			(*notsent)++;
+			done++;
+		} else {
+			sent += (unsigned int)cc;
+			done += (unsigned int)cc;
+		}
 	}
+	q->count = 0;
+	return sent;
 }
 
 
+/*
+ * flush_xmit_queue - send a queue and account for it
+ */
+static void
+flush_xmit_queue(
+	struct xmit_queue *	q
+	)
+{
+	endpt *		ep = q->ep;
+	unsigned int	count = q->count;
+	unsigned int	sent, notsent;
+
+	if (0 == count)
+		return;
+	sent = send_xmit_queue(q, &notsent);
+	COUNT_ADD(ep->sent, (long)sent);
+	COUNT_ADD(ep->notsent, (long)notsent);
+	COUNT_ADD(pkt_count.sent, sent);
+	COUNT_ADD(pkt_count.notsent, notsent);
+	COUNT_INC(pkt_count.xbatches);
+	COUNT_ADD(pkt_count.xbatch_pkts, count);
+}
+#endif /* HAVE_SENDMMSG */
+
 
 #ifdef REFCLOCK
 /*
@@ -2080,7 +2507,7 @@ read_refclock_packet(
 		char buf[RX_BUFF_SIZE];
 
 		buflen = read(fd, buf, sizeof buf);
-		pkt_count.dropped++;
+		COUNT_INC(pkt_count.dropped);
 		return (buflen);
 	}
 
@@ -2113,7 +2540,7 @@ read_refclock_packet(
 	if (!consumed) {
 		rp->recvcount++;
 		// FIXME: should have separate slot for refclock packets
-		pkt_count.received++;
+		COUNT_INC(pkt_count.received);
 	}
 
 	return (int)buflen;
@@ -2136,7 +2563,7 @@ read_network_packet(
 	struct recvbuf *rb;
 	struct msghdr msghdr;
 	struct iovec iovec;
-	char control[100];   /* FIXME: Need space for time stamp plus overhead */
+	union recv_control control;
 
 	/*
 	 * Get a buffer and read the frame.  If we
@@ -2163,12 +2590,17 @@ read_network_packet(
 			    : "drop",
 			free_recvbuffs(), fd, socktoa(&from)));
 		if (itf->ignore_packets)
-			pkt_count.ignored++;
+			COUNT_INC(pkt_count.ignored);
 		else
-			pkt_count.dropped++;
+			COUNT_INC(pkt_count.dropped);
 		return (buflen);
 	}
 
+#ifdef HAVE_RECVMMSG
+	if (recv_batch > 1)
+		return read_network_batch(fd, itf, rb);
+#endif
+
 	fromlen = sizeof(rb->recv_srcadr);
 
 	iovec.iov_base        = &rb->recv_buffer;
@@ -2179,8 +2611,8 @@ read_network_packet(
 	msghdr.msg_iov        = &iovec;
 	msghdr.msg_iovlen     = 1;
 	msghdr.msg_flags      = 0;
-	msghdr.msg_control    = (void *)&control;
-	msghdr.msg_controllen = sizeof(control);
+	msghdr.msg_control    = (void *)&control.buf;
+	msghdr.msg_controllen = sizeof(control.buf);
 	buflen                = recvmsg(fd, &msghdr, 0);
 
 	rb->recv_length = (size_t)buflen;
@@ -2203,6 +2635,112 @@ read_network_packet(
 	DPRINT(3, ("read_network_packet: fd=%d length %d from %s\n",
 		   fd, (int)buflen, socktoa(&rb->recv_srcadr)));
 
+	deliver_network_packet(fd, itf, rb, &msghdr);
+	return (buflen);
+}
+
+#ifdef HAVE_RECVMMSG
+/*
+ * Routine to read a batch of network NTP packets for a specific
+ * interface with one recvmmsg() call.  rb is the first buffer of
+ * the batch; as many more as are free (up to recv_batch) are added.
+ * Return the number of packets read, or 0 if the batch came back
+ * short, which means the socket has been drained.
+ */
+static int
+read_network_batch(
+	SOCKET			fd,
+	endpt *			itf,
+	struct recvbuf *	rb
+	)
+{
+	struct recvbuf *	rbs[RECV_BATCH_MAX];
+	struct mmsghdr		msgs[RECV_BATCH_MAX];
+	struct iovec		iovecs[RECV_BATCH_MAX];
+	union recv_control	control[RECV_BATCH_MAX];
+	unsigned int		want, got, i;
+	int			nmsgs, bucket;
+
+	want = min(recv_batch, RECV_BATCH_MAX);
+	rbs[0] = rb;
+	for (got = 1; got < want; got++) {
+		rbs[got] = get_free_recv_buffer();
+		if (NULL == rbs[got])
+			break;
+	}
+
+	memset(msgs, '\0', got * sizeof(msgs[0]));
+	for (i = 0; i < got; i++) {
+		iovecs[i].iov_base = &rbs[i]->recv_buffer;
+		iovecs[i].iov_len = sizeof(rbs[i]->recv_buffer);
+		msgs[i].msg_hdr.msg_name = &rbs[i]->recv_srcadr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(rbs[i]->recv_srcadr);
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = (void *)&control[i].buf;
+		msgs[i].msg_hdr.msg_controllen = sizeof(control[i].buf);
+	}
+
+	nmsgs = recvmmsg(fd, msgs, got, 0, NULL);
+	if (nmsgs <= 0) {
+		if (nmsgs < 0 && EWOULDBLOCK != errno && EAGAIN != errno) {
+			msyslog(LOG_ERR, "IO: recvmmsg() fd=%d: %s",
+				fd, strerror(errno));
+			DPRINT(5, ("read_network_batch: fd=%d dropped (bad recvmmsg)\n",
+				   fd));
+		}
+		for (i = 0; i < got; i++)
+			freerecvbuf(rbs[i]);
+		return nmsgs;
+	}
+
+	COUNT_INC(pkt_count.rbatches);
+	COUNT_ADD(pkt_count.rbatch_pkts, (unsigned int)nmsgs);
+	for (bucket = 0; (nmsgs >> (bucket + 1)) != 0
+		     && bucket < RECV_BATCH_BUCKETS - 1; bucket++)
+		continue;
+	COUNT_INC(pkt_count.rbatch_hist[bucket]);
+
+	DPRINT(3, ("read_network_batch: fd=%d %d of %u packets\n",
+		   fd, nmsgs, got));
+
+	/* Give back what the kernel didn't fill before working */
+	for (i = (unsigned int)nmsgs; i < got; i++)
+		freerecvbuf(rbs[i]);
+
+	xmit_deferred = true;
+	for (i = 0; i < (unsigned int)nmsgs; i++) {
+		if (0 == msgs[i].msg_len) {
+			freerecvbuf(rbs[i]);
+			continue;
+		}
+		rbs[i]->recv_length = msgs[i].msg_len;
+		DPRINT(3, ("read_network_batch: fd=%d length %u from %s\n",
+			   fd, msgs[i].msg_len,
+			   socktoa(&rbs[i]->recv_srcadr)));
+		deliver_network_packet(fd, itf, rbs[i], &msgs[i].msg_hdr);
+	}
+	xmit_deferred = false;
+#ifdef HAVE_SENDMMSG
+	flush_xmit_queue(&xmitq);
+#endif
+
+	return ((unsigned int)nmsgs < got) ? 0 : nmsgs;
+}
+#endif /* HAVE_RECVMMSG */
+
+/*
+ * Hand one network packet that has been read into rb to the
+ * protocol machine, then release the buffer.
+ */
+static void
+deliver_network_packet(
+	SOCKET			fd,
+	endpt *			itf,
+	struct recvbuf *	rb,
+	struct msghdr *		msghdr
+	)
+{
 	/*
 	 * We used to drop network packets with addresses matching the magic
 	 * refclock format here. Now we do the check in the protocol machine,
@@ -2224,10 +2762,10 @@ read_network_packet(
 		if (   IN6_IS_ADDR_LOOPBACK(PSOCK_ADDR6(&rb->recv_srcadr))
 		    && !IN6_IS_ADDR_LOOPBACK(PSOCK_ADDR6(&itf->sin))
 		   ) {
-			pkt_count.dropped++;
+			COUNT_INC(pkt_count.dropped);
 			DPRINT(2, ("DROPPING that packet\n"));
 			freerecvbuf(rb);
-			return buflen;
+			return;
 		}
 		DPRINT(2, ("processing that packet\n"));
 	}
@@ -2238,81 +2776,691 @@ read_network_packet(
 	 */
 	rb->dstadr = itf;
 	rb->fd = fd;
-	rb->recv_time = fetch_packetstamp(&msghdr);
+	rb->recv_time = fetch_packetstamp(msghdr);
 
 	receive(rb);
 	freerecvbuf(rb);
 
-	itf->received++;
-	pkt_count.received++;
-	return (buflen);
+	COUNT_INC(itf->received);
+	COUNT_INC(pkt_count.received);
 }
 
 /*
- * attempt to handle io
+ * io_set_recvbatch - set the number of datagrams read per system
+ * call.  1 turns batching off.
  */
 void
-io_handler(void)
+io_set_recvbatch(
+	int	n
+	)
 {
-	bool flag;
-	sigset_t runMask;
-	fd_set rdfdes;
-	int nfound;
-
-	/*
-	 * Use select() on all input fd's for unlimited
-	 * time.  select() will terminate on SIGALARM or on the
-	 * reception of input.
-	 */
-	pthread_sigmask(SIG_BLOCK, &blockMask, &runMask);
-	flag = sig_flags.sawALRM || sig_flags.sawQuit || sig_flags.sawHUP || \
-	  sig_flags.sawDNS;
-	if (!flag) {
-	  rdfdes = activefds;
-	  nfound = pselect(maxactivefd+1, &rdfdes, NULL, NULL, NULL, &runMask);
-	} else {
-	  nfound = -1;
-	  errno = EINTR;
+	if (n < 1 || n > RECV_BATCH_MAX) {
+		msyslog(LOG_ERR, "CONFIG: recvbatch %d out of range 1 to %d",
+			n, RECV_BATCH_MAX);
+		return;
 	}
-	pthread_sigmask(SIG_SETMASK, &runMask, NULL);
+#ifndef HAVE_RECVMMSG
+	if (n > 1) {
+		msyslog(LOG_ERR, "CONFIG: recvbatch not supported on this system");
+		return;
+	}
+#endif
+	recv_batch = (unsigned int)n;
+	reserve_recvbuffs(recv_batch + RECV_LOWAT);
+	msyslog(LOG_INFO, "CONFIG: recvbatch %u", recv_batch);
+}
 
-	if (nfound > 0) {
-		input_handler(&rdfdes);
-	} else if (nfound == -1 && errno != EINTR) {
-		msyslog(LOG_ERR, "IO: select() error: %s", strerror(errno));
+/*
+ * io_set_sendbatch - set how many replies may wait on the transmit
+ * queue during a batched receive.  1 turns the queue off.
+ */
+void
+io_set_sendbatch(
+	int	n
+	)
+{
+	if (n < 1 || n > SEND_BATCH_MAX) {
+		msyslog(LOG_ERR, "CONFIG: sendbatch %d out of range 1 to %d",
+			n, SEND_BATCH_MAX);
+		return;
 	}
-#   ifdef DEBUG
-	else if (debug > 4) { /* SPECIAL DEBUG */
-		msyslog(LOG_DEBUG, "IO: select(): nfound=%d, error: %s", nfound, strerror(errno));
-	} else {
-		DPRINT(1, ("select() returned %d: %s\n", nfound, strerror(errno)));
+#ifndef HAVE_SENDMMSG
+	if (n > 1) {
+		msyslog(LOG_ERR, "CONFIG: sendbatch not supported on this system");
+		return;
 	}
-#   endif /* DEBUG */
+#else
+	/* Only ever called between batches, so the queue is empty */
+	INSIST(0 == xmitq.count);
+	free(xmitq.pkt);
+	xmitq.pkt = NULL;
+#endif
+	send_batch = (unsigned int)n;
+	msyslog(LOG_INFO, "CONFIG: sendbatch %u", send_batch);
 }
 
 /*
- * input_handler - receive packets
+ * io_set_workers - set the number of server worker threads.  Must be
+ * given before the sockets are opened; 0 (the default) serves
+ * everything from the main thread.
  */
-static void
-input_handler(
-	fd_set *	fds
+void
+io_set_workers(
+	int	n
 	)
 {
-	int		buflen;
-	SOCKET		fd;
-	size_t		select_count;
-	endpt *		ep;
-#ifdef REFCLOCK
-	struct refclockio *rp;
-	int		saved_errno;
-	const char *	clk;
-#endif
-#ifdef USE_ROUTING_SOCKET
-	struct asyncio_reader *	asyncio_reader;
-	struct asyncio_reader *	next_asyncio_reader;
+#ifdef USE_WORKERS
+	pthread_rwlockattr_t	attr;
+	struct epoll_event	ev;
 #endif
 
-	pkt_count.handler_calls++;
+	if (n < 0) {
+		msyslog(LOG_ERR, "CONFIG: serverworkers %d out of range 0 to %d",
+			n, WORKERS_MAX);
+		return;
+	}
+	if (n > WORKERS_MAX) {
+		msyslog(LOG_WARNING, "CONFIG: serverworkers %d is too many, using %d",
+			n, WORKERS_MAX);
+		n = WORKERS_MAX;
+	}
+#ifndef USE_WORKERS
+	if (n > 0) {
+		msyslog(LOG_ERR, "CONFIG: serverworkers not supported on this system");
+		return;
+	}
+#else
+	if (NULL != workers || NULL != io_data.ep_list) {
+		msyslog(LOG_ERR, "CONFIG: serverworkers can only be set at startup");
+		return;
+	}
+	if (0 == n)
+		return;
+	if (epoll_fd < 0) {
+		msyslog(LOG_ERR, "CONFIG: serverworkers needs the epoll() event loop");
+		return;
+	}
+
+	handoff_vsock.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ZERO(ev);
+	ev.events = EPOLLIN;
+	ev.data.ptr = &handoff_vsock;
+	if (handoff_vsock.fd < 0 ||
+	    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, handoff_vsock.fd, &ev) < 0) {
+		msyslog(LOG_ERR, "CONFIG: serverworkers: can't set up hand-off: %s",
+			strerror(errno));
+		if (handoff_vsock.fd >= 0)
+			close(handoff_vsock.fd);
+		handoff_vsock.fd = -1;
+		return;
+	}
+
+	/* Don't let busy workers starve an endpoint going away */
+	pthread_rwlockattr_init(&attr);
+# ifdef __GLIBC__
+	pthread_rwlockattr_setkind_np(&attr,
+		PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+# endif
+	pthread_rwlock_init(&wsock_lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+
+	workers = eallocarray((size_t)n, sizeof(*workers));
+	memset(workers, '\0', (size_t)n * sizeof(*workers));
+	for (int i = 0; i < n; i++) {
+		workers[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (workers[i].epfd < 0) {
+			msyslog(LOG_ERR, "CONFIG: serverworkers: epoll_create1() failed: %s",
+				strerror(errno));
+			exit(1);
+		}
+		workers[i].xmitq.pkt = eallocarray(SEND_BATCH_MAX,
+						   sizeof(struct pkt));
+	}
+	server_workers = (unsigned int)n;
+#endif
+	msyslog(LOG_INFO, "CONFIG: serverworkers %d", n);
+}
+
+/*
+ * io_start_workers - start the server worker threads
+ */
+void
+io_start_workers(void)
+{
+#ifdef USE_WORKERS
+	sigset_t	block_mask, saved_sig_mask;
+	unsigned int	started;
+	int		rc;
+
+	if (0 == server_workers)
+		return;
+
+	sigfillset(&block_mask);
+	pthread_sigmask(SIG_BLOCK, &block_mask, &saved_sig_mask);
+	for (started = 0; started < server_workers; started++) {
+		struct server_worker *w = &workers[started];
+
+		w->batch = recv_batch;
+		grow_recvbuf_list(&w->rbufs, w->batch);
+		rc = pthread_create(&w->tid, NULL, worker_main, w);
+		if (rc) {
+			msyslog(LOG_ERR, "IO: can't start server worker %u: %s",
+				started, strerror(rc));
+			break;
+		}
+		pthread_detach(w->tid);
+	}
+	pthread_sigmask(SIG_SETMASK, &saved_sig_mask, NULL);
+
+	/*
+	 * Nobody reads the sockets of the workers that didn't start,
+	 * and the kernel would still give them their share of the
+	 * clients.  Close them and carry on with the ones that did.
+	 */
+	if (started < server_workers)
+		drop_workers(started);
+	if (0 == started)
+		return;
+	workers_running = true;
+	msyslog(LOG_INFO, "IO: %u server workers running", started);
+#endif
+}
+
+#ifdef USE_WORKERS
+/*
+ * drop_workers - close the sockets of workers first and up, which
+ * have no thread, and stop counting them.
+ */
+static void
+drop_workers(
+	unsigned int	first
+	)
+{
+	wsock_t **	pws;
+	wsock_t *	ws;
+
+	for (pws = &wsock_list; NULL != (ws = *pws); ) {
+		if (ws->worker < &workers[first]) {
+			pws = &ws->link;
+			continue;
+		}
+		*pws = ws->link;
+		close(ws->fd);
+		free(ws);
+	}
+	for (unsigned int i = first; i < server_workers; i++) {
+		close(workers[i].epfd);
+		workers[i].epfd = -1;
+	}
+	server_workers = first;
+}
+#endif /* USE_WORKERS */
+
+#ifdef USE_WORKERS
+/*
+ * open_worker_sockets - give every worker a socket bound like the
+ * endpoint's own.  A worker that can't get one just doesn't serve
+ * that endpoint.
+ */
+static void
+open_worker_sockets(
+	sockaddr_u *	addr,
+	bool		turn_off_reuse,
+	endpt *		ep
+	)
+{
+	struct epoll_event	ev;
+	wsock_t *		ws;
+	SOCKET			fd;
+
+	for (unsigned int i = 0; i < server_workers; i++) {
+		fd = open_bound_socket(addr, turn_off_reuse, ep);
+		if (INVALID_SOCKET == fd)
+			continue;
+		ws = emalloc_zero(sizeof(*ws));
+		ws->fd = fd;
+		ws->ep = ep;
+		ws->worker = &workers[i];
+		ZERO(ev);
+		ev.events = EPOLLIN;
+		ev.data.ptr = ws;
+		if (epoll_ctl(workers[i].epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			msyslog(LOG_ERR, "IO: epoll_ctl(ADD) of worker fd %d failed: %s",
+				fd, strerror(errno));
+			close(fd);
+			free(ws);
+			continue;
+		}
+		LINK_SLIST(wsock_list, ws, link);
+	}
+}
+
+/*
+ * close_worker_sockets - close the workers' sockets for an endpoint
+ * that is going away, and drop anything of its still waiting to be
+ * handed off.
+ */
+static void
+close_worker_sockets(
+	endpt *	ep
+	)
+{
+	wsock_t **	pws;
+	wsock_t *	ws;
+	recvbuf_t *	rb;
+	recvbuf_t *	keep;
+
+	if (NULL == workers)
+		return;
+
+	pthread_rwlock_wrlock(&wsock_lock);
+
+	wsock_gen++;
+	for (pws = &wsock_list; NULL != (ws = *pws); ) {
+		if (ws->ep != ep) {
+			pws = &ws->link;
+			continue;
+		}
+		*pws = ws->link;
+		(void)epoll_ctl(ws->worker->epfd, EPOLL_CTL_DEL, ws->fd, NULL);
+		close(ws->fd);
+		free(ws);
+	}
+
+	pthread_mutex_lock(&handoff_lock);
+	keep = NULL;
+	for (;;) {
+		UNLINK_FIFO(rb, handoff_fifo, link);
+		if (NULL == rb)
+			break;
+		if (rb->dstadr == ep) {
+			handoff_count--;
+			free(rb);
+		} else {
+			rb->link = keep;
+			keep = rb;
+		}
+	}
+	while (NULL != (rb = keep)) {
+		keep = rb->link;
+		LINK_FIFO(handoff_fifo, rb, link);
+	}
+	pthread_mutex_unlock(&handoff_lock);
+
+	pthread_rwlock_unlock(&wsock_lock);
+}
+
+/*
+ * worker_main - server worker thread
+ */
+static void *
+worker_main(
+	void *	arg
+	)
+{
+	struct server_worker *	w = arg;
+	struct epoll_event	events[EPOLL_MAX_EVENTS];
+	unsigned long		gen;
+	int			nfound;
+
+	pthread_rwlock_rdlock(&wsock_lock);
+	for (;;) {
+		gen = wsock_gen;
+		pthread_rwlock_unlock(&wsock_lock);
+		nfound = epoll_wait(w->epfd, events, EPOLL_MAX_EVENTS, -1);
+		pthread_rwlock_rdlock(&wsock_lock);
+		if (nfound < 0 && EINTR != errno)
+			msyslog(LOG_ERR, "IO: worker epoll_wait() error: %s",
+				strerror(errno));
+		/*
+		 * If sockets were closed meanwhile some events may
+		 * point at freed ones.  Ask again; what's still there
+		 * is still readable.
+		 */
+		if (nfound <= 0 || gen != wsock_gen)
+			continue;
+		for (int i = 0; i < nfound; i++)
+			worker_read(w, events[i].data.ptr);
+	}
+	return NULL;
+}
+
+/*
+ * worker_read - read and serve one batch from a worker socket.
+ * Returns the number of datagrams read.
+ */
+static int
+worker_read(
+	struct server_worker *	w,
+	wsock_t *		ws
+	)
+{
+	struct recvbuf *	rbs[RECV_BATCH_MAX];
+	bool			spoofed[RECV_BATCH_MAX];
+	struct mmsghdr		msgs[RECV_BATCH_MAX];
+	struct iovec		iovecs[RECV_BATCH_MAX];
+	union recv_control	control[RECV_BATCH_MAX];
+	struct recvbuf *	rb;
+	endpt *			ep = ws->ep;
+	unsigned int		i, count, sent, notsent, received;
+	int			nmsgs, bucket;
+
+	memset(msgs, '\0', w->batch * sizeof(msgs[0]));
+	for (i = 0; i < w->batch; i++) {
+		rb = rbs[i] = recvbuf_list_get(&w->rbufs);
+		iovecs[i].iov_base = &rb->recv_buffer;
+		iovecs[i].iov_len = sizeof(rb->recv_buffer);
+		msgs[i].msg_hdr.msg_name = &rb->recv_srcadr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(rb->recv_srcadr);
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = (void *)&control[i].buf;
+		msgs[i].msg_hdr.msg_controllen = sizeof(control[i].buf);
+	}
+
+	nmsgs = recvmmsg(ws->fd, msgs, w->batch, 0, NULL);
+	if (nmsgs <= 0) {
+		if (nmsgs < 0 && EWOULDBLOCK != errno && EAGAIN != errno)
+			msyslog(LOG_ERR, "IO: worker recvmmsg() fd=%d: %s",
+				ws->fd, strerror(errno));
+		for (i = 0; i < w->batch; i++)
+			recvbuf_list_put(&w->rbufs, rbs[i]);
+		return nmsgs;
+	}
+
+	/*
+	 * Screen the client requests for the whole batch first, so
+	 * the restriction and MRU lookups run back to back.
+	 */
+	for (i = 0; i < (unsigned int)nmsgs; i++) {
+		rb = rbs[i];
+		spoofed[i] = false;
+		if (0 == msgs[i].msg_len)
+			continue;
+		/* Classic Bug 2672, as in deliver_network_packet() */
+		if (AF_INET6 == ep->family
+		    && IN6_IS_ADDR_LOOPBACK(PSOCK_ADDR6(&rb->recv_srcadr))
+		    && !IN6_IS_ADDR_LOOPBACK(PSOCK_ADDR6(&ep->sin))) {
+			spoofed[i] = true;
+			continue;
+		}
+		rb->dstadr = ep;
+		rb->fd = ws->fd;
+		rb->worker = w;
+		rb->recv_length = msgs[i].msg_len;
+		rb->recv_time = fetch_packetstamp(&msgs[i].msg_hdr);
+		if (MODE_CLIENT == PKT_MODE(rb->recv_buffer[0]))
+			screen_request(rb);
+	}
+
+	COUNT_INC(pkt_count.rbatches);
+	COUNT_ADD(pkt_count.rbatch_pkts, (unsigned int)nmsgs);
+	for (bucket = 0; (nmsgs >> (bucket + 1)) != 0
+		     && bucket < RECV_BATCH_BUCKETS - 1; bucket++)
+		continue;
+	COUNT_INC(pkt_count.rbatch_hist[bucket]);
+	received = 0;
+	for (i = 0; i < (unsigned int)nmsgs; i++) {
+		rb = rbs[i];
+		if (ep->ignore_packets) {
+			COUNT_INC(pkt_count.ignored);
+			continue;
+		}
+		if (0 == msgs[i].msg_len)
+			continue;
+		if (spoofed[i]) {
+			COUNT_INC(pkt_count.dropped);
+			continue;
+		}
+		received++;
+
+		if (MODE_CLIENT != PKT_MODE(rb->recv_buffer[0])
+#ifdef ENABLE_MSSNTP
+		    || (rb->screened && (RES_MSSNTP & rb->restrict_mask))
+#endif
+		    ) {
+			worker_handoff(w, rb);
+			continue;
+		}
+		w->served++;
+		receive(rb);
+	}
+	COUNT_ADD(ep->received, (long)received);
+	COUNT_ADD(pkt_count.received, received);
+	for (i = 0; i < w->batch; i++)
+		recvbuf_list_put(&w->rbufs, rbs[i]);
+
+	count = w->xmitq.count;
+	if (count > 0) {
+		sent = send_xmit_queue(&w->xmitq, &notsent);
+		COUNT_ADD(ep->sent, (long)sent);
+		COUNT_ADD(ep->notsent, (long)notsent);
+		COUNT_ADD(pkt_count.sent, sent);
+		COUNT_ADD(pkt_count.notsent, notsent);
+		COUNT_INC(pkt_count.xbatches);
+		COUNT_ADD(pkt_count.xbatch_pkts, count);
+	}
+#ifndef DISABLE_NTS
+	/* the replies are out, now is the time to restock */
+	nts_nonce_refill();
+#endif
+
+	return nmsgs;
+}
+
+/*
+ * worker_handoff - pass a packet the worker doesn't answer itself to
+ * the main thread.
+ */
+static void
+worker_handoff(
+	struct server_worker *	w,
+	struct recvbuf *	rb
+	)
+{
+	static const uint64_t	one = 1;
+	recvbuf_t *		copy;
+
+	pthread_mutex_lock(&handoff_lock);
+	if (handoff_count >= HANDOFF_MAX) {
+		pthread_mutex_unlock(&handoff_lock);
+		COUNT_INC(pkt_count.dropped);
+		return;
+	}
+	copy = emalloc(sizeof(*copy));
+	memcpy(copy, rb, sizeof(*copy));
+	copy->worker = NULL;
+	LINK_FIFO(handoff_fifo, copy, link);
+	handoff_count++;
+	pthread_mutex_unlock(&handoff_lock);
+
+	w->handoffs++;
+	if (write(handoff_vsock.fd, &one, sizeof(one)) < 0 && EAGAIN != errno)
+		msyslog(LOG_ERR, "IO: worker hand-off wakeup failed: %s",
+			strerror(errno));
+}
+
+/*
+ * drain_handoff - run the packets the workers passed us
+ */
+static void
+drain_handoff(void)
+{
+	uint64_t	wakeups;
+	recvbuf_t *	rb;
+
+	if (read(handoff_vsock.fd, &wakeups, sizeof(wakeups)) < 0)
+		return;
+	for (;;) {
+		pthread_mutex_lock(&handoff_lock);
+		UNLINK_FIFO(rb, handoff_fifo, link);
+		if (NULL != rb)
+			handoff_count--;
+		pthread_mutex_unlock(&handoff_lock);
+		if (NULL == rb)
+			break;
+		receive(rb);
+		free(rb);
+	}
+}
+#endif /* USE_WORKERS */
+
+/*
+ * Hooks for the unit tests of the server workers.  No threads are
+ * started: the tests have the first worker read from a socket of
+ * their own and then drain its hand-offs on the main thread.
+ */
+
+/* throw away the workers and anything they handed off */
+void
+io_workers_ut_pristine(void)
+{
+#ifdef USE_WORKERS
+	recvbuf_t *	rb;
+
+	for (;;) {
+		UNLINK_FIFO(rb, handoff_fifo, link);
+		if (NULL == rb)
+			break;
+		free(rb);
+	}
+	handoff_count = 0;
+	if (handoff_vsock.fd >= 0) {
+		(void)epoll_ctl(epoll_fd, EPOLL_CTL_DEL, handoff_vsock.fd,
+				NULL);
+		close(handoff_vsock.fd);
+		handoff_vsock.fd = -1;
+	}
+	for (unsigned int i = 0; NULL != workers && i < server_workers; i++) {
+		close(workers[i].epfd);
+		free(workers[i].xmitq.pkt);
+	}
+	free(workers);
+	workers = NULL;
+	server_workers = 0;
+	/* io_set_workers() wants an event loop to hand off to */
+	if (epoll_fd < 0)
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+#endif
+}
+
+/* number of workers io_set_workers() made */
+unsigned int
+io_workers_ut_count(void)
+{
+#ifdef USE_WORKERS
+	return server_workers;
+#else
+	return 0;
+#endif
+}
+
+/* have the first worker read one batch from fd as if it were ep's */
+int
+io_worker_ut_read(
+	SOCKET	fd,
+	endpt *	ep
+	)
+{
+#ifdef USE_WORKERS
+	struct server_worker *	w = &workers[0];
+	wsock_t			ws;
+
+	if (0 == w->batch) {
+		w->batch = recv_batch;
+		grow_recvbuf_list(&w->rbufs, w->batch);
+	}
+	ZERO(ws);
+	ws.fd = fd;
+	ws.ep = ep;
+	ws.worker = w;
+	return worker_read(w, &ws);
+#else
+	UNUSED_ARG(fd);
+	UNUSED_ARG(ep);
+	return -1;
+#endif
+}
+
+/* run what the workers handed off, as the main thread would */
+void
+io_handoff_ut_drain(void)
+{
+#ifdef USE_WORKERS
+	drain_handoff();
+#endif
+}
+
+/*
+ * attempt to handle io
+ */
+void
+io_handler(void)
+{
+	bool flag;
+	sigset_t runMask;
+	fd_set rdfdes;
+	int nfound;
+
+#ifdef USE_EPOLL
+	if (epoll_fd >= 0) {
+		epoll_handler();
+		return;
+	}
+#endif
+
+	/*
+	 * Use select() on all input fd's for unlimited
+	 * time.  select() will terminate on SIGALARM or on the
+	 * reception of input.
+	 */
+	pthread_sigmask(SIG_BLOCK, &blockMask, &runMask);
+	flag = sig_flags.sawALRM || sig_flags.sawQuit || sig_flags.sawHUP || \
+	  sig_flags.sawDNS;
+	if (!flag) {
+	  rdfdes = activefds;
+	  nfound = pselect(maxactivefd+1, &rdfdes, NULL, NULL, NULL, &runMask);
+	} else {
+	  nfound = -1;
+	  errno = EINTR;
+	}
+	pthread_sigmask(SIG_SETMASK, &runMask, NULL);
+
+	if (nfound > 0) {
+		input_handler(&rdfdes);
+	} else if (nfound == -1 && errno != EINTR) {
+		msyslog(LOG_ERR, "IO: select() error: %s", strerror(errno));
+	}
+#   ifdef DEBUG
+	else if (debug > 4) { /* SPECIAL DEBUG */
+		msyslog(LOG_DEBUG, "IO: select(): nfound=%d, error: %s", nfound, strerror(errno));
+	} else {
+		DPRINT(1, ("select() returned %d: %s\n", nfound, strerror(errno)));
+	}
+#   endif /* DEBUG */
+}
+
+/*
+ * input_handler - receive packets
+ */
+static void
+input_handler(
+	fd_set *	fds
+	)
+{
+	int		buflen;
+	SOCKET		fd;
+	size_t		select_count;
+	endpt *		ep;
+#ifdef REFCLOCK
+	struct refclockio *rp;
+#endif
+#ifdef USE_ROUTING_SOCKET
+	struct asyncio_reader *	asyncio_reader;
+	struct asyncio_reader *	next_asyncio_reader;
+#endif
+
+	pkt_count.handler_calls++;
 	select_count = 0;
 
 	/*
@@ -2328,37 +3476,10 @@ input_handler(
 	 */
 
 	for (rp = refio; rp != NULL; rp = rp->next) {
-		fd = rp->fd;
-
-		if (!FD_ISSET(fd, fds))
+		if (!FD_ISSET(rp->fd, fds))
 			continue;
 		++select_count;
-		buflen = read_refclock_packet(fd, rp);
-		/*
-		 * The first read must succeed after select()
-		 * indicates readability, or we've reached
-		 * a permanent EOF.  http://bugs.ntp.org/1732
-		 * reported ntpd munching CPU after a USB GPS
-		 * was unplugged because select was indicating
-		 * EOF but ntpd didn't remove the descriptor
-		 * from the activefds set.
-		 */
-		if (buflen < 0 && EAGAIN != errno) {
-			saved_errno = errno;
-			clk = refclock_name(rp->srcclock);
-			errno = saved_errno;
-			msyslog(LOG_ERR, "IO: %s read: %s", clk, strerror(errno));
-			maintain_activefds(fd, true);
-		} else if (0 == buflen) {
-			clk = refclock_name(rp->srcclock);
-			msyslog(LOG_ERR, "IO: %s read EOF", clk);
-			maintain_activefds(fd, true);
-		} else {
-			/* drain any remaining refclock input */
-			do {
-				buflen = read_refclock_packet(fd, rp);
-			} while (buflen > 0);
-		}
+		input_refclock(rp);
 	}
 #endif /* REFCLOCK */
 
@@ -2409,6 +3530,156 @@ input_handler(
 }
 
 
+#ifdef REFCLOCK
+/*
+ * input_refclock - read a refclock that polled readable
+ */
+static void
+input_refclock(
+	struct refclockio *	rp
+	)
+{
+	int		buflen;
+	int		saved_errno;
+	const char *	clk;
+
+	buflen = read_refclock_packet(rp->fd, rp);
+	/*
+	 * The first read must succeed after select()
+	 * indicates readability, or we've reached
+	 * a permanent EOF.  http://bugs.ntp.org/1732
+	 * reported ntpd munching CPU after a USB GPS
+	 * was unplugged because select was indicating
+	 * EOF but ntpd didn't remove the descriptor
+	 * from the activefds set.
+	 */
+	if (buflen < 0 && EAGAIN != errno) {
+		saved_errno = errno;
+		clk = refclock_name(rp->srcclock);
+		errno = saved_errno;
+		msyslog(LOG_ERR, "IO: %s read: %s", clk, strerror(errno));
+		unwatch_fd(rp->fd);
+	} else if (0 == buflen) {
+		clk = refclock_name(rp->srcclock);
+		msyslog(LOG_ERR, "IO: %s read EOF", clk);
+		unwatch_fd(rp->fd);
+	} else {
+		/* drain any remaining refclock input */
+		do {
+			buflen = read_refclock_packet(rp->fd, rp);
+		} while (buflen > 0);
+	}
+}
+#endif /* REFCLOCK */
+
+
+#ifdef USE_EPOLL
+/*
+ * epoll_handler - wait for and dispatch ready descriptors
+ *
+ * Signals are never unblocked in this mode, so the handlers only run
+ * from read_signalfd() and sig_flags can't change between the test
+ * and the wait.
+ */
+static void
+epoll_handler(void)
+{
+	vsock_t *	lsock;
+	int		nfound;
+
+	if (sig_flags.sawALRM || sig_flags.sawQuit || sig_flags.sawHUP ||
+	    sig_flags.sawDNS)
+		return;
+
+	nfound = epoll_wait(epoll_fd, ready_events, EPOLL_MAX_EVENTS, -1);
+	if (nfound < 0) {
+		if (EINTR != errno)
+			msyslog(LOG_ERR, "IO: epoll_wait() error: %s",
+				strerror(errno));
+		return;
+	}
+
+	pkt_count.handler_calls++;
+	++pkt_count.handler_pkts;
+
+	ready_count = nfound;
+	for (int i = 0; i < ready_count; i++) {
+		/* NULL if an earlier callback closed the descriptor */
+		lsock = ready_events[i].data.ptr;
+		if (NULL == lsock)
+			continue;
+
+		switch (lsock->use) {
+
+		case FD_USE_ENDPT:
+			while (read_network_packet(lsock->fd, lsock->owner) > 0)
+				/* drain */;
+			break;
+
+#ifdef REFCLOCK
+		case FD_USE_REFCLOCK:
+			input_refclock(lsock->owner);
+			break;
+#endif
+
+#ifdef USE_ROUTING_SOCKET
+		case FD_USE_ASYNCIO: {
+			struct asyncio_reader *reader = lsock->owner;
+
+			(*reader->receiver)(reader);
+			break;
+		}
+#endif
+
+		case FD_USE_SIGNAL:
+			read_signalfd(lsock->fd);
+			break;
+
+		case FD_USE_TIMER:
+			timer_fd_expired();
+			break;
+
+#ifdef USE_WORKERS
+		case FD_USE_HANDOFF:
+			drain_handoff();
+			break;
+#endif
+
+		default:
+			break;
+		}
+	}
+	ready_count = 0;
+}
+
+
+/*
+ * read_signalfd - run the handlers for signals taken from the signalfd
+ *
+ * The handlers installed by ntpd only set sig_flags, so running them
+ * here leaves mainloop() as it is.
+ */
+static void
+read_signalfd(
+	int	fd
+	)
+{
+	struct signalfd_siginfo	ssi;
+	struct sigaction	sa;
+	int			sig;
+
+	while ((ssize_t)sizeof(ssi) == read(fd, &ssi, sizeof(ssi))) {
+		sig = (int)ssi.ssi_signo;
+		if (0 != sigaction(sig, NULL, &sa) ||
+		    (SA_SIGINFO & sa.sa_flags))
+			continue;
+		if (SIG_DFL != sa.sa_handler && SIG_IGN != sa.sa_handler)
+			(*sa.sa_handler)(sig);
+	}
+}
+#endif /* USE_EPOLL */
+
+
 /*
  * find an interface suitable for the src address
  */
@@ -2728,14 +3999,20 @@ getinterface(
 void
 io_clr_stats(void)
 {
-	pkt_count.dropped = 0;
-	pkt_count.ignored = 0;
-	pkt_count.received = 0;
-	pkt_count.sent = 0;
-	pkt_count.notsent = 0;
+	COUNT_CLEAR(pkt_count.dropped);
+	COUNT_CLEAR(pkt_count.ignored);
+	COUNT_CLEAR(pkt_count.received);
+	COUNT_CLEAR(pkt_count.sent);
+	COUNT_CLEAR(pkt_count.notsent);
 
 	pkt_count.handler_calls = 0;
 	pkt_count.handler_pkts = 0;
+	COUNT_CLEAR(pkt_count.rbatches);
+	COUNT_CLEAR(pkt_count.rbatch_pkts);
+	for (int i = 0; i < RECV_BATCH_BUCKETS; i++)
+		COUNT_CLEAR(pkt_count.rbatch_hist[i]);
+	COUNT_CLEAR(pkt_count.xbatches);
+	COUNT_CLEAR(pkt_count.xbatch_pkts);
 	pkt_count.io_timereset = current_time;
 }
 
@@ -2765,7 +4042,7 @@ uint64_t received_count(void) {
  * required so that refclock_generic.c can track its packets
  */
 void inc_received_count(void) {
-  pkt_count.received++;
+  COUNT_INC(pkt_count.received);
 }
 
 /*
@@ -2795,6 +4072,80 @@ uint64_t handler_pkts_count(void) {
   return pkt_count.handler_pkts;
 }
 
+/*
+ * rbatch_count - return the number of batched reads that got data
+ */
+uint64_t rbatch_count(void) {
+  return pkt_count.rbatches;
+}
+
+/*
+ * rbatch_pkts_count - return the number of packets read in batches
+ */
+uint64_t rbatch_pkts_count(void) {
+  return pkt_count.rbatch_pkts;
+}
+
+/*
+ * rbatch_hist_count - return one bucket of the batch size histogram
+ */
+uint64_t rbatch_hist_count(int bucket) {
+  if (bucket < 0 || bucket >= RECV_BATCH_BUCKETS)
+    return 0;
+  return pkt_count.rbatch_hist[bucket];
+}
+
+/*
+ * xbatch_count - return the number of transmit queue flushes
+ */
+uint64_t xbatch_count(void) {
+  return pkt_count.xbatches;
+}
+
+/*
+ * xbatch_pkts_count - return the number of packets sent in batches
+ */
+uint64_t xbatch_pkts_count(void) {
+  return pkt_count.xbatch_pkts;
+}
+
+/*
+ * worker_count - return the number of server worker threads running
+ */
+unsigned int worker_count(void) {
+#ifdef USE_WORKERS
+  return workers_running ? server_workers : 0;
+#else
+  return 0;
+#endif
+}
+
+/*
+ * worker_served_count - return the number of client requests the
+ * server workers answered
+ */
+uint64_t worker_served_count(void) {
+  uint64_t served = 0;
+#ifdef USE_WORKERS
+  for (unsigned int i = 0; NULL != workers && i < server_workers; i++)
+    served += workers[i].served;
+#endif
+  return served;
+}
+
+/*
+ * worker_handoff_count - return the number of packets the server
+ * workers passed to the main thread
+ */
+uint64_t worker_handoff_count(void) {
+  uint64_t handoffs = 0;
+#ifdef USE_WORKERS
+  for (unsigned int i = 0; NULL != workers && i < server_workers; i++)
+    handoffs += workers[i].handoffs;
+#endif
+  return handoffs;
+}
+
 /*
  * counter_reset_time - return the time of the last counter reset
  */
@@ -2827,7 +4178,7 @@ io_addclock(
 	/*
 	 * register fd
 	 */
-	add_fd_to_list(rio->fd, FD_TYPE_FILE);
+	add_fd_to_list(rio->fd, FD_TYPE_FILE, FD_USE_REFCLOCK, rio);
 
 	return true;
 }
@@ -2865,16 +4216,20 @@ io_closeclock(
 static void
 add_fd_to_list(
 	SOCKET fd,
-	enum desc_type type
+	enum desc_type type,
+	enum desc_use use,
+	void *owner
 	)
 {
 	vsock_t *lsock = emalloc(sizeof(*lsock));
 
 	lsock->fd = fd;
 	lsock->type = type;
+	lsock->use = use;
+	lsock->owner = owner;
 
 	LINK_SLIST(fd_list, lsock, link);
-	maintain_activefds(fd, false);
+	watch_fd(lsock);
 }
 
 
@@ -2892,6 +4247,12 @@ close_and_delete_fd_from_list(
 		return;
 	}
 
+	/*
+	 * stop watching before the close, epoll() can't be told
+	 * about a descriptor that's gone
+	 */
+	unwatch_fd(fd);
+
 	switch (lsock->type) {
 
 	case FD_TYPE_SOCKET:
@@ -2910,9 +4271,60 @@ close_and_delete_fd_from_list(
 	}
 
 	free(lsock);
-	/*
-	 * remove from activefds
-	 */
+}
+
+
+/*
+ * watch_fd - have the I/O loop wait for input on a descriptor
+ */
+static void
+watch_fd(
+	vsock_t *	lsock
+	)
+{
+#ifdef USE_EPOLL
+	struct epoll_event ev;
+
+	if (epoll_fd >= 0) {
+		ZERO(ev);
+		ev.events = EPOLLIN;
+		ev.data.ptr = lsock;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, lsock->fd, &ev) < 0) {
+			msyslog(LOG_ERR, "IO: epoll_ctl(ADD) of fd %d failed: %s",
+				lsock->fd, strerror(errno));
+			/* EPERM is a plain file, which can't be polled */
+			if (EPERM != errno)
+				exit(1);
+		}
+		return;
+	}
+#endif
+	maintain_activefds(lsock->fd, false);
+}
+
+
+/*
+ * unwatch_fd - stop waiting for input on a descriptor
+ */
+static void
+unwatch_fd(
+	SOCKET	fd
+	)
+{
+#ifdef USE_EPOLL
+	vsock_t *lsock;
+
+	if (epoll_fd >= 0) {
+		/* it may still be due in the batch being dispatched */
+		for (int i = 0; i < ready_count; i++) {
+			lsock = ready_events[i].data.ptr;
+			if (lsock != NULL && fd == lsock->fd)
+				ready_events[i].data.ptr = NULL;
+		}
+		(void)epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+		return;
+	}
+#endif
 	maintain_activefds(fd, true);
 }
 
@@ -5,6 +5,7 @@
 #include "config.h"
 
 #include <math.h>
+#include <pthread.h>
 #include <stdlib.h>
 
 #include "ntpd.h"
@@ -19,17 +20,46 @@
  * anything else. While at it, implement rate controls for inbound
  * traffic.
  *
- * Each entry is doubly linked into two lists, a hash table and a most-
- * recently-used (MRU) list. When a packet arrives it is looked up in
- * the hash table. If found, the statistics are updated and the entry
- * relinked at the head of the MRU list. If not found, a new entry is
- * allocated, initialized and linked into both the hash table and at the
- * head of the MRU list.
+ * Each entry lives in two structures, an open-addressing hash table
+ * and a most-recently-used (MRU) list.  When a packet arrives it is
+ * looked up in the hash table.  If found, the statistics are updated
+ * and the entry is marked referenced.  If not found, a new entry is
+ * allocated, initialized, inserted into the hash table and linked at
+ * the head of the MRU list.
+ *
+ * The hash table is a flat array of (hash, entry) slots probed
+ * linearly with Robin Hood displacement, so a lookup usually touches
+ * one or two adjacent cache lines and the stored hash acts as a
+ * fingerprint that avoids dereferencing entries which cannot match.
+ * Deletion shifts the following cluster back, no tombstones are used.
+ * A table doubles when it gets three quarters full.
+ *
+ * Server workers call us from several threads at once.  The table is
+ * split into MON_SHARDS shards by the top bits of the address hash,
+ * each with its own lock, and all packets from one address meet in
+ * the same shard, so its score stays right whichever thread a packet
+ * lands on.  Each shard keeps its own MRU list, and a miss recycles
+ * the oldest entry of its shard, so a packet only ever takes its own
+ * shard lock.  The addresses spread evenly over the shards, so their
+ * oldest entries are about as old as the oldest overall.  Only the
+ * free list and its counters are shared, behind mon_free_lock, which
+ * is taken inside a shard lock.  mrulist walks the shard lists merged
+ * in last-seen order with every shard locked.
+ *
+ * Recency is tracked CLOCK style: a hit only sets the referenced flag
+ * instead of relinking the entry at the head of its MRU list.  The
+ * lists are brought back into order lazily.  When an entry is needed
+ * for recycling, referenced entries found at the tail get a second
+ * chance and are moved to the head.  Before the mrulist is walked for
+ * ntpq all referenced entries are merged back in order of their
+ * last-seen time, so mrulist paging sees every entry modified since
+ * the prior request after the point where that request stopped.  Each
+ * shard counts its referenced entries, so one nobody hit is skipped.
  *
  * Memory is usually allocated by grabbing a big chunk of new memory and
  * cutting it up into littler pieces. The exception to this when we hit
  * the memory limit. Then we free memory by grabbing entries off the
- * tail for the MRU list, unlinking from the hash table, and
+ * tail of a shard's MRU list, unlinking from the hash table, and
  * reinitializing.
  *
  * INC_MONLIST is the default allocation granularity in entries.
@@ -45,9 +75,44 @@
 # define MRU_MAXDEPTH_DEF	(1024 * 1024 / sizeof(mon_entry))
 #endif
 
-#define MON_HASH_SLOTS          (1U << mon_data.mon_hash_bits)
-#define MON_HASH_MASK           (MON_HASH_SLOTS - 1)
-#define MON_HASH(addr)          (sock_hash(addr) & MON_HASH_MASK)
+/*
+ * Each shard's table is initially sized for its part of maxdepth at
+ * half load, but no larger than MON_HASH_INIT_MAX bits; past that it
+ * grows on demand.  The top MON_SHARD_BITS of the hash pick the
+ * shard, the bits below them the home slot.
+ */
+#define MON_HASH_BITS_MIN	4
+#define MON_HASH_INIT_MAX	16
+#define MON_HASH_BITS_MAX	(32 - MON_SHARD_BITS)
+
+/* Fibonacci hashing, sock_hash() leaves the low bits poorly mixed */
+#define MON_HASH(addr)		(sock_hash(addr) * 0x9e3779b1U)
+#define MON_SHARD(h)		(&mon_shards[(h) >> (32 - MON_SHARD_BITS)])
+#define SHARD_SLOTS(sh)		(1U << (sh)->bits)
+#define SHARD_MASK(sh)		(SHARD_SLOTS(sh) - 1)
+#define MON_HOME(sh, h)		((uint32_t)((h) << MON_SHARD_BITS) \
+				 >> (32 - (sh)->bits))
+#define MON_DIST(sh, i, h)	(((i) - MON_HOME(sh, h)) & SHARD_MASK(sh))
+
+struct mon_slot {
+	uint32_t	hash;		/* mixed address hash, also fingerprint */
+	mon_entry *	mon;		/* entry, NULL if empty */
+};
+
+struct mon_shard {
+	pthread_mutex_t	lock;
+	struct mon_slot *table;
+	uint8_t		bits;		/* log2 size of table */
+	mon_entry	mru_list;	/* this shard's MRU list head */
+	uint64_t	entries;	/* entries hashed here */
+	uint64_t	referenced;	/* entries out of MRU order */
+	uint64_t	exists;		/* lookups that found an entry */
+	uint64_t	waits;		/* times the lock was busy */
+	uint8_t		pad[64];	/* keep shards off each other's lines */
+};
+
+static struct mon_shard mon_shards[MON_SHARDS];
+static pthread_mutex_t mon_free_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
 struct monitor_data mon_data = {
@@ -60,7 +125,6 @@ struct monitor_data mon_data = {
 	.mru_maxdepth = MRU_MAXDEPTH_DEF,	/* MRU count hard limit */
 	.mru_initalloc = INIT_MONLIST, /* entries to preallocate */
 	.mru_incalloc = INC_MONLIST, /* allocation batch factor */
-	.mru_exists = 0,	/* slot already exists */
 	.mru_new = 0,		/* allocate a new slot (2 cases) */
 	.mru_recycleold = 0,	/* recycle slot: age > mru_maxage */
 	.mru_recyclefull = 0,	/* recycle slot: full and age > mru_minage */
@@ -73,16 +137,29 @@ struct monitor_data mon_data = {
 
 /*
  * List of free structures, and counters of in-use and total
- * structures. The free structures are linked with the hash_next field.
+ * structures. The free structures are linked with the free_next field.
+ * All three belong to mon_free_lock.
  */
 static  mon_entry *mon_free;		/* free list or null if none */
 static	uint64_t mru_alloc;		/* mru list + free list count */
 static	uint64_t mon_mem_increments;	/* times called malloc() */
 
 static	void	mon_getmoremem(void);
-static	void	remove_from_hash(mon_entry *);
+static	mon_entry *mon_alloc(bool);
+static	void	shard_lock(struct mon_shard *);
+static	void	shard_sort(struct mon_shard *);
+static	void	hash_insert(struct mon_shard *, mon_entry *, uint32_t);
+static	mon_entry *hash_lookup(const struct mon_shard *,
+			       const sockaddr_u *, uint32_t);
+static	void	hash_grow(struct mon_shard *);
+static	void	remove_from_hash(struct mon_shard *, mon_entry *);
 static	void	mon_free_entry(mon_entry *);
-static	void	mon_reclaim_entry(mon_entry *);
+static	void	mon_reclaim_entry(struct mon_shard *, mon_entry *);
+static	void	mon_drop_entries(uint64_t);
+static	mon_entry *mon_clock_sweep(struct mon_shard *);
+static	int	oldest_age(const mon_entry *, l_fp);
+static	unsigned short mon_hit(struct mon_shard *, mon_entry *,
+			       struct recvbuf *, unsigned short);
 
 
 /*
@@ -91,50 +168,209 @@ static	void	mon_reclaim_entry(mon_entry *);
 void
 init_mon(void)
 {
+	static bool shards_ready;
+
 	/*
 	 * Don't do much of anything here.  We don't allocate memory
 	 * until mon_start().
 	 */
-	INIT_DLIST(mon_data.mon_mru_list, mru);
+	for (unsigned int i = 0; i < MON_SHARDS; i++) {
+		if (!shards_ready)
+			pthread_mutex_init(&mon_shards[i].lock, NULL);
+		INIT_DLIST(mon_shards[i].mru_list, mru);
+	}
+	shards_ready = true;
+}
+
+
+/*
+ * shard_lock - lock a shard, counting the times somebody else had it.
+ */
+static void
+shard_lock(
+	struct mon_shard *shard
+	)
+{
+	if (0 != pthread_mutex_trylock(&shard->lock)) {
+		pthread_mutex_lock(&shard->lock);
+		shard->waits++;
+	}
+}
+
+#define shard_unlock(shard)	pthread_mutex_unlock(&(shard)->lock)
+
+
+/*
+ * mon_lock_all - take every shard lock, in order, stopping all monitor
+ *		  updates so the whole table can be walked.  Entries hit
+ *		  since mon_sort_mru() are merged back in too, which is
+ *		  cheap when it was called just before.
+ */
+void
+mon_lock_all(void)
+{
+	for (unsigned int i = 0; i < MON_SHARDS; i++) {
+		shard_lock(&mon_shards[i]);
+		shard_sort(&mon_shards[i]);
+	}
+}
+
+
+void
+mon_unlock_all(void)
+{
+	for (unsigned int i = MON_SHARDS; i > 0; i--)
+		shard_unlock(&mon_shards[i - 1]);
+}
+
+
+/*
+ * hash_insert - place an entry in a shard's table, Robin Hood style:
+ *		 walking the probe sequence, any resident closer to its
+ *		 home slot than we are to ours gives up its slot and
+ *		 continues the walk in our place.
+ */
+static void
+hash_insert(
+	struct mon_shard *shard,
+	mon_entry *mon,
+	uint32_t hash
+	)
+{
+	struct mon_slot cur, tmp;
+	struct mon_slot *slot;
+	uint32_t i, dist;
+
+	cur.hash = hash;
+	cur.mon = mon;
+	i = MON_HOME(shard, hash);
+	for (dist = 0; ; dist++, i = (i + 1) & SHARD_MASK(shard)) {
+		slot = &shard->table[i];
+		if (NULL == slot->mon) {
+			*slot = cur;
+			return;
+		}
+		if (MON_DIST(shard, i, slot->hash) < dist) {
+			tmp = *slot;
+			*slot = cur;
+			cur = tmp;
+			dist = MON_DIST(shard, i, cur.hash);
+		}
+	}
+}
+
+
+/*
+ * hash_lookup - find the entry for an address.  The walk stops at an
+ *		 empty slot or at a resident closer to home than the
+ *		 wanted entry would be, which Robin Hood insertion
+ *		 guarantees it is not past.
+ */
+static mon_entry *
+hash_lookup(
+	const struct mon_shard *shard,
+	const sockaddr_u *addr,
+	uint32_t hash
+	)
+{
+	const struct mon_slot *slot;
+	uint32_t i, dist;
+
+	if (NULL == shard->table)
+		return NULL;
+	i = MON_HOME(shard, hash);
+	for (dist = 0; ; dist++, i = (i + 1) & SHARD_MASK(shard)) {
+		slot = &shard->table[i];
+		if (NULL == slot->mon || MON_DIST(shard, i, slot->hash) < dist)
+			return NULL;
+		if (slot->hash == hash && SOCK_EQ(&slot->mon->rmtadr, addr))
+			return slot->mon;
+	}
+}
+
+
+/*
+ * hash_grow - double a shard's table and reinsert its entries.
+ *	       Called with the shard lock held.
+ */
+static void
+hash_grow(
+	struct mon_shard *shard
+	)
+{
+	struct mon_slot *old;
+	size_t oldslots, i;
+
+	old = shard->table;
+	oldslots = SHARD_SLOTS(shard);
+	shard->bits++;
+	COUNT_ADD(mon_data.mru_hashslots, oldslots);
+	shard->table = erealloc_zero(NULL,
+			sizeof(*shard->table) * SHARD_SLOTS(shard), 0);
+	for (i = 0; i < oldslots; i++)
+		if (NULL != old[i].mon)
+			hash_insert(shard, old[i].mon, old[i].hash);
+	free(old);
+	msyslog(LOG_INFO, "MON: MRU hash shard %d grown to %d bits",
+		(int)(shard - mon_shards), shard->bits);
 }
 
 
 /*
  * remove_from_hash - removes an entry from the address hash table and
- *		      decrements mru_entries.
+ *		      decrements mru_entries.  The rest of the probe
+ *		      cluster is shifted back one slot to close the gap.
+ *		      Called with the entry's shard lock held.
  */
 static void
 remove_from_hash(
+	struct mon_shard *shard,
 	mon_entry *mon
 	)
 {
-	unsigned int hash;
-	mon_entry *punlinked;
+	uint32_t i, next;
+	struct mon_slot *slot;
 
-	mon_data.mru_entries--;
-	hash = MON_HASH(&mon->rmtadr);
-	UNLINK_SLIST(punlinked, mon_data.mon_hash[hash], mon, hash_next,
-		     mon_entry);
-	ENSURE(punlinked == mon);
-	if (NULL == mon_data.mon_hash[hash])
-		mon_data.mru_hashslots--;
+	mon_drop_entries(1);
+	shard->entries--;
+	if (mon->referenced)
+		shard->referenced--;
+	i = MON_HOME(shard, MON_HASH(&mon->rmtadr));
+	while (shard->table[i].mon != mon) {
+		INSIST(NULL != shard->table[i].mon);
+		i = (i + 1) & SHARD_MASK(shard);
+	}
+	for (;;) {
+		next = (i + 1) & SHARD_MASK(shard);
+		slot = &shard->table[next];
+		if (NULL == slot->mon || 0 == MON_DIST(shard, next, slot->hash))
+			break;
+		shard->table[i] = *slot;
+		i = next;
+	}
+	shard->table[i].mon = NULL;
+	shard->table[i].hash = 0;
 }
 
 
+/*
+ * mon_free_entry - put an entry on the free list.  Called with
+ *		    mon_free_lock held.
+ */
 static void
 mon_free_entry(
 	mon_entry *m
 	)
 {
 	ZERO(*m);
-	LINK_SLIST(mon_free, m, hash_next);
+	LINK_SLIST(mon_free, m, free_next);
 }
 
 
 /*
- * mon_reclaim_entry - Remove an entry from the MRU list and from the
- *		       hash array, then zero-initialize it.  Indirectly
- *		       decrements mru_entries.
+ * mon_reclaim_entry - Remove an entry from its shard's MRU list and
+ *		       from the hash array, then zero-initialize it.
+ *		       Indirectly decrements mru_entries.
 
  * The entry is prepared to be reused.  Before return, in
  * remove_from_hash(), mru_entries is decremented.  It is the caller's
@@ -142,19 +378,99 @@ mon_free_entry(
  */
 static void
 mon_reclaim_entry(
+	struct mon_shard *shard,
 	mon_entry *m
 	)
 {
 	INSIST(NULL != m);
 
 	UNLINK_DLIST(m, mru);
-	remove_from_hash(m);
+	remove_from_hash(shard, m);
 	ZERO(*m);
 }
 
 
 /*
- * mon_getmoremem - get more memory and put it on the free list
+ * mon_add_entry, mon_drop_entries - count entries in and out of
+ *		  mru_entries, which all shards share.
+ */
+static void
+mon_add_entry(void)
+{
+	uint64_t n, peak;
+
+	n = __atomic_add_fetch(&mon_data.mru_entries, 1, __ATOMIC_RELAXED);
+	peak = __atomic_load_n(&mon_data.mru_peakentries, __ATOMIC_RELAXED);
+	while (n > peak &&
+	       !__atomic_compare_exchange_n(&mon_data.mru_peakentries,
+					    &peak, n, true, __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+		continue;
+}
+
+static void
+mon_drop_entries(
+	uint64_t n
+	)
+{
+	__atomic_fetch_sub(&mon_data.mru_entries, n, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * mon_clock_sweep - advance the CLOCK hand of a shard: referenced
+ *		     entries at the tail of its MRU list get a second
+ *		     chance at the head.  Called with the shard lock
+ *		     held, so nothing is hit meanwhile and one lap is
+ *		     enough.  Returns the oldest unreferenced entry, or
+ *		     NULL if the list is empty.
+ */
+static mon_entry *
+mon_clock_sweep(
+	struct mon_shard *shard
+	)
+{
+	mon_entry *tail;
+
+	for (;;) {
+		tail = TAIL_DLIST(shard->mru_list, mru);
+		if (NULL == tail || !tail->referenced)
+			return tail;
+		tail->referenced = false;
+		shard->referenced--;
+		UNLINK_DLIST(tail, mru);
+		LINK_DLIST(shard->mru_list, tail, mru);
+	}
+}
+
+
+/*
+ * mon_alloc - take an entry off the free list, getting more memory if
+ *	       it is empty.  With limit that is only done while fewer
+ *	       than mru_maxdepth entries exist; NULL once they do.
+ */
+static mon_entry *
+mon_alloc(
+	bool limit
+	)
+{
+	mon_entry *mon = NULL;
+
+	pthread_mutex_lock(&mon_free_lock);
+	if (!limit || NULL != mon_free ||
+	    mru_alloc < mon_data.mru_maxdepth) {
+		if (NULL == mon_free)
+			mon_getmoremem();
+		UNLINK_HEAD_SLIST(mon, mon_free, free_next);
+	}
+	pthread_mutex_unlock(&mon_free_lock);
+	return mon;
+}
+
+
+/*
+ * mon_getmoremem - get more memory and put it on the free list.
+ *		    Called with mon_free_lock held.
  */
 static void
 mon_getmoremem(void)
@@ -198,28 +514,41 @@ void
 mon_start(void)
 {
 	size_t octets;
-	unsigned int min_hash_slots;
+	uint64_t min_hash_slots;
+	uint8_t bits;
 
 	if (MON_OFF == mon_data.mon_enabled)
 		return;
+	mon_lock_all();
+	pthread_mutex_lock(&mon_free_lock);
 	if (0 == mon_mem_increments)
 		mon_getmoremem();
+	pthread_mutex_unlock(&mon_free_lock);
 	/* There used to be a 16 bit limit to mon_hash_bits.
 	 * and a target of 8 entries per hash slot.
 	 * That was not good with large MRU lists.
 	 * There was also a startup timing bug that got 13 bits.
+	 * Open addressing wants the table at most half full, and
+	 * huge maxdepth settings are served by growing on demand.
 	 */
-	min_hash_slots = mon_data.mru_maxdepth;  /* 1 hash slot per entry */
-	mon_data.mon_hash_bits = 0;
+	min_hash_slots = mon_data.mru_maxdepth * 2 / MON_SHARDS;
+	bits = 0;
 	while (min_hash_slots >>= 1)
-		mon_data.mon_hash_bits++;
-	mon_data.mon_hash_bits = max(4, mon_data.mon_hash_bits);
-	mon_data.mon_hash_bits = min(24, mon_data.mon_hash_bits);
-	octets = sizeof(*mon_data.mon_hash) * MON_HASH_SLOTS;
-	msyslog(LOG_INFO, "INIT: MRU %llu entries, %d hash bits, %llu bytes",
-		(unsigned long long)mon_data.mru_maxdepth,
-		mon_data.mon_hash_bits, (unsigned long long)octets);
-	mon_data.mon_hash = erealloc_zero(mon_data.mon_hash, octets, 0);
+		bits++;
+	bits = max(MON_HASH_BITS_MIN, bits);
+	bits = min(MON_HASH_INIT_MAX, bits);
+	octets = sizeof(*mon_shards[0].table) << bits;
+	__atomic_store_n(&mon_data.mru_hashslots, (uint64_t)MON_SHARDS << bits,
+			 __ATOMIC_RELAXED);
+	msyslog(LOG_INFO, "INIT: MRU %llu entries, %u shards of %d hash bits, %llu bytes",
+		(unsigned long long)mon_data.mru_maxdepth, MON_SHARDS,
+		bits, (unsigned long long)octets * MON_SHARDS);
+	for (unsigned int i = 0; i < MON_SHARDS; i++) {
+		mon_shards[i].bits = bits;
+		mon_shards[i].table = erealloc_zero(mon_shards[i].table,
+						    octets, 0);
+	}
+	mon_unlock_all();
 }
 
 
@@ -230,24 +559,35 @@ void
 mon_stop(void)
 {
 	mon_entry *mon;
+	struct mon_shard *shard;
 
 	if (MON_OFF == mon_data.mon_enabled)
 		return;
 
-	/*
-	 * Move everything on the MRU list to the free list quickly,
-	 * without bothering to remove each from either the MRU list or
-	 * the hash table.
-	 */
-	ITER_DLIST_BEGIN(mon_data.mon_mru_list, mon, mru, mon_entry)
-		mon_free_entry(mon);
-	ITER_DLIST_END()
+	for (unsigned int i = 0; i < MON_SHARDS; i++) {
+		shard = &mon_shards[i];
+		shard_lock(shard);
+		/*
+		 * Move everything on the MRU list to the free list
+		 * quickly, without bothering to remove each from
+		 * either the MRU list or the hash table.
+		 */
+		pthread_mutex_lock(&mon_free_lock);
+		ITER_DLIST_BEGIN(shard->mru_list, mon, mru, mon_entry)
+			mon_free_entry(mon);
+		ITER_DLIST_END()
+		pthread_mutex_unlock(&mon_free_lock);
 
-	/* empty the MRU list and hash table. */
-	mon_data.mru_entries = 0;
-	mon_data.mru_hashslots = 0;
-	INIT_DLIST(mon_data.mon_mru_list, mru);
-	memset(mon_data.mon_hash, '\0', sizeof(*mon_data.mon_hash) * MON_HASH_SLOTS);
+		/* empty the MRU list and hash table. */
+		mon_drop_entries(shard->entries);
+		shard->entries = 0;
+		shard->referenced = 0;
+		INIT_DLIST(shard->mru_list, mru);
+		if (NULL != shard->table)
+			memset(shard->table, '\0',
+			       sizeof(*shard->table) * SHARD_SLOTS(shard));
+		shard_unlock(shard);
+	}
 }
 
 
@@ -261,43 +601,320 @@ mon_clearinterface(
 	)
 {
 	mon_entry *mon;
+	struct mon_shard *shard;
 
-	/* iterate mon over mon_mru_list */
-	ITER_DLIST_BEGIN(mon_data.mon_mru_list, mon, mru, mon_entry)
-		if (mon->lcladr == lcladr) {
-			/* remove from mru list */
-			UNLINK_DLIST(mon, mru);
-			/* remove from hash list, adjust mru_entries */
-			remove_from_hash(mon);
-			/* put on free list */
-			mon_free_entry(mon);
-		}
-	ITER_DLIST_END()
+	for (unsigned int i = 0; i < MON_SHARDS; i++) {
+		shard = &mon_shards[i];
+		shard_lock(shard);
+		/* iterate mon over the shard's MRU list */
+		ITER_DLIST_BEGIN(shard->mru_list, mon, mru, mon_entry)
+			if (mon->lcladr == lcladr) {
+				/* remove from mru list */
+				UNLINK_DLIST(mon, mru);
+				/* remove from hash list, adjust mru_entries */
+				remove_from_hash(shard, mon);
+				/* put on free list */
+				pthread_mutex_lock(&mon_free_lock);
+				mon_free_entry(mon);
+				pthread_mutex_unlock(&mon_free_lock);
+			}
+		ITER_DLIST_END()
+		shard_unlock(shard);
+	}
 }
 
+/*
+ * mon_get_slot - look up an address.  The caller must hold
+ * mon_lock_all() for the entry to stay put.
+ */
 mon_entry *mon_get_slot(sockaddr_u *addr)
 {
-	mon_entry *mon;
+	uint32_t hash = MON_HASH(addr);
 
-	mon = mon_data.mon_hash[MON_HASH(addr)];
-	for (; mon != NULL; mon = mon->hash_next)
-		if (SOCK_EQ(&mon->rmtadr, addr))
-			break;
-	return mon;
+	return hash_lookup(MON_SHARD(hash), addr, hash);
 }
 
-int mon_get_oldest_age(l_fp now)
+static int
+oldest_age(
+	const mon_entry *oldest,
+	l_fp now
+	)
 {
-    mon_entry *	oldest;
-    if (mon_data.mru_entries == 0)
+    if (NULL == oldest)
 	return 0;
-    oldest = TAIL_DLIST(mon_data.mon_mru_list, mru);
     now -= oldest->last;
     /* add one-half second to round up */
     now += 0x80000000;
     return lfpsint(now);
 }
 
+int mon_get_oldest_age(l_fp now)
+{
+    struct mon_shard *shard;
+    int		age = 0;
+
+    for (unsigned int i = 0; i < MON_SHARDS; i++) {
+	shard = &mon_shards[i];
+	shard_lock(shard);
+	age = max(age, oldest_age(mon_clock_sweep(shard), now));
+	shard_unlock(shard);
+    }
+    return age;
+}
+
+
+/*
+ * mon_shard_stats - occupancy and lock statistics of one shard.
+ */
+void
+mon_shard_stats(
+	unsigned int		which,
+	struct mon_shard_stats *stats
+	)
+{
+	struct mon_shard *shard;
+
+	REQUIRE(which < MON_SHARDS);
+	shard = &mon_shards[which];
+	pthread_mutex_lock(&shard->lock);
+	stats->entries = shard->entries;
+	stats->exists = shard->exists;
+	stats->waits = shard->waits;
+	pthread_mutex_unlock(&shard->lock);
+}
+
+
+static int
+mon_last_cmp(
+	const void *a,
+	const void *b
+	)
+{
+	const mon_entry *ma = *(const mon_entry * const *)a;
+	const mon_entry *mb = *(const mon_entry * const *)b;
+
+	if (ma->last < mb->last)
+		return -1;
+	return (ma->last > mb->last);
+}
+
+
+/*
+ * shard_sort - put a shard's MRU list back in last-seen order.
+ *		Referenced entries are pulled out, sorted, and merged
+ *		back in, the others are already in order.  A shard
+ *		that nobody hit since it was last sorted is left alone.
+ *		Called with the shard lock held.
+ */
+static void
+shard_sort(
+	struct mon_shard *shard
+	)
+{
+	mon_entry **moved;
+	mon_entry *mon, *next, *pos;
+	mon_entry * const head = &shard->mru_list;
+	size_t count, i;
+
+	count = shard->referenced;
+	if (0 == count)
+		return;
+
+	moved = eallocarray(count, sizeof(*moved));
+	i = 0;
+	for (mon = head->mru.f; mon != head && i < count; mon = next) {
+		next = mon->mru.f;
+		if (mon->referenced) {
+			mon->referenced = false;
+			UNLINK_DLIST(mon, mru);
+			moved[i++] = mon;
+		}
+	}
+	INSIST(i == count);
+	shard->referenced = 0;
+	qsort(moved, count, sizeof(*moved), mon_last_cmp);
+
+	/*
+	 * Merge walking from the tail (oldest) toward the head; each
+	 * entry goes in on the older side of the first newer one.
+	 */
+	pos = head->mru.b;
+	for (i = 0; i < count; i++) {
+		mon = moved[i];
+		while (pos != head && pos->last <= mon->last)
+			pos = pos->mru.b;
+		mon->mru.b = pos;
+		mon->mru.f = pos->mru.f;
+		pos->mru.f->mru.b = mon;
+		pos->mru.f = mon;
+	}
+	free(moved);
+}
+
+
+/*
+ * mon_sort_mru - put every shard's MRU list back in last-seen order
+ *		  before they are walked for an mrulist request.  Each
+ *		  shard is locked only while it is sorted.
+ */
+void
+mon_sort_mru(void)
+{
+	struct mon_shard *shard;
+
+	for (unsigned int i = 0; i < MON_SHARDS; i++) {
+		shard = &mon_shards[i];
+		shard_lock(shard);
+		shard_sort(shard);
+		shard_unlock(shard);
+	}
+}
+
+
+/*
+ * mon_scan_shard - call scan for each entry of one shard, oldest first,
+ *		    with only that shard locked.  Merging what it gets
+ *		    from every shard by last-seen time gives the whole
+ *		    MRU list, nearly as it was.
+ */
+void
+mon_scan_shard(
+	unsigned int	which,
+	mon_scanner_t	scan,
+	void *		arg
+	)
+{
+	struct mon_shard *shard;
+	mon_entry *mon;
+
+	REQUIRE(which < MON_SHARDS);
+	shard = &mon_shards[which];
+	shard_lock(shard);
+	shard_sort(shard);
+	for (mon = TAIL_DLIST(shard->mru_list, mru);
+	     NULL != mon;
+	     mon = PREV_DLIST(shard->mru_list, mon, mru))
+		(*scan)(mon, arg);
+	shard_unlock(shard);
+}
+
+
+/*
+ * mon_walk_start - set up a walk over the MRU lists of all shards,
+ *		    merged oldest first by last-seen time, with ties
+ *		    taken in shard order.  The walk starts at from, or
+ *		    at the oldest entry if from is NULL.  The caller
+ *		    must hold mon_lock_all().
+ */
+void
+mon_walk_start(
+	struct mon_walk *walk,
+	mon_entry *	from
+	)
+{
+	struct mon_shard *home = NULL;
+	struct mon_shard *shard;
+	mon_entry *mon;
+
+	if (NULL != from)
+		home = MON_SHARD(MON_HASH(&from->rmtadr));
+	for (unsigned int i = 0; i < MON_SHARDS; i++) {
+		shard = &mon_shards[i];
+		mon = TAIL_DLIST(shard->mru_list, mru);
+		if (shard == home)
+			mon = from;
+		else if (NULL != from)
+			/* skip what the merge puts before from */
+			while (NULL != mon &&
+			       (mon->last < from->last ||
+				(mon->last == from->last && shard < home)))
+				mon = PREV_DLIST(shard->mru_list, mon, mru);
+		walk->next[i] = mon;
+	}
+}
+
+
+/*
+ * mon_walk_next - the next entry of a walk, NULL at the end.
+ */
+mon_entry *
+mon_walk_next(
+	struct mon_walk *walk
+	)
+{
+	mon_entry *mon = NULL;
+	unsigned int pick = 0;
+
+	for (unsigned int i = 0; i < MON_SHARDS; i++)
+		if (NULL != walk->next[i] &&
+		    (NULL == mon || walk->next[i]->last < mon->last)) {
+			mon = walk->next[i];
+			pick = i;
+		}
+	if (NULL != mon)
+		walk->next[pick] = PREV_DLIST(mon_shards[pick].mru_list,
+					      mon, mru);
+	return mon;
+}
+
+
+/*
+ * mon_hit - update the statistics of an existing entry and apply the
+ *	     rate limits.  Called with the entry's shard lock held.
+ */
+static unsigned short
+mon_hit(
+	struct mon_shard *shard,
+	mon_entry *	mon,
+	struct recvbuf *rbufp,
+	unsigned short	flags
+	)
+{
+	l_fp		delta_fp;
+	unsigned short	restrict_mask;
+	float		since_last;	/* seconds since last packet */
+
+	delta_fp = rbufp->recv_time-mon->last;
+	mon->last = rbufp->recv_time;
+	NSRCPORT(&mon->rmtadr) = NSRCPORT(&rbufp->recv_srcadr);
+	mon->count++;
+	restrict_mask = flags;
+	mon->vn_mode = VN_MODE(PKT_VERSION(rbufp->recv_buffer[0]),
+			       PKT_MODE(rbufp->recv_buffer[0]));
+
+	/* The MRU list catches up lazily, see mon_clock_sweep(). */
+	if (!mon->referenced) {
+		mon->referenced = true;
+		shard->referenced++;
+	}
+
+	/* Keep score:
+	 * if packets arrive at 1/second,
+	 * score will build up to (almost) 1.0
+	 */
+	since_last = ldexpf(delta_fp, -32);
+	mon->score *= expf(-since_last/mon_data.decay_time);
+	mon->score += 1.0/mon_data.decay_time;
+
+	if (mon->score < mon_data.rate_limit) {
+		/* low score, turn off reject bits */
+		restrict_mask &= ~(RES_LIMITED | RES_KOD);
+	}
+	if (RES_LIMITED & restrict_mask)
+		mon->dropped++;
+
+	/* HACK: Much abusive traffic is big bursts.
+	 * Don't send KoDs for them or we can be used
+	 * as a DDoS reflector to hide the true source. */
+	if (mon->score > (+mon_data.kod_limit+mon_data.rate_limit)) {
+		restrict_mask &= ~RES_KOD;
+	}
+
+	mon->flags = restrict_mask;
+	return mon->flags;
+}
+
+
 /*
  * ntp_monitor - record stats about this packet
  *
@@ -312,6 +929,8 @@ int mon_get_oldest_age(l_fp now)
  * such responses.  ntpq -c reslist lets you see whether RES_LIMITED
  * or RES_KOD is lit for a particular address before ntp_monitor()'s
  * typical dousing.
+ *
+ * Safe to call from several threads at once.
  */
 unsigned short
 ntp_monitor(
@@ -319,77 +938,35 @@ ntp_monitor(
 	unsigned short	flags
 	)
 {
-	l_fp		delta_fp;
 	mon_entry *	mon;
 	mon_entry *	oldest;
-	int		oldest_age;
-	unsigned int	hash;
+	int		age;
+	uint32_t	hash;
+	struct mon_shard *shard;
 	unsigned short	restrict_mask;
-	uint8_t		mode;
-	uint8_t		version;
-	uint8_t		li_vn_mode;
-	float		since_last;	/* seconds since last packet */
 
 	if (mon_data.mon_enabled == MON_OFF)
 		return ~(RES_LIMITED | RES_KOD) & flags;
 
 	hash = MON_HASH(&rbufp->recv_srcadr);
-	li_vn_mode = rbufp->recv_buffer[0];
-	mode = PKT_MODE(li_vn_mode);
-	version = PKT_VERSION(li_vn_mode);
-	mon = mon_data.mon_hash[hash];
+	shard = MON_SHARD(hash);
 	/*
 	 * We keep track of all traffic for a given IP in one entry,
 	 * otherwise cron'ed ntpdate or similar evades RES_LIMITED.
 	 */
-
-	for (; mon != NULL; mon = mon->hash_next)
-		if (SOCK_EQ(&mon->rmtadr, &rbufp->recv_srcadr))
-			break;
-
+	shard_lock(shard);
+	mon = hash_lookup(shard, &rbufp->recv_srcadr, hash);
 	if (mon != NULL) {
-		mon_data.mru_exists++;
-		delta_fp = rbufp->recv_time-mon->last;
-		mon->last = rbufp->recv_time;
-		NSRCPORT(&mon->rmtadr) = NSRCPORT(&rbufp->recv_srcadr);
-		mon->count++;
-		restrict_mask = flags;
-		mon->vn_mode = VN_MODE(version, mode);
-
-		/* Shuffle to the head of the MRU list. */
-		UNLINK_DLIST(mon, mru);
-		LINK_DLIST(mon_data.mon_mru_list, mon, mru);
-
-		/* Keep score:
-		 * if packets arrive at 1/second,
-		 * score will build up to (almost) 1.0
-		 */
-		since_last = ldexpf(delta_fp, -32);
-		mon->score *= expf(-since_last/mon_data.decay_time);
-		mon->score += 1.0/mon_data.decay_time;
-
-		if (mon->score < mon_data.rate_limit) {
-			/* low score, turn off reject bits */
-			restrict_mask &= ~(RES_LIMITED | RES_KOD);
-		}
-		if (RES_LIMITED & restrict_mask)
-			mon->dropped++;
-
-		/* HACK: Much abusive traffic is big bursts.
-		 * Don't send KoDs for them or we can be used
-		 * as a DDoS reflector to hide the true source. */
-		if (mon->score > (+mon_data.kod_limit+mon_data.rate_limit)) {
-			restrict_mask &= ~RES_KOD;
-		}
-
-		mon->flags = restrict_mask;
-		return mon->flags;
+		shard->exists++;
+		restrict_mask = mon_hit(shard, mon, rbufp, flags);
+		shard_unlock(shard);
+		return restrict_mask;
 	}
 
 	/*
 	 * If we got here, this is the first we've heard of this
 	 * guy.  Get him some memory, either from the free list
-	 * or from the tail of the MRU list.
+	 * or from the tail of his shard's MRU list.
 	 *
 	 * The following ntp.conf "mru" knobs come into play determining
 	 * the depth (or count) of the MRU list:
@@ -420,29 +997,25 @@ ntp_monitor(
 	 * initmem", and for "mru incalloc" and "mru incmem".
 	 */
 	if (mon_data.mru_entries < mon_data.mru_mindepth) {
-		mon_data.mru_new++;
-		if (NULL == mon_free)
-			mon_getmoremem();
-		UNLINK_HEAD_SLIST(mon, mon_free, hash_next);
+		COUNT_INC(mon_data.mru_new);
+		mon = mon_alloc(false);
 	} else {
-		oldest = TAIL_DLIST(mon_data.mon_mru_list, mru);
-		oldest_age = mon_get_oldest_age(rbufp->recv_time);
-		if (mon_data.mru_maxage < oldest_age) {
-			mon_data.mru_recycleold++;
-			mon_reclaim_entry(oldest);
+		oldest = mon_clock_sweep(shard);
+		age = oldest_age(oldest, rbufp->recv_time);
+		if (NULL != oldest && mon_data.mru_maxage < age) {
+			COUNT_INC(mon_data.mru_recycleold);
+			mon_reclaim_entry(shard, oldest);
 			mon = oldest;
-		} else if (mon_free != NULL || mru_alloc < mon_data.mru_maxdepth) {
-			mon_data.mru_new++;
-			if (NULL == mon_free)
-				mon_getmoremem();
-			UNLINK_HEAD_SLIST(mon, mon_free, hash_next);
-		} else if (oldest_age < mon_data.mru_minage) {
-			mon_data.mru_none++;
+		} else if (NULL != (mon = mon_alloc(true))) {
+			COUNT_INC(mon_data.mru_new);
+		} else if (NULL == oldest || age < mon_data.mru_minage) {
+			/* an empty shard has nothing of its own to give */
+			COUNT_INC(mon_data.mru_none);
+			shard_unlock(shard);
 			return ~(RES_LIMITED | RES_KOD) & flags;
 		} else {
-			mon_data.mru_recyclefull++;
-			/* coverity[var_deref_model] */
-			mon_reclaim_entry(oldest);
+			COUNT_INC(mon_data.mru_recyclefull);
+			mon_reclaim_entry(shard, oldest);
 			mon = oldest;
 		}
 	}
@@ -451,9 +1024,7 @@ ntp_monitor(
 	 * Got one, initialize it
 	 */
 	REQUIRE(mon != NULL);
-	mon_data.mru_entries++;
-	mon_data.mru_peakentries = max(mon_data.mru_peakentries,
-								   mon_data.mru_entries);
+	mon_add_entry();
 	mon->last = rbufp->recv_time;
 	mon->first = mon->last;
 	mon->count = 1;
@@ -461,19 +1032,24 @@ ntp_monitor(
 	mon->score = 1.0/mon_data.decay_time;
 	mon->flags = ~(RES_LIMITED | RES_KOD) & flags;
 	memcpy(&mon->rmtadr, &rbufp->recv_srcadr, sizeof(mon->rmtadr));
-	mon->vn_mode = VN_MODE(version, mode);
+	mon->vn_mode = VN_MODE(PKT_VERSION(rbufp->recv_buffer[0]),
+			       PKT_MODE(rbufp->recv_buffer[0]));
 	mon->lcladr = rbufp->dstadr;
 
 	/*
-	 * Drop him into front of the hash table. Also put him on top of
-	 * the MRU list.
+	 * Drop him into the hash table. Also put him on top of his
+	 * shard's MRU list.
 	 */
-	if (NULL == mon_data.mon_hash[hash])
-		mon_data.mru_hashslots++;
-	LINK_SLIST(mon_data.mon_hash[hash], mon, hash_next);
-	LINK_DLIST(mon_data.mon_mru_list, mon, mru);
+	shard->entries++;
+	if (shard->entries * 4 > SHARD_SLOTS(shard) * 3 &&
+	    shard->bits < MON_HASH_BITS_MAX)
+		hash_grow(shard);
+	hash_insert(shard, mon, hash);
+	LINK_DLIST(shard->mru_list, mon, mru);
+	restrict_mask = mon->flags;
 
-	return mon->flags;
+	shard_unlock(shard);
+	return restrict_mask;
 }
 
 /* This is a hack to sanity check the MRU list
@@ -492,13 +1068,13 @@ void mon_timer(void) {
 	long int count = 0, hits = 0;
 	l_fp when = 0;
 	mon_entry *mon, *slot;
+	struct mon_walk walk;
 	struct timespec start, finish;
 	float scan_time;
 
 	clock_gettime(CLOCK_REALTIME, &start);
-	for (	mon = TAIL_DLIST(mon_data.mon_mru_list, mru);
-		mon != NULL;
-		mon = PREV_DLIST(mon_data.mon_mru_list, mon, mru)) {
+	mon_walk_start(&walk, NULL);
+	while (NULL != (mon = mon_walk_next(&walk))) {
 	  count++;
 	  /* check if lookup of addr gets this slot */
 	  slot = mon_get_slot(&mon->rmtadr);
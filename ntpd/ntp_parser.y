@@ -60,6 +60,7 @@
 %token	<Integer>	T_Average
 %token	<Integer>	T_Baud
 %token	<Integer>	T_Bias
+%token	<Integer>	T_Binary
 %token	<Integer>	T_Burst
 %token	<Integer>	T_Calibrate
 %token	<Integer>	T_Ca
@@ -75,6 +76,7 @@
 %token	<Integer>	T_Default
 %token	<Integer>	T_Disable
 %token	<Integer>	T_Dispersion
+%token	<Integer>	T_Dnsworkers
 %token	<Double>	T_Double		/* Not a token */
 %token	<Integer>	T_Driftfile
 %token	<Integer>	T_Drop
@@ -112,7 +114,10 @@
 %token	<Integer>	T_Ipv4_flag
 %token	<Integer>	T_Ipv6
 %token	<Integer>	T_Ipv6_flag
+%token	<Integer>	T_Kemaxconns
 %token	<Integer>	T_Kernel
+%token	<Integer>	T_Keserver
+%token	<Integer>	T_Keworkers
 %token	<Integer>	T_Key
 %token	<Integer>	T_Keys
 %token	<Integer>	T_Kod
@@ -179,7 +184,9 @@
 %token	<Integer>	T_Ppspath
 %token	<Integer>	T_Prefer
 %token	<Integer>	T_Protostats
+%token	<Integer>	T_Ratchet
 %token	<Integer>	T_Rawstats
+%token	<Integer>	T_Recvbatch
 %token	<Integer>	T_Refclock
 %token	<Integer>	T_Refid
 %token	<Integer>	T_Requestkey
@@ -188,7 +195,9 @@
 %token	<Integer>	T_Restrict
 %token	<Integer>	T_Rlimit
 %token	<Integer>	T_Saveconfigdir
+%token	<Integer>	T_Sendbatch
 %token	<Integer>	T_Server
+%token	<Integer>	T_Serverworkers
 %token	<Integer>	T_Setvar
 %token	<Integer>	T_Source
 %token	<Integer>	T_Stacksize
@@ -204,6 +213,7 @@
 %token	<String>	T_String		/* Not a token */
 %token	<Integer>	T_Sys
 %token	<Integer>	T_Sysstats
+%token	<Integer>	T_Text
 %token	<Integer>	T_Tick
 %token	<Integer>	T_Time1
 %token	<Integer>	T_Time2
@@ -212,6 +222,7 @@
 %token	<Integer>	T_Tinker
 %token	<Integer>	T_Tlsciphers
 %token	<Integer>	T_Tlsciphersuites
+%token	<Integer>	T_Tlsresume
 %token	<Integer>	T_Tos
 %token	<Integer>	T_True
 %token	<Integer>	T_Trustedkey
@@ -293,9 +304,11 @@
 %type	<Integer>	system_option_local_flag_keyword
 %type	<Attr_val_fifo>	system_option_list
 %type	<Integer>	t_default_or_zero
+%type	<Integer>	text_binary
 %type	<Integer>	tinker_option_keyword
 %type	<Attr_val>	tinker_option
 %type	<Attr_val_fifo>	tinker_option_list
+%type	<Integer>	nts_int_option_keyword
 %type	<Integer>	nts_string_option_keyword
 %type	<Attr_val>	nts_option
 %type	<Attr_val_fifo>	nts_option_list
@@ -474,6 +487,8 @@ option_string
 			{ $$ = create_attr_sval($1, $2); }
 	|	T_Require T_String
 			{ $$ = create_attr_sval($1, $2); }
+	|	T_Keserver T_String
+			{ $$ = create_attr_sval($1, $2); }
 	|	T_Ca T_String
 			{ $$ = create_attr_sval($1, $2); }
 	|	T_Cert T_String
@@ -703,6 +718,15 @@ filegen_option
 				yyerror(err);
 			}
 		}
+	|	text_binary
+		{
+			if (lex_from_file()) {
+				$$ = create_attr_ival(T_Flag, $1);
+			} else {
+				$$ = NULL;
+				yyerror("filegen format remote config ignored");
+			}
+		}
 	|	enable_disable
 			{ $$ = create_attr_ival(T_Flag, $1); }
 	;
@@ -712,6 +736,11 @@ link_nolink
 	|	T_Nolink
 	;
 
+text_binary
+	:	T_Text
+	|	T_Binary
+	;
+
 enable_disable
 	:	T_Enable
 	|	T_Disable
@@ -1127,12 +1156,23 @@ nts_option_list
 nts_option
 	:	nts_string_option_keyword T_String
 			{ $$ = create_attr_sval($1, $2); }
+	|	nts_int_option_keyword T_Integer
+			{ $$ = create_attr_ival($1, $2); }
 	|	T_Disable
 			{ $$ = create_attr_ival($1, 0); }
 	|	T_Enable
 			{ $$ = create_attr_ival($1, 1); }
+	|	T_Ratchet
+			{ $$ = create_attr_ival($1, 1); }
+	|	T_Tlsresume
+			{ $$ = create_attr_ival($1, 1); }
+	;
+
 	;
 
+nts_int_option_keyword
+	:	T_Kemaxconns
+	|	T_Keworkers
 	;
 
 nts_string_option_keyword
@@ -1228,7 +1268,11 @@ misc_cmd_dbl_keyword
 	;
 
 misc_cmd_int_keyword
-	:	T_Dscp
+	:	T_Dnsworkers
+	|	T_Dscp
+	|	T_Recvbatch
+	|	T_Sendbatch
+	|	T_Serverworkers
 	;
 
 misc_cmd_int_keyword
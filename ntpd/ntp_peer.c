@@ -403,6 +403,9 @@ free_peer(
 
 	if (p->hostname != NULL)
 		free(p->hostname);
+#ifndef DISABLE_NTS
+	nts_client_forget(p);
+#endif
 
 	/* Add his corporeal form to peer free list */
 	ZERO(*p);
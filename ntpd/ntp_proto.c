@@ -18,6 +18,11 @@
 #include <libscf.h>
 #endif
 #include <unistd.h>
+#include <pthread.h>
+
+#if defined(HAVE_STDATOMIC_H) && !defined(__COVERITY__)
+# include <stdatomic.h>
+#endif /* HAVE_STDATOMIC_H */
 
 
 /*
@@ -101,6 +106,27 @@ typedef struct peer_select_tag {
 struct system_variables sys_vars;
 static uint8_t	xmt_leap;		/* leap indicator sent in client requests */
 
+/*
+ * Server reply template.  Everything in a server reply that comes from
+ * the system variables is encoded once, in network order, into the
+ * first LEN_PKT_NOMAC octets of a reply, and republished whenever the
+ * discipline changes them.  fast_xmit() copies the header and only
+ * fills in the version, poll and timestamps.
+ *
+ * The main thread is the only writer.  Readers, which may be server
+ * workers (see ntp_io.c), use reply_tmpl_seq as a seqlock: it is odd
+ * while an update is under way and readers retry if it moved.
+ */
+struct reply_template {
+	uint8_t		header[LEN_PKT_NOMAC];	/* version 0, mode server */
+#ifdef ENABLE_LEAP_SMEAR
+	bool		smear;		/* leap smear in progress */
+	l_fp		smear_offset;	/* add to rec and xmt */
+#endif
+};
+static struct reply_template reply_tmpl;
+static volatile unsigned int reply_tmpl_seq;
+
 #ifdef ENABLE_LEAP_SMEAR
 struct leap_smear_info leap_smear;
 #endif
@@ -184,7 +210,7 @@ uint64_t stat_restricted(void)
 
 void increment_restricted(void)
 {
-  stat_count.sys_restricted++;
+  COUNT_INC(stat_count.sys_restricted);
 }
 
 uint64_t stat_newversion(void)
@@ -252,6 +278,7 @@ static	double	root_distance	(struct peer *);
 static	void	restart_nts_ke	(struct peer *);
 #endif
 static	void	maybe_log_junk	(const char *tag, struct recvbuf *rbuf);
+static	void	read_reply_template(struct reply_template *);
 
 void
 set_sys_leap(unsigned char new_sys_leap) {
@@ -279,6 +306,87 @@ set_sys_leap(unsigned char new_sys_leap) {
 		}
 #endif	/* ENABLE_LEAP_SMEAR */
 	}
+	publish_reply_template();
+}
+
+#ifdef ENABLE_LEAP_SMEAR
+
+static void
+leap_smear_add_offs(l_fp *t) {
+	*t += leap_smear.offset;
+}
+
+#endif	/* ENABLE_LEAP_SMEAR */
+
+static inline void
+reply_tmpl_barrier(void)
+{
+#if defined(HAVE_STDATOMIC_H) && !defined(__COVERITY__)
+	atomic_thread_fence(memory_order_seq_cst);
+#endif /* HAVE_STDATOMIC_H */
+}
+
+/*
+ * publish_reply_template - re-encode the server reply template from
+ * sys_vars.  Main thread only; call it after changing any of the
+ * variables a reply carries.
+ */
+void
+publish_reply_template(void)
+{
+	struct pkt		xpkt;
+	struct reply_template	tmpl;
+	l_fp			reftime = sys_vars.sys_reftime;
+
+	ZERO(tmpl);
+	xpkt.li_vn_mode = PKT_LI_VN_MODE(sys_vars.sys_leap, 0, MODE_SERVER);
+	xpkt.stratum = STRATUM_TO_PKT(sys_vars.sys_stratum);
+	xpkt.ppoll = 0;
+	xpkt.precision = sys_vars.sys_precision;
+	xpkt.rootdelay = HTONS_FP(DTOUFP(sys_vars.sys_rootdelay));
+	xpkt.rootdisp = HTONS_FP(DTOUFP(sys_vars.sys_rootdisp));
+	xpkt.refid = sys_vars.sys_refid;
+
+#ifdef ENABLE_LEAP_SMEAR
+	/*
+	 * If we are inside the leap smear interval we add the current
+	 * smear offset to the reftime, so it isn't later than the
+	 * smeared transmit/receive times, and show the offset in the
+	 * refid.
+	 */
+	if (leap_smear.in_progress) {
+		leap_smear_add_offs(&reftime);
+		xpkt.refid = convertLFPToRefID(leap_smear.offset);
+		tmpl.smear = true;
+		tmpl.smear_offset = leap_smear.offset;
+	}
+#endif
+	xpkt.reftime = htonl_fp(reftime);
+	memcpy(tmpl.header, &xpkt, LEN_PKT_NOMAC);
+
+	reply_tmpl_seq++;
+	reply_tmpl_barrier();
+	reply_tmpl = tmpl;
+	reply_tmpl_barrier();
+	reply_tmpl_seq++;
+}
+
+/*
+ * read_reply_template - get a consistent copy of the reply template
+ */
+static void
+read_reply_template(
+	struct reply_template *tmpl
+	)
+{
+	unsigned int seq;
+
+	do {
+		seq = reply_tmpl_seq;
+		reply_tmpl_barrier();
+		*tmpl = reply_tmpl;
+		reply_tmpl_barrier();
+	} while ((seq & 1) || seq != reply_tmpl_seq);
 }
 
 /* Returns false for packets we want to reject out of hand: those with an
@@ -525,7 +633,7 @@ handle_procpkt(
 		}
 	} else {
 		/* This case should be unreachable. */
-		stat_count.sys_declined++;
+		COUNT_INC(stat_count.sys_declined);
 		return;
 	}
 
@@ -661,6 +769,30 @@ handle_procpkt(
 }
 
 
+/*
+ * screen_request - the restriction lookup and rate limiting that
+ * receive() does first, for server workers to run on a whole batch
+ * before they answer any of it.  receive() picks up the result from
+ * the buffer and counts it.
+ */
+void
+screen_request(
+	struct recvbuf *rbufp
+	)
+{
+	unsigned short restrict_mask;
+
+	if (!is_vn_mode_acceptable(rbufp))
+		return;		/* receive() drops it */
+	restrict_mask = restrictions(&rbufp->recv_srcadr);
+	rbufp->restricted = check_early_restrictions(rbufp, restrict_mask);
+	if (!rbufp->restricted)
+		restrict_mask = ntp_monitor(rbufp, restrict_mask);
+	rbufp->restrict_mask = restrict_mask;
+	rbufp->screened = true;
+}
+
+
 void
 receive(
 	struct recvbuf *rbufp
@@ -671,31 +803,40 @@ receive(
 	auth_info* auth = NULL;  /* !NULL if authenticated */
 	int mode;
 
-	stat_count.sys_received++;
+	COUNT_INC(stat_count.sys_received);
 
 	if(!is_vn_mode_acceptable(rbufp)) {
-		stat_count.sys_badlength++;
+		COUNT_INC(stat_count.sys_badlength);
 		return;
 	}
 
 	/* FIXME: This is lots more cleanup to do in this area. */
 
-	restrict_mask = restrictions(&rbufp->recv_srcadr);
+	if (rbufp->screened) {
+		/* a server worker has done these already */
+		restrict_mask = rbufp->restrict_mask;
+		if (rbufp->restricted) {
+			COUNT_INC(stat_count.sys_restricted);
+			return;
+		}
+	} else {
+		restrict_mask = restrictions(&rbufp->recv_srcadr);
 
-	if(check_early_restrictions(rbufp, restrict_mask)) {
-		stat_count.sys_restricted++;
-		return;
-	}
+		if(check_early_restrictions(rbufp, restrict_mask)) {
+			COUNT_INC(stat_count.sys_restricted);
+			return;
+		}
 
-	restrict_mask = ntp_monitor(rbufp, restrict_mask);
+		restrict_mask = ntp_monitor(rbufp, restrict_mask);
+	}
 	if (restrict_mask & RES_LIMITED) {
-		stat_count.sys_limitrejected++;
+		COUNT_INC(stat_count.sys_limitrejected);
 		if(!(restrict_mask & RES_KOD)) { return; }
 	}
 
 	if(is_control_packet(rbufp)) {
 		process_control(rbufp, restrict_mask);
-		stat_count.sys_processed++;
+		COUNT_INC(stat_count.sys_processed);
 		return;
 	}
 
@@ -706,18 +847,18 @@ receive(
 	{
 	uint8_t hisversion = PKT_VERSION(rbufp->recv_buffer[0]);
 	if (hisversion == NTP_VERSION) {
-		stat_count.sys_newversion++;		/* new version */
+		COUNT_INC(stat_count.sys_newversion);		/* new version */
 	} else if (!(restrict_mask & RES_VERSION) && hisversion >=
 	    NTP_OLDVERSION) {
-		stat_count.sys_oldversion++;		/* previous version */
+		COUNT_INC(stat_count.sys_oldversion);		/* previous version */
 	} else {
-		stat_count.sys_badlength++;
+		COUNT_INC(stat_count.sys_badlength);
 		return;			/* old version */
 	}
 	}
 
 	if (!parse_packet(rbufp)) {
-		stat_count.sys_badlength++;
+		COUNT_INC(stat_count.sys_badlength);
 		return;
 	}
 
@@ -729,7 +870,7 @@ receive(
 	     * with a different key. */
 	    peer = findpeer(rbufp);
 	    if (NULL == peer) {
-		stat_count.sys_declined++;
+		COUNT_INC(stat_count.sys_declined);
 		return;
 	    }
 	}
@@ -762,7 +903,7 @@ receive(
 				 (int)(rbufp->recv_length - (rbufp->mac_len + 4)),
 				 (int)(rbufp->mac_len + 4))) {
 
-			stat_count.sys_badauth++;
+			COUNT_INC(stat_count.sys_badauth);
 			if(peer != NULL) {
 				peer->badauth++;
 				peer->cfg.flags &= ~FLAG_AUTHENTIC;
@@ -780,16 +921,16 @@ receive(
 			  rbufp->recv_buffer, rbufp->recv_length)
 #endif
 ) {
-			stat_count.sys_declined++;
+			COUNT_INC(stat_count.sys_declined);
 			maybe_log_junk("EX-REQ", rbufp);
 			break;
 		}
 		fast_xmit(rbufp, auth, restrict_mask);
-		stat_count.sys_processed++;
+		COUNT_INC(stat_count.sys_processed);
 		break;
 	    case MODE_SERVER:  /* Reply to our request to a server. */
 		if (NULL == peer) {
-		    stat_count.sys_declined++;
+		    COUNT_INC(stat_count.sys_declined);
 		    break;
 		}
 		if ((peer->cfg.flags & FLAG_NTS)
@@ -799,7 +940,7 @@ receive(
 		          rbufp->recv_buffer, rbufp->recv_length)
 #endif
 )) {
-		    stat_count.sys_declined++;
+		    COUNT_INC(stat_count.sys_declined);
 		    maybe_log_junk("EX-REP", rbufp);
 		    break;
 		}
@@ -807,7 +948,7 @@ receive(
 		peer->cfg.flags |= FLAG_AUTHENTIC;
 		peer->timereceived = current_time;
 		handle_procpkt(rbufp, peer);
-		stat_count.sys_processed++;
+		COUNT_INC(stat_count.sys_processed);
 		peer->processed++;
 		break;
 	    default:
@@ -815,7 +956,7 @@ receive(
 		   which are a security nightmare.  So they go to the
 		   bit bucket until this improves.
 		*/
-		stat_count.sys_declined++;
+		COUNT_INC(stat_count.sys_declined);
 		break;
 	}
 
@@ -830,6 +971,7 @@ transmit(
 	)
 {
 	uint8_t	hpoll;
+	bool	refill = false;	/* NTS cookies */
 
 	/*
 	 * The polling state machine. There are two kinds of machines,
@@ -874,6 +1016,18 @@ transmit(
 		return;
         }
 
+#ifndef DISABLE_NTS
+	/*
+	 * If the last request was lost and the cookie pool is
+	 * getting low, follow up with one more request in a couple
+	 * of seconds rather than waiting a whole poll interval.
+	 * Each reply brings back the cookies we are missing.
+	 * Only on a regular poll, so an outage costs one extra.
+	 */
+	refill = (FLAG_NTS & peer->cfg.flags) && 0 == peer->burst &&
+	    !clock_ctl.mode_ntpdate && nts_cookies_low(peer);
+#endif
+
 	/*
 	 * In unicast modes the dance is much more intricate. It is
 	 * designed to back off whenever possible to minimize network
@@ -975,6 +1129,8 @@ transmit(
 		peer->retry--;
 
 	peer_xmit(peer);
+	if (refill)
+		peer->burst = 1;
 	poll_update(peer, hpoll);
 }
 
@@ -1143,6 +1299,7 @@ clock_update(
 	default:
 		break;
 	}
+	publish_reply_template();
 }
 
 
@@ -1283,11 +1440,14 @@ peer_clear(
 	 * first poll is delayed by the "discard minimum" to avoid rate
 	 * limiting. Other post-startup new or cleared associations
 	 * randomize the first poll over the minimum poll interval to
-	 * avoid implosion.
+	 * avoid implosion.  Associations that start with a DNS or
+	 * NTS-KE lookup go at once; dnsworkers limits those.
 	 */
 	peer->nextdate = peer->update = peer->outdate = current_time;
 	if (initializing1) {
-		peer->nextdate += (unsigned long)peer_associations;
+		if (!(FLAG_LOOKUP & peer->cfg.flags) &&
+		    !(MDF_POOL & peer->cast_flags))
+			peer->nextdate += (unsigned long)peer_associations;
 	} else {
 	    /*
 	     * Randomizing the next poll interval used to be done with
@@ -1537,6 +1697,7 @@ clock_select(void)
 		set_sys_leap(LEAP_NOTINSYNC);
 		sys_vars.sys_stratum = STRATUM_UNSPEC;
 		memcpy(&sys_vars.sys_refid, "DOWN", REFIDLEN);
+		publish_reply_template();
 	}
 
 	/*
@@ -2203,15 +2364,6 @@ peer_xmit(
 }
 
 
-#ifdef ENABLE_LEAP_SMEAR
-
-static void
-leap_smear_add_offs(l_fp *t) {
-	t += leap_smear.offset;
-}
-
-#endif	/* ENABLE_LEAP_SMEAR */
-
 /*
  * fast_xmit - Send packet for nonpersistent association. Note that
  * neither the source or destination can be a broadcast address.
@@ -2224,6 +2376,7 @@ fast_xmit(
 	)
 {
 	struct pkt xpkt;	/* transmit packet structure */
+	struct reply_template tmpl;	/* system state for the reply */
 	l_fp	xmt_tx;
 	struct timespec	start, finish;
 	size_t	sendlen;
@@ -2245,7 +2398,7 @@ fast_xmit(
 	 * synchronization.
 	 */
 	if (flags & RES_KOD) {
-		stat_count.sys_kodsent++;
+		COUNT_INC(stat_count.sys_kodsent);
 		xpkt.li_vn_mode = PKT_LI_VN_MODE(LEAP_NOTINSYNC,
 		    PKT_VERSION(rbufp->pkt.li_vn_mode), MODE_SERVER);
 		xpkt.stratum = STRATUM_PKT_UNSPEC;
@@ -2267,62 +2420,31 @@ fast_xmit(
 	 * This is a normal packet. Use the system variables.
 	 */
 	} else {
-#ifdef ENABLE_LEAP_SMEAR
-		/*
-		 * Make copies of the variables which can be affected by smearing.
-		 */
-		l_fp this_ref_time;
-		l_fp this_recv_time;
-#endif
+		l_fp	this_recv_time = rbufp->recv_time;
 
-		/*
-		 * If we are inside the leap smear interval we add the
-		 * current smear offset to the packet receive time, to
-		 * the packet transmit time, and eventually to the
-		 * reftime to make sure the reftime isn't later than
-		 * the transmit/receive times.
-		 */
-		xpkt.li_vn_mode = PKT_LI_VN_MODE(sys_vars.sys_leap,
-		    PKT_VERSION(rbufp->pkt.li_vn_mode), MODE_SERVER);
-		xpkt.stratum = STRATUM_TO_PKT(sys_vars.sys_stratum);
+		read_reply_template(&tmpl);
+		memcpy(&xpkt, tmpl.header, LEN_PKT_NOMAC);
+		xpkt.li_vn_mode |= VN_MODE(PKT_VERSION(rbufp->pkt.li_vn_mode), 0);
 		xpkt.ppoll = max(rbufp->pkt.ppoll, rstrct.ntp_minpoll);
-		xpkt.precision = sys_vars.sys_precision;
-		xpkt.refid = sys_vars.sys_refid;
-		xpkt.rootdelay = HTONS_FP(DTOUFP(sys_vars.sys_rootdelay));
-		xpkt.rootdisp = HTONS_FP(DTOUFP(sys_vars.sys_rootdisp));
+		xpkt.org.l_ui = htonl(rbufp->pkt.xmt >> 32);
+		xpkt.org.l_uf = htonl(rbufp->pkt.xmt & 0xFFFFFFFF);
 
+		get_systime(&xmt_tx);
 #ifdef ENABLE_LEAP_SMEAR
-		this_ref_time = sys_vars.sys_reftime;
-		if (leap_smear.in_progress) {
-			leap_smear_add_offs(&this_ref_time);
-			xpkt.refid = convertLFPToRefID(leap_smear.offset);
+		/*
+		 * Inside the leap smear interval the receive and
+		 * transmit times get the smear offset too.
+		 */
+		if (tmpl.smear) {
+			this_recv_time += tmpl.smear_offset;
+			xmt_tx += tmpl.smear_offset;
 			DPRINT(2, ("fast_xmit: leap_smear.in_progress: refid %8x, smear %s\n",
 				ntohl(xpkt.refid),
-				lfptoa(leap_smear.offset, 8)
+				lfptoa(tmpl.smear_offset, 8)
 				));
 		}
-		xpkt.reftime = htonl_fp(this_ref_time);
-#else
-		xpkt.reftime = htonl_fp(sys_vars.sys_reftime);
 #endif
-
-		xpkt.org.l_ui = htonl(rbufp->pkt.xmt >> 32);
-		xpkt.org.l_uf = htonl(rbufp->pkt.xmt & 0xFFFFFFFF);
-
-#ifdef ENABLE_LEAP_SMEAR
-		this_recv_time = rbufp->recv_time;
-		if (leap_smear.in_progress)
-			leap_smear_add_offs(&this_recv_time);
 		xpkt.rec = htonl_fp(this_recv_time);
-#else
-		xpkt.rec = htonl_fp(rbufp->recv_time);
-#endif
-
-		get_systime(&xmt_tx);
-#ifdef ENABLE_LEAP_SMEAR
-		if (leap_smear.in_progress)
-			leap_smear_add_offs(&xmt_tx);
-#endif
 		xpkt.xmt = htonl_fp(xmt_tx);
 	}
 
@@ -2347,7 +2469,12 @@ fast_xmit(
 	clock_gettime(CLOCK_REALTIME, &start);
 	if (rbufp->ntspacket.valid) {
 #ifndef DISABLE_NTS
-	  sendlen += extens_server_send(&rbufp->ntspacket, &xpkt);
+	  int extlen = extens_server_send(&rbufp->ntspacket, &xpkt);
+	  if (0 > extlen) {
+	    maybe_log_junk("NTS-big", rbufp);
+	    return;
+	  }
+	  sendlen += (size_t)extlen;
 #endif
         } else if (NULL != auth) {
 	  sendlen += (size_t)authencrypt(auth, (uint32_t *)&xpkt, (int)sendlen);
@@ -2360,9 +2487,11 @@ fast_xmit(
 	  maybe_log_junk("DDoS", rbufp);	/* needs a counter */
 	  return;
 	}
-	sendpkt(&rbufp->recv_srcadr, rbufp->dstadr, &xpkt, (int)sendlen);
+	queuepkt(rbufp, &xpkt, (unsigned int)sendlen);
 	clock_gettime(CLOCK_REALTIME, &finish);
-	sys_authdelay = tspec_to_d(sub_tspec(finish, start));
+	__atomic_store_n(&sys_authdelay,
+			 dtolfp(tspec_to_d(sub_tspec(finish, start))),
+			 __ATOMIC_RELAXED);
 	/* Previous versions of this code had separate DPRINT-s so it
 	 * could print the key on the auth case.  That requires separate
 	 * sendpkt-s on each branch or the DPRINT pollutes the timing. */
@@ -2493,6 +2622,7 @@ void dns_take_status(struct peer* peer, DNS_Status status) {
 	switch (status) {
 		case DNS_good:
 			txt = "good";
+			peer->dns_fails = 0;
 			if (FLAG_LOOKUP & peer->cfg.flags)
 				/* server: got answer, but didn't like any */
 				/* (all) already in use ?? */
@@ -2514,7 +2644,19 @@ void dns_take_status(struct peer* peer, DNS_Status status) {
 			break;
 		case DNS_error:
 			txt = "error";
-			hpoll += 4;
+#ifndef DISABLE_NTS
+			/* Try the next NTS-KE server before backing off */
+			if ((FLAG_NTS & peer->cfg.flags) &&
+			    nts_next_ke_server(peer)) {
+				hpoll = 3;
+				break;
+			}
+#endif
+			/* Back off per peer: 128 seconds, doubling
+			 * with each failure in a row. */
+			if (peer->dns_fails < 6)
+				peer->dns_fails++;
+			hpoll = 6 + peer->dns_fails;
 			break;
 		default:
 			txt = "default";
@@ -2530,7 +2672,10 @@ void dns_take_status(struct peer* peer, DNS_Status status) {
 	if (0 == hpoll)
 		return; /* hpoll already in use by new server */
 	peer->hpoll = hpoll;
-	peer->nextdate = current_time + (1U << hpoll);
+	/* Up to 1/8 more, so associations that failed together
+	 * don't all retry in the same second. */
+	peer->nextdate = current_time + (1U << hpoll) +
+	    ((unsigned long)random() & ((1U << (hpoll - 3)) - 1));
 }
 
 #ifndef DISABLE_NTS
@@ -2802,6 +2947,8 @@ set_sys_tick_precision(
 }
 
 	sys_vars.sys_precision = (int8_t)i;
+	/* replies carry the precision */
+	publish_reply_template();
 }
 #endif
 
@@ -2839,6 +2986,7 @@ init_proto(const bool verbose)
 	stat_count.use_stattime = current_time;
 	clock_ctl.hardpps_enable = false;
 	stats_control = true;
+	publish_reply_template();
 }
 
 
@@ -2956,21 +3104,24 @@ void
 proto_clr_stats(void)
 {
 	stat_count.sys_stattime = current_time;
-	stat_count.sys_received = 0;
-	stat_count.sys_processed = 0;
-	stat_count.sys_newversion = 0;
-	stat_count.sys_oldversion = 0;
-	stat_count.sys_declined = 0;
-	stat_count.sys_restricted = 0;
-	stat_count.sys_badlength = 0;
-	stat_count.sys_badauth = 0;
-	stat_count.sys_limitrejected = 0;
-	stat_count.sys_kodsent = 0;
+	COUNT_CLEAR(stat_count.sys_received);
+	COUNT_CLEAR(stat_count.sys_processed);
+	COUNT_CLEAR(stat_count.sys_newversion);
+	COUNT_CLEAR(stat_count.sys_oldversion);
+	COUNT_CLEAR(stat_count.sys_declined);
+	COUNT_CLEAR(stat_count.sys_restricted);
+	COUNT_CLEAR(stat_count.sys_badlength);
+	COUNT_CLEAR(stat_count.sys_badauth);
+	COUNT_CLEAR(stat_count.sys_limitrejected);
+	COUNT_CLEAR(stat_count.sys_kodsent);
 }
 
 
 /* limit logging so bad guys can't DDoS us by sending crap */
 
+/* server workers log junk too */
+static pthread_mutex_t junk_lock = PTHREAD_MUTEX_INITIALIZER;
+
 void maybe_log_junk(const char *tag, struct recvbuf *rbufp) {
   static float junk_limit = 2.0;         /* packets per hour */
   static float junk_score = 0;           /* score, packets/hour */
@@ -2980,9 +3131,11 @@ void maybe_log_junk(const char *tag, struct recvbuf *rbufp) {
   static long  junk_print = 0;           /* printed count */
 #define JUNKSIZE 500
     char buf[JUNKSIZE];
+    char addrbuf[100];
     int lng = rbufp->recv_length;
     int i, j;
 
+    pthread_mutex_lock(&junk_lock);
     junk_count++;
     if (0 == junk_last) {
       /* first time */
@@ -2992,8 +3145,10 @@ void maybe_log_junk(const char *tag, struct recvbuf *rbufp) {
       float since_last = ldexpf(interval_fp, -32)/3600.0;
       junk_last = rbufp->recv_time;
       junk_score *= expf(-since_last/junk_decay);
-      if (junk_limit < junk_score)
+      if (junk_limit < junk_score) {
+	pthread_mutex_unlock(&junk_lock);
 	return;
+      }
     }
     junk_print++;
     junk_score += 1.0/junk_decay;  /* only count the ones we print */
@@ -3002,7 +3157,8 @@ void maybe_log_junk(const char *tag, struct recvbuf *rbufp) {
 	"%s: Count=%ld Print=%ld, Score=%.3f, M%d V%d from %s, lng=%d",
 	tag, junk_count, junk_print, junk_score,
         PKT_MODE(rbufp->pkt.li_vn_mode), PKT_VERSION(rbufp->pkt.li_vn_mode),
-        sockporttoa(&rbufp->recv_srcadr), lng);
+        sockporttoa_r(&rbufp->recv_srcadr, addrbuf, sizeof(addrbuf)), lng);
+    pthread_mutex_unlock(&junk_lock);
     for (i=0,j=0; i<lng; i++) {
       if ((j+4)>JUNKSIZE) break;
       if (0 == (i%4)) buf[j++] = ' ';
@@ -1,6 +1,10 @@
 #include "config.h"
 
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "ntp_assert.h"
 #include "ntp_syslog.h"
@@ -11,13 +15,34 @@
 
 /*
  * Memory allocation.
+ *
+ * Receive buffers are carved out of slabs that are never freed while
+ * ntpd runs.  Every buffer starts on a cache line of its own, so
+ * buffers owned by different threads never share one.  A slab starts
+ * with a cache line holding its header.
+ *
+ * Free buffers sit on a recvbuf_list.  The main thread uses main_list
+ * through get_free_recv_buffer() and freerecvbuf(); any other thread
+ * that reads packets keeps a list of its own, so only taking a new
+ * slab needs a lock.
  */
-static unsigned long free_recvbufs;	/* recvbufs on free_recv_list */
-static unsigned long total_recvbufs;	/* total recvbufs currently in use */
+#define RECVBUF_ALIGN	64	/* cache line size, or a multiple of it */
+#define RECVBUF_STRIDE	((sizeof(recvbuf_t) + RECVBUF_ALIGN - 1) \
+			 & ~(size_t)(RECVBUF_ALIGN - 1))
+
+typedef struct recvbuf_slab recvbuf_slab_t;
+struct recvbuf_slab {
+	recvbuf_slab_t *	link;
+	unsigned int		nbufs;
+};
+
+static recvbuf_slab_t *	slab_list;	/* every slab ever allocated */
+static pthread_mutex_t	slab_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static recvbuf_list_t	main_list;
 static unsigned long lowater_adds;	/* # of times we have added memory */
 static unsigned long buffer_shortfall;	/* # of missed free receive buffers
 					   between replenishments */
-static recvbuf_t *		   free_recv_list;
 
 #ifdef DEBUG
 static void uninit_recvbuff(void);
@@ -27,13 +52,13 @@ static void uninit_recvbuff(void);
 unsigned long
 free_recvbuffs (void)
 {
-	return free_recvbufs;
+	return main_list.free;
 }
 
 unsigned long
 total_recvbuffs (void)
 {
-	return total_recvbufs;
+	return main_list.total;
 }
 
 unsigned long
@@ -42,41 +67,128 @@ lowater_additions(void)
 	return lowater_adds;
 }
 
+unsigned long
+recvbuf_allocs(void)
+{
+	return main_list.allocs;
+}
+
+unsigned long
+recvbuf_hiwater(void)
+{
+	return main_list.hiwater;
+}
+
+/*
+ * initialise_buffer - reset a buffer for reuse.  Only the bookkeeping
+ * is cleared: recv_buffer is overwritten by the read, and
+ * parse_packet() sets the authentication and NTS fields before
+ * anything looks at them, so clearing the whole buffer (well over a
+ * kilobyte) for every packet would be wasted memory bandwidth.
+ */
 static inline void
 initialise_buffer(recvbuf_t *buff)
 {
-	ZERO(*buff);
+	memset(buff, '\0', offsetof(recvbuf_t, recv_buffer));
+	ZERO(buff->pkt);
+	buff->used = 0;
+	buff->keyid_present = false;
+	buff->keyid = 0;
+	buff->mac_len = 0;
+	buff->extens_present = false;
+	buff->ntspacket.valid = false;
+#ifdef REFCLOCK
+	buff->recv_peer = NULL;
+#endif
+}
+
+/*
+ * grow_recvbuf_list - add a slab of nbufs buffers to a free list
+ */
+void
+grow_recvbuf_list(
+	recvbuf_list_t *	list,
+	unsigned int		nbufs
+	)
+{
+	recvbuf_slab_t *slab;
+	recvbuf_t *bufp;
+	void *mem;
+	unsigned int i;
+
+	if (0 == nbufs)
+		return;
+	if (0 != posix_memalign(&mem, RECVBUF_ALIGN,
+				RECVBUF_ALIGN + nbufs * RECVBUF_STRIDE)) {
+		msyslog(LOG_ERR, "ERR: no memory for %u receive buffers",
+			nbufs);
+		exit(1);
+	}
+	memset(mem, '\0', RECVBUF_ALIGN + nbufs * RECVBUF_STRIDE);
+	slab = mem;
+	slab->nbufs = nbufs;
+	pthread_mutex_lock(&slab_lock);
+	LINK_SLIST(slab_list, slab, link);
+	pthread_mutex_unlock(&slab_lock);
+
+	for (i = 0; i < nbufs; i++) {
+		bufp = (recvbuf_t *)((char *)mem + RECVBUF_ALIGN
+				     + i * RECVBUF_STRIDE);
+		LINK_SLIST(list->free_list, bufp, link);
+	}
+	list->free += nbufs;
+	list->total += nbufs;
+	/* coverity[leaked_storage] */
+}
+
+/*
+ * recvbuf_list_get - take a buffer off a free list, ready for use.
+ * NULL if the list is empty.
+ */
+recvbuf_t *
+recvbuf_list_get(
+	recvbuf_list_t *	list
+	)
+{
+	recvbuf_t *buffer;
+
+	UNLINK_HEAD_SLIST(buffer, list->free_list, link);
+	if (NULL == buffer)
+		return NULL;
+	list->free--;
+	list->allocs++;
+	if (list->total - list->free > list->hiwater)
+		list->hiwater = list->total - list->free;
+	initialise_buffer(buffer);
+	buffer->used++;
+	return buffer;
+}
+
+/*
+ * recvbuf_list_put - return a buffer to the free list it came from
+ */
+void
+recvbuf_list_put(
+	recvbuf_list_t *	list,
+	recvbuf_t *		rb
+	)
+{
+	rb->used--;
+	if (rb->used != 0)
+		msyslog(LOG_ERR, "ERR: ******** freerecvbuff non-zero usage: %d *******", rb->used);
+	LINK_SLIST(list->free_list, rb, link);
+	list->free++;
 }
 
 static void
 create_buffers(unsigned int nbufs)
 {
-	recvbuf_t *bufp;
-	unsigned int i, abuf;
+	unsigned int abuf;
 
 	abuf = nbufs + buffer_shortfall;
 	buffer_shortfall = 0;
-
-#ifndef DEBUG
-	bufp = emalloc_zero(abuf * sizeof(*bufp));
-#endif
-
-	for (i = 0; i < abuf; i++) {
-#ifdef DEBUG
-		/*
-		 * Allocate each buffer individually so they can be
-		 * free()d during ntpd shutdown on DEBUG builds to
-		 * keep them out of heap leak reports.
-		 */
-		bufp = emalloc_zero(sizeof(*bufp));
-#endif
-		LINK_SLIST(free_recv_list, bufp, link);
-		bufp++;
-		free_recvbufs++;
-		total_recvbufs++;
-	}
+	grow_recvbuf_list(&main_list, abuf);
 	lowater_adds++;
-	/* coverity[leaked_storage] */
 }
 
 void
@@ -84,9 +196,11 @@ init_recvbuff(unsigned int nbufs)
 {
 
 	/*
-	 * Init buffer free list and stat counters
+	 * Init buffer free list and stat counters.  Buffers from an
+	 * earlier call stay in their slabs.
 	 */
-	free_recvbufs = total_recvbufs = lowater_adds = 0;
+	ZERO(main_list);
+	lowater_adds = 0;
 
 	create_buffers(nbufs);
 
@@ -96,17 +210,34 @@ init_recvbuff(unsigned int nbufs)
 }
 
 
+/*
+ * reserve_recvbuffs - grow the pool so that at least nbufs buffers
+ * exist.  Batched receive posts a whole vector of buffers to the
+ * kernel at once, so the pool must be at least that deep.
+ */
+void
+reserve_recvbuffs(unsigned int nbufs)
+{
+	if (main_list.total < nbufs)
+		create_buffers((unsigned int)(nbufs - main_list.total));
+}
+
+
 #ifdef DEBUG
+/*
+ * Free the slabs during ntpd shutdown on DEBUG builds to keep them out
+ * of heap leak reports.
+ */
 static void
 uninit_recvbuff(void)
 {
-	recvbuf_t *rbunlinked;
+	recvbuf_slab_t *slab;
 
 	for (;;) {
-		UNLINK_HEAD_SLIST(rbunlinked, free_recv_list, link);
-		if (rbunlinked == NULL)
+		UNLINK_HEAD_SLIST(slab, slab_list, link);
+		if (slab == NULL)
 			break;
-		free(rbunlinked);
+		free(slab);
 	}
 }
 #endif	/* DEBUG */
@@ -117,14 +248,9 @@ get_free_recv_buffer(void)
 {
         recvbuf_t *buffer;
 
-        UNLINK_HEAD_SLIST(buffer, free_recv_list, link);
-        if (buffer != NULL) {
-                free_recvbufs--;
-                initialise_buffer(buffer);
-                buffer->used++;
-        } else {
+        buffer = recvbuf_list_get(&main_list);
+        if (buffer == NULL)
                 buffer_shortfall++;
-        }
 
         return buffer;
 }
@@ -140,11 +266,7 @@ freerecvbuf(recvbuf_t *rb)
 		return;
 	}
 
-	rb->used--;
-	if (rb->used != 0)
-		msyslog(LOG_ERR, "ERR: ******** freerecvbuff non-zero usage: %d *******", rb->used);
-	LINK_SLIST(free_recv_list, rb, link);
-	free_recvbufs++;
+	recvbuf_list_put(&main_list, rb);
 }
 
 
@@ -4,6 +4,7 @@
 
 #include "config.h"
 
+#include <pthread.h>
 #include <stdio.h>
 #include <sys/types.h>
 
@@ -29,6 +30,11 @@
  * flags you found. Because of the ordering of the list, the most
  * specific match will provide the final set of flags.
  *
+ * Walking the list for every packet gets expensive with thousands of
+ * entries, so each list is also indexed by a path-compressed binary
+ * trie keyed on address prefix (see below).  The trie gives the same
+ * answer as the walk; the list stays the master copy.
+ *
  * This was originally intended to restrict you from sync'ing to your
  * own broadcasts when you are doing that, by restricting yourself from
  * your own interfaces. It was also thought it would sometimes be useful
@@ -85,6 +91,19 @@ static unsigned long res_calls;
 static unsigned long res_found;
 static unsigned long res_not_found;
 
+/*
+ * Server workers look up restrictions alongside the main thread.
+ * Lookups only read the lists and tries, so they share res_lock and
+ * the main thread, which makes every change, takes it exclusively.
+ * The hit counters are bumped by concurrent readers and so are atomic.
+ */
+static pthread_rwlock_t res_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*
+ * Entries that will expire, so the timer knows whether to sweep.
+ */
+static unsigned long res_expiring;
+
 /*
  * Count number of restriction entries referring to RES_LIMITED, to
  * control implicit activation/deactivation of the MRU monlist.
@@ -104,6 +123,40 @@ static	bool		restrict_source_enabled = false;
 static	unsigned short	restrict_source_flags;
 static	unsigned short	restrict_source_mflags;
 
+/*
+ * The lookup tries.  A node holds a prefix of plen bits of key (in
+ * network order for both families) and, when any entries have exactly
+ * that address and mask, the first of them on the sorted list and how
+ * many there are; they are adjacent there, in descending mflags order.
+ * Nodes without entries are only branch points.  Every child extends
+ * its parent's prefix, child[0] with a 0 bit next and child[1] with a
+ * 1.
+ *
+ * A longest-prefix match visits at most one node per entry on the
+ * path instead of every entry on the list.  Because the list sorts by
+ * descending address then descending mask, its first match is the
+ * longest matching prefix, which is what the trie finds.
+ *
+ * Masks with holes in them, like 255.0.255.0, are legal but can't be
+ * expressed as a prefix.  While a family has any, its lookups walk the
+ * list as before.
+ */
+#define RES_KEYLEN	16	/* octets, big enough for IPv6 */
+
+typedef struct res_node_tag	res_node;
+struct res_node_tag {
+	res_node *	child[2];
+	restrict_u *	first;		/* first entry with this prefix */
+	unsigned int	nent;		/* entries with this prefix */
+	unsigned int	plen;		/* prefix length in bits */
+	uint8_t		key[RES_KEYLEN];
+};
+
+static res_node *	res_trie4;
+static res_node *	res_trie6;
+static unsigned long	res_holes4;	/* entries with non-prefix masks */
+static unsigned long	res_holes6;
+
 /*
  * private functions
  */
@@ -118,6 +171,23 @@ static restrict_u *	match_restrict6_addr(const struct in6_addr *,
 static restrict_u *	match_restrict_entry(const restrict_u *, int);
 static int		res_sorts_before4(restrict_u *, restrict_u *);
 static int		res_sorts_before6(restrict_u *, restrict_u *);
+static bool		res_prefix(const restrict_u *, int, uint8_t *,
+				   unsigned int *);
+static res_node *	trie_find(res_node *, const uint8_t *, unsigned int);
+static res_node *	trie_insert(res_node **, const uint8_t *,
+				    unsigned int);
+static void		trie_remove(res_node **, const uint8_t *,
+				    unsigned int);
+static void		trie_free(res_node *);
+static void		do_hack_restrict(int, sockaddr_u *, sockaddr_u *,
+					 unsigned short, unsigned short,
+					 unsigned long);
+static void		do_restrict_source(sockaddr_u *, bool,
+					   unsigned long);
+static void		res_index(restrict_u *, int);
+static void		res_unindex(restrict_u *, int);
+static restrict_u *	trie_match(res_node *, const uint8_t *,
+				   unsigned int, unsigned short);
 
 
 /*
@@ -164,6 +234,14 @@ init_restrict(void)
 		inc_res_limited();
 	}
 	restrictcount = 2;
+
+	trie_free(res_trie4);
+	trie_free(res_trie6);
+	res_trie4 = res_trie6 = NULL;
+	res_holes4 = res_holes6 = 0;
+	res_expiring = 0;
+	res_index(&restrict_def4, false);
+	res_index(&restrict_def6, true);
 }
 
 
@@ -229,6 +307,9 @@ free_res(
 	restrictcount--;
 	if (RES_LIMITED & res->flags)
 		dec_res_limited();
+	if (res->expire)
+		res_expiring--;
+	res_unindex(res, v6);
 
 	if (v6)
 		plisthead = &rstrct.restrictlist6;
@@ -266,26 +347,328 @@ dec_res_limited(void)
 }
 
 
+/*
+ * key_bit - bit n of a trie key, counting from the most significant
+ */
+static inline unsigned int
+key_bit(
+	const uint8_t *	key,
+	unsigned int	n
+	)
+{
+	return (key[n / 8] >> (7 - n % 8)) & 1;
+}
+
+
+/*
+ * key_common - how many leading bits two keys share, at most maxbits
+ */
+static unsigned int
+key_common(
+	const uint8_t *	k1,
+	const uint8_t *	k2,
+	unsigned int	maxbits
+	)
+{
+	unsigned int	n;
+	uint8_t		diff;
+
+	for (n = 0; n < maxbits; n += 8) {
+		diff = k1[n / 8] ^ k2[n / 8];
+		if (diff) {
+			while (!(diff & 0x80)) {
+				diff <<= 1;
+				n++;
+			}
+			break;
+		}
+	}
+	return min(n, maxbits);
+}
+
+
+/*
+ * res_prefix - get the trie key and prefix length for an entry.
+ * Returns false if its mask has holes and it can't go in the trie.
+ */
+static bool
+res_prefix(
+	const restrict_u *	res,
+	int			v6,
+	uint8_t *		key,
+	unsigned int *		plen
+	)
+{
+	const uint8_t *	mask;
+	uint32_t	addr4, mask4;
+	unsigned int	i, len;
+
+	memset(key, '\0', RES_KEYLEN);
+	if (v6) {
+		memcpy(key, &res->u.v6.addr, sizeof(res->u.v6.addr));
+		mask = res->u.v6.mask.s6_addr;
+		for (len = 0; len < 128 && key_bit(mask, len); len++)
+			continue;
+		for (i = len; i < 128; i++)
+			if (key_bit(mask, i))
+				return false;
+	} else {
+		addr4 = htonl(res->u.v4.addr);
+		memcpy(key, &addr4, sizeof(addr4));
+		mask4 = res->u.v4.mask;
+		if ((~mask4 & (~mask4 + 1)) != 0)
+			return false;
+		for (len = 0; len < 32 && (mask4 & (0x80000000U >> len));
+		     len++)
+			continue;
+	}
+	*plen = len;
+	return true;
+}
+
+
+/*
+ * trie_find - find the node for exactly this prefix, if there is one
+ */
+static res_node *
+trie_find(
+	res_node *	node,
+	const uint8_t *	key,
+	unsigned int	plen
+	)
+{
+	while (node != NULL && node->plen <= plen) {
+		if (key_common(node->key, key, node->plen) < node->plen)
+			return NULL;
+		if (node->plen == plen)
+			return node;
+		node = node->child[key_bit(key, node->plen)];
+	}
+	return NULL;
+}
+
+
+/*
+ * trie_insert - find or make the node for a prefix
+ */
+static res_node *
+trie_insert(
+	res_node **	pnode,
+	const uint8_t *	key,
+	unsigned int	plen
+	)
+{
+	res_node *	node;
+	res_node *	add;
+	res_node *	branch;
+	unsigned int	common;
+
+	for (;;) {
+		node = *pnode;
+		if (NULL == node)
+			break;
+		common = key_common(node->key, key, min(node->plen, plen));
+		if (common == node->plen) {
+			if (plen == node->plen)
+				return node;
+			pnode = &node->child[key_bit(key, node->plen)];
+			continue;
+		}
+		/*
+		 * The new prefix and the node's part ways after common
+		 * bits.  Either the new prefix ends there and the node
+		 * goes below it, or a branch node is needed.
+		 */
+		add = emalloc_zero(sizeof(*add));
+		memcpy(add->key, key, RES_KEYLEN);
+		add->plen = plen;
+		if (common == plen) {
+			add->child[key_bit(node->key, plen)] = node;
+			*pnode = add;
+			return add;
+		}
+		branch = emalloc_zero(sizeof(*branch));
+		memcpy(branch->key, key, RES_KEYLEN);
+		branch->plen = common;
+		branch->child[key_bit(key, common)] = add;
+		branch->child[key_bit(node->key, common)] = node;
+		*pnode = branch;
+		return add;
+	}
+	add = emalloc_zero(sizeof(*add));
+	memcpy(add->key, key, RES_KEYLEN);
+	add->plen = plen;
+	*pnode = add;
+	return add;
+}
+
+
+/*
+ * trie_remove - drop the node for a prefix that has no entries left,
+ * along with any branch node that no longer branches
+ */
+static void
+trie_remove(
+	res_node **	pnode,
+	const uint8_t *	key,
+	unsigned int	plen
+	)
+{
+	res_node **	path[128 + 2];
+	res_node *	node;
+	int		depth = 0;
+
+	for (;;) {
+		node = *pnode;
+		INSIST(node != NULL && node->plen <= plen);
+		path[depth++] = pnode;
+		if (node->plen == plen)
+			break;
+		pnode = &node->child[key_bit(key, node->plen)];
+	}
+	INSIST(0 == node->nent);
+
+	while (depth > 0) {
+		pnode = path[--depth];
+		node = *pnode;
+		if (node->nent || (node->child[0] && node->child[1]))
+			break;
+		*pnode = (node->child[0]) ? node->child[0] : node->child[1];
+		free(node);
+	}
+}
+
+
+static void
+trie_free(
+	res_node *	node
+	)
+{
+	if (NULL == node)
+		return;
+	trie_free(node->child[0]);
+	trie_free(node->child[1]);
+	free(node);
+}
+
+
+/*
+ * res_index - add a new entry, already on its list, to the trie
+ */
+static void
+res_index(
+	restrict_u *	res,
+	int		v6
+	)
+{
+	uint8_t		key[RES_KEYLEN];
+	unsigned int	plen;
+	res_node *	node;
+
+	if (!res_prefix(res, v6, key, &plen)) {
+		if (v6)
+			res_holes6++;
+		else
+			res_holes4++;
+		return;
+	}
+	node = trie_insert(v6 ? &res_trie6 : &res_trie4, key, plen);
+	/* It heads its group if it sorted in just before the old head */
+	if (0 == node->nent || res->link == node->first)
+		node->first = res;
+	node->nent++;
+}
+
+
+/*
+ * res_unindex - take an entry, still on its list, out of the trie
+ */
+static void
+res_unindex(
+	restrict_u *	res,
+	int		v6
+	)
+{
+	uint8_t		key[RES_KEYLEN];
+	unsigned int	plen;
+	res_node *	node;
+	res_node **	proot = v6 ? &res_trie6 : &res_trie4;
+
+	if (!res_prefix(res, v6, key, &plen)) {
+		if (v6)
+			res_holes6--;
+		else
+			res_holes4--;
+		return;
+	}
+	node = trie_find(*proot, key, plen);
+	INSIST(node != NULL && node->nent > 0);
+	if (node->first == res)
+		node->first = res->link;
+	if (0 == --node->nent)
+		trie_remove(proot, key, plen);
+}
+
+
+/*
+ * trie_match - longest-prefix match of an address (network order).
+ * Within a prefix, entries are tried in list order and the first one
+ * whose match flags allow the source port wins.
+ */
+static restrict_u *
+trie_match(
+	res_node *	node,
+	const uint8_t *	addr,
+	unsigned int	addrbits,
+	unsigned short	port
+	)
+{
+	res_node *	path[128 + 1];
+	int		depth = 0;
+	restrict_u *	res;
+	unsigned int	i;
+
+	while (node != NULL
+	       && key_common(node->key, addr, node->plen) == node->plen) {
+		if (node->nent)
+			path[depth++] = node;
+		if (node->plen >= addrbits)
+			break;
+		node = node->child[key_bit(addr, node->plen)];
+	}
+	while (depth > 0) {
+		node = path[--depth];
+		res = node->first;
+		for (i = 0; i < node->nent; i++, res = res->link)
+			if (!(RESM_NTPONLY & res->mflags)
+			    || NTP_PORT == port)
+				return res;
+	}
+	return NULL;
+}
+
+
 static restrict_u *
 match_restrict4_addr(
 	uint32_t	addr,
 	unsigned short	port
 	)
 {
-	const int	v6 = 0;
 	restrict_u *	res;
-	restrict_u *	next;
-
-	for (res = rstrct.restrictlist4; res != NULL; res = next) {
-		next = res->link;
-		if (res->expire &&
-		    res->expire <= current_time)
-			free_res(res, v6);
+	uint8_t		key[RES_KEYLEN];
+	uint32_t	naddr;
+
+	if (0 == res_holes4) {
+		memset(key, '\0', sizeof(key));
+		naddr = htonl(addr);
+		memcpy(key, &naddr, sizeof(naddr));
+		return trie_match(res_trie4, key, 32, port);
+	}
+	for (res = rstrct.restrictlist4; res != NULL; res = res->link)
 		if (res->u.v4.addr == (addr & res->u.v4.mask)
 		    && (!(RESM_NTPONLY & res->mflags)
 			|| NTP_PORT == port))
 			break;
-	}
 	return res;
 }
 
@@ -296,17 +679,13 @@ match_restrict6_addr(
 	unsigned short		port
 	)
 {
-	const int	v6 = 1;
 	restrict_u *	res;
-	restrict_u *	next;
 	struct in6_addr	masked;
 
-	for (res = rstrct.restrictlist6; res != NULL; res = next) {
-		next = res->link;
-		INSIST(next != res);
-		if (res->expire &&
-		    res->expire <= current_time)
-			free_res(res, v6);
+	if (0 == res_holes6)
+		return trie_match(res_trie6, addr->s6_addr, 128, port);
+	for (res = rstrct.restrictlist6; res != NULL; res = res->link) {
+		INSIST(res->link != res);
 		MASK_IPV6_ADDR(&masked, addr, &res->u.v6.mask);
 		if (ADDR6_EQ(&masked, &res->u.v6.addr)
 		    && (!(RESM_NTPONLY & res->mflags)
@@ -334,8 +713,23 @@ match_restrict_entry(
 {
 	restrict_u *res;
 	restrict_u *rlist;
+	res_node *node;
+	uint8_t key[RES_KEYLEN];
+	unsigned int plen;
+	unsigned int i;
 	size_t cb;
 
+	if (res_prefix(pmatch, v6, key, &plen)) {
+		node = trie_find(v6 ? res_trie6 : res_trie4, key, plen);
+		if (NULL == node)
+			return NULL;
+		res = node->first;
+		for (i = 0; i < node->nent; i++, res = res->link)
+			if (res->mflags == pmatch->mflags)
+				return res;
+		return NULL;
+	}
+
 	if (v6) {
 		rlist = rstrct.restrictlist6;
 		cb = sizeof(pmatch->u.v6);
@@ -433,7 +827,8 @@ restrictions(
 	struct in6_addr *pin6;
 	unsigned short flags;
 
-	res_calls++;
+	pthread_rwlock_rdlock(&res_lock);
+	COUNT_INC(res_calls);
 	flags = 0;
 	/* IPv4 source address */
 	if (IS_IPV4(srcadr)) {
@@ -442,21 +837,23 @@ restrictions(
 		 * (this should be done early in the receive process,
 		 * not later!)
 		 */
-		if (IN_CLASSD(SRCADR(srcadr)))
+		if (IN_CLASSD(SRCADR(srcadr))) {
+			pthread_rwlock_unlock(&res_lock);
 			return (int)RES_IGNORE;
+		}
 
 		match = match_restrict4_addr(SRCADR(srcadr),
 					     SRCPORT(srcadr));
-		match->hitcount++;
+		COUNT_INC(match->hitcount);
 		/*
 		 * res_not_found counts only use of the final default
 		 * entry, not any "restrict default ntpport ...", which
 		 * would be just before the final default.
 		 */
 		if (&restrict_def4 == match)
-			res_not_found++;
+			COUNT_INC(res_not_found);
 		else
-			res_found++;
+			COUNT_INC(res_found);
 		flags = match->flags;
 	}
 
@@ -469,17 +866,20 @@ restrictions(
 		 * (this should be done early in the receive process,
 		 * not later!)
 		 */
-		if (IN6_IS_ADDR_MULTICAST(pin6))
+		if (IN6_IS_ADDR_MULTICAST(pin6)) {
+			pthread_rwlock_unlock(&res_lock);
 			return (int)RES_IGNORE;
+		}
 
 		match = match_restrict6_addr(pin6, SRCPORT(srcadr));
-		match->hitcount++;
+		COUNT_INC(match->hitcount);
 		if (&restrict_def6 == match)
-			res_not_found++;
+			COUNT_INC(res_not_found);
 		else
-			res_found++;
+			COUNT_INC(res_found);
 		flags = match->flags;
 	}
+	pthread_rwlock_unlock(&res_lock);
 	return (flags);
 }
 
@@ -496,6 +896,22 @@ hack_restrict(
 	unsigned short	flags,
 	unsigned long	expire
 	)
+{
+	pthread_rwlock_wrlock(&res_lock);
+	do_hack_restrict(op, resaddr, resmask, mflags, flags, expire);
+	pthread_rwlock_unlock(&res_lock);
+}
+
+
+static void
+do_hack_restrict(
+	int		op,
+	sockaddr_u *	resaddr,
+	sockaddr_u *	resmask,
+	unsigned short	mflags,
+	unsigned short	flags,
+	unsigned long	expire
+	)
 {
 	int		v6;
 	restrict_u	match;
@@ -572,7 +988,10 @@ hack_restrict(
 				  ? res_sorts_before6(res, L_S_S_CUR())
 				  : res_sorts_before4(res, L_S_S_CUR()),
 				link, restrict_u);
+			res_index(res, v6);
 			restrictcount++;
+			if (res->expire)
+				res_expiring++;
 			if (RES_LIMITED & flags)
 				inc_res_limited();
 		} else {
@@ -629,6 +1048,19 @@ restrict_source(
 	bool		farewell,	/* false to add, true to remove */
 	unsigned long	expire		/* 0 is infinite, valid until */
 	)
+{
+	pthread_rwlock_wrlock(&res_lock);
+	do_restrict_source(addr, farewell, expire);
+	pthread_rwlock_unlock(&res_lock);
+}
+
+
+static void
+do_restrict_source(
+	sockaddr_u *	addr,
+	bool		farewell,
+	unsigned long	expire
+	)
 {
 	sockaddr_u	onesmask;
 	restrict_u *	res;
@@ -641,8 +1073,8 @@ restrict_source(
 
 	SET_HOSTMASK(&onesmask, AF(addr));
 	if (farewell) {
-		hack_restrict(RESTRICT_REMOVE, addr, &onesmask,
-			      0, 0, 0);
+		do_hack_restrict(RESTRICT_REMOVE, addr, &onesmask,
+				 0, 0, 0);
 		DPRINT(1, ("restrict_source: %s removed", socktoa(addr)));
 		return;
 	}
@@ -654,7 +1086,8 @@ restrict_source(
 	 * However, if the specific entry found is a fleeting one
 	 * added by pool_xmit() before soliciting, replace it
 	 * immediately regardless of the expire value to make way
-	 * for the more persistent entry.
+	 * for the more persistent entry.  One whose time is up but
+	 * that the timer hasn't swept yet goes too.
 	 */
 	if (IS_IPV4(addr)) {
 		res = match_restrict4_addr(SRCADR(addr), SRCPORT(addr));
@@ -665,7 +1098,8 @@ restrict_source(
 		found_specific = ADDR6_EQ(&res->u.v6.mask,
 					  &SOCK_ADDR6(&onesmask));
 	}
-	if (!expire && found_specific && res->expire) {
+	if (found_specific && res->expire
+	    && (!expire || res->expire <= current_time)) {
 		found_specific = 0;
 		free_res(res, IS_IPV6(addr));
 	}
@@ -673,9 +1107,36 @@ restrict_source(
 		return;
 	}
 
-	hack_restrict(RESTRICT_FLAGS, addr, &onesmask,
-		      restrict_source_mflags, restrict_source_flags,
-		      expire);
+	do_hack_restrict(RESTRICT_FLAGS, addr, &onesmask,
+			 restrict_source_mflags, restrict_source_flags,
+			 expire);
 	DPRINT(1, ("restrict_source: %s host restriction added\n",
 		   socktoa(addr)));
 }
+
+
+/*
+ * restrict_expire - remove entries whose time is up.  Called once a
+ * second from the timer, so lookups never have to check.
+ */
+void
+restrict_expire(void)
+{
+	restrict_u *	res;
+	restrict_u *	next;
+
+	if (0 == res_expiring)
+		return;
+	pthread_rwlock_wrlock(&res_lock);
+	for (res = rstrct.restrictlist4; res != NULL; res = next) {
+		next = res->link;
+		if (res->expire && res->expire <= current_time)
+			free_res(res, false);
+	}
+	for (res = rstrct.restrictlist6; res != NULL; res = next) {
+		next = res->link;
+		if (res->expire && res->expire <= current_time)
+			free_res(res, true);
+	}
+	pthread_rwlock_unlock(&res_lock);
+}
@@ -319,11 +319,20 @@ int scmp_sc[] = {
 	SCMP_SYS(clock_settime),
 	SCMP_SYS(close),
 	SCMP_SYS(connect),
+#ifdef HAVE_EPOLL_CREATE1
+	SCMP_SYS(epoll_create1),	/* event-driven I/O loop */
+	SCMP_SYS(epoll_ctl),
+# ifdef __NR_epoll_wait
+	SCMP_SYS(epoll_wait),	/* not in ARM64 */
+# endif
+	SCMP_SYS(epoll_pwait),
+#endif
 	SCMP_SYS(exit),
 	SCMP_SYS(exit_group),
 	SCMP_SYS(fcntl),
 	SCMP_SYS(fstat),
 	SCMP_SYS(fsync),
+	SCMP_SYS(ftruncate),	/* binary filegen torn-record trim */
 	SCMP_SYS(futex),	/* sem_xxx, used by threads */
 
 
@@ -359,6 +368,9 @@ int scmp_sc[] = {
 				* (Or maybe sooner if a request arrives.)
 				*/
 	SCMP_SYS(recvmsg),
+#ifdef __NR_recvmmsg
+	SCMP_SYS(recvmmsg),	/* recvbatch */
+#endif
 	SCMP_SYS(rename),
 	SCMP_SYS(rt_sigaction),
 	SCMP_SYS(rt_sigprocmask),
@@ -366,6 +378,9 @@ int scmp_sc[] = {
 	SCMP_SYS(sigaction),
 	SCMP_SYS(sigprocmask),
 	SCMP_SYS(sigreturn),
+#ifdef HAVE_SIGNALFD
+	SCMP_SYS(signalfd4),
+#endif
 #ifdef __NR_select
 	SCMP_SYS(select),	/* not in ARM */
 #endif
@@ -386,6 +401,11 @@ int scmp_sc[] = {
 	SCMP_SYS(timer_create),
 	SCMP_SYS(timer_gettime),
 	SCMP_SYS(timer_settime),
+# ifdef HAVE_TIMERFD_CREATE
+	SCMP_SYS(timerfd_create),
+	SCMP_SYS(timerfd_gettime),
+	SCMP_SYS(timerfd_settime),
+# endif
 #else
 	SCMP_SYS(getitimer),
 	SCMP_SYS(setitimer),
@@ -457,6 +477,7 @@ int scmp_sc[] = {
 #if defined(__i386__) || defined(__arm__) || defined(__powerpc__)
 	SCMP_SYS(_newselect),
 	SCMP_SYS(_llseek),
+	SCMP_SYS(ftruncate64),
 	SCMP_SYS(mmap2),
 	SCMP_SYS(send),
 	SCMP_SYS(stat64),
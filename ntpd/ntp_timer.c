@@ -15,6 +15,10 @@
 
 #include "ntp_syscall.h"
 
+#ifdef USE_TIMERFD
+# include <sys/timerfd.h>
+#endif
+
 #ifdef HAVE_TIMER_CREATE
 /* TC_ERR represents the timer_create() error return value. */
 # define	TC_ERR	(-1)
@@ -74,6 +78,15 @@ typedef struct itimerval intervaltimer;
 #endif
 static intervaltimer itimer;
 
+#ifdef USE_TIMERFD
+/*
+ * With the epoll() I/O loop the tick is read from a timerfd in the
+ * same wait as the packets instead of interrupting it with SIGALRM.
+ */
+static int timer_fd = -1;
+static bool init_timer_fd(void);
+#endif
+
 void	set_timer_or_die(void);
 
 void
@@ -82,9 +95,17 @@ set_timer_or_die(void)
 	const char *	setfunc;
 	int		rc;
 
+#ifdef USE_TIMERFD
+	if (timer_fd >= 0) {
+		setfunc = "timerfd_settime";
+		rc = timerfd_settime(timer_fd, 0, &itimer, NULL);
+	} else
+#endif
 #ifdef HAVE_TIMER_CREATE
-	setfunc = "timer_settime";
-	rc = timer_settime(timer_id, 0, &itimer, NULL);
+	{
+		setfunc = "timer_settime";
+		rc = timer_settime(timer_id, 0, &itimer, NULL);
+	}
 #else
 	setfunc = "setitimer";
 	rc = setitimer(ITIMER_REAL, &itimer, NULL);
@@ -104,6 +125,11 @@ void
 reinit_timer(void)
 {
 	ZERO(itimer);
+#ifdef USE_TIMERFD
+	if (timer_fd >= 0)
+		timerfd_gettime(timer_fd, &itimer);
+	else
+#endif
 #ifdef HAVE_TIMER_CREATE
 	timer_gettime(timer_id, &itimer);
 #else
@@ -148,13 +174,19 @@ init_timer(void)
 	 * seconds from now and they continue on every 2**EVENT_TIMEOUT
 	 * seconds.
 	 */
+#ifdef USE_TIMERFD
+	if (!init_timer_fd())
+#endif
+	{
 #ifdef HAVE_TIMER_CREATE
-	if (TC_ERR == timer_create(CLOCK_REALTIME, NULL, &timer_id)) {
-		msyslog(LOG_ERR, "ERR: timer_create failed, %s", strerror(errno));
-		exit(1);
-	}
+		if (TC_ERR == timer_create(CLOCK_REALTIME, NULL, &timer_id)) {
+			msyslog(LOG_ERR, "ERR: timer_create failed, %s",
+				strerror(errno));
+			exit(1);
+		}
 #endif
-	signal_no_reset(SIGALRM, catchALRM);
+		signal_no_reset(SIGALRM, catchALRM);
+	}
 	itimer.it_interval.tv_sec =
 		itimer.it_value.tv_sec = (1 << EVENT_TIMEOUT);
 	itimer.it_interval.itv_frac = itimer.it_value.itv_frac = 0;
@@ -163,6 +195,44 @@ init_timer(void)
 
 
 
+#ifdef USE_TIMERFD
+/*
+ * init_timer_fd - set up a timerfd if the I/O loop can wait on it
+ */
+static bool
+init_timer_fd(void)
+{
+	timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd < 0)
+		return false;
+	if (!io_watch_timer(timer_fd)) {
+		close(timer_fd);
+		timer_fd = -1;
+		return false;
+	}
+	return true;
+}
+#endif
+
+
+/*
+ * timer_fd_expired - the I/O loop saw the timerfd become readable
+ */
+void
+timer_fd_expired(void)
+{
+#ifdef USE_TIMERFD
+	uint64_t	ticks;
+
+	if ((ssize_t)sizeof(ticks) != read(timer_fd, &ticks, sizeof(ticks)))
+		return;
+	/* one alarm per expiry, overruns counted as with SIGALRM */
+	while (ticks-- > 0)
+		catchALRM(SIGALRM);
+#endif
+}
+
+
 /*
  * timer - event timer
  */
@@ -257,6 +327,26 @@ timer(void)
 		}
 	}
 
+	/*
+	 * Root dispersion grows every second, and orphan mode or the
+	 * leap second code may have changed more.
+	 */
+	publish_reply_template();
+
+	/*
+	 * Drop restrict entries whose time is up.
+	 */
+	restrict_expire();
+	mru_snapshot_expire();
+
+#ifndef DISABLE_NTS
+	/*
+	 * NTS cookie keys: rotate on time, pick up a new keys file.
+	 */
+	if (0 == (current_time & 7))
+		nts_cookie_timer();
+#endif
+
 	/*
 	 * Update huff-n'-puff filter.
 	 */
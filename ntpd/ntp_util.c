@@ -18,6 +18,8 @@
 #include <stdio.h>
 #include <libgen.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -26,6 +28,10 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 
+#if defined(HAVE_STDATOMIC_H) && !defined(__COVERITY__)
+# include <stdatomic.h>
+#endif /* HAVE_STDATOMIC_H */
+
 /*
  * Defines used by file logging
  */
@@ -76,6 +82,126 @@ bool stats_control;
  */
 static double prev_drift_comp;		/* last frequency update */
 
+/*
+ * Statistics writer.  The record_*_stats() routines format their
+ * line on the main thread and queue it; a writer thread appends it
+ * to the right filegen file, rotating generations as it goes, so a
+ * slow statsdir never holds up packet processing.
+ *
+ * The queue is a single-producer, single-consumer ring: only the
+ * main thread advances statq_head, only the writer advances
+ * statq_tail.  When the ring is full the line is dropped and counted.
+ * Files are written through stdio buffers and flushed at most
+ * STATQ_FLUSH seconds after a line is queued.
+ */
+#define STATQ_SLOTS	512		/* power of 2 */
+#define STATQ_LINE	640		/* clockstats text is up to 512 */
+#define STATQ_FLUSH	1		/* seconds */
+#define STATQ_GENS	8		/* dirty files between flushes */
+
+struct statq_rec {
+	FILEGEN *	gen;
+	time_t		stamp;		/* picks the file generation */
+	size_t		len;		/* binary record length, 0 for text */
+	char		line[STATQ_LINE];
+};
+
+/*
+ * The ring indices, the writer's sleeping flag and its counters are
+ * shared between the threads.  Publishing a line and the writer going
+ * to sleep are a store-then-load handshake on each side, so those use
+ * sequential consistency; everything else is release/acquire or, for
+ * the counters, relaxed.
+ */
+#if defined(HAVE_STDATOMIC_H) && !defined(__COVERITY__)
+# define STATQ_ATOMIC		_Atomic
+# define STATQ_RELAXED		memory_order_relaxed
+# define STATQ_ACQUIRE		memory_order_acquire
+# define STATQ_RELEASE		memory_order_release
+# define STATQ_SEQ_CST		memory_order_seq_cst
+# define statq_load(p, mo)	atomic_load_explicit((p), (mo))
+# define statq_store(p, v, mo)	atomic_store_explicit((p), (v), (mo))
+#else
+# define STATQ_ATOMIC
+# define STATQ_RELAXED		__ATOMIC_RELAXED
+# define STATQ_ACQUIRE		__ATOMIC_ACQUIRE
+# define STATQ_RELEASE		__ATOMIC_RELEASE
+# define STATQ_SEQ_CST		__ATOMIC_SEQ_CST
+# define statq_load(p, mo)	__atomic_load_n((p), (mo))
+# define statq_store(p, v, mo)	__atomic_store_n((p), (v), (mo))
+#endif /* HAVE_STDATOMIC_H */
+
+static struct statq_rec *statq;
+static STATQ_ATOMIC unsigned int statq_head;	/* next slot to fill */
+static STATQ_ATOMIC unsigned int statq_tail;	/* next slot to write */
+static bool		statq_running;	/* writer thread started */
+static bool		statq_atexit;	/* statq_shutdown() registered */
+static STATQ_ATOMIC bool statq_sleeping; /* writer waiting on statq_cond */
+static bool		statq_stop;	/* under statq_mutex */
+static pthread_t	statq_thread;
+static pthread_mutex_t	statq_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	statq_cond = PTHREAD_COND_INITIALIZER;
+
+/* writer side */
+static FILEGEN *	statq_dirty[STATQ_GENS];
+static int		statq_ndirty;
+static struct timespec	statq_dirty_since;
+static STATQ_ATOMIC uint64_t statq_written;
+static STATQ_ATOMIC uint64_t statq_dropped;
+
+/* main thread side */
+static uint64_t		statq_overflow;
+static unsigned int	statq_hiwater;
+
+/*
+ * Record formats for "filegen ... binary".  The fields match the text
+ * lines, except that the time is Unix seconds and the raw timestamps
+ * stay l_fp.
+ */
+#define LABEL_LEN	48		/* an IPv6 address fits */
+
+static const struct filegen_column loopstats_cols[] = {
+	{ "time",	'd', 8 },
+	{ "offset",	'd', 8 },
+	{ "freq",	'd', 8 },	/* PPM */
+	{ "jitter",	'd', 8 },
+	{ "wander",	'd', 8 },	/* PPM */
+	{ "poll",	'i', 4 },
+	{ NULL,		0,   0 }
+};
+
+static const struct filegen_column peerstats_cols[] = {
+	{ "time",	'd', 8 },
+	{ "peer",	's', LABEL_LEN },
+	{ "status",	'x', 4 },
+	{ "offset",	'd', 8 },
+	{ "delay",	'd', 8 },
+	{ "disp",	'd', 8 },
+	{ "jitter",	'd', 8 },
+	{ NULL,		0,   0 }
+};
+
+static const struct filegen_column rawstats_cols[] = {
+	{ "time",	'd', 8 },
+	{ "peer",	's', LABEL_LEN },
+	{ "dst",	's', LABEL_LEN },
+	{ "t1",		'l', 8 },
+	{ "t2",		'l', 8 },
+	{ "t3",		'l', 8 },
+	{ "t4",		'l', 8 },
+	{ "leap",	'b', 1 },
+	{ "version",	'b', 1 },
+	{ "mode",	'b', 1 },
+	{ "stratum",	'b', 1 },
+	{ "ppoll",	'b', 1 },
+	{ "precision",	'b', 1 },
+	{ "rootdelay",	'd', 8 },
+	{ "rootdisp",	'd', 8 },
+	{ "refid",	's', 16 },
+	{ "outcount",	'u', 4 },
+	{ NULL,		0,   0 }
+};
+
 /*
  * Function prototypes
  */
@@ -132,6 +258,9 @@ init_util(void)
 	filegen_register(statsdir, "peerstats",	  &peerstats);
 	filegen_register(statsdir, "protostats",  &protostats);
 	filegen_register(statsdir, "usestats",	  &usestats);
+	filegen_layout(&loopstats, loopstats_cols);
+	filegen_layout(&peerstats, peerstats_cols);
+	filegen_layout(&rawstats, rawstats_cols);
 
 	/*
 	 * register with libntp ntp_set_tod() to call us back
@@ -353,6 +482,258 @@ stats_config(
 	}
 }
 
+/* only the draining thread changes these, so no read-modify-write */
+static inline void
+statq_count(STATQ_ATOMIC uint64_t *counter)
+{
+	statq_store(counter, statq_load(counter, STATQ_RELAXED) + 1,
+		    STATQ_RELAXED);
+}
+
+uint64_t stats_written(void)
+	{ return statq_load(&statq_written, STATQ_RELAXED); }
+unsigned int stats_hiwater(void) { return statq_hiwater; }
+uint64_t stats_overflow(void) { return statq_overflow; }
+uint64_t stats_dropped(void)
+	{ return statq_load(&statq_dropped, STATQ_RELAXED); }
+
+/*
+ * statq_flush - push out the stdio buffers of the files written since
+ * the last flush.  Caller holds the filegen lock.
+ */
+static void
+statq_flush(void)
+{
+	for (int i = 0; i < statq_ndirty; i++)
+		if (statq_dirty[i]->fp != NULL)
+			fflush(statq_dirty[i]->fp);
+	statq_ndirty = 0;
+}
+
+/*
+ * statq_drain - write every queued line.  Only the writer thread
+ * calls this, or the main thread if there is no writer.
+ */
+static void
+statq_drain(bool flush)
+{
+	struct timespec now;
+	unsigned int head, tail;
+
+	filegen_lock();
+	head = statq_load(&statq_head, STATQ_ACQUIRE);
+	tail = statq_load(&statq_tail, STATQ_RELAXED);
+	while (tail != head) {
+		struct statq_rec *rec = &statq[tail & (STATQ_SLOTS - 1)];
+		FILEGEN *gen = rec->gen;
+		int i;
+
+		filegen_setup(gen, rec->stamp);
+		if (rec->len > 0
+		    ? filegen_write_binary(gen, rec->stamp, rec->line, rec->len)
+		    : (gen->fp != NULL && !(gen->flag & FGEN_FLAG_BINARY)
+		       && fputs(rec->line, gen->fp) >= 0))
+			statq_count(&statq_written);
+		else
+			statq_count(&statq_dropped);
+
+		for (i = 0; i < statq_ndirty; i++)
+			if (statq_dirty[i] == gen)
+				break;
+		if (i == statq_ndirty) {
+			if (statq_ndirty == STATQ_GENS)
+				statq_flush();
+			if (statq_ndirty == 0)
+				clock_gettime(CLOCK_MONOTONIC,
+					      &statq_dirty_since);
+			statq_dirty[statq_ndirty++] = gen;
+		}
+
+		/* hand the slot back to the main thread */
+		statq_store(&statq_tail, ++tail, STATQ_RELEASE);
+		if (tail == head)
+			head = statq_load(&statq_head, STATQ_ACQUIRE);
+	}
+	if (statq_ndirty > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (flush || now.tv_sec - statq_dirty_since.tv_sec >= STATQ_FLUSH)
+			statq_flush();
+	}
+	filegen_unlock();
+}
+
+static void *
+statq_writer(void *arg)
+{
+	UNUSED_ARG(arg);
+
+	for (;;) {
+		struct timespec deadline;
+		bool stop, idle;
+		int rc = 0;
+
+		statq_drain(false);
+
+		pthread_mutex_lock(&statq_mutex);
+		statq_store(&statq_sleeping, true, STATQ_SEQ_CST);
+		idle = (statq_load(&statq_tail, STATQ_RELAXED)
+			== statq_load(&statq_head, STATQ_SEQ_CST));
+		stop = statq_stop;
+		if (idle && !stop) {
+			if (statq_ndirty > 0) {
+				clock_gettime(CLOCK_REALTIME, &deadline);
+				deadline.tv_sec += STATQ_FLUSH;
+				rc = pthread_cond_timedwait(&statq_cond,
+					&statq_mutex, &deadline);
+			} else {
+				pthread_cond_wait(&statq_cond, &statq_mutex);
+			}
+			stop = statq_stop;
+		}
+		statq_store(&statq_sleeping, false, STATQ_RELAXED);
+		pthread_mutex_unlock(&statq_mutex);
+
+		if (stop || ETIMEDOUT == rc)
+			statq_drain(true);
+		if (stop)
+			break;
+	}
+	return NULL;
+}
+
+/*
+ * statq_shutdown - at exit, let the writer finish the queue.
+ */
+static void
+statq_shutdown(void)
+{
+	if (!statq_running)
+		return;
+	pthread_mutex_lock(&statq_mutex);
+	statq_stop = true;
+	pthread_cond_signal(&statq_cond);
+	pthread_mutex_unlock(&statq_mutex);
+	pthread_join(statq_thread, NULL);
+	statq_running = false;
+}
+
+static void
+statq_start(void)
+{
+	sigset_t block_mask, saved_sig_mask;
+	int rc;
+
+	statq = emalloc_zero(STATQ_SLOTS * sizeof(*statq));
+
+	sigfillset(&block_mask);
+	pthread_sigmask(SIG_BLOCK, &block_mask, &saved_sig_mask);
+	rc = pthread_create(&statq_thread, NULL, statq_writer, NULL);
+	pthread_sigmask(SIG_SETMASK, &saved_sig_mask, NULL);
+	if (rc) {
+		/* carry on, writing from the main thread */
+		msyslog(LOG_ERR, "LOG: can't start stats writer: %s",
+			strerror(rc));
+		return;
+	}
+	statq_running = true;
+	if (!statq_atexit) {
+		atexit(&statq_shutdown);
+		statq_atexit = true;
+	}
+}
+
+/*
+ * statq_slot - return the buffer to format a line for gen into, or
+ * NULL if gen is disabled or the queue is full.  statq_commit()
+ * queues the line.
+ */
+static char *
+statq_slot(
+	FILEGEN *	gen,
+	time_t		stamp
+	)
+{
+	struct statq_rec *rec;
+	unsigned int head, depth;
+
+	if (!(gen->flag & FGEN_FLAG_ENABLED))
+		return NULL;
+	if (NULL == statq)
+		statq_start();
+
+	head = statq_load(&statq_head, STATQ_RELAXED);
+	depth = head - statq_load(&statq_tail, STATQ_ACQUIRE);
+	if (depth >= STATQ_SLOTS) {
+		statq_overflow++;
+		return NULL;
+	}
+	if (depth + 1 > statq_hiwater)
+		statq_hiwater = depth + 1;
+
+	rec = &statq[head & (STATQ_SLOTS - 1)];
+	rec->gen = gen;
+	rec->stamp = stamp;
+	return rec->line;
+}
+
+static void
+statq_commit(
+	size_t	len		/* binary record length, 0 for text */
+	)
+{
+	unsigned int head = statq_load(&statq_head, STATQ_RELAXED);
+
+	statq[head & (STATQ_SLOTS - 1)].len = len;
+	/* publish the slot; seq_cst against the writer's check before
+	 * it sleeps, so one of us sees the other */
+	statq_store(&statq_head, head + 1, STATQ_SEQ_CST);
+	if (!statq_running) {
+		statq_drain(true);
+		return;
+	}
+	if (statq_load(&statq_sleeping, STATQ_SEQ_CST)) {
+		pthread_mutex_lock(&statq_mutex);
+		pthread_cond_signal(&statq_cond);
+		pthread_mutex_unlock(&statq_mutex);
+	}
+}
+
+/*
+ * Hooks for the unit tests of the statistics writer.
+ */
+
+/* stop the writer and forget the queue; the next line starts anew */
+void
+stats_ut_pristine(void)
+{
+	statq_shutdown();
+	free(statq);
+	statq = NULL;
+	statq_store(&statq_head, 0, STATQ_RELAXED);
+	statq_store(&statq_tail, 0, STATQ_RELAXED);
+	statq_stop = false;
+}
+
+/* what ntpd does at exit */
+void
+stats_ut_shutdown(void)
+{
+	statq_shutdown();
+}
+
+/* lines queued and not yet written */
+unsigned int
+stats_ut_depth(void)
+{
+	return statq_load(&statq_head, STATQ_ACQUIRE)
+		- statq_load(&statq_tail, STATQ_ACQUIRE);
+}
+
+static double
+timespec_to_unix(const struct timespec *ts) {
+	return (double)ts->tv_sec + ts->tv_nsec * S_PER_NS;
+}
+
 /* timespec_to_MJDtime
  */
 
@@ -402,19 +783,31 @@ record_peer_stats(
 	)
 {
 	struct timespec now;
+	char *line;
 
 	if (!stats_control)
 		return;
 
 	clock_gettime(CLOCK_REALTIME, &now);
-	filegen_setup(&peerstats, now.tv_sec);
-	if (peerstats.fp != NULL) {
-		fprintf(peerstats.fp,
+	line = statq_slot(&peerstats, now.tv_sec);
+	if (line != NULL && (peerstats.flag & FGEN_FLAG_BINARY)) {
+		uint8_t *p = (uint8_t *)line;
+
+		p = fgen_put_double(p, timespec_to_unix(&now));
+		p = fgen_put_str(p, peerlabel(peer), LABEL_LEN);
+		p = fgen_put_u32(p, (uint32_t)status);
+		p = fgen_put_double(p, peer->offset);
+		p = fgen_put_double(p, peer->delay);
+		p = fgen_put_double(p, peer->disp);
+		p = fgen_put_double(p, peer->jitter);
+		statq_commit((size_t)(p - (uint8_t *)line));
+	} else if (line != NULL) {
+		snprintf(line, STATQ_LINE,
 		    "%s %s %x %.9f %.9f %.9f %.9f\n",
 		    timespec_to_MJDtime(&now),
 		    peerlabel(peer), (unsigned int)status, peer->offset,
 		    peer->delay, peer->disp, peer->jitter);
-		fflush(peerstats.fp);
+		statq_commit(0);
 	}
 }
 
@@ -440,18 +833,29 @@ record_loop_stats(
 	)
 {
 	struct timespec	now;
+	char	*line;
 
 	if (!stats_control)
 		return;
 
 	clock_gettime(CLOCK_REALTIME, &now);
-	filegen_setup(&loopstats, now.tv_sec);
-	if (loopstats.fp != NULL) {
-		fprintf(loopstats.fp, "%s %.9f %.6f %.9f %.6f %d\n",
+	line = statq_slot(&loopstats, now.tv_sec);
+	if (line != NULL && (loopstats.flag & FGEN_FLAG_BINARY)) {
+		uint8_t *p = (uint8_t *)line;
+
+		p = fgen_put_double(p, timespec_to_unix(&now));
+		p = fgen_put_double(p, offset);
+		p = fgen_put_double(p, freq * US_PER_S);
+		p = fgen_put_double(p, jitter);
+		p = fgen_put_double(p, wander * US_PER_S);
+		p = fgen_put_u32(p, (uint32_t)spoll);
+		statq_commit((size_t)(p - (uint8_t *)line));
+	} else if (line != NULL) {
+		snprintf(line, STATQ_LINE, "%s %.9f %.6f %.9f %.6f %d\n",
 		    timespec_to_MJDtime(&now),
 		    offset, freq * US_PER_S, jitter,
 		    wander * US_PER_S, spoll);
-		fflush(loopstats.fp);
+		statq_commit(0);
 	}
 }
 
@@ -472,16 +876,17 @@ record_clock_stats(
 	)
 {
 	struct timespec	now;
+	char	*line;
 
 	if (!stats_control)
 		return;
 
 	clock_gettime(CLOCK_REALTIME, &now);
-	filegen_setup(&clockstats, now.tv_sec);
-	if (clockstats.fp != NULL) {
-		fprintf(clockstats.fp, "%s %s %s\n",
+	line = statq_slot(&clockstats, now.tv_sec);
+	if (line != NULL) {
+		snprintf(line, STATQ_LINE, "%s %s %s\n",
 		    timespec_to_MJDtime(&now), peerlabel(peer), text);
-		fflush(clockstats.fp);
+		statq_commit(0);
 	}
 }
 
@@ -537,6 +942,7 @@ record_raw_stats(
 	)
 {
 	struct timespec	now;
+	char	*line;
 	const sockaddr_u *dstaddr = peer->dstadr ? &peer->dstadr->sin : NULL;
 	l_fp	t1 = peer->org_ts;	/* originate timestamp */
 	l_fp	t2 = peer->rec;		/* receive timestamp */
@@ -547,9 +953,31 @@ record_raw_stats(
 		return;
 
 	clock_gettime(CLOCK_REALTIME, &now);
-	filegen_setup(&rawstats, now.tv_sec);
-	if (rawstats.fp != NULL) {
-		fprintf(rawstats.fp, "%s %s %s %s %s %s %s %d %d %d %d %d %d %.6f %.6f %s %u\n",
+	line = statq_slot(&rawstats, now.tv_sec);
+	if (line != NULL && (rawstats.flag & FGEN_FLAG_BINARY)) {
+		uint8_t *p = (uint8_t *)line;
+
+		p = fgen_put_double(p, timespec_to_unix(&now));
+		p = fgen_put_str(p, peerlabel(peer), LABEL_LEN);
+		p = fgen_put_str(p, dstaddr ? socktoa(dstaddr) : "-",
+				 LABEL_LEN);
+		p = fgen_put_u64(p, t1);
+		p = fgen_put_u64(p, t2);
+		p = fgen_put_u64(p, t3);
+		p = fgen_put_u64(p, t4);
+		*p++ = (uint8_t)leap;
+		*p++ = (uint8_t)version;
+		*p++ = (uint8_t)mode;
+		*p++ = (uint8_t)stratum;
+		*p++ = (uint8_t)ppoll;
+		*p++ = (uint8_t)precision;
+		p = fgen_put_double(p, root_delay);
+		p = fgen_put_double(p, root_dispersion);
+		p = fgen_put_str(p, refid_str(refid, stratum), 16);
+		p = fgen_put_u32(p, outcount);
+		statq_commit((size_t)(p - (uint8_t *)line));
+	} else if (line != NULL) {
+		snprintf(line, STATQ_LINE, "%s %s %s %s %s %s %s %d %d %d %d %d %d %.6f %.6f %s %u\n",
 		    timespec_to_MJDtime(&now),
 		    peerlabel(peer), dstaddr ?  socktoa(dstaddr) : "-",
 		    ulfptoa(t1, 9), ulfptoa(t2, 9),
@@ -557,7 +985,7 @@ record_raw_stats(
 		    leap, version, mode, stratum, ppoll, precision,
 		    root_delay, root_dispersion, refid_str(refid, stratum),
 		    outcount);
-		fflush(rawstats.fp);
+		statq_commit(0);
 	}
 }
 
@@ -589,19 +1017,20 @@ void record_ref_stats(
     )
 {
     struct timespec now;
+    char *line;
 
     if (!stats_control)
         return;
 
     clock_gettime(CLOCK_REALTIME, &now);
-    filegen_setup(&refstats, now.tv_sec);
-    if (refstats.fp != NULL) {
-        fprintf(refstats.fp,
+    line = statq_slot(&refstats, now.tv_sec);
+    if (line != NULL) {
+        snprintf(line, STATQ_LINE,
             "%s %s %d %d %d  %.9f %.9f %.9f %.9f %.9f  %.9f %.9f %.9f\n",
             timespec_to_MJDtime(&now), peerlabel(peer),
             n, i, j,
             t1, t2, t3, t4, t5, jitter, std_dev, std_dev_all);
-        fflush(refstats.fp);
+        statq_commit(0);
     }
 }
 
@@ -628,14 +1057,15 @@ void
 record_sys_stats(void)
 {
 	struct timespec	now;
+	char	*line;
 
 	if (!stats_control)
 		return;
 
 	clock_gettime(CLOCK_REALTIME, &now);
-	filegen_setup(&sysstats, now.tv_sec);
-	if (sysstats.fp != NULL) {
-		fprintf(sysstats.fp,
+	line = statq_slot(&sysstats, now.tv_sec);
+	if (line != NULL) {
+		snprintf(line, STATQ_LINE,
 		    "%s %u %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64
 		    " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
 			timespec_to_MJDtime(&now), current_time - stat_stattime(),
@@ -643,7 +1073,7 @@ record_sys_stats(void)
 			stat_oldversion(), stat_restricted(), stat_badlength(),
 			stat_badauth(), stat_declined(), stat_limitrejected(),
 			stat_kodsent());
-		fflush(sysstats.fp);
+		statq_commit(0);
 		proto_clr_stats();
 	}
 }
@@ -660,6 +1090,7 @@ record_sys_stats(void)
 void record_use_stats(void)
 {
 	struct timespec	now;
+	char	*line;
 	struct rusage usage;
 	static struct rusage oldusage;
 	/* Descriptions in NetBSD and FreeBSD are better than Linux
@@ -669,8 +1100,8 @@ void record_use_stats(void)
 		return;
 
 	clock_gettime(CLOCK_REALTIME, &now);
-	filegen_setup(&usestats, now.tv_sec);
-	if (usestats.fp != NULL) {
+	line = statq_slot(&usestats, now.tv_sec);
+	if (line != NULL) {
 		double utime, stimex;
 		getrusage(RUSAGE_SELF, &usage);
 		utime =  usage.ru_utime.tv_usec - oldusage.ru_utime.tv_usec;
@@ -679,7 +1110,7 @@ void record_use_stats(void)
 		stimex =  usage.ru_stime.tv_usec - oldusage.ru_stime.tv_usec;
 		stimex /= 1E6;
 		stimex += usage.ru_stime.tv_sec -  oldusage.ru_stime.tv_sec;
-		fprintf(usestats.fp,
+		snprintf(line, STATQ_LINE,
 		    "%s %u %.3f %.3f %ld %ld %ld %ld %ld %ld %ld %ld %ld\n",
 		    timespec_to_MJDtime(&now), current_time - stat_use_stattime(),
 		    utime, stimex,
@@ -692,7 +1123,7 @@ void record_use_stats(void)
 		    usage.ru_nivcsw -   oldusage.ru_nivcsw,
 		    usage.ru_nsignals - oldusage.ru_nsignals,
 		    usage.ru_maxrss );
-		fflush(usestats.fp);
+		statq_commit(0);
 		oldusage = usage;
 		set_use_stattime(current_time);
 	}
@@ -713,16 +1144,17 @@ record_proto_stats(
 	)
 {
 	struct timespec	now;
+	char	*line;
 
 	if (!stats_control)
 		return;
 
 	clock_gettime(CLOCK_REALTIME, &now);
-	filegen_setup(&protostats, now.tv_sec);
-	if (protostats.fp != NULL) {
-		fprintf(protostats.fp, "%s %s\n",
+	line = statq_slot(&protostats, now.tv_sec);
+	if (line != NULL) {
+		snprintf(line, STATQ_LINE, "%s %s\n",
 		    timespec_to_MJDtime(&now), str);
-		fflush(protostats.fp);
+		statq_commit(0);
 	}
 }
 
@@ -881,6 +881,7 @@ main(
 	    msyslog(LOG_ERR, "statistics directory %s does not exist or is unwriteable, error %s", statsdir, strerror(errno));
 	}
 
+	io_start_workers();
 	mainloop();
         /* unreachable, mainloop() never returns */
 }
@@ -928,6 +929,9 @@ static void mainloop(void)
 			/*
 			 * Nothing to do.  Wait for something.
 			 */
+#ifndef DISABLE_NTS
+			nts_nonce_refill();
+#endif
 			io_handler();
 		}
 
@@ -38,7 +38,11 @@ struct ntsconfig_t ntsconfig = {
 	.key = NULL,
 	.KI = NULL,
 	.ca = NULL,
-	.aead = NULL
+	.aead = NULL,
+	.keworkers = NTS_KE_WORKERS,
+	.kemaxconns = NTS_KE_MAXCONNS,
+	.tlsresume = false,
+	.ratchet = false
 };
 
 void nts_log_version(void);
@@ -113,7 +117,6 @@ void nts_log_version(void) {
 
 void nts_timer(void) {
 	nts_cert_timer();
-	nts_cookie_timer();
 }
 
 /*****************************************************/
@@ -296,9 +299,7 @@ void nts_log_ssl_error(void) {
 
 /* NB: KE length is body length, Extension length includes header. */
 
-/* 2 byte type, 2 byte length */
-#define NTS_KE_HDR_LNG 4
-#define NTS_KE_U16_LNG 2
+/* NTS_KE_HDR_LNG and NTS_KE_U16_LNG are in nts.h */
 
 /* Troubles with signed/unsigned compares when using sizeof() */
 
@@ -46,10 +46,19 @@ bool nts_client_send_request_core(uint8_t *buff, int buf_size, int *used, struct
 bool nts_client_process_response(SSL *ssl, struct peer *peer);
 bool nts_client_process_response_core(uint8_t *buff, int transferred, struct peer* peer);
 bool nts_server_lookup(char *server, sockaddr_u *addr, int af);
+static int new_session_cb(SSL *ssl, SSL_SESSION *session);
+static const char *ke_server(struct peer *peer);
 
 static SSL_CTX *client_ctx = NULL;
-static sockaddr_u sockaddr;
-static bool addrOK;
+
+/* Probes run on the DNS worker pool, several at once. */
+static pthread_mutex_t probe_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void probe_count(uint64_t *counter) {
+	pthread_mutex_lock(&probe_stats_lock);
+	(*counter)++;
+	pthread_mutex_unlock(&probe_stats_lock);
+}
 
 // Fedora 30:  0x1010104fL  1.1.1d
 // Fedora 29:  0x1010102fL  1.1.1b
@@ -73,7 +82,7 @@ bool nts_client_init(void) {
 
 bool nts_probe(struct peer * peer) {
 	struct timeval timeout = {.tv_sec = NTS_KE_TIMEOUT, .tv_usec = 0};
-	const char *hostname = peer->hostname;
+	const char *hostname = ke_server(peer);
 	char hostbuf[100];
 	char errbuf[100];
 	SSL     *ssl;
@@ -84,7 +93,7 @@ bool nts_probe(struct peer * peer) {
 	if (NULL == client_ctx)
 		return false;
 
-	addrOK = false;
+	peer->nts_state.addrOK = false;
 	clock_gettime(CLOCK_REALTIME, &start);
 
 	if (NULL == hostname) {
@@ -105,7 +114,7 @@ bool nts_probe(struct peer * peer) {
 
 	server = open_TCP_socket(peer, hostname);
 	if (-1 == server) {
-		nts_ke_probes_bad++;
+		probe_count(&nts_ke_probes_bad);
 		return false;
 	}
 
@@ -114,7 +123,7 @@ bool nts_probe(struct peer * peer) {
 		ntp_strerror_r(errno, errbuf, sizeof(errbuf));
 		msyslog(LOG_ERR, "NTSc: can't setsockopt: %s", errbuf);
 		close(server);
-		nts_ke_probes_bad++;
+		probe_count(&nts_ke_probes_bad);
 		return false;
 	}
 
@@ -132,6 +141,11 @@ bool nts_probe(struct peer * peer) {
 	}
 	set_hostname(ssl, peer, hostname);
 	SSL_set_fd(ssl, server);
+	if (ntsconfig.tlsresume) {
+		SSL_set_app_data(ssl, peer);	/* for new_session_cb */
+		if (NULL != peer->nts_state.session)
+			SSL_set_session(ssl, peer->nts_state.session);
+	}
 
 	if (1 != SSL_connect(ssl)) {
 		msyslog(LOG_INFO, "NTSc: SSL_connect failed");
@@ -144,11 +158,19 @@ bool nts_probe(struct peer * peer) {
 		goto bail;
 	}
 
+	if (ntsconfig.tlsresume) {
+		if (SSL_session_reused(ssl))
+			probe_count(&nts_ke_probe_resume_hits);
+		else
+			probe_count(&nts_ke_probe_resume_misses);
+	}
+
 	/* This may be clutter, but this is how to do it. */
-	msyslog(LOG_INFO, "NTSc: Using %s, %s (%d)",
+	msyslog(LOG_INFO, "NTSc: Using %s, %s (%d)%s",
 		SSL_get_version(ssl),
 		SSL_get_cipher_name(ssl),
-		SSL_get_cipher_bits(ssl, NULL));
+		SSL_get_cipher_bits(ssl, NULL),
+		SSL_session_reused(ssl) ? ", resumed" : "");
 
 	if (!check_certificate(ssl, peer))
 		goto bail;
@@ -174,13 +196,14 @@ bool nts_probe(struct peer * peer) {
 			   peer->nts_state.keylen))
 		goto bail;
 
-	addrOK = true;
-	nts_ke_probes_good++;
+	peer->nts_state.addrOK = true;
+	probe_count(&nts_ke_probes_good);
 
   bail:
-	if (!addrOK) {
-		nts_ke_probes_bad++;
+	if (!peer->nts_state.addrOK) {
+		probe_count(&nts_ke_probes_bad);
 		peer->nts_state.count = -1;
+		nts_client_forget(peer);	/* start over next time */
 	}
 	SSL_shutdown(ssl);
 	SSL_free(ssl);
@@ -190,23 +213,79 @@ bool nts_probe(struct peer * peer) {
 	finish = sub_tspec(finish, start);
 	msyslog(LOG_INFO, "NTSc: NTS-KE req to %s took %.3f sec, %s",
 		hostname, tspec_to_d(finish),
-		addrOK? "OK" : "fail");
+		peer->nts_state.addrOK? "OK" : "fail");
 
-	return addrOK;
+	return peer->nts_state.addrOK;
 }
 
 bool nts_check(struct peer *peer) {
 	if (0) {
 		char errbuf[100];
-		sockporttoa_r(&sockaddr, errbuf, sizeof(errbuf));
-		msyslog(LOG_INFO, "NTSc: nts_check %s, %d", errbuf, addrOK);
+		sockporttoa_r(&peer->nts_state.addr, errbuf, sizeof(errbuf));
+		msyslog(LOG_INFO, "NTSc: nts_check %s, %d",
+			errbuf, peer->nts_state.addrOK);
 	}
-	if (addrOK) {
-		dns_take_server(peer, &sockaddr);
+	if (peer->nts_state.addrOK) {
+		peer->nts_state.ketries = 0;
+		dns_take_server(peer, &peer->nts_state.addr);
 		dns_take_status(peer, DNS_good);
 	} else
 		dns_take_status(peer, DNS_error);
-	return addrOK;
+	return peer->nts_state.addrOK;
+}
+
+/* NTS-KE server for the next probe: the server itself,
+ * or one of its keserver options.
+ */
+static const char *ke_server(struct peer *peer) {
+	int idx = peer->nts_state.keidx;
+
+	if (0 == idx || idx > peer->cfg.nts_cfg.nkeservers)
+		return peer->hostname;
+	return peer->cfg.nts_cfg.keservers[idx-1];
+}
+
+/* Switch to the next NTS-KE server after a failure.
+ * Returns false when there is no other server or all of them
+ * have failed in a row, so the caller should back off.
+ * The TLS session belongs to the old server, so drop it.
+ */
+bool nts_next_ke_server(struct peer *peer) {
+	int n = 1 + peer->cfg.nts_cfg.nkeservers;
+
+	if (1 == n)
+		return false;
+	peer->nts_state.keidx = (peer->nts_state.keidx + 1) % n;
+	nts_client_forget(peer);
+	if (++peer->nts_state.ketries < n) {
+		msyslog(LOG_INFO, "NTSc: trying NTS-KE server %s",
+			ke_server(peer) ? ke_server(peer) : "(address)");
+		return true;
+	}
+	peer->nts_state.ketries = 0;
+	return false;
+}
+
+/* Keep the newest session (ticket) for the next NTS-KE to this peer.
+ * TLS 1.3 tickets arrive after the handshake, so this is how we
+ * get them rather than SSL_get1_session().
+ */
+static int new_session_cb(SSL *ssl, SSL_SESSION *session) {
+	struct peer *peer = SSL_get_app_data(ssl);
+
+	if (NULL == peer)
+		return 0;
+	nts_client_forget(peer);
+	peer->nts_state.session = session;
+	return 1;	/* we keep the reference */
+}
+
+/* Drop the session saved for peer, if any. */
+void nts_client_forget(struct peer *peer) {
+	if (NULL != peer->nts_state.session) {
+		SSL_SESSION_free(peer->nts_state.session);
+		peer->nts_state.session = NULL;
+	}
 }
 
 SSL_CTX* make_ssl_client_ctx(const char * filename) {
@@ -227,8 +306,16 @@ SSL_CTX* make_ssl_client_ctx(const char * filename) {
 		SSL_CTX_set_alpn_protos(ctx, alpn, sizeof(alpn));
 	}
 
-	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
-	SSL_CTX_set_timeout(ctx, NTS_KE_TIMEOUT);   /* session lifetime */
+	if (ntsconfig.tlsresume) {
+		/* No shared cache, each peer keeps its own session. */
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT |
+					       SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(ctx, new_session_cb);
+		SSL_CTX_set_timeout(ctx, NTS_KE_TICKET_LIFETIME);
+	} else {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+		SSL_CTX_set_timeout(ctx, NTS_KE_TIMEOUT);   /* session lifetime */
+	}
 
 	ok &= nts_load_versions(ctx);
 	ok &= nts_load_ciphers(ctx);
@@ -294,10 +381,10 @@ int open_TCP_socket(struct peer *peer, const char *hostname) {
 	 * setup default NTP port now
 	 *   in case of server-name:port later on
 	 */
-	memcpy(&sockaddr, answer->ai_addr, answer->ai_addrlen);
-	SET_PORT(&sockaddr, NTP_PORT);
+	memcpy(&peer->nts_state.addr, answer->ai_addr, answer->ai_addrlen);
+	SET_PORT(&peer->nts_state.addr, NTP_PORT);
 
-	sockporttoa_r(&sockaddr, errbuf, sizeof(errbuf));
+	sockporttoa_r(&peer->nts_state.addr, errbuf, sizeof(errbuf));
 	msyslog(LOG_INFO, "NTSc: connecting to %s:%s => %s",
 		host, port, errbuf);
 
@@ -650,11 +737,11 @@ bool nts_client_process_response_core(uint8_t *buff, int transferred, struct pee
 			next_bytes(&buf, (uint8_t *)server, length);
 			server[length] = '\0';
 			/* save port in case port specified before server */
-			port = SRCPORT(&sockaddr);
-			if (!nts_server_lookup(server, &sockaddr, AF(&peer->srcadr)))
+			port = SRCPORT(&peer->nts_state.addr);
+			if (!nts_server_lookup(server, &peer->nts_state.addr, AF(&peer->srcadr)))
 				return false;
-			SET_PORT(&sockaddr, port);
-			socktoa_r(&sockaddr, errbuf, sizeof(errbuf));
+			SET_PORT(&peer->nts_state.addr, port);
+			socktoa_r(&peer->nts_state.addr, errbuf, sizeof(errbuf));
 			msyslog(LOG_ERR, "NTSc: Using server %s=>%s", server, errbuf);
 			break;
 		    case nts_port_negotiation:
@@ -664,7 +751,7 @@ bool nts_client_process_response_core(uint8_t *buff, int transferred, struct pee
 				return false;
 			}
 			port = next_uint16(&buf);
-			SET_PORT(&sockaddr, port);
+			SET_PORT(&peer->nts_state.addr, port);
 			msyslog(LOG_ERR, "NTSc: Using port %d", port);
 			break;
 		    case nts_end_of_message:
@@ -29,6 +29,12 @@
 #include <unistd.h>
 
 #include <aes_siv.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#if defined(HAVE_STDATOMIC_H) && !defined(__COVERITY__)
+# include <stdatomic.h>
+#endif /* HAVE_STDATOMIC_H */
 
 #include "ntpd.h"
 #include "ntp_stdlib.h"
@@ -56,6 +62,15 @@
  * It would be possible to run without a cookie file.  Nobody would
  * notice until the server was restarted.  Then there would be a flurry
  * of NTS-KE requests until all clients obtained new/working cookies.
+ *
+ * With "nts ratchet" the file also holds a seed, S, and K and I are
+ * derived from it and the day number instead of being random.  Every
+ * server with a copy of the file makes the same keys on the same day
+ * without talking to the others, so a farm behind one address can
+ * decode each other's cookies.  See nts_ratchet_cookie_key().
+ *
+ * The file is checked for changes every few seconds and reloaded, so
+ * a new copy can be pushed to running servers.
  */
 
 /* Encryption within cookies uses AEAD_AES_SIV_CMAC_nnn.  That's the
@@ -93,13 +108,53 @@ int K_length = AEAD_AES_SIV_CMAC_256_KEYLEN;
 uint8_t K[NTS_MAX_KEYLEN], K2[NTS_MAX_KEYLEN];
 uint32_t I, I2;
 time_t K_time = 0;	/* time K was created, 0 for none */
+uint8_t K_seed[NTS_SEED_LENGTH];	/* S: for ratchet mode */
+bool K_seeded = false;
+
+/* What the keys file looked like when we last read or wrote it */
+static struct stat cookie_file_stat;
+
+/* Rotate the keys once a day
+ * Set this shorter for debugging
+ *  keys will timeout, packets will get dropped
+ *  after 8 lost packets, it should go through the NTS-KE dance again
+ */
+#define SecondsPerDay (24*60*60)
+// #define SecondsPerDay 3600
 
-/* The mutex protects cookie_ctx
- * The NTS-KE servers can make cookies
- *   while the main NTP server thread is unpacking and making cookies.
- * If this becomes a bottleneck, we could use a cookie_ctx per thread. */
+/* Every thread that makes or unpacks cookies (the main thread, the
+ * server workers and the NTS-KE workers) keeps its own AES_SIV
+ * contexts, already keyed with K and K2.  Cookies go through the
+ * batch calls with a NULL key, which reuse the key a context already
+ * holds, so there is no key schedule, context copy or lock per cookie.
+ *
+ * The mutex protects K, K2, I, I2 and K_length.  Whoever changes them
+ * bumps cookie_gen while holding it.  A thread that sees cookie_gen
+ * move re-keys its contexts under the mutex; that only happens when
+ * the keys rotate.
+ */
 pthread_mutex_t cookie_lock = PTHREAD_MUTEX_INITIALIZER;
-AES_SIV_CTX* cookie_ctx;
+static volatile unsigned int cookie_gen = 1;
+
+/* Each thread also keeps a pool of random bytes for nonces.  Taking
+ * nonces from it is a memcpy; the RAND_bytes() call that fills it is
+ * made by nts_nonce_refill() once the thread's replies have gone out.
+ * The pool holds NONCE_POOL nonces and is consumed from the front,
+ * so the unused part is always pool[NONCE_POOL_BYTES - nonce_left..].
+ */
+#define NONCE_POOL		128	/* nonces per thread */
+#define NONCE_POOL_BYTES	(NONCE_POOL * NONCE_LENGTH)
+
+struct cookie_ctxs {
+	unsigned int	gen;		/* cookie_gen when keyed */
+	uint32_t	I, I2;
+	AES_SIV_CTX *	key;		/* AES_SIV_Init done with K */
+	AES_SIV_CTX *	key2;		/* ... and with K2 */
+	int		nonce_left;	/* unused bytes at end of pool */
+	uint8_t		pool[NONCE_POOL_BYTES];
+};
+static pthread_key_t cookie_ctxs_key;
+static pthread_once_t cookie_ctxs_once = PTHREAD_ONCE_INIT;
 
 /* Statistics for ntpq */
 uint64_t nts_cookie_make = 0;
@@ -107,23 +162,42 @@ uint64_t nts_cookie_decode = 0;
 uint64_t nts_cookie_decode_old = 0;
 uint64_t nts_cookie_decode_too_old = 0;
 uint64_t nts_cookie_decode_error = 0;
+uint64_t nts_nonce_refills = 0;
+uint64_t nts_nonce_stalls = 0;
 
 void nts_lock_cookielock(void);
 void nts_unlock_cookielock(void);
+static void cookie_keys_changed(void);
+static const char *cookie_file(void);
+static void cookie_file_seen(void);
+static bool cookie_file_changed(void);
+static struct cookie_ctxs *cookie_ctxs_get(void);
+static void nonce_pool_fill(struct cookie_ctxs *ctxs);
 
 // FIXME  AEAD_LENGTH
 /* Associated data: aead (rounded up to 4) plus NONCE */
 #define AD_LENGTH 20
 #define AEAD_LENGTH 4
 
-/* cookie_ctx needed for client side */
+static void cookie_ctxs_free(void *arg) {
+	struct cookie_ctxs *ctxs = arg;
+
+	AES_SIV_CTX_free(ctxs->key);
+	AES_SIV_CTX_free(ctxs->key2);
+	free(ctxs);
+}
+
+static void cookie_ctxs_key_init(void) {
+	if (0 != pthread_key_create(&cookie_ctxs_key, cookie_ctxs_free)) {
+		msyslog(LOG_ERR, "NTS: Can't create cookie_ctxs_key");
+		exit(1);
+	}
+}
+
+/* cookie contexts needed for client side */
 bool nts_cookie_init(void) {
-  cookie_ctx = AES_SIV_CTX_new();
-  if (NULL == cookie_ctx) {
-    msyslog(LOG_ERR, "NTS: Can't init cookie_ctx");
-    exit(1);
-  }
-  return true;
+	cookie_ctxs_get();
+	return true;
 }
 
 /* cookie key needed for server side */
@@ -135,28 +209,152 @@ bool nts_cookie_init2(void) {
 		K_time = time(NULL);
 		nts_write_cookie_keys();
 	}
+	if (ntsconfig.ratchet) {
+		bool fresh = !K_seeded;
+		if (fresh) {
+			ntp_RAND_priv_bytes(K_seed, sizeof(K_seed));
+			K_seeded = true;
+		}
+		nts_ratchet_cookie_key((unsigned long)(time(NULL) / SecondsPerDay));
+		if (fresh) {
+			nts_write_cookie_keys();
+			msyslog(LOG_INFO, "NTS: New cookie key seed, copy %s to the other servers",
+				cookie_file());
+		}
+	}
+	nts_lock_cookielock();
+	cookie_keys_changed();
+	nts_unlock_cookielock();
+	nts_ticket_keys_update();
 	return OK;
 }
 
-/* Rotate key -- 24 hours after last rotate
- * That allows a cluster NTS-KE server to keep in sync
- * if we use ratchet rather than random.
+/* Tell the threads to re-key.  Call with cookie_lock held. */
+static void cookie_keys_changed(void) {
+#if defined(HAVE_STDATOMIC_H) && !defined(__COVERITY__)
+	atomic_thread_fence(memory_order_seq_cst);
+#endif /* HAVE_STDATOMIC_H */
+	cookie_gen++;
+}
+
+/* This thread's cookie contexts, keyed with the current K and K2. */
+static struct cookie_ctxs *cookie_ctxs_get(void) {
+	struct cookie_ctxs *ctxs;
+	bool ok;
+
+	pthread_once(&cookie_ctxs_once, cookie_ctxs_key_init);
+	ctxs = pthread_getspecific(cookie_ctxs_key);
+	if (NULL == ctxs) {
+		ctxs = emalloc_zero(sizeof(*ctxs));
+		ctxs->key = AES_SIV_CTX_new();
+		ctxs->key2 = AES_SIV_CTX_new();
+		if (NULL == ctxs->key || NULL == ctxs->key2) {
+			msyslog(LOG_ERR, "NTS: Can't init cookie_ctx");
+			exit(1);
+		}
+		nonce_pool_fill(ctxs);
+		pthread_setspecific(cookie_ctxs_key, ctxs);
+	}
+	if (ctxs->gen == cookie_gen)
+		return ctxs;
+
+	nts_lock_cookielock();
+	ctxs->gen = cookie_gen;
+	ctxs->I = I;
+	ctxs->I2 = I2;
+	ok = AES_SIV_Init(ctxs->key, K, K_length) &&
+	     AES_SIV_Init(ctxs->key2, K2, K_length);
+	nts_unlock_cookielock();
+	if (!ok) {
+		msyslog(LOG_ERR, "NTS: Can't key cookie_ctx");
+		exit(1);
+	}
+	return ctxs;
+}
+
+/* Replace the used part of the pool.  The fresh bytes go in front
+ * of the unused ones, so nothing has to move.
+ */
+static void nonce_pool_fill(struct cookie_ctxs *ctxs) {
+	int used = NONCE_POOL_BYTES - ctxs->nonce_left;
+
+	if (0 == used)
+		return;
+	ntp_RAND_bytes(ctxs->pool, used);
+	ctxs->nonce_left = NONCE_POOL_BYTES;
+	COUNT_INC(nts_nonce_refills);
+}
+
+/* Copy count nonces from this thread's pool.
+ * Only falls back to RAND_bytes() if the pool has run dry.
+ */
+void nts_get_nonces(uint8_t *nonces, int count) {
+	struct cookie_ctxs *ctxs = cookie_ctxs_get();
+	int length = count * NONCE_LENGTH;
+
+	if (length > NONCE_POOL_BYTES) {
+		ntp_RAND_bytes(nonces, length);
+		return;
+	}
+	if (length > ctxs->nonce_left) {
+		COUNT_INC(nts_nonce_stalls);
+		nonce_pool_fill(ctxs);
+	}
+	memcpy(nonces, ctxs->pool + NONCE_POOL_BYTES - ctxs->nonce_left,
+	       length);
+	ctxs->nonce_left -= length;
+}
+
+/* Top up this thread's nonce pool if it is half empty.
+ * Threads that answer NTS call this when they are about to go idle,
+ * so the RAND_bytes() cost stays out of the request/response path.
+ * Cheap for threads that never made a cookie.
+ */
+void nts_nonce_refill(void) {
+	struct cookie_ctxs *ctxs;
+
+	pthread_once(&cookie_ctxs_once, cookie_ctxs_key_init);
+	ctxs = pthread_getspecific(cookie_ctxs_key);
+	if (NULL == ctxs || ctxs->nonce_left >= NONCE_POOL_BYTES / 2)
+		return;
+	nonce_pool_fill(ctxs);
+}
+
+/* Rotate key -- 24 hours after last rotate,
+ * or at midnight UTC in ratchet mode.
+ * Called every few seconds, which also catches a new keys file.
  */
-#define SecondsPerDay (24*60*60)
-// Set this shorter for debugging
-//  keys will timeout, packets will get dropped
-//  after 8 lost packets, it should go through the NTS-KE dance again
-// #define SecondsPerDay 3600
 void nts_cookie_timer(void) {
 	time_t now;
 	if (0 == K_time) {
 		return;
 	}
+	if (cookie_file_changed()) {
+		/* Trouble was logged, and is retried when the file
+		 * changes again. */
+		cookie_file_seen();
+		if (nts_read_cookie_keys()) {
+			if (ntsconfig.ratchet && K_seeded)
+				nts_ratchet_cookie_key(
+				    (unsigned long)(time(NULL) / SecondsPerDay));
+			nts_ticket_keys_update();
+			msyslog(LOG_INFO, "NTS: Reloaded cookie keys from %s",
+				cookie_file());
+		}
+	}
 	now = time(NULL);
 	if (SecondsPerDay > (now-K_time)) {
 		return;
 	}
+	if (ntsconfig.ratchet && K_seeded) {
+		/* Everybody has the seed, so nothing to write */
+		nts_ratchet_cookie_key((unsigned long)(now / SecondsPerDay));
+		nts_ticket_keys_update();
+		msyslog(LOG_INFO, "NTS: Ratcheted cookie key.");
+		return;
+	}
 	nts_make_cookie_key();
+	nts_ticket_keys_update();
 	/* In case we were off for many days. */
 	while (SecondsPerDay < (now-K_time)) {
 		K_time += SecondsPerDay;
@@ -169,71 +367,140 @@ void nts_cookie_timer(void) {
 }
 
 
-bool nts_read_cookie_keys(void) {
-	const char *cookie_filename = NTS_COOKIE_KEY_FILE;
-	FILE *in;
-	unsigned long templ;
+static const char *cookie_file(void) {
 	if (NULL != ntsconfig.KI)
-		cookie_filename = ntsconfig.KI;
-	in = fopen(cookie_filename, "r");
-	if (NULL == in) {
-		char errbuf[100];
-		if (ENOENT == errno)
-			return false;		/* File doesn't exist */
-		ntp_strerror_r(errno, errbuf, sizeof(errbuf));
-		msyslog(LOG_ERR, "NTSs: can't read old cookie file: %s=>%s",
-			cookie_filename, errbuf);
-		exit(1);
+		return ntsconfig.KI;
+	return NTS_COOKIE_KEY_FILE;
+}
+
+static void cookie_file_seen(void) {
+	if (0 != stat(cookie_file(), &cookie_file_stat))
+		ZERO(cookie_file_stat);
+}
+
+/* A new file is usually renamed into place, so compare the inode
+ * as well as the size and time. */
+static bool cookie_file_changed(void) {
+	struct stat now;
+	if (0 != stat(cookie_file(), &now))
+		return false;
+	return now.st_ino != cookie_file_stat.st_ino ||
+	       now.st_dev != cookie_file_stat.st_dev ||
+	       now.st_size != cookie_file_stat.st_size ||
+	       now.st_mtime != cookie_file_stat.st_mtime;
+}
+
+/* Everything in the keys file */
+struct cookie_keys {
+	time_t time;
+	int length;
+	uint32_t I, I2;
+	uint8_t K[NTS_MAX_KEYLEN], K2[NTS_MAX_KEYLEN];
+	bool seeded;
+	uint8_t seed[NTS_SEED_LENGTH];
+};
+
+static bool read_hex(FILE *in, uint8_t *out, int length) {
+	for (int i=0; i< length; i++) {
+		unsigned int temp;
+		if (1 != fscanf(in, "%02x", &temp)) {
+			return false;
+		}
+		out[i] = temp;
 	}
+	if (0 != fscanf(in, "\n")) {
+		return false;
+	}
+	return true;
+}
+
+static bool parse_cookie_keys(FILE *in, struct cookie_keys *keys) {
+	unsigned long templ;
+	int c;
 	if (1 != fscanf(in, "T: %lu\n", &templ)) {
-		goto bail;
+		return false;
 	}
-	K_time = templ;
-	if (1 != fscanf(in, "L: %d\n", &K_length)) {
-		goto bail;
+	keys->time = templ;
+	if (1 != fscanf(in, "L: %d\n", &keys->length)) {
+		return false;
 	}
-	if ( !((32 == K_length) || (48 == K_length) || (64 == K_length))) {
-		goto bail;
+	if ( !((32 == keys->length) || (48 == keys->length) ||
+	       (64 == keys->length))) {
+		return false;
 	}
-	if (1 != fscanf(in, "I: %u\n", &I)) {
-		goto bail;
+	if (1 != fscanf(in, "I: %u\n", &keys->I)) {
+		return false;
 	}
 	if (0 != fscanf(in, "K: ")) {
-		goto bail;
-	}
-	for (int i=0; i< K_length; i++) {
-		unsigned int temp;
-		if (1 != fscanf(in, "%02x", &temp)) {
-			goto bail;
-		}
-		K[i] = temp;
+		return false;
 	}
-	if (0 != fscanf(in, "\n")) {
-		goto bail;
+	if (!read_hex(in, keys->K, keys->length)) {
+		return false;
 	}
-	if (1 != fscanf(in, "I: %u\n", &I2)) {
-		goto bail;
+	if (1 != fscanf(in, "I: %u\n", &keys->I2)) {
+		return false;
 	}
 	if (0 != fscanf(in, "K: ")) {
-		goto bail;
+		return false;
 	}
-	for (int i=0; i< K_length; i++) {
-		unsigned int temp;
-		if (1 != fscanf(in, "%02x", &temp)) {
-			goto bail;
-		}
-		K2[i] = temp;
+	if (!read_hex(in, keys->K2, keys->length)) {
+		return false;
 	}
-	if (0 != fscanf(in, "\n")) {
-		goto bail;
+	/* S: is optional, only ratchet mode needs it */
+	keys->seeded = false;
+	c = getc(in);
+	if ('S' == c) {
+		ungetc(c, in);
+		if (0 != fscanf(in, "S: ")) {
+			return false;
+		}
+		if (!read_hex(in, keys->seed, NTS_SEED_LENGTH)) {
+			return false;
+		}
+		keys->seeded = true;
 	}
-	fclose(in);
 	return true;
+}
 
-  bail:
-	msyslog(LOG_ERR, "ERR: Error parsing cookie keys file");
+bool nts_read_cookie_keys(void) {
+	const char *cookie_filename = cookie_file();
+	struct cookie_keys keys;
+	FILE *in;
+	bool ok;
+	in = fopen(cookie_filename, "r");
+	if (NULL == in) {
+		char errbuf[100];
+		if (ENOENT == errno)
+			return false;		/* File doesn't exist */
+		ntp_strerror_r(errno, errbuf, sizeof(errbuf));
+		msyslog(LOG_ERR, "NTSs: can't read old cookie file: %s=>%s",
+			cookie_filename, errbuf);
+		if (0 != K_time)
+			return false;		/* keep the keys we have */
+		exit(1);
+	}
+	ok = parse_cookie_keys(in, &keys);
 	fclose(in);
-	return false;
+	if (!ok) {
+		OPENSSL_cleanse(&keys, sizeof(keys));
+		msyslog(LOG_ERR, "ERR: Error parsing cookie keys file");
+		return false;
+	}
+
+	nts_lock_cookielock();
+	K_time = keys.time;
+	K_length = keys.length;
+	I = keys.I;
+	memcpy(K, keys.K, sizeof(K));
+	I2 = keys.I2;
+	memcpy(K2, keys.K2, sizeof(K2));
+	K_seeded = keys.seeded;
+	memcpy(K_seed, keys.seed, sizeof(K_seed));
+	cookie_keys_changed();
+	nts_unlock_cookielock();
+	OPENSSL_cleanse(&keys, sizeof(keys));
+	cookie_file_seen();
+	return true;
 }
 
 /* The draft describes a ratchet mode to make new keys
@@ -242,21 +509,93 @@ bool nts_read_cookie_keys(void) {
  * after a one-time copy of the cookie file from NTP server to KE server.
  */
 void nts_make_cookie_key(void) {
+	nts_lock_cookielock();
 	memcpy(&K2, &K, sizeof(K2));	/* Push current cookie to old */
 	I2 = I;
 	ntp_RAND_priv_bytes(K, sizeof(K));
 	ntp_RAND_bytes((uint8_t *)&I, sizeof(I));
+	cookie_keys_changed();
+	nts_unlock_cookielock();
 	return;
 }
 
+/* The key for one day in ratchet mode:
+ *   K = HMAC-SHA512(S, "NTS cookie key" || day), cut to K_length
+ *   I = HMAC-SHA256(S, "NTS cookie index" || day), first 4 bytes
+ * day is 8 bytes, big endian.  The low bit of I is the low bit of
+ * day, so I and I2 always differ.
+ */
+static void ratchet_key(unsigned long day, uint8_t *key, uint32_t *index) {
+	static const char klabel[] = "NTS cookie key";
+	static const char ilabel[] = "NTS cookie index";
+	uint8_t msg[sizeof(ilabel) + 8];
+	uint8_t out[EVP_MAX_MD_SIZE];
+	unsigned int length;
+	size_t used;
+	bool ok;
+
+	used = strlen(klabel);
+	memcpy(msg, klabel, used);
+	for (int i = 7; i >= 0; i--)
+		msg[used++] = (uint8_t)(day >> (8 * i));
+	length = sizeof(out);
+	ok = NULL != HMAC(EVP_sha512(), K_seed, sizeof(K_seed),
+			  msg, used, out, &length);
+	memcpy(key, out, K_length);
+
+	used = strlen(ilabel);
+	memcpy(msg, ilabel, used);
+	for (int i = 7; i >= 0; i--)
+		msg[used++] = (uint8_t)(day >> (8 * i));
+	length = sizeof(out);
+	ok = ok && NULL != HMAC(EVP_sha256(), K_seed, sizeof(K_seed),
+				msg, used, out, &length);
+	memcpy(index, out, sizeof(*index));
+	*index = (*index & ~1U) | (day & 1);
+
+	OPENSSL_cleanse(out, sizeof(out));
+	if (!ok) {
+		msyslog(LOG_ERR, "NTS: ratchet_key - Error from HMAC");
+		exit(1);
+	}
+}
+
+/* Ratchet mode: K/I for today, K2/I2 for yesterday.
+ * day is days since the epoch, UTC.
+ */
+void nts_ratchet_cookie_key(unsigned long day) {
+	nts_lock_cookielock();
+	ratchet_key(day, K, &I);
+	ratchet_key(day - 1, K2, &I2);
+	K_time = (time_t)day * SecondsPerDay;
+	cookie_keys_changed();
+	nts_unlock_cookielock();
+}
+
+/* Other secrets that should rotate with the cookie keys, like the
+ * NTS-KE session ticket keys, are derived from them here:
+ * HMAC-SHA256 of label keyed with K, or K2 if old.
+ */
+void nts_cookie_derive(bool old, const char *label, uint8_t *out) {
+	unsigned int length = NTS_DERIVED_LENGTH;
+	unsigned char *ok;
+
+	nts_lock_cookielock();
+	ok = HMAC(EVP_sha256(), old ? K2 : K, K_length,
+		  (const unsigned char *)label, strlen(label), out, &length);
+	nts_unlock_cookielock();
+	if (NULL == ok) {
+		msyslog(LOG_ERR, "NTS: nts_cookie_derive - Error from HMAC");
+		exit(1);
+	}
+}
+
 bool nts_write_cookie_keys(void) {
-	const char *cookie_filename = NTS_COOKIE_KEY_FILE;
+	const char *cookie_filename = cookie_file();
 	int fd;
 	FILE *out;
 	char errbuf[100];
-	if (NULL != ntsconfig.KI)
-		cookie_filename = ntsconfig.KI;
-	fd = open(cookie_filename, O_CREAT|O_WRONLY, S_IRUSR|S_IWUSR);
+	fd = open(cookie_filename, O_CREAT|O_WRONLY|O_TRUNC, S_IRUSR|S_IWUSR);
 	if (-1 == fd) {
 		ntp_strerror_r(errno, errbuf, sizeof(errbuf));
 		msyslog(LOG_ERR, "ERR: can't open %s: %s", cookie_filename, errbuf);
@@ -279,28 +618,57 @@ bool nts_write_cookie_keys(void) {
 	fprintf(out, "K: ");
 	for (int i=0; i< K_length; i++) fprintf(out, "%02x", K2[i]);
 	fprintf(out, "\n");
+	if (K_seeded) {
+		fprintf(out, "S: ");
+		for (int i=0; i< NTS_SEED_LENGTH; i++) fprintf(out, "%02x", K_seed[i]);
+		fprintf(out, "\n");
+	}
 	fclose(out);
+	cookie_file_seen();
 	return true;
 }
 
 /* returns actual length */
+/* Length of the cookies nts_make_cookie makes for keylen.
+ * Lets callers leave room for them before making them.
+ */
+int nts_cookie_length(int keylen) {
+	return AD_LENGTH + CMAC_LENGTH + AEAD_LENGTH + 2*keylen;
+}
+
 int nts_make_cookie(uint8_t *cookie,
+  uint16_t aead,
+  uint8_t *c2s, uint8_t *s2c, int keylen) {
+	return nts_make_cookies(cookie, 1, NTS_MAX_COOKIELEN,
+				aead, c2s, s2c, keylen);
+}
+
+/* Make count cookies that all carry the same AEAD and keys.
+ * Cookie i goes at cookies + i*stride, so they can be made right
+ * where they are going, between the headers of a packet.
+ * The plaintext is built once and the nonces come from the
+ * thread's pool in one piece.
+ * returns actual length of each cookie
+ */
+int nts_make_cookies(uint8_t *cookies, int count, int stride,
   uint16_t aead,
   uint8_t *c2s, uint8_t *s2c, int keylen) {
 	uint8_t plaintext[NTS_MAX_COOKIELEN];
-	uint8_t *nonce;
+	uint8_t nonces[NTS_MAX_COOKIES * NONCE_LENGTH];
+	AES_SIV_JOB jobs[NTS_MAX_COOKIES];
+	uint8_t *cookie;
 	int used, plainlength;
-	bool ok;
 	uint8_t * finger;
 	uint32_t temp;	/* keep 4 byte alignment */
-	size_t left;
-
-	if (NULL == cookie_ctx)
-		return 0;		/* We aren't initialized yet. */
+	struct cookie_ctxs *ctxs;
 
-	nts_cookie_make++;
+	ctxs = cookie_ctxs_get();
 
 	INSIST(keylen <= NTS_MAX_KEYLEN);
+	INSIST(0 < count && count <= NTS_MAX_COOKIES);
+	INSIST(1 == count || nts_cookie_length(keylen) <= stride);
+
+	COUNT_ADD(nts_cookie_make, count);
 
 	/* collect plaintext
 	 * separate buffer avoids encrypt in place
@@ -316,31 +684,35 @@ int nts_make_cookie(uint8_t *cookie,
 	finger += keylen;
 	plainlength = finger-plaintext;
 
-	/* collect associated data */
-	finger = cookie;
-
-	memcpy(finger, &I, sizeof(I));
-	finger += sizeof(I);
+	used = sizeof(ctxs->I) + NONCE_LENGTH;
+	INSIST(used + CMAC_LENGTH + plainlength <= NTS_MAX_COOKIELEN);
 
-	nonce = finger;
-	ntp_RAND_bytes(finger, NONCE_LENGTH);
-	finger += NONCE_LENGTH;
+	nts_get_nonces(nonces, count);
 
-	used = finger-cookie;
-	left = NTS_MAX_COOKIELEN-used;
+	ZERO(jobs);
+	for (int i = 0; i < count; i++) {
+		/* collect associated data */
+		cookie = cookies + i * stride;
+		finger = cookie;
 
-	nts_lock_cookielock();
+		memcpy(finger, &ctxs->I, sizeof(ctxs->I));
+		finger += sizeof(ctxs->I);
 
-	ok = AES_SIV_Encrypt(cookie_ctx,
-			     finger, &left,   /* left: in: max out length, out: length used */
-			     K, K_length,
-			     nonce, NONCE_LENGTH,
-			     plaintext, plainlength,
-			     cookie, AD_LENGTH);
+		jobs[i].nonce = finger;
+		jobs[i].nonce_len = NONCE_LENGTH;
+		memcpy(finger, nonces + i * NONCE_LENGTH, NONCE_LENGTH);
+		finger += NONCE_LENGTH;
 
-	nts_unlock_cookielock();
+		/* key is NULL: ctxs->key already has K */
+		jobs[i].ad = cookie;
+		jobs[i].ad_len = AD_LENGTH;
+		jobs[i].in = plaintext;
+		jobs[i].in_len = plainlength;
+		jobs[i].out = finger;
+		jobs[i].out_len = CMAC_LENGTH + plainlength;
+	}
 
-	if (!ok) {
+	if (!AES_SIV_EncryptBatch(ctxs->key, jobs, count)) {
 		msyslog(LOG_ERR, "NTS: nts_make_cookie - Error from AES_SIV_Encrypt");
 		/* I don't think this should happen,
 		 * so crash rather than work incorrectly.
@@ -350,77 +722,78 @@ int nts_make_cookie(uint8_t *cookie,
 		exit(1);
 	}
 
-	used += left;
-	INSIST(used <= NTS_MAX_COOKIELEN);
+	used += CMAC_LENGTH + plainlength;
 
 	return used;
 }
 
-/* can't decrypt in place - that would trash the unauthenticated packet */
+/* can't decrypt in place - that would trash the unauthenticated packet
+ * plain gets the inside, NTS_COOKIE_PLAINLEN bytes.  c2s and s2c
+ * point into it rather than being copied out.
+ */
 bool nts_unpack_cookie(uint8_t *cookie, int cookielen,
-  uint16_t *aead,
-  uint8_t *c2s, uint8_t *s2c, int *keylen) {
+  uint8_t *plain, uint16_t *aead,
+  uint8_t **c2s, uint8_t **s2c, int *keylen) {
 	uint8_t *finger;
-	uint8_t plaintext[NTS_MAX_COOKIELEN];
-	uint8_t *key;
-	uint8_t *nonce;
+	AES_SIV_CTX *key;
+	AES_SIV_JOB job;
 	uint32_t temp;
 	size_t plainlength;
 	int cipherlength;
-	bool ok;
+	struct cookie_ctxs *ctxs;
 
-	if (NULL == cookie_ctx)
-		return false;	/* We aren't initialized yet. */
+	ctxs = cookie_ctxs_get();
 
 	/* We may get garbage from the net */
 	if (cookielen > NTS_MAX_COOKIELEN)
 		return false;
 
 	finger = cookie;
-	if (0 == memcmp(finger, &I, sizeof(I))) {
-		key = K;
-		nts_cookie_decode++;
-	} else if (0 == memcmp(finger, &I2, sizeof(I2))) {
-		key = K2;
-		nts_cookie_decode_old++;
+	if (0 == memcmp(finger, &ctxs->I, sizeof(ctxs->I))) {
+		key = ctxs->key;
+		COUNT_INC(nts_cookie_decode);
+	} else if (0 == memcmp(finger, &ctxs->I2, sizeof(ctxs->I2))) {
+		key = ctxs->key2;
+		COUNT_INC(nts_cookie_decode_old);
 	} else {
-		nts_cookie_decode_too_old++;
+		COUNT_INC(nts_cookie_decode_too_old);
 		return false;
 	}
 	finger += sizeof(I);
-	nonce = finger;
+	ZERO(job);
+	job.nonce = finger;
+	job.nonce_len = NONCE_LENGTH;
 	finger += NONCE_LENGTH;
 
 	// require(AD_LENGTH==finger-cookie);
 
 	cipherlength = cookielen - AD_LENGTH;
-	plainlength = NTS_MAX_COOKIELEN;
-
-	nts_lock_cookielock();
-
-	ok = AES_SIV_Decrypt(cookie_ctx,
-			     plaintext, &plainlength,
-			     key, K_length,
-			     nonce, NONCE_LENGTH,
-			     finger, cipherlength,
-			     cookie, AD_LENGTH);
-
-	nts_unlock_cookielock();
-
-	if (!ok) {
-		nts_cookie_decode_error++;
+	if (cipherlength < CMAC_LENGTH) {
+		COUNT_INC(nts_cookie_decode_error);
+		return false;
+	}
+	plainlength = cipherlength - CMAC_LENGTH;
+
+	/* AES_SIV_Decrypt() without the AES_SIV_Init() */
+	job.ad = cookie;
+	job.ad_len = AD_LENGTH;
+	job.in = finger;
+	job.in_len = cipherlength;
+	job.out = plain;
+	job.out_len = NTS_COOKIE_PLAINLEN;	/* fails if bigger */
+	if (!AES_SIV_DecryptBatch(key, &job, 1)) {
+		COUNT_INC(nts_cookie_decode_error);
 		return false;
 	}
 
 	*keylen = (plainlength-AEAD_LENGTH)/2;
-	finger = plaintext;
+	finger = plain;
 	memcpy(&temp, finger, AEAD_LENGTH);
 	*aead = temp;
 	finger += AEAD_LENGTH;
-	memcpy(c2s, finger, *keylen);
-	finger += *keylen;
-	memcpy(s2c, finger, *keylen);
+	*c2s = finger;
 	finger += *keylen;
+	*s2c = finger;
 
 	return true;
 }
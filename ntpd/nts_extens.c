@@ -8,8 +8,8 @@
  *
  * We carefully arrange things so that no padding is necessary.
  *
- * This is only called by the main ntpd thread, so we don't need
- * a lock to protect wire_ctx.
+ * Server workers answer NTS requests as well as the main thread, so
+ * each thread has its own wire_ctx.
  */
 
 #include "config.h"
@@ -17,6 +17,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <pthread.h>
 
 #include <aes_siv.h>
 
@@ -47,16 +48,40 @@ enum NtpExtFieldType {
 	NTS_AEEF = 0x404 /* Authenticated and Encrypted Extension Fields */
 };
 
-/* This is only called by the main thread so we don't need a lock. */
-AES_SIV_CTX* wire_ctx = NULL;
+static pthread_key_t wire_ctx_key;
+static pthread_once_t wire_ctx_once = PTHREAD_ONCE_INIT;
 
+static void wire_ctx_free(void *arg) {
+	AES_SIV_CTX_free(arg);
+}
 
-bool extens_init(void) {
-	wire_ctx = AES_SIV_CTX_new();
-	if (NULL == wire_ctx) {
-		msyslog(LOG_ERR, "NTS: Can't init wire_ctx");
+static void wire_ctx_key_init(void) {
+	if (0 != pthread_key_create(&wire_ctx_key, wire_ctx_free)) {
+		msyslog(LOG_ERR, "NTS: Can't create wire_ctx_key");
 		exit(1);
 	}
+}
+
+/* This thread's wire_ctx */
+static AES_SIV_CTX *wire_ctx_get(void) {
+	AES_SIV_CTX *wire_ctx;
+
+	pthread_once(&wire_ctx_once, wire_ctx_key_init);
+	wire_ctx = pthread_getspecific(wire_ctx_key);
+	if (NULL == wire_ctx) {
+		wire_ctx = AES_SIV_CTX_new();
+		if (NULL == wire_ctx) {
+			msyslog(LOG_ERR, "NTS: Can't init wire_ctx");
+			exit(1);
+		}
+		pthread_setspecific(wire_ctx_key, wire_ctx);
+	}
+	return wire_ctx;
+}
+
+
+bool extens_init(void) {
+	wire_ctx_get();
 	return true;
 }
 
@@ -71,6 +96,13 @@ int extens_client_send(struct peer *peer, struct pkt *xpkt) {
 	buf.next = xpkt->exten;
 	buf.left = MAX_EXT_LEN;
 
+	/* loss: decaying average of unanswered requests */
+	if (peer->nts_state.pending)
+		peer->nts_state.loss += (255 - peer->nts_state.loss) >> 3;
+	else
+		peer->nts_state.loss -= peer->nts_state.loss >> 3;
+	peer->nts_state.pending = true;
+
 	/* UID */
 	ntp_RAND_bytes(peer->nts_state.UID, NTS_UID_LENGTH);
 	ex_append_record_bytes(&buf, Unique_Identifier,
@@ -102,7 +134,7 @@ int extens_client_send(struct peer *peer, struct pkt *xpkt) {
 	buf.next += NONCE_LENGTH;
 	buf.left -= NONCE_LENGTH;
 	left = buf.left;
-	ok = AES_SIV_Encrypt(wire_ctx,
+	ok = AES_SIV_Encrypt(wire_ctx_get(),
 			     buf.next, &left,   /* left: in: max out length, out: length used */
 			     peer->nts_state.c2s, peer->nts_state.keylen,
 			     nonce, NONCE_LENGTH,
@@ -132,7 +164,7 @@ bool extens_server_recv(struct ntspacket_t *ntspacket, uint8_t *pkt, int lng) {
 	bool sawcookie, sawAEEF;
 	int cookielen;			/* cookie and placeholder(s) */
 
-	nts_server_recv_bad++;		/* assume bad, undo if OK */
+	COUNT_INC(nts_server_recv_bad);	/* assume bad, undo if OK */
 
 	buf.next = pkt+LEN_PKT_NOMAC;
 	buf.left = lng-LEN_PKT_NOMAC;
@@ -163,8 +195,11 @@ bool extens_server_recv(struct ntspacket_t *ntspacket, uint8_t *pkt, int lng) {
 			if (length > NTS_UID_MAX_LENGTH) {
 				return false;
 			}
+			/* echoed from here, no need to copy it */
 			ntspacket->uidlen = length;
-			next_bytes(&buf, ntspacket->UID, length);
+			ntspacket->uid = buf.next;
+			buf.next += length;
+			buf.left -= length;
 			break;
 		    case NTS_Cookie:
 			/* cookies and placeholders must be the same length
@@ -179,8 +214,10 @@ bool extens_server_recv(struct ntspacket_t *ntspacket, uint8_t *pkt, int lng) {
 			else if (length != cookielen) {
 				return false;
 			}
-			ok = nts_unpack_cookie(buf.next, length, &aead, ntspacket->c2s,
-					       ntspacket->s2c, &ntspacket->keylen);
+			ok = nts_unpack_cookie(buf.next, length,
+					       ntspacket->plain, &aead,
+					       &ntspacket->c2s, &ntspacket->s2c,
+					       &ntspacket->keylen);
 			if (!ok) {
 				return false;
 			}
@@ -222,7 +259,7 @@ bool extens_server_recv(struct ntspacket_t *ntspacket, uint8_t *pkt, int lng) {
 			nonce = buf.next;
 			cmac = nonce+NONCE_LENGTH;
 			outlen = 6;
-			ok = AES_SIV_Decrypt(wire_ctx,
+			ok = AES_SIV_Decrypt(wire_ctx_get(),
 					     NULL, &outlen,
 					     ntspacket->c2s, ntspacket->keylen,
 					     nonce, noncelen,
@@ -262,24 +299,27 @@ bool extens_server_recv(struct ntspacket_t *ntspacket, uint8_t *pkt, int lng) {
 	//  printf("ESRx: %d, %d, %d\n",
 	//      lng-LEN_PKT_NOMAC, ntspacket->needed, ntspacket->keylen);
 	ntspacket->valid = true;
-	nts_server_recv_good++;
-	nts_server_recv_bad--;
+	COUNT_INC(nts_server_recv_good);
+	COUNT_ADD(nts_server_recv_bad, -1);
 	return true;
 }
 
+/* The reply is built in xpkt and nowhere else.  The UID comes
+ * straight from the request, and the cookies are made in their
+ * final places inside the AEEF, then encrypted in place.
+ * Returns the length of the extensions, or -1 if they don't fit.
+ */
 int extens_server_send(struct ntspacket_t *ntspacket, struct pkt *xpkt) {
 	struct BufCtl_t buf;
 	int used, adlength;
 	size_t left;
 	uint8_t *nonce, *packet;
 	uint8_t *plaintext, *ciphertext;;
-	uint8_t cookie[NTS_MAX_COOKIELEN];
-	int cookielen, plainleng, aeadlen;
+	int cookielen, plainleng, aeadlen, stride, batch;
 	bool ok;
 
-	/* get first cookie now so we have length */
-	cookielen = nts_make_cookie(cookie, ntspacket->aead,
-				    ntspacket->c2s, ntspacket->s2c, ntspacket->keylen);
+	cookielen = nts_cookie_length(ntspacket->keylen);
+	stride = NTP_EX_HDR_LNG+cookielen;
 
 	packet = (uint8_t*)xpkt;
 	buf.next = xpkt->exten;
@@ -288,20 +328,24 @@ int extens_server_send(struct ntspacket_t *ntspacket, struct pkt *xpkt) {
 	/* UID */
 	if (0 < ntspacket->uidlen)
 		ex_append_record_bytes(&buf, Unique_Identifier,
-				       ntspacket->UID, ntspacket->uidlen);
+				       ntspacket->uid, ntspacket->uidlen);
 
 	adlength = buf.next-packet;		/* up to here is Additional Data */
 
 	/* length of whole AEEF */
-	plainleng = ntspacket->needed*(NTP_EX_HDR_LNG+cookielen);
+	plainleng = ntspacket->needed*stride;
 	/* length of whole AEEF header */
 	aeadlen = NTP_EX_U16_LNG*2+NONCE_LENGTH+CMAC_LENGTH + plainleng;
+	/* The cookies are written straight into buf below, so check
+	 * the whole AEEF fits first. */
+	if (NTP_EX_HDR_LNG + aeadlen > buf.left)
+		return -1;
 	ex_append_header(&buf, NTS_AEEF, aeadlen);
 	append_uint16(&buf, NONCE_LENGTH);
 	append_uint16(&buf, plainleng+CMAC_LENGTH);
 
 	nonce = buf.next;
-	ntp_RAND_bytes(nonce, NONCE_LENGTH);
+	nts_get_nonces(nonce, 1);
 	buf.next += NONCE_LENGTH;
 	buf.left -= NONCE_LENGTH;
 
@@ -311,22 +355,26 @@ int extens_server_send(struct ntspacket_t *ntspacket, struct pkt *xpkt) {
 	buf.left -= CMAC_LENGTH;
 	plaintext = buf.next;		/* encrypt in place */
 
-	ex_append_record_bytes(&buf, NTS_Cookie,
-			       cookie, cookielen);
-	for (int i=1; i<ntspacket->needed; i++) {
-		/* WARN: This may get too big for the MTU. See length calculation above.
-		 * Responses are the same length as requests to avoid DDoS amplification.
-		 * So if it got to us, there is a good chance it will get back.  */
-		nts_make_cookie(cookie, ntspacket->aead,
-				ntspacket->c2s, ntspacket->s2c, ntspacket->keylen);
-		ex_append_record_bytes(&buf, NTS_Cookie,
-				       cookie, cookielen);
+	/* WARN: This may get too big for the MTU. See length calculation above.
+	 * Responses are the same length as requests to avoid DDoS amplification.
+	 * So if it got to us, there is a good chance it will get back.  */
+	for (int i=0; i<ntspacket->needed; i++) {
+		ex_append_header(&buf, NTS_Cookie, cookielen);
+		buf.next += cookielen;
+		buf.left -= cookielen;
+	}
+	for (int i=0; i<ntspacket->needed; i+=batch) {
+		batch = min(ntspacket->needed-i, NTS_MAX_COOKIES);
+		nts_make_cookies(plaintext+i*stride+NTP_EX_HDR_LNG, batch,
+				 stride, ntspacket->aead,
+				 ntspacket->c2s, ntspacket->s2c,
+				 ntspacket->keylen);
 	}
 
 	//printf("ESSa: %d, %d, %d, %d\n",
 	//  adlength, plainleng, cookielen, ntspacket->needed);
 
-	ok = AES_SIV_Encrypt(wire_ctx,
+	ok = AES_SIV_Encrypt(wire_ctx_get(),
 			     ciphertext, &left,   /* left: in: max out length, out: length used */
 			     ntspacket->s2c, ntspacket->keylen,
 			     nonce, NONCE_LENGTH,
@@ -347,7 +395,7 @@ int extens_server_send(struct ntspacket_t *ntspacket, struct pkt *xpkt) {
 
 	// printf("ESSx: %lu, %d\n", (long unsigned)left, used);
 
-	nts_server_send++;
+	COUNT_INC(nts_server_send);
 	return used;
 }
 
@@ -411,7 +459,7 @@ bool extens_client_recv(struct peer *peer, uint8_t *pkt, int lng) {
 			plaintext = ciphertext+CMAC_LENGTH;
 			outlen = buf.left-NONCE_LENGTH-CMAC_LENGTH;
 			//      printf("ECRa: %lu, %d\n", (long unsigned)outlen, noncelen);
-			ok = AES_SIV_Decrypt(wire_ctx,
+			ok = AES_SIV_Decrypt(wire_ctx_get(),
 					     plaintext, &outlen,
 					     peer->nts_state.s2c, peer->nts_state.keylen,
 					     nonce, noncelen,
@@ -442,8 +490,23 @@ bool extens_client_recv(struct peer *peer, uint8_t *pkt, int lng) {
 	if (!sawAEEF) {
 		return false;
 	}
+	peer->nts_state.pending = false;
 	nts_client_recv_good++;
 	nts_client_recv_bad--;
 	return true;
 }
+
+/* Should we ask for cookies before the next regular poll?
+ * A good reply refills the pool, so it only drains when
+ * requests are lost.  The more we have been losing lately,
+ * the earlier we start: with no losses that is at the last
+ * cookie, with heavy losses at half the pool.
+ */
+bool nts_cookies_low(struct peer *peer) {
+	int low = 1 + peer->nts_state.loss * (NTS_MAX_COOKIES/2) / 256;
+
+	if (!peer->nts_state.pending)
+		return false;
+	return 0 < peer->nts_state.count && peer->nts_state.count <= low;
+}
 /* end */
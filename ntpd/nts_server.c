@@ -9,6 +9,7 @@
  */
 #include "config.h"
 
+#include <fcntl.h>
 #include <signal.h>
 #include <pthread.h>
 #include <unistd.h>
@@ -16,15 +17,30 @@
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
 #include <openssl/x509.h>
+#if OPENSSL_VERSION_NUMBER > 0x20000000L
+# include <openssl/core_names.h>
+# include <openssl/params.h>
+#else
+# include <openssl/hmac.h>
+#endif
 
 #include "ntp.h"
 #include "ntpd.h"
+#include "ntp_lists.h"
 #include "ntp_stdlib.h"
 #include "nts.h"
 #include "nts2.h"
 #include "timespecops.h"
 
+#ifdef USE_EPOLL
+# include <sys/epoll.h>
+# ifndef EPOLLEXCLUSIVE
+#  define EPOLLEXCLUSIVE 0	/* pre 4.5 kernel headers: wake them all */
+# endif
+#endif
+
 /* Beware: bind and accept take type sockaddr, but that's not big
  *         enough for an IPv6 address.
  */
@@ -34,7 +50,15 @@ static bool create_listener4(int port);
 static bool create_listener6(int port);
 static void* nts_ke_listener(void*);
 static bool nts_ke_request(SSL *ssl);
+static bool nts_ke_reply(SSL *ssl, uint8_t *buff, int bytes_read,
+			 int size, int *used);
 static void nts_ke_accept_fail(char* addrbuf, double sec);
+static void nts_ke_stats(bool handshook, bool good, bool resumed,
+			 double hs_sec);
+static void nts_ticket_setup(SSL_CTX *ctx);
+#ifdef USE_EPOLL
+static bool nts_ke_start_workers(void);
+#endif
 
 static void nts_lock_certlock(void);
 static void nts_unlock_certlock(void);
@@ -55,6 +79,20 @@ uint64_t nts_ke_serves_good = 0;
 uint64_t nts_ke_serves_bad = 0;
 uint64_t nts_ke_probes_good = 0;
 uint64_t nts_ke_probes_bad = 0;
+uint64_t nts_ke_active = 0;		/* connections being served */
+uint64_t nts_ke_active_max = 0;		/* high water mark of that */
+uint64_t nts_ke_timeouts = 0;		/* dropped at their deadline */
+uint64_t nts_ke_full = 0;		/* accepting paused at kemaxconns */
+uint64_t nts_ke_handshakes = 0;		/* completed TLS handshakes */
+double nts_ke_hs_time = 0;		/* total seconds in those */
+double nts_ke_hs_max = 0;		/* slowest one */
+uint64_t nts_ke_resume_hits = 0;	/* handshakes that used a ticket */
+uint64_t nts_ke_resume_misses = 0;	/* full handshakes, tlsresume on */
+uint64_t nts_ke_probe_resume_hits = 0;	/* client side of those */
+uint64_t nts_ke_probe_resume_misses = 0;
+
+/* The NTS-KE threads share the counters above. */
+static pthread_mutex_t ke_stats_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int alpn_select_cb(SSL *ssl,
 			  const unsigned char **out,
@@ -106,7 +144,14 @@ bool nts_server_init(void) {
 
 	SSL_CTX_set_alpn_select_cb(server_ctx, alpn_select_cb, NULL);
 	SSL_CTX_set_session_cache_mode(server_ctx, SSL_SESS_CACHE_OFF);
-	SSL_CTX_set_timeout(server_ctx, NTS_KE_TIMEOUT);  /* session lifetime */
+	if (ntsconfig.tlsresume)
+		nts_ticket_setup(server_ctx);
+	else {
+		/* Nobody could use a ticket, don't send any. */
+		SSL_CTX_set_options(server_ctx, SSL_OP_NO_TICKET);
+		SSL_CTX_set_num_tickets(server_ctx, 0);
+		SSL_CTX_set_timeout(server_ctx, NTS_KE_TIMEOUT);  /* session lifetime */
+	}
 
 	ok &= nts_load_versions(server_ctx);
 	ok &= nts_load_ciphers(server_ctx);
@@ -135,6 +180,134 @@ bool nts_server_init(void) {
 	return ok;
 }
 
+/*
+ * TLS session resumption, "nts tlsresume".
+ *
+ * The server keeps no session cache.  It hands out stateless tickets
+ * (one per handshake) encrypted with AES-256-CBC and authenticated
+ * with HMAC-SHA256 under keys derived from the cookie keys, so they
+ * rotate in nts_cookie_timer() along with them.  New tickets use
+ * the current key; tickets under the previous one are still
+ * accepted.  Every resumption gets a new ticket.  That keeps a
+ * ticket good for at least NTS_KE_TICKET_LIFETIME, and servers
+ * sharing a cookie key file accept each other's tickets.
+ */
+#define TICKET_NAME_LENGTH	16
+struct ticket_key {
+	unsigned char name[TICKET_NAME_LENGTH];
+	unsigned char aes[NTS_DERIVED_LENGTH];	/* AES-256-CBC */
+	unsigned char mac[NTS_DERIVED_LENGTH];	/* HMAC-SHA256 */
+};
+static struct ticket_key ticket_keys[2];	/* current, previous */
+static bool ticket_keys_ok = false;
+static pthread_mutex_t ticket_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#if OPENSSL_VERSION_NUMBER > 0x20000000L
+typedef EVP_MAC_CTX TICKET_MAC_CTX;
+
+static bool ticket_mac_init(TICKET_MAC_CTX *hctx, unsigned char *key) {
+	static char digest[] = "SHA256";
+	OSSL_PARAM params[2];
+
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+						     digest, 0);
+	params[1] = OSSL_PARAM_construct_end();
+	return EVP_MAC_init(hctx, key, NTS_DERIVED_LENGTH, params);
+}
+#else
+typedef HMAC_CTX TICKET_MAC_CTX;
+
+static bool ticket_mac_init(TICKET_MAC_CTX *hctx, unsigned char *key) {
+	return HMAC_Init_ex(hctx, key, NTS_DERIVED_LENGTH,
+			    EVP_sha256(), NULL);
+}
+#endif
+
+/* Called by OpenSSL to seal (enc) or open a session ticket.
+ * Returns 1 for OK, 2 for OK and issue a new ticket, 0 for no ticket
+ * (full handshake) and -1 for error.
+ */
+static int ticket_key_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+			 EVP_CIPHER_CTX *ectx, TICKET_MAC_CTX *hctx, int enc)
+{
+	struct ticket_key key;
+	int which, rc;
+
+	UNUSED_ARG(ssl);
+
+	pthread_mutex_lock(&ticket_lock);
+	if (!ticket_keys_ok) {
+		pthread_mutex_unlock(&ticket_lock);
+		return 0;
+	}
+	if (enc) {
+		which = 0;
+	} else {
+		for (which = 0; which < 2; which++)
+			if (0 == memcmp(name, ticket_keys[which].name,
+					TICKET_NAME_LENGTH))
+				break;
+		if (2 == which) {
+			pthread_mutex_unlock(&ticket_lock);
+			return 0;	/* too old, or not ours */
+		}
+	}
+	key = ticket_keys[which];
+	pthread_mutex_unlock(&ticket_lock);
+
+	/* Always hand out a fresh ticket on resumption: a ticket used
+	 * twice links the two connections, and without that write the
+	 * client's request waits for a delayed ACK. */
+	rc = enc ? 1 : 2;
+	if (enc) {
+		memcpy(name, key.name, TICKET_NAME_LENGTH);
+		if (1 != RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) ||
+		    !EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL,
+					key.aes, iv) ||
+		    !ticket_mac_init(hctx, key.mac))
+			rc = -1;
+	} else {
+		if (!ticket_mac_init(hctx, key.mac) ||
+		    !EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL,
+					key.aes, iv))
+			rc = -1;
+	}
+	OPENSSL_cleanse(&key, sizeof(key));
+	return rc;
+}
+
+static void nts_ticket_setup(SSL_CTX *ctx) {
+	SSL_CTX_set_num_tickets(ctx, 1);
+	SSL_CTX_set_timeout(ctx, NTS_KE_TICKET_LIFETIME);  /* session lifetime */
+#if OPENSSL_VERSION_NUMBER > 0x20000000L
+	SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key_cb);
+#else
+	SSL_CTX_set_tlsext_ticket_key_cb(ctx, ticket_key_cb);
+#endif
+	msyslog(LOG_INFO, "NTSs: TLS session resumption enabled");
+}
+
+/* Re-derive the ticket keys after the cookie keys changed. */
+void nts_ticket_keys_update(void) {
+	struct ticket_key fresh[2];
+
+	if (!ntsconfig.tlsresume)
+		return;
+	for (int i = 0; i < 2; i++) {
+		unsigned char name[NTS_DERIVED_LENGTH];
+
+		nts_cookie_derive(1 == i, "NTS-KE ticket name", name);
+		memcpy(fresh[i].name, name, TICKET_NAME_LENGTH);
+		nts_cookie_derive(1 == i, "NTS-KE ticket aes", fresh[i].aes);
+		nts_cookie_derive(1 == i, "NTS-KE ticket mac", fresh[i].mac);
+	}
+	pthread_mutex_lock(&ticket_lock);
+	memcpy(ticket_keys, fresh, sizeof(ticket_keys));
+	ticket_keys_ok = true;
+	pthread_mutex_unlock(&ticket_lock);
+	OPENSSL_cleanse(fresh, sizeof(fresh));
+}
+
 bool nts_server_init2(void) {
 	pthread_t worker;
 	sigset_t block_mask, saved_sig_mask;
@@ -145,6 +318,12 @@ bool nts_server_init2(void) {
 		return false;
 	}
 
+#ifdef USE_EPOLL
+	if (nts_ke_start_workers())
+		return true;
+	msyslog(LOG_WARNING, "NTSs: using one blocking thread per listener");
+#endif
+
 	sigfillset(&block_mask);
 	pthread_sigmask(SIG_BLOCK, &block_mask, &saved_sig_mask);
 	if (listener4_sock != -1) {
@@ -216,6 +395,7 @@ void* nts_ke_listener(void* arg) {
 	char errbuf[100];
 	char addrbuf[100];
 	char usingbuf[100];
+	bool resumed;
 
 #ifdef HAVE_SECCOMP_H
         setup_SIGSYS_trap();   /* enable trap for this thread */
@@ -226,7 +406,9 @@ void* nts_ke_listener(void* arg) {
 		socklen_t len = sizeof(addr);
 		SSL *ssl;
 		struct timespec start, finish;
+		double hs_sec;
 		int client, err;
+		bool good;
 
 		client = accept(sock, &addr.sa, &len);
 		if (client < 0) {
@@ -263,11 +445,11 @@ void* nts_ke_listener(void* arg) {
 			ntp_strerror_r(errno, errbuf, sizeof(errbuf));
 			msyslog(LOG_ERR, "NTSs: can't setsockopt: %s", errbuf);
 			close(client);
-			nts_ke_serves_bad++;
+			nts_ke_stats(false, false, false, 0);
 			continue;
 		}
 
-		/* WARN: For high volume servers, this should go in a new thread. */
+		/* The worker pool below doesn't have this problem. */
 		nts_lock_certlock();
 		ssl = SSL_new(server_ctx);
 		nts_unlock_certlock();
@@ -279,18 +461,22 @@ void* nts_ke_listener(void* arg) {
 			nts_ke_accept_fail(addrbuf, tspec_to_d(finish));
 			SSL_free(ssl);
 			close(client);
-			nts_ke_serves_bad++;
+			nts_ke_stats(false, false, false, 0);
 			continue;
 		}
+		clock_gettime(CLOCK_REALTIME, &finish);
+		finish = sub_tspec(finish, start);
+		hs_sec = tspec_to_d(finish);
 
 		/* Save info for final message. */
-		snprintf(usingbuf, sizeof(usingbuf), "%s, %s (%d)",
+		resumed = SSL_session_reused(ssl);
+		snprintf(usingbuf, sizeof(usingbuf), "%s, %s (%d)%s",
 			SSL_get_version(ssl),
 			SSL_get_cipher_name(ssl),
-			SSL_get_cipher_bits(ssl, NULL));
+			SSL_get_cipher_bits(ssl, NULL),
+			resumed ? ", resumed" : "");
 
-		if (!nts_ke_request(ssl))
-			nts_ke_serves_bad++;
+		good = nts_ke_request(ssl);
 
 		SSL_shutdown(ssl);
 		SSL_free(ssl);
@@ -298,7 +484,7 @@ void* nts_ke_listener(void* arg) {
 
 		clock_gettime(CLOCK_REALTIME, &finish);
 		finish = sub_tspec(finish, start);
-		nts_ke_serves_good++;
+		nts_ke_stats(true, good, resumed, hs_sec);
 		msyslog(LOG_INFO, "NTSs: NTS-KE from %s, Using %s, took %.3f sec",
 			addrbuf, usingbuf, tspec_to_d(finish));
 
@@ -338,9 +524,6 @@ bool nts_ke_request(SSL *ssl) {
 	 * 8*168 fits comfortably into 2K.
 	 */
 	uint8_t buff[2048];
-	uint8_t c2s[NTS_MAX_KEYLEN], s2c[NTS_MAX_KEYLEN];
-	int aead, keylen;
-	struct BufCtl_t buf;
 	int bytes_read, bytes_written;
 	int used;
 
@@ -348,6 +531,25 @@ bool nts_ke_request(SSL *ssl) {
 	if (0 > bytes_read)
 		return false;
 
+	if (!nts_ke_reply(ssl, buff, bytes_read, sizeof(buff), &used))
+		return false;
+
+	bytes_written = nts_ssl_write(ssl, buff, used);
+	if (bytes_written != used)
+		return false;
+
+	return true;
+}
+
+/* Turn the request in buff into the reply, in place.
+ * Shared by the blocking listener and the worker pool.
+ */
+bool nts_ke_reply(SSL *ssl, uint8_t *buff, int bytes_read,
+		  int size, int *used) {
+	uint8_t c2s[NTS_MAX_KEYLEN], s2c[NTS_MAX_KEYLEN];
+	int aead, keylen;
+	struct BufCtl_t buf;
+
 	buf.next = buff;
 	buf.left = bytes_read;
 	aead = NO_AEAD;
@@ -364,23 +566,449 @@ bool nts_ke_request(SSL *ssl) {
 		return false;
 
 	buf.next = buff;
-	buf.left = sizeof(buff);
+	buf.left = size;
 	if (!nts_ke_setup_send(&buf, aead, c2s, s2c, keylen))
 		return false;
 
-	used = sizeof(buff)-buf.left;
-	bytes_written = nts_ssl_write(ssl, buff, used);
-	if (bytes_written != used)
-		return false;
+	*used = size-buf.left;
 
 	/* Skip logging the normal case. */
 	if ((bytes_read!=16) || (aead!=15) )
 		msyslog(LOG_INFO, "NTSs: Read %d, wrote %d bytes.  AEAD=%d",
-			bytes_read, bytes_written, aead);
+			bytes_read, *used, aead);
+
+	return true;
+}
+
+/* Account for one finished NTS-KE connection. */
+void nts_ke_stats(bool handshook, bool good, bool resumed, double hs_sec) {
+	pthread_mutex_lock(&ke_stats_lock);
+	if (handshook) {
+		/* Historically a failed request counts as bad and good. */
+		nts_ke_serves_good++;
+		nts_ke_handshakes++;
+		nts_ke_hs_time += hs_sec;
+		if (hs_sec > nts_ke_hs_max)
+			nts_ke_hs_max = hs_sec;
+		if (resumed)
+			nts_ke_resume_hits++;
+		else if (ntsconfig.tlsresume)
+			nts_ke_resume_misses++;
+	}
+	if (!good)
+		nts_ke_serves_bad++;
+	pthread_mutex_unlock(&ke_stats_lock);
+}
+
+#ifdef USE_EPOLL
+/*
+ * Event-driven NTS-KE server.
+ *
+ * Each worker thread has its own epoll set holding every listen
+ * socket (EPOLLEXCLUSIVE, so a new connection wakes one worker) and
+ * the connections that worker accepted.  A connection is a small
+ * state machine stepped by non-blocking SSL_accept, SSL_read and
+ * SSL_write; whatever OpenSSL wants next is what we wait for.
+ *
+ * Connections are kept in accept order.  They all get the same
+ * NTS_KE_TIMEOUT, so the head of the list is always the next to
+ * expire.  A slow or hostile client holds one slot until then and
+ * nobody waits behind it.  A worker at its share of kemaxconns
+ * takes the listen sockets out of its set, leaving new connections
+ * in the kernel backlog for the other workers.
+ */
+#define KE_MAX_EVENTS	32
+#define KE_MAX_LISTEN	4
+
+/* epoll hands back one of these: a listen socket or a ke_conn */
+struct ke_event {
+	int	fd;
+	bool	listener;
+};
+
+enum ke_state { KE_HANDSHAKE, KE_READ, KE_WRITE };
+
+struct ke_conn {
+	struct ke_event	ev;		/* must be first */
+	DECL_DLIST_LINK(struct ke_conn, link);	/* accept order */
+	SSL *		ssl;
+	enum ke_state	state;
+	struct timespec	start;		/* CLOCK_MONOTONIC at accept */
+	double		hs_sec;		/* handshake time */
+	bool		resumed;	/* handshake used a ticket */
+	int		used;		/* reply bytes in buff */
+	char		addrbuf[100];
+	char		usingbuf[100];
+	uint8_t		buff[2048];	/* see nts_ke_request */
+};
+
+struct ke_worker {
+	int		epfd;
+	int		active;		/* connections in progress */
+	int		maxconns;	/* this worker's share */
+	bool		paused;		/* listen sockets removed */
+	struct ke_conn	conns;		/* list head */
+};
+
+static struct ke_event ke_listeners[KE_MAX_LISTEN];
+static int ke_nlisteners;
+
+/* Workers wait for this before their first accept, so the
+ * connection limit is split between the workers that started. */
+static pthread_mutex_t ke_start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ke_start_cond = PTHREAD_COND_INITIALIZER;
+static bool ke_started;
+
+static void *nts_ke_worker(void *);
+static void ke_accept(struct ke_worker *, int);
+static void ke_step(struct ke_worker *, struct ke_conn *);
+static void ke_done(struct ke_worker *, struct ke_conn *, bool);
+static void ke_close(struct ke_worker *, struct ke_conn *);
+static int ke_expire(struct ke_worker *);
+static void ke_listen(struct ke_worker *, bool);
+
+static double
+ke_elapsed(const struct ke_conn *conn)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return tspec_to_d(sub_tspec(now, conn->start));
+}
+
+bool
+nts_ke_start_workers(void)
+{
+	int socks[KE_MAX_LISTEN] = {
+		listener4_sock, listener4_sock_old,
+		listener6_sock, listener6_sock_old };
+	sigset_t block_mask, saved_sig_mask;
+	int workers = max(1, ntsconfig.keworkers);
+	int maxconns = max(workers, ntsconfig.kemaxconns);
+	struct ke_worker *w, **pool;
+	pthread_t thread;
+	char errbuf[100];
+	int started = 0;
+
+	ke_nlisteners = 0;
+	for (int i = 0; i < KE_MAX_LISTEN; i++) {
+		if (-1 == socks[i])
+			continue;
+		/* another worker may take the connection first */
+		if (0 > fcntl(socks[i], F_SETFL,
+			      fcntl(socks[i], F_GETFL) | O_NONBLOCK)) {
+			ntp_strerror_r(errno, errbuf, sizeof(errbuf));
+			msyslog(LOG_ERR, "NTSs: can't make listener non-blocking: %s",
+				errbuf);
+			return false;
+		}
+		ke_listeners[ke_nlisteners].fd = socks[i];
+		ke_listeners[ke_nlisteners].listener = true;
+		ke_nlisteners++;
+	}
+
+	pool = emalloc_zero(workers * sizeof(*pool));
+	sigfillset(&block_mask);
+	pthread_sigmask(SIG_BLOCK, &block_mask, &saved_sig_mask);
+	for (int i = 0; i < workers; i++) {
+		w = emalloc_zero(sizeof(*w));
+		INIT_DLIST(w->conns, link);
+		w->epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (0 > w->epfd) {
+			ntp_strerror_r(errno, errbuf, sizeof(errbuf));
+			msyslog(LOG_ERR, "NTSs: epoll_create1 failed: %s", errbuf);
+			free(w);
+			break;
+		}
+		w->paused = true;
+		ke_listen(w, true);
+		if (pthread_create(&thread, NULL, nts_ke_worker, w)) {
+			ntp_strerror_r(errno, errbuf, sizeof(errbuf));
+			msyslog(LOG_ERR, "NTSs: error from pthread_create: %s",
+				errbuf);
+			close(w->epfd);
+			free(w);
+			break;
+		}
+		pool[started++] = w;
+	}
+	pthread_sigmask(SIG_SETMASK, &saved_sig_mask, NULL);
 
+	if (0 == started) {
+		free(pool);
+		/* back to blocking for the fallback threads */
+		for (int i = 0; i < ke_nlisteners; i++)
+			fcntl(ke_listeners[i].fd, F_SETFL,
+			      fcntl(ke_listeners[i].fd, F_GETFL) & ~O_NONBLOCK);
+		return false;
+	}
+
+	/* share the limit between the workers that are running */
+	pthread_mutex_lock(&ke_start_lock);
+	for (int i = 0; i < started; i++)
+		pool[i]->maxconns = (maxconns + started - 1) / started;
+	ke_started = true;
+	pthread_cond_broadcast(&ke_start_cond);
+	pthread_mutex_unlock(&ke_start_lock);
+	free(pool);
+
+	msyslog(LOG_INFO, "NTSs: %d NTS-KE workers, %d connections each",
+		started, (maxconns + started - 1) / started);
 	return true;
 }
 
+/* Add or remove the listen sockets from a worker's epoll set. */
+void
+ke_listen(struct ke_worker *w, bool on)
+{
+	struct epoll_event ev;
+
+	if (on != w->paused)
+		return;
+	for (int i = 0; i < ke_nlisteners; i++) {
+		ZERO(ev);
+		ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+		ev.data.ptr = &ke_listeners[i];
+		epoll_ctl(w->epfd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+			  ke_listeners[i].fd, &ev);
+	}
+	w->paused = !on;
+}
+
+void *
+nts_ke_worker(void *arg)
+{
+	struct ke_worker *w = arg;
+	struct epoll_event events[KE_MAX_EVENTS];
+	char errbuf[100];
+
+#ifdef HAVE_SECCOMP_H
+        setup_SIGSYS_trap();   /* enable trap for this thread */
+#endif
+
+	pthread_mutex_lock(&ke_start_lock);
+	while (!ke_started)
+		pthread_cond_wait(&ke_start_cond, &ke_start_lock);
+	pthread_mutex_unlock(&ke_start_lock);
+
+	while (1) {
+		int count;
+
+		nts_nonce_refill();
+		count = epoll_wait(w->epfd, events, KE_MAX_EVENTS,
+				   ke_expire(w));
+		if (0 > count) {
+			if (EINTR == errno)
+				continue;
+			ntp_strerror_r(errno, errbuf, sizeof(errbuf));
+			msyslog(LOG_ERR, "NTSs: epoll_wait failed: %s", errbuf);
+			sleep(1);		/* avoid log clutter on bug */
+			continue;
+		}
+		for (int i = 0; i < count; i++) {
+			struct ke_event *ev = events[i].data.ptr;
+
+			if (ev->listener)
+				ke_accept(w, ev->fd);
+			else
+				ke_step(w, (struct ke_conn *)ev);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * ke_expire - drop connections past their deadline.
+ * Returns the epoll_wait timeout for the next one, in ms.
+ */
+int
+ke_expire(struct ke_worker *w)
+{
+	struct ke_conn *conn;
+	double age;
+
+	while (NULL != (conn = HEAD_DLIST(w->conns, link))) {
+		age = ke_elapsed(conn);
+		if (age < NTS_KE_TIMEOUT)
+			return 1 + (int)((NTS_KE_TIMEOUT - age) * MS_PER_S);
+		msyslog(LOG_INFO, "NTSs: NTS-KE from %s timed out %s, took %.3f sec",
+			conn->addrbuf,
+			(KE_HANDSHAKE == conn->state) ? "in handshake" : "after handshake",
+			age);
+		pthread_mutex_lock(&ke_stats_lock);
+		nts_ke_timeouts++;
+		pthread_mutex_unlock(&ke_stats_lock);
+		nts_ke_stats(KE_HANDSHAKE != conn->state, false,
+			     conn->resumed, conn->hs_sec);
+		ke_close(w, conn);
+	}
+	return -1;
+}
+
+void
+ke_accept(struct ke_worker *w, int sock)
+{
+	struct ke_conn *conn;
+	struct epoll_event ev;
+	sockaddr_u addr;
+	socklen_t len = sizeof(addr);
+	char errbuf[100];
+	int client;
+	bool full;
+
+	client = accept(sock, &addr.sa, &len);
+	if (client < 0) {
+		/* another worker got it, or it went away */
+		if (EAGAIN == errno || EWOULDBLOCK == errno ||
+		    ECONNABORTED == errno || EINTR == errno)
+			return;
+		ntp_strerror_r(errno, errbuf, sizeof(errbuf));
+		msyslog(LOG_ERR, "NTSs: TCP accept failed: %s", errbuf);
+		return;
+	}
+	if (0 > fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK)) {
+		ntp_strerror_r(errno, errbuf, sizeof(errbuf));
+		msyslog(LOG_ERR, "NTSs: can't make connection non-blocking: %s",
+			errbuf);
+		close(client);
+		nts_ke_stats(false, false, false, 0);
+		return;
+	}
+
+	conn = emalloc_zero(sizeof(*conn));
+	conn->ev.fd = client;
+	conn->ev.listener = false;
+	conn->state = KE_HANDSHAKE;
+	clock_gettime(CLOCK_MONOTONIC, &conn->start);
+	sockporttoa_r(&addr, conn->addrbuf, sizeof(conn->addrbuf));
+	nts_lock_certlock();
+	conn->ssl = SSL_new(server_ctx);
+	nts_unlock_certlock();
+	SSL_set_fd(conn->ssl, client);
+
+	ZERO(ev);
+	ev.events = EPOLLIN;
+	ev.data.ptr = conn;
+	if (0 > epoll_ctl(w->epfd, EPOLL_CTL_ADD, client, &ev)) {
+		ntp_strerror_r(errno, errbuf, sizeof(errbuf));
+		msyslog(LOG_ERR, "NTSs: can't add connection to epoll: %s",
+			errbuf);
+		SSL_free(conn->ssl);
+		close(client);
+		free(conn);
+		nts_ke_stats(false, false, false, 0);
+		return;
+	}
+	LINK_TAIL_DLIST(w->conns, conn, link);
+	full = (++w->active >= w->maxconns);
+	if (full)
+		ke_listen(w, false);
+	pthread_mutex_lock(&ke_stats_lock);
+	if (++nts_ke_active > nts_ke_active_max)
+		nts_ke_active_max = nts_ke_active;
+	if (full)
+		nts_ke_full++;
+	pthread_mutex_unlock(&ke_stats_lock);
+
+	ke_step(w, conn);
+}
+
+/* Run a connection as far as it will go without blocking. */
+void
+ke_step(struct ke_worker *w, struct ke_conn *conn)
+{
+	struct epoll_event ev;
+	int rc, err;
+
+	while (1) {
+		switch (conn->state) {
+		    case KE_HANDSHAKE:
+			rc = SSL_accept(conn->ssl);
+			if (0 < rc) {
+				conn->hs_sec = ke_elapsed(conn);
+				conn->resumed = SSL_session_reused(conn->ssl);
+				snprintf(conn->usingbuf, sizeof(conn->usingbuf),
+					 "%s, %s (%d)%s",
+					 SSL_get_version(conn->ssl),
+					 SSL_get_cipher_name(conn->ssl),
+					 SSL_get_cipher_bits(conn->ssl, NULL),
+					 conn->resumed ? ", resumed" : "");
+				conn->state = KE_READ;
+				continue;
+			}
+			break;
+		    case KE_READ:
+			rc = SSL_read(conn->ssl, conn->buff, sizeof(conn->buff));
+			if (0 < rc) {
+				if (!nts_ke_reply(conn->ssl, conn->buff, rc,
+						  sizeof(conn->buff),
+						  &conn->used)) {
+					ke_done(w, conn, false);
+					return;
+				}
+				conn->state = KE_WRITE;
+				continue;
+			}
+			break;
+		    case KE_WRITE:
+		    default:
+			rc = SSL_write(conn->ssl, conn->buff, conn->used);
+			if (0 < rc) {
+				ke_done(w, conn, true);
+				return;
+			}
+			break;
+		}
+
+		err = SSL_get_error(conn->ssl, rc);
+		if (SSL_ERROR_WANT_READ != err && SSL_ERROR_WANT_WRITE != err)
+			break;
+		ZERO(ev);
+		ev.events = (SSL_ERROR_WANT_READ == err) ? EPOLLIN : EPOLLOUT;
+		ev.data.ptr = conn;
+		epoll_ctl(w->epfd, EPOLL_CTL_MOD, conn->ev.fd, &ev);
+		return;
+	}
+
+	/* hard failure */
+	if (KE_HANDSHAKE == conn->state) {
+		nts_ke_accept_fail(conn->addrbuf, ke_elapsed(conn));
+		nts_ke_stats(false, false, false, 0);
+		ke_close(w, conn);
+		return;
+	}
+	msyslog(LOG_INFO, "NTS: SSL_%s error",
+		(KE_READ == conn->state) ? "read" : "write");
+	nts_log_ssl_error();
+	ke_done(w, conn, false);
+}
+
+/* Finish a connection that got through the handshake. */
+void
+ke_done(struct ke_worker *w, struct ke_conn *conn, bool good)
+{
+	SSL_shutdown(conn->ssl);
+	nts_ke_stats(true, good, conn->resumed, conn->hs_sec);
+	msyslog(LOG_INFO, "NTSs: NTS-KE from %s, Using %s, took %.3f sec",
+		conn->addrbuf, conn->usingbuf, ke_elapsed(conn));
+	ke_close(w, conn);
+}
+
+void
+ke_close(struct ke_worker *w, struct ke_conn *conn)
+{
+	UNLINK_DLIST(conn, link);
+	SSL_free(conn->ssl);
+	close(conn->ev.fd);		/* also leaves the epoll set */
+	free(conn);
+	if (--w->active < w->maxconns)
+		ke_listen(w, true);
+	pthread_mutex_lock(&ke_stats_lock);
+	nts_ke_active--;
+	pthread_mutex_unlock(&ke_stats_lock);
+}
+#endif /* USE_EPOLL */
+
 bool create_listener4(int port) {
 	int sock = -1;
 	sockaddr_u addr;
@@ -415,7 +1043,7 @@ bool create_listener4(int port) {
 		close(sock);
 		return false;
 	}
-	if (listen(sock, 6) < 0) {
+	if (listen(sock, SOMAXCONN) < 0) {
 		ntp_strerror_r(errno, errbuf, sizeof(errbuf));
 		msyslog(LOG_ERR, "NTSs: can't listen4: %s", errbuf);
 		close(sock);
@@ -469,7 +1097,7 @@ bool create_listener6(int port) {
 		close(sock);
 		return false;
 	}
-	if (listen(sock, 6) < 0) {
+	if (listen(sock, SOMAXCONN) < 0) {
 		ntp_strerror_r(errno, errbuf, sizeof(errbuf));
 		msyslog(LOG_ERR, "NTSs: can't listen6: %s", errbuf);
 		close(sock);
@@ -551,6 +1179,7 @@ bool nts_ke_process_receive(struct BufCtl_t *buf, int *aead) {
 
 bool nts_ke_setup_send(struct BufCtl_t *buf, int aead,
        uint8_t *c2s, uint8_t *s2c, int keylen) {
+	int cookielen, stride;
 
 	/* 4.1.2 Next Protocol */
 	ke_append_record_uint16(buf,
@@ -558,10 +1187,17 @@ bool nts_ke_setup_send(struct BufCtl_t *buf, int aead,
 	/* 4.1.5 AEAD Algorithm List */
 	ke_append_record_uint16(buf, nts_algorithm_negotiation, aead);
 
+	/* Make the cookies where they go, between their headers. */
+	cookielen = nts_cookie_length(keylen);
+	stride = NTS_KE_HDR_LNG+cookielen;
+	if (NTS_MAX_COOKIES*stride > buf->left)
+		return false;
+	nts_make_cookies(buf->next+NTS_KE_HDR_LNG, NTS_MAX_COOKIES, stride,
+			 aead, c2s, s2c, keylen);
 	for (int i=0; i<NTS_MAX_COOKIES; i++) {
-		uint8_t cookie[NTS_MAX_COOKIELEN];
-		int cookielen = nts_make_cookie(cookie, aead, c2s, s2c, keylen);
-		ke_append_record_bytes(buf, nts_new_cookie, cookie, cookielen);
+		append_header(buf, nts_new_cookie, cookielen);
+		buf->next += cookielen;
+		buf->left -= cookielen;
 	}
 
 	/* 4.1.1: End, Critical */
@@ -615,6 +615,7 @@ SERR_STALL = "***No response, probably high-traffic server with low MRU limit"
 SERR_BADTAG = "***Bad MRU tag %s"
 SERR_BADSORT = "***Sort order %s is not implemented"
 SERR_NOTRUST = "***No trusted keys have been declared"
+SERR_BADMRU = "***Malformed binary MRU response"
 
 
 def dump_hex_printable(xdata, outfp=sys.stdout):
@@ -1288,6 +1289,18 @@ class ControlSession:
             qdata = ""
         else:
             qdata = ",".join(varlist)
+        if len(qdata) > ntp.control.CTL_MAX_DATA_LEN:
+            # Too many names for one request packet, ask in pieces.
+            items = []
+            chunk = []
+            for var in varlist:
+                if chunk and (len(",".join(chunk + [var])) >
+                              ntp.control.CTL_MAX_DATA_LEN):
+                    items += self.readvar(associd, chunk, opcode, raw).items()
+                    chunk = []
+                chunk.append(var)
+            items += self.readvar(associd, chunk, opcode, raw).items()
+            return ntp.util.OrderedDict(items)
         self.doquery(opcode, associd=associd, qdata=qdata)
         return self.__parse_varlist(raw)
 
@@ -1430,6 +1443,19 @@ This combats source address spoofing
         if variables:
             sorter, sortkey, frags = parse_mru_variables(variables)
 
+        # The snapshot records carry no local address, so laddr=
+        # needs the text protocol.
+        if variables.pop("bin", False) and "laddr" not in variables:
+            try:
+                span = self.__mrulist_bin(variables, rawhook, direct)
+            except ControlException as e:
+                if e.errorcode != ntp.control.CERR_BADOP:
+                    raise e
+                self.warndbg("no binary MRU export, falling back", 1)
+            else:
+                stitch_mru(span, sorter, sortkey)
+                return span
+
         nonce = self.fetch_nonce()
 
         span = MRUList()
@@ -1523,6 +1549,59 @@ This combats source address spoofing
         stitch_mru(span, sorter, sortkey)
         return span
 
+    def __mrulist_bin(self, variables, rawhook, direct):
+        "Page through a MRU snapshot with CTL_OP_READ_MRU_BIN"
+        span = MRUList()
+        snap = cursor = 0
+        restarted_count = 0
+        nonce = self.fetch_nonce()
+        try:
+            while True:
+                if time.time() - self.nonce_xmit >= ntp.control.NONCE_TIMEOUT:
+                    nonce = self.fetch_nonce()
+                req_buf = "%s, frags=%d" % (nonce, MAXFRAGS)
+                if snap:
+                    req_buf += ", snap=%d, cursor=%d" % (snap, cursor)
+                try:
+                    self.doquery(opcode=ntp.control.CTL_OP_READ_MRU_BIN,
+                                 qdata=req_buf)
+                except ControlException as e:
+                    if e.errorcode != ntp.control.CERR_UNKNOWNVAR:
+                        raise e
+                    # Someone else took a new snapshot, start over
+                    restarted_count += 1
+                    if restarted_count > 8:
+                        raise ControlException(SERR_STALL)
+                    span.entries = []
+                    snap = cursor = 0
+                    continue
+                (snap, total, first, now, entries) = \
+                    parse_mru_bin(self.response)
+                if first != cursor:
+                    raise ControlException(SERR_BADMRU)
+                cursor += len(entries)
+                self.slots += len(entries)
+                entries = [e for e in entries
+                           if mru_bin_match(e, variables, now)]
+                if rawhook:
+                    # Raw mode prints self.response, give it the text
+                    rawvars = mru_bin_variables(entries)
+                    self.response = ntp.poly.polybytes(", ".join(
+                        "%s=%s" % item for item in rawvars.items()) + "\n")
+                    rawhook(rawvars)
+                if direct is not None:
+                    direct(entries)
+                else:
+                    span.entries += entries
+                if cursor >= total:
+                    span.now = now
+                    break
+        except KeyboardInterrupt:  # pragma: no cover
+            pass        # We can test for interruption with is_complete()
+        if "recent" in variables and direct is None:
+            span.entries = span.entries[-int(variables["recent"]):]
+        return span
+
     def __ordlist(self, listtype):
         "Retrieve ordered-list data."
         self.doquery(opcode=ntp.control.CTL_OP_READ_ORDLIST_A,
@@ -1596,7 +1675,7 @@ def parse_mru_variables(variables):
         if k in ("mincount", "mindrop", "minscore",
                  "resall", "resany", "kod", "limited",
                  "maxlstint", "minlstint", "laddr", "recent",
-                 "sort", "frags", "limit"):
+                 "sort", "frags", "limit", "bin"):
             continue
         else:
             raise ControlException(SERR_BADPARAM % k)
@@ -1614,6 +1693,77 @@ def parse_mru_variables(variables):
     return sorter, sortkey, frags
 
 
+def parse_mru_bin(data):
+    "Split a CTL_OP_READ_MRU_BIN response into its header and MRUEntry list"
+    hdrlen = ntp.control.MRU_BIN_HDRLEN
+    reclen = ntp.control.MRU_BIN_RECLEN
+    data = ntp.poly.polybytes(data)
+    if len(data) < hdrlen:
+        raise ControlException(SERR_BADMRU)
+    (version, size, _, snap, total, first, count, now_i, now_f) = \
+        struct.unpack("!BBHIIIIII", data[:hdrlen])
+    if (version != ntp.control.MRU_BIN_VERSION or size != reclen or
+            len(data) < hdrlen + count * reclen):
+        raise ControlException(SERR_BADMRU)
+    now = ntp.ntpc.lfptofloat("0x%08x.%08x" % (now_i, now_f))
+    entries = []
+    for i in range(count):
+        rec = data[hdrlen + i * reclen:hdrlen + (i + 1) * reclen]
+        (family, mv, rs, port, _, addr, first_i, first_f,
+         last_i, last_f, ct, dr, sc) = \
+            struct.unpack("!BBHHH16sIIIIIIf", rec)
+        entry = MRUEntry()
+        if family == 6:
+            entry.addr = "[%s]:%d" % (socket.inet_ntop(socket.AF_INET6,
+                                                       addr), port)
+        else:
+            entry.addr = "%s:%d" % (socket.inet_ntop(socket.AF_INET,
+                                                     addr[:4]), port)
+        entry.first = "0x%08x.%08x" % (first_i, first_f)
+        entry.last = "0x%08x.%08x" % (last_i, last_f)
+        entry.mv = mv
+        entry.rs = rs
+        entry.ct = ct
+        entry.dr = dr
+        entry.sc = sc
+        entries.append(entry)
+    return (snap, total, first, now, entries)
+
+
+def mru_bin_match(entry, variables, now):
+    "Apply the mrulist filters ntpd applies for CTL_OP_READ_MRU"
+    if entry.ct < variables.get("mincount", 0):
+        return False
+    if entry.dr < variables.get("mindrop", 0):
+        return False
+    if entry.sc < variables.get("minscore", 0):
+        return False
+    resall = variables.get("resall", 0)
+    if resall and (entry.rs & resall) != resall:
+        return False
+    resany = variables.get("resany", 0)
+    if resany and not entry.rs & resany:
+        return False
+    lstint = int(now) - int(ntp.ntpc.lfptofloat(entry.last))
+    if 0 < variables.get("maxlstint", 0) < lstint:
+        return False
+    if lstint < variables.get("minlstint", 0):
+        return False
+    return True
+
+
+def mru_bin_variables(entries):
+    "Snapshot entries as the tag=value pairs of CTL_OP_READ_MRU, for raw mode"
+    items = []
+    for (i, e) in enumerate(entries):
+        for prefix in ("addr", "last", "first", "ct", "mv", "rs", "sc", "dr"):
+            value = getattr(e, prefix)
+            if prefix == "rs":
+                value = "0x%x" % value
+            items.append(("%s.%d" % (prefix, i), value))
+    return ntp.util.OrderedDict(items)
+
+
 def stitch_mru(span, sorter, sortkey):
     # C ntpq's code for stitching together spans was absurdly
     # overelaborate - all that dancing with last.older and
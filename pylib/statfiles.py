@@ -12,11 +12,219 @@ from __future__ import print_function, division
 import calendar
 import glob
 import gzip
+import hashlib
+import marshal
+import mmap
 import os
 import socket
+import struct
 import sys
 import time
 
+import ntp.ntpc
+
+# The C versions of the hot loops below; an older ntpc may lack them.
+statrows = getattr(ntp.ntpc, "statrows", None)
+statgroup = getattr(ntp.ntpc, "statgroup", None)
+
+
+class StatsBinFile:
+    """Reader for the binary filegen format ("filegen ... binary").
+
+    A 4096 byte header names the columns and indexes the first record
+    of each day; fixed-width little-endian records follow.  The file is
+    memory mapped and only the days inside a time range are decoded.
+    See include/ntp_filegen.h for the layout."""
+    MAGIC = b"NTPSTATS"
+    HEADER = struct.Struct("<8sHHHHHH")
+    COLUMNS = 32
+    COLUMN = struct.Struct("<16sHcB")
+    COLLEN = 24
+    INDEX = COLUMNS + 32 * COLLEN
+    ENTRY = struct.Struct("<II")
+    CODES = {b'd': 'd', b'l': 'Q', b'i': 'i', b'b': 'b',
+             b'u': 'I', b'x': 'I', b's': 's'}
+
+    def __init__(self, data):
+        "data is a bytes-like object holding the whole file"
+        self.data = data
+        (magic, version, hdrlen, reclen, ncols,
+         slots, used) = self.HEADER.unpack_from(data, 0)
+        if magic != self.MAGIC or version != 1:
+            raise ValueError("not a binary stats file")
+        self.hdrlen = hdrlen
+        self.reclen = reclen
+        self.names = []
+        self.types = []
+        fmt = "<"
+        here = 0
+        for i in range(ncols):
+            (name, offset, ctype, size) = self.COLUMN.unpack_from(
+                data, self.COLUMNS + i * self.COLLEN)
+            if offset != here or ctype not in self.CODES:
+                raise ValueError("bad column %d" % i)
+            self.names.append(name.rstrip(b"\0").decode("ascii"))
+            self.types.append(ctype)
+            fmt += (str(size) + "s") if ctype == b's' else self.CODES[ctype]
+            here += size
+        self.record = struct.Struct(fmt)
+        if here != reclen or self.record.size != reclen:
+            raise ValueError("bad record length")
+        self.nrec = (len(data) - hdrlen) // reclen
+        self.days = [self.ENTRY.unpack_from(data, self.INDEX + i * 8)
+                     for i in range(min(used, slots))]
+        self.full = used >= slots
+
+    @classmethod
+    def open(cls, path):
+        "Map a binary stats file, reading it whole if gzipped."
+        if path.endswith("gz"):
+            return cls(gzip.open(path, 'rb').read())
+        with open(path, 'rb') as fp:
+            return cls(mmap.mmap(fp.fileno(), 0, access=mmap.ACCESS_READ))
+
+    def close(self):
+        "Release the mapping."
+        if isinstance(self.data, mmap.mmap):
+            self.data.close()
+
+    def segments(self, starttime, endtime):
+        "Yield (first, end) record ranges that may hold times in range."
+        if not self.days:
+            yield (0, self.nrec)
+            return
+        firstday = int(starttime // NTPStats.SecondsInDay)
+        lastday = int(endtime // NTPStats.SecondsInDay)
+        for i, (day, first) in enumerate(self.days):
+            last = i + 1 == len(self.days)
+            end = self.nrec if last else self.days[i + 1][1]
+            # the last entry of a full index covers all later days
+            if firstday <= day <= lastday or (last and self.full
+                                              and day <= lastday):
+                yield (min(first, self.nrec), min(end, self.nrec))
+
+    def records(self, starttime, endtime):
+        "Yield record tuples with starttime <= time <= endtime."
+        view = memoryview(self.data)
+        for (first, end) in self.segments(starttime, endtime):
+            chunk = view[self.hdrlen + first * self.reclen:
+                         self.hdrlen + end * self.reclen]
+            for rec in self.record.iter_unpack(chunk):
+                if starttime <= rec[0] <= endtime:
+                    yield rec
+            chunk.release()
+        view.release()
+
+    def rows(self, starttime, endtime):
+        """Return records in range as NTPStats.unixize() rows, integer
+        milliseconds and the time then the other fields as strings."""
+        conv = []
+        for ctype in self.types[1:]:
+            if ctype == b's':
+                conv.append(lambda v: v.rstrip(b"\0").decode("ascii"))
+            elif ctype == b'x':
+                conv.append(lambda v: "%x" % v)
+            elif ctype == b'l':
+                conv.append(lambda v: "%d.%09d"
+                            % (v >> 32, ((v & 0xffffffff) * 1000000000) >> 32))
+            else:
+                conv.append(str)
+        rows = []
+        for rec in self.records(starttime, endtime):
+            row = [int(rec[0] * 1000), str(rec[0])]
+            row.extend(f(v) for (f, v) in zip(conv, rec[1:]))
+            rows.append(row)
+        return rows
+
+
+class StatsCache:
+    """On-disk cache of converted text log files ("ntpviz --cache").
+
+    Each log file gets one cache file holding its rows already in Unix
+    time, the time span they cover, and the size, mtime and inode of
+    the log file when it was parsed.  A closed day's file is parsed
+    once; the current day's file has only its new tail parsed on each
+    run.  Any mismatch or unreadable cache entry means parse it all."""
+    VERSION = 1
+
+    def __init__(self, cachedir):
+        self.cachedir = cachedir
+        if not os.path.isdir(cachedir):
+            try:
+                os.makedirs(cachedir)
+            except OSError:
+                # rows() will complain
+                pass
+
+    def path(self, logpart):
+        "Cache file for a log file, named so it can be found by hand."
+        logpart = os.path.abspath(logpart)
+        digest = hashlib.sha1(logpart.encode("utf-8")).hexdigest()
+        return os.path.join(self.cachedir, "%s.%s.cache"
+                            % (os.path.basename(logpart), digest[:12]))
+
+    def load(self, path):
+        "Return (size, mtime, inode, offset, first, last, rows) or None."
+        try:
+            with open(path, "rb") as fp:
+                entry = marshal.loads(fp.read())
+            if entry[0] == self.VERSION and 8 == len(entry):
+                return entry[1:]
+        except (IOError, OSError, EOFError, ValueError, TypeError,
+                IndexError):
+            pass
+        return None
+
+    def rows(self, logpart, convert):
+        """Return (first, last, rows) for a log file, converting any
+        lines not yet in the cache with convert(lines)."""
+        stat = os.stat(logpart)
+        key = (stat.st_size, stat.st_mtime, stat.st_ino)
+        cachefile = self.path(logpart)
+        entry = self.load(cachefile)
+        if entry is not None and tuple(entry[:3]) == key:
+            return entry[4:]
+
+        offset = 0
+        first = last = None
+        rows = []
+        if entry is not None and entry[2] == stat.st_ino \
+           and entry[3] <= stat.st_size and not logpart.endswith("gz"):
+            # same file, grown since: keep what we have
+            (offset, first, last, rows) = entry[3:]
+
+        if logpart.endswith("gz"):
+            with gzip.open(logpart, "rb") as fp:
+                data = fp.read()
+        else:
+            with open(logpart, "rb") as fp:
+                fp.seek(offset)
+                data = fp.read()
+            # leave a partial last line for next time
+            data = data[:data.rfind(b"\n") + 1]
+            offset += len(data)
+        new = convert(data.decode("utf-8", "replace").splitlines())
+        if new:
+            times = [float(row[1]) for row in new]
+            if first is None:
+                (first, last) = (min(times), max(times))
+            else:
+                (first, last) = (min(first, min(times)),
+                                 max(last, max(times)))
+            rows.extend(new)
+
+        # the cache is only an optimization, carry on without it
+        tmpfile = "%s.%d" % (cachefile, os.getpid())
+        try:
+            with open(tmpfile, "wb") as fp:
+                fp.write(marshal.dumps((self.VERSION,) + key +
+                                       (offset, first, last, rows)))
+            os.rename(tmpfile, cachefile)
+        except (IOError, OSError):
+            sys.stderr.write("ntpviz: WARNING: could not write %s\n"
+                             % cachefile)
+        return (first, last, rows)
+
 
 class NTPStats:
     "Gather statistics for a specified NTP site"
@@ -33,6 +241,8 @@ class NTPStats:
         """Extract first two fields, MJD and seconds past midnight.
         convert timestamp (MJD & seconds past midnight) to Unix time
         Replace MJD+second with Unix time."""
+        if statrows is not None:
+            return statrows(lines, starttime, endtime)
         # HOT LOOP!  Do not change w/o profiling before and after
         lines1 = []
         for line in lines:
@@ -54,6 +264,31 @@ class NTPStats:
                 lines1.append(split)
         return lines1
 
+    @staticmethod
+    def prefixtime(lines, starttime, endtime):
+        """Split lines whose first field is already Unix time (temps,
+        gpsd) and prefix them with the time in integer milliseconds."""
+        if statrows is not None:
+            return statrows(lines, starttime, endtime, True)
+        lines1 = []
+        for line in lines:
+            split = line.split()
+            if 3 > len(split):
+                # skip short lines
+                continue
+
+            try:
+                time_float = float(split[0])
+            except ValueError:
+                # ignore comment lines, lines with no time
+                continue
+
+            if starttime <= time_float <= endtime:
+                # prefix with int milli sec.
+                split.insert(0, int(time_float * 1000))
+                lines1.append(split)
+        return lines1
+
     @staticmethod
     def timestamp(line):
         "get Unix time from converted line."
@@ -107,7 +342,7 @@ class NTPStats:
         return key      # Someday, be smarter than this.
 
     def __init__(self, statsdir, sitename=None,
-                 period=None, starttime=None, endtime=None):
+                 period=None, starttime=None, endtime=None, cachedir=None):
         "Grab content of logfiles, sorted by timestamp."
         if period is None:
             period = NTPStats.DefaultPeriod
@@ -134,6 +369,11 @@ class NTPStats:
                              % statsdir)
             raise SystemExit(1)
 
+        # rows already in Unix time, from binary files or the cache
+        self.converted = {}
+        self.cache = None
+        if cachedir is not None:
+            self.cache = StatsCache(cachedir)
         self.clockstats = []
         self.peerstats = []
         self.loopstats = []
@@ -157,40 +397,53 @@ class NTPStats:
                 # skip files older than starttime
                 if self.starttime > os.path.getmtime(logpart):
                     continue
-                if logpart.endswith("gz"):
+                if logpart[len(pattern):] == "bin":
+                    # link to the current binary generation
+                    continue
+                if logpart[len(pattern):].startswith("bin"):
+                    # binary filegen, already in Unix time
+                    binfile = StatsBinFile.open(logpart)
+                    self.converted.setdefault(stem, []).extend(
+                        binfile.rows(self.starttime, self.endtime))
+                    binfile.close()
+                elif self.cache is not None:
+                    self.__load_cached(stem, logpart)
+                elif logpart.endswith("gz"):
                     lines += gzip.open(logpart, 'rt').readlines()
                 else:
                     lines += open(logpart, 'r').readlines()
-        except IOError:  # pragma: no cover
+        except (IOError, ValueError):  # pragma: no cover
             sys.stderr.write("ntpviz: WARNING: could not read %s\n"
                              % logpart)
 
         return lines
 
+    def __load_cached(self, stem, logpart):
+        "Take the rows in range of one log file from the cache."
+        inf = float("inf")
+        if stem == "temps" or stem == "gpsd":
+            (first, last, rows) = self.cache.rows(
+                logpart, lambda lines: NTPStats.prefixtime(lines, -inf, inf))
+        else:
+            (first, last, rows) = self.cache.rows(
+                logpart, lambda lines: NTPStats.unixize(lines, -inf, inf))
+        if first is None or last < self.starttime or self.endtime < first:
+            return
+        if first < self.starttime or self.endtime < last:
+            rows = [row for row in rows
+                    if self.starttime <= float(row[1]) <= self.endtime]
+        self.converted.setdefault(stem, []).extend(rows)
+
     def __process_stem(self, stem, lines):
         lines1 = []
         if stem == "temps" or stem == "gpsd":
             # temps and gpsd are already in UNIX time
-            for line in lines:
-                split = line.split()
-                if 3 > len(split):
-                    # skip short lines
-                    continue
-
-                try:
-                    time_float = float(split[0])
-                except ValueError:
-                    # ignore comment lines, lines with no time
-                    continue
-
-                if self.starttime <= time_float <= self.endtime:
-                    # prefix with int milli sec.
-                    split.insert(0, int(time_float * 1000))
-                    lines1.append(split)
+            lines1 = NTPStats.prefixtime(lines, self.starttime, self.endtime)
         else:
             # Morph first fields into Unix time with fractional seconds
             # ut into nice dictionary of dictionary rows
             lines1 = NTPStats.unixize(lines, self.starttime, self.endtime)
+        lines1 += self.converted.pop(stem, [])
 
         # Sort by datestamp
         # by default, a tuple sort()s on the 1st item, which is a nice
@@ -205,6 +458,9 @@ class NTPStats:
         if self.peermap:
             return self.peermap
 
+        if statgroup is not None:
+            self.peermap.update(statgroup(self.peerstats, 2))
+            return self.peermap
         for row in self.peerstats:
             try:
                 ip_address = row[2]     # peerstats field 2, refclock id
@@ -218,6 +474,8 @@ class NTPStats:
 
     def gpssplit(self):
         "Return a dictionary mapping gps sources to entry subsets."
+        if statgroup is not None:
+            return statgroup(self.gpsd, 2)
         gpsmap = {}
         for row in self.gpsd:
             try:
@@ -232,6 +490,8 @@ class NTPStats:
 
     def tempssplit(self):
         "Return a dictionary mapping temperature sources to entry subsets."
+        if statgroup is not None:
+            return statgroup(self.temps, 2)
         tempsmap = {}
         for row in self.temps:
             try:
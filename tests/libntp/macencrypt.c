@@ -133,6 +133,41 @@ TEST(macencrypt, DecryptInvalidCMAC) {
 		(uint32_t*)invalidPacket, packetLength, 20));
 }
 
+/* auth_setkey() keys the contexts once; the MACs must not change */
+TEST(macencrypt, KeyedContexts) {
+	char packetPtr[totalLength];
+	auth_info *keyed;
+
+	auth_setkey(4321, AUTH_CMAC, "AES-128-CBC",
+		    (uint8_t *)CMACkey, strlen(CMACkey));
+	keyed = authlookup(4321, false);
+	TEST_ASSERT_NOT_NULL(keyed);
+	TEST_ASSERT_NOT_NULL(keyed->cmac_ctx);
+	for (int i = 0; i < 2; i++) {
+		memcpy(packetPtr, packet, (size_t)packetLength);
+		memset(packetPtr+packetLength, 0, (size_t)keyIdLength);
+		TEST_ASSERT_EQUAL(4+16, cmac_encrypt(keyed,
+				  (uint32_t*)packetPtr, packetLength));
+		TEST_ASSERT_TRUE(memcmp(expectedCMACPacket, packetPtr,
+					totalLength) == 0);
+	}
+
+	/* replacing the key rebuilds the context */
+	auth_setkey(4321, AUTH_DIGEST, "MD5",
+		    (uint8_t *)MD5key, strlen(MD5key));
+	TEST_ASSERT_NULL(keyed->cmac_ctx);
+	TEST_ASSERT_NOT_NULL(keyed->digest_ctx);
+	TEST_ASSERT_FALSE(digest_decrypt(keyed,
+		(uint32_t*)expectedCMACPacket, packetLength, 20));
+	TEST_ASSERT_TRUE(digest_decrypt(keyed,
+		(uint32_t*)expectedMD5Packet, packetLength, 20));
+	TEST_ASSERT_TRUE(digest_decrypt(keyed,
+		(uint32_t*)expectedMD5Packet, packetLength, 20));
+
+	auth_delkeys();
+	TEST_ASSERT_NULL(authlookup(4321, false));
+}
+
 TEST(macencrypt, IPv4AddressToRefId) {
 	sockaddr_u addr;
 	SET_AF(&addr, AF_INET);
@@ -172,6 +207,7 @@ TEST_GROUP_RUNNER(macencrypt) {
 	RUN_TEST_CASE(macencrypt, CMAC_Encrypt);
 	RUN_TEST_CASE(macencrypt, DecryptValidCMAC);
 	RUN_TEST_CASE(macencrypt, DecryptInvalidCMAC);
+	RUN_TEST_CASE(macencrypt, KeyedContexts);
 	RUN_TEST_CASE(macencrypt, IPv4AddressToRefId);
 	RUN_TEST_CASE(macencrypt, IPv6AddressToRefId);
 }
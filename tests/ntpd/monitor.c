@@ -0,0 +1,363 @@
+#include "config.h"
+
+#include <pthread.h>
+
+#include "ntpd.h"
+#include "ntp_lists.h"
+
+#include "unity.h"
+#include "unity_fixture.h"
+
+TEST_GROUP(monitor);
+
+static uint64_t saved_mindepth;
+static int saved_maxage;
+static struct recvbuf rbuf;
+static endpt ifaces[2];
+
+static sockaddr_u
+create_sockaddr_u(uint32_t addr) {
+	sockaddr_u sockaddr;
+
+	ZERO(sockaddr);
+	SET_AF(&sockaddr, AF_INET);
+	NSRCPORT(&sockaddr) = htons(123);
+	SET_ADDR4(&sockaddr, addr);
+	return sockaddr;
+}
+
+/* feed one client packet from addr at time sec */
+static void
+hear(uint32_t addr, unsigned int sec, endpt *dstadr) {
+	rbuf.recv_srcadr = create_sockaddr_u(addr);
+	rbuf.recv_time = lfpinit((int32_t)sec, 0);
+	rbuf.recv_buffer[0] = VN_MODE(4, MODE_CLIENT);
+	rbuf.dstadr = dstadr;
+	ntp_monitor(&rbuf, 0);
+}
+
+static mon_entry *
+lookup(uint32_t addr) {
+	sockaddr_u sockaddr = create_sockaddr_u(addr);
+
+	return mon_get_slot(&sockaddr);
+}
+
+/* the shard holding addr, which is left out of the table */
+static unsigned int
+shard_of(uint32_t addr) {
+	struct mon_shard_stats stats;
+	unsigned int i;
+
+	mon_stop();
+	hear(addr, 1, &ifaces[0]);
+	for (i = 0; i < MON_SHARDS; i++) {
+		mon_shard_stats(i, &stats);
+		if (stats.entries)
+			break;
+	}
+	mon_stop();
+	TEST_ASSERT_TRUE(i < MON_SHARDS);
+	return i;
+}
+
+/* fill addrs with n addresses from base up that share one shard */
+static void
+same_shard(uint32_t base, uint32_t *addrs, unsigned int n) {
+	unsigned int shard = shard_of(base);
+
+	addrs[0] = base;
+	for (unsigned int i = 1; i < n; i++) {
+		addrs[i] = addrs[i - 1] + 1;
+		while (shard_of(addrs[i]) != shard)
+			addrs[i]++;
+	}
+}
+
+/* first entry of a walk of all the MRU lists from the oldest */
+static mon_entry *
+oldest(void) {
+	struct mon_walk walk;
+
+	mon_walk_start(&walk, NULL);
+	return mon_walk_next(&walk);
+}
+
+TEST_SETUP(monitor) {
+	saved_mindepth = mon_data.mru_mindepth;
+	saved_maxage = mon_data.mru_maxage;
+	ZERO(rbuf);
+	init_mon();
+	mon_start();
+}
+
+TEST_TEAR_DOWN(monitor) {
+	mon_stop();
+	mon_data.mru_mindepth = saved_mindepth;
+	mon_data.mru_maxage = saved_maxage;
+}
+
+
+TEST(monitor, LookupAfterGrow) {
+	uint32_t i;
+	const uint32_t count = 4 * (uint32_t)mon_data.mru_hashslots;
+
+	mon_data.mru_mindepth = count + 1;
+	for (i = 0; i < count; i++)
+		hear(0x0a000000 + i * 7919, 1, &ifaces[0]);
+
+	TEST_ASSERT_EQUAL(count, mon_data.mru_entries);
+	TEST_ASSERT_TRUE(mon_data.mru_hashslots * 3 >= count * 4);
+	for (i = 0; i < count; i++) {
+		mon_entry *mon = lookup(0x0a000000 + i * 7919);
+		TEST_ASSERT_NOT_NULL(mon);
+		TEST_ASSERT_EQUAL(0x0a000000 + i * 7919,
+				  SRCADR(&mon->rmtadr));
+	}
+	TEST_ASSERT_NULL(lookup(0x0b000001));
+}
+
+TEST(monitor, RemoveKeepsClusters) {
+	uint32_t i;
+
+	mon_data.mru_mindepth = 1000;
+	for (i = 0; i < 500; i++)
+		hear(0xc0a80000 + i, 1, &ifaces[i % 2]);
+
+	mon_clearinterface(&ifaces[1]);
+	TEST_ASSERT_EQUAL(250, mon_data.mru_entries);
+	for (i = 0; i < 500; i++) {
+		if (i % 2) {
+			TEST_ASSERT_NULL(lookup(0xc0a80000 + i));
+		} else {
+			TEST_ASSERT_NOT_NULL(lookup(0xc0a80000 + i));
+		}
+	}
+}
+
+TEST(monitor, HitDoesNotRelink) {
+	uint32_t a[3];
+
+	/* in one shard the walk follows its list until sorted */
+	same_shard(0x01020301, a, 3);
+	hear(a[0], 1, &ifaces[0]);
+	hear(a[1], 2, &ifaces[0]);
+	hear(a[2], 3, &ifaces[0]);
+	hear(a[0], 4, &ifaces[0]);
+
+	TEST_ASSERT_EQUAL(2, lookup(a[0])->count);
+	TEST_ASSERT_TRUE(lookup(a[0])->referenced);
+	TEST_ASSERT_EQUAL_PTR(lookup(a[0]), oldest());
+
+	/* mrulist sees the entries in last-seen order */
+	mon_sort_mru();
+	TEST_ASSERT_FALSE(lookup(a[0])->referenced);
+	TEST_ASSERT_EQUAL_PTR(lookup(a[1]), oldest());
+}
+
+TEST(monitor, SortMergesByLastSeen) {
+	struct mon_walk walk;
+	mon_entry *mon;
+	l_fp when = 0;
+	unsigned int n = 0;
+
+	hear(0x01020301, 1, &ifaces[0]);
+	hear(0x01020301, 2, &ifaces[0]);
+	hear(0x01020302, 3, &ifaces[0]);
+	hear(0x01020303, 4, &ifaces[0]);
+	hear(0x01020303, 5, &ifaces[0]);
+	hear(0x01020304, 6, &ifaces[0]);
+
+	mon_sort_mru();
+	mon_walk_start(&walk, NULL);
+	while (NULL != (mon = mon_walk_next(&walk))) {
+		TEST_ASSERT_TRUE(when <= mon->last);
+		when = mon->last;
+		n++;
+	}
+	TEST_ASSERT_EQUAL(4, n);
+	TEST_ASSERT_EQUAL(4, mon_data.mru_entries);
+}
+
+TEST(monitor, WalkResumesAmongTies) {
+	mon_entry *order[40];
+	struct mon_walk walk;
+	unsigned int n = 0;
+
+	/* many entries seen at the same time, in several shards */
+	for (uint32_t i = 0; i < 40; i++)
+		hear(0x0a010000 + i, 1 + i / 10, &ifaces[0]);
+	mon_sort_mru();
+	mon_walk_start(&walk, NULL);
+	while (n < 40 && NULL != (order[n] = mon_walk_next(&walk)))
+		n++;
+	TEST_ASSERT_EQUAL(40, n);
+	TEST_ASSERT_NULL(mon_walk_next(&walk));
+
+	/* a walk from any entry goes on just as the full walk did */
+	for (unsigned int i = 0; i < n; i++) {
+		mon_walk_start(&walk, order[i]);
+		for (unsigned int j = i; j < n; j++)
+			TEST_ASSERT_EQUAL_PTR(order[j], mon_walk_next(&walk));
+		TEST_ASSERT_NULL(mon_walk_next(&walk));
+	}
+}
+
+TEST(monitor, LockAllCatchesUpHits) {
+	uint32_t a[3];
+
+	same_shard(0x01020301, a, 3);
+	hear(a[0], 1, &ifaces[0]);
+	hear(a[1], 2, &ifaces[0]);
+	hear(a[2], 3, &ifaces[0]);
+	mon_sort_mru();
+
+	/* a hit between the sort and the walk is merged in */
+	hear(a[0], 4, &ifaces[0]);
+	mon_lock_all();
+	TEST_ASSERT_FALSE(lookup(a[0])->referenced);
+	TEST_ASSERT_EQUAL_PTR(lookup(a[1]), oldest());
+	mon_unlock_all();
+}
+
+struct scanned {
+	unsigned int	count;
+	l_fp		last;
+	bool		ordered;
+};
+
+static void
+scan_one(const mon_entry *mon, void *arg) {
+	struct scanned *seen = arg;
+
+	if (mon->last < seen->last)
+		seen->ordered = false;
+	seen->last = mon->last;
+	seen->count++;
+}
+
+TEST(monitor, ScanShardsOldestFirst) {
+	struct scanned seen;
+	unsigned int total = 0;
+
+	for (uint32_t i = 0; i < 40; i++)
+		hear(0x0a020000 + i, 1 + i, &ifaces[0]);
+	for (uint32_t i = 0; i < 40; i += 3)
+		hear(0x0a020000 + i, 100 - i, &ifaces[0]);
+
+	for (unsigned int i = 0; i < MON_SHARDS; i++) {
+		ZERO(seen);
+		seen.ordered = true;
+		mon_scan_shard(i, scan_one, &seen);
+		TEST_ASSERT_TRUE(seen.ordered);
+		total += seen.count;
+	}
+	TEST_ASSERT_EQUAL(40, total);
+}
+
+TEST(monitor, SecondChanceOnRecycle) {
+	uint64_t recycled = mon_data.mru_recycleold;
+	uint32_t a[3];
+
+	same_shard(0x01020301, a, 3);
+	mon_data.mru_mindepth = 2;
+	mon_data.mru_maxage = 10;
+	hear(a[0], 1, &ifaces[0]);
+	hear(a[1], 2, &ifaces[0]);
+	hear(a[0], 100, &ifaces[0]);
+	hear(a[2], 100, &ifaces[0]);
+
+	/* the stale entry went, the busy older one survived */
+	TEST_ASSERT_EQUAL(recycled + 1, mon_data.mru_recycleold);
+	TEST_ASSERT_NULL(lookup(a[1]));
+	TEST_ASSERT_NOT_NULL(lookup(a[0]));
+	TEST_ASSERT_NOT_NULL(lookup(a[2]));
+	TEST_ASSERT_EQUAL(2, mon_data.mru_entries);
+}
+
+TEST(monitor, RecycleWithinShard) {
+	uint64_t recycled = mon_data.mru_recycleold;
+	uint32_t a[2], other = 0x01020301;
+
+	same_shard(0x01020401, a, 2);
+	while (shard_of(other) == shard_of(a[0]))
+		other++;
+	mon_data.mru_mindepth = 2;
+	mon_data.mru_maxage = 10;
+	hear(other, 1, &ifaces[0]);
+	hear(a[0], 2, &ifaces[0]);
+	hear(a[1], 100, &ifaces[0]);
+
+	/* the stale entry of the new one's own shard went */
+	TEST_ASSERT_EQUAL(recycled + 1, mon_data.mru_recycleold);
+	TEST_ASSERT_NULL(lookup(a[0]));
+	TEST_ASSERT_NOT_NULL(lookup(other));
+	TEST_ASSERT_NOT_NULL(lookup(a[1]));
+}
+
+#define HAMMER_THREADS	4
+#define HAMMER_PACKETS	2000
+#define HAMMER_ADDRS	8
+
+/* what a server worker does: its own buffer, the shared table */
+static void *
+hammer(void *arg) {
+	struct recvbuf rb;
+
+	UNUSED_ARG(arg);
+	ZERO(rb);
+	rb.recv_buffer[0] = VN_MODE(4, MODE_CLIENT);
+	rb.dstadr = &ifaces[0];
+	for (unsigned int i = 0; i < HAMMER_PACKETS; i++) {
+		rb.recv_srcadr = create_sockaddr_u(0x0a0b0000 +
+						   i % HAMMER_ADDRS);
+		rb.recv_time = lfpinit((int32_t)(i + 1), 0);
+		ntp_monitor(&rb, 0);
+	}
+	return NULL;
+}
+
+TEST(monitor, ConcurrentHitsAreCounted) {
+	pthread_t tids[HAMMER_THREADS];
+	struct mon_shard_stats stats;
+	uint64_t entries = 0, exists = 0;
+	int total = 0;
+
+	for (unsigned int i = 0; i < MON_SHARDS; i++) {
+		mon_shard_stats(i, &stats);
+		exists -= stats.exists;
+	}
+	for (unsigned int i = 0; i < HAMMER_THREADS; i++)
+		TEST_ASSERT_EQUAL(0, pthread_create(&tids[i], NULL,
+						    hammer, NULL));
+	for (unsigned int i = 0; i < HAMMER_THREADS; i++)
+		pthread_join(tids[i], NULL);
+
+	TEST_ASSERT_EQUAL(HAMMER_ADDRS, mon_data.mru_entries);
+	for (unsigned int i = 0; i < HAMMER_ADDRS; i++)
+		total += lookup(0x0a0b0000 + i)->count;
+	TEST_ASSERT_EQUAL(HAMMER_THREADS * HAMMER_PACKETS, total);
+
+	for (unsigned int i = 0; i < MON_SHARDS; i++) {
+		mon_shard_stats(i, &stats);
+		entries += stats.entries;
+		exists += stats.exists;
+	}
+	TEST_ASSERT_EQUAL(HAMMER_ADDRS, entries);
+	/* every packet but the first from each address was a hit */
+	TEST_ASSERT_EQUAL(HAMMER_THREADS * HAMMER_PACKETS - HAMMER_ADDRS,
+			  exists);
+}
+
+TEST_GROUP_RUNNER(monitor) {
+	RUN_TEST_CASE(monitor, LookupAfterGrow);
+	RUN_TEST_CASE(monitor, RemoveKeepsClusters);
+	RUN_TEST_CASE(monitor, HitDoesNotRelink);
+	RUN_TEST_CASE(monitor, SortMergesByLastSeen);
+	RUN_TEST_CASE(monitor, WalkResumesAmongTies);
+	RUN_TEST_CASE(monitor, LockAllCatchesUpHits);
+	RUN_TEST_CASE(monitor, ScanShardsOldestFirst);
+	RUN_TEST_CASE(monitor, SecondChanceOnRecycle);
+	RUN_TEST_CASE(monitor, RecycleWithinShard);
+	RUN_TEST_CASE(monitor, ConcurrentHitsAreCounted);
+}
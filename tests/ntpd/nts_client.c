@@ -267,6 +267,31 @@ void setup_SIGSYS_trap(void) {
 }
 #endif
 
+TEST(nts_client, nts_next_ke_server) {
+	struct peer peer;
+	char ke1[] = "ke1.example.com", ke2[] = "ke2.example.com";
+
+	ZERO(peer);
+	/* No keserver options, nowhere to go */
+	TEST_ASSERT_FALSE(nts_next_ke_server(&peer));
+	TEST_ASSERT_EQUAL(0, peer.nts_state.keidx);
+
+	peer.cfg.nts_cfg.keservers[0] = ke1;
+	peer.cfg.nts_cfg.keservers[1] = ke2;
+	peer.cfg.nts_cfg.nkeservers = 2;
+	TEST_ASSERT_TRUE(nts_next_ke_server(&peer));
+	TEST_ASSERT_EQUAL(1, peer.nts_state.keidx);
+	TEST_ASSERT_TRUE(nts_next_ke_server(&peer));
+	TEST_ASSERT_EQUAL(2, peer.nts_state.keidx);
+	/* All three failed in a row, back off */
+	TEST_ASSERT_FALSE(nts_next_ke_server(&peer));
+	TEST_ASSERT_EQUAL(0, peer.nts_state.keidx);
+	TEST_ASSERT_EQUAL(0, peer.nts_state.ketries);
+	/* and start over */
+	TEST_ASSERT_TRUE(nts_next_ke_server(&peer));
+	TEST_ASSERT_EQUAL(1, peer.nts_state.keidx);
+}
+
 void dns_take_server(struct peer *a, sockaddr_u *b) {
 	UNUSED_ARG(a);
 	UNUSED_ARG(b);
@@ -282,4 +307,5 @@ void dns_take_status(struct peer *a, DNS_Status b) {
 TEST_GROUP_RUNNER(nts_client) {
 	RUN_TEST_CASE(nts_client, nts_client_send_request_core);
 	RUN_TEST_CASE(nts_client, nts_client_process_response_core);
+	RUN_TEST_CASE(nts_client, nts_next_ke_server);
 }
@@ -8,11 +8,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "aes_siv.h"
 
-extern AES_SIV_CTX* cookie_ctx;
 extern uint8_t K[NTS_MAX_KEYLEN], K2[NTS_MAX_KEYLEN];
-extern uint32_t I;
+extern uint32_t I, I2;
+extern int K_length;
+extern uint8_t K_seed[NTS_SEED_LENGTH];
+extern bool K_seeded;
 
 TEST_GROUP(nts_cookie);
 
@@ -53,8 +56,8 @@ TEST(nts_cookie, nts_make_unpack_cookie) {
 	/* Using 16 bytes in test for ease of handling */
 	uint8_t c2s[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
 	uint8_t s2c[16] = {16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
-	uint8_t c2s_2[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-	uint8_t s2c_2[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	uint8_t plain[NTS_COOKIE_PLAINLEN];
+	uint8_t *c2s_2, *s2c_2;
 	int len;
 	int keylen;
 	bool ok;
@@ -66,7 +69,8 @@ TEST(nts_cookie, nts_make_unpack_cookie) {
 	TEST_ASSERT_EQUAL(72, len);
 	/* Very limited in what data can be directly checked here */
 	/* Reverse the test */
-	ok = nts_unpack_cookie(cookie, len, &aead, c2s_2, s2c_2, &keylen);
+	ok = nts_unpack_cookie(cookie, len, plain, &aead,
+			       &c2s_2, &s2c_2, &keylen);
 	TEST_ASSERT_EQUAL(true, ok);
 	TEST_ASSERT_EQUAL(AEAD_AES_SIV_CMAC_256, aead);
 	TEST_ASSERT_EQUAL(16, keylen);
@@ -74,7 +78,190 @@ TEST(nts_cookie, nts_make_unpack_cookie) {
 	TEST_ASSERT_EQUAL_UINT8_ARRAY(s2c, s2c_2, 16);
 }
 
+/* The pre-keyed contexts must give what AES_SIV_Encrypt() would */
+TEST(nts_cookie, cookie_matches_one_shot) {
+	uint8_t cookie[NTS_MAX_COOKIELEN];
+	uint8_t plaintext[NTS_MAX_COOKIELEN];
+	uint8_t c2s[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+	uint8_t s2c[16] = {16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+	size_t plainlength = sizeof(plaintext);
+	AES_SIV_CTX *ctx = AES_SIV_CTX_new();
+	int len;
+
+	nts_make_cookie_key();
+	len = nts_make_cookie(cookie, AEAD_AES_SIV_CMAC_256, c2s, s2c, sizeof(c2s));
+	TEST_ASSERT_EQUAL(72, len);
+	TEST_ASSERT_EQUAL(0, memcmp(cookie, &I, sizeof(I)));
+	TEST_ASSERT_TRUE(AES_SIV_Decrypt(ctx, plaintext, &plainlength,
+					 K, K_length,
+					 cookie + 4, NONCE_LENGTH,
+					 cookie + 20, len - 20,
+					 cookie, 20));
+	TEST_ASSERT_EQUAL(4 + 2 * 16, plainlength);
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(c2s, plaintext + 4, 16);
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(s2c, plaintext + 20, 16);
+	AES_SIV_CTX_free(ctx);
+}
+
+/* Cookies survive one key rotation, not two */
+TEST(nts_cookie, cookie_key_rotation) {
+	uint8_t cookie[NTS_MAX_COOKIELEN];
+	uint8_t c2s[16] = {0}, s2c[16] = {0};
+	uint8_t plain[NTS_COOKIE_PLAINLEN], *c2s_2, *s2c_2;
+	uint64_t old = nts_cookie_decode_old;
+	uint64_t too_old = nts_cookie_decode_too_old;
+	uint16_t aead;
+	int len, keylen;
+
+	len = nts_make_cookie(cookie, AEAD_AES_SIV_CMAC_256, c2s, s2c, sizeof(c2s));
+	nts_make_cookie_key();
+	TEST_ASSERT_TRUE(nts_unpack_cookie(cookie, len, plain, &aead,
+					   &c2s_2, &s2c_2, &keylen));
+	TEST_ASSERT_EQUAL(old + 1, nts_cookie_decode_old);
+	nts_make_cookie_key();
+	TEST_ASSERT_FALSE(nts_unpack_cookie(cookie, len, plain, &aead,
+					   &c2s_2, &s2c_2, &keylen));
+	TEST_ASSERT_EQUAL(too_old + 1, nts_cookie_decode_too_old);
+}
+
+/* A batch is count good cookies, each with its own nonce */
+TEST(nts_cookie, make_cookies_batch) {
+	uint8_t cookies[NTS_MAX_COOKIES][NTS_MAX_COOKIELEN];
+	uint8_t c2s[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+	uint8_t s2c[16] = {16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+	uint8_t plain[NTS_COOKIE_PLAINLEN], *c2s_2, *s2c_2;
+	uint64_t made = nts_cookie_make;
+	uint16_t aead;
+	int len, keylen;
+
+	len = nts_make_cookies(cookies[0], NTS_MAX_COOKIES, NTS_MAX_COOKIELEN,
+			       AEAD_AES_SIV_CMAC_256, c2s, s2c, sizeof(c2s));
+	TEST_ASSERT_EQUAL(72, len);
+	TEST_ASSERT_EQUAL(made + NTS_MAX_COOKIES, nts_cookie_make);
+	for (int i = 0; i < NTS_MAX_COOKIES; i++) {
+		TEST_ASSERT_TRUE(nts_unpack_cookie(cookies[i], len, plain, &aead,
+						   &c2s_2, &s2c_2, &keylen));
+		TEST_ASSERT_EQUAL(AEAD_AES_SIV_CMAC_256, aead);
+		TEST_ASSERT_EQUAL_UINT8_ARRAY(c2s, c2s_2, 16);
+		TEST_ASSERT_EQUAL_UINT8_ARRAY(s2c, s2c_2, 16);
+		for (int j = 0; j < i; j++)
+			TEST_ASSERT_NOT_EQUAL(0, memcmp(cookies[i] + 4,
+						cookies[j] + 4, NONCE_LENGTH));
+	}
+}
+
+/* The nonce pool hands out fresh bytes and restocks when asked */
+TEST(nts_cookie, nonce_pool) {
+	uint8_t a[4 * NONCE_LENGTH], b[4 * NONCE_LENGTH];
+	uint64_t refills, stalls = nts_nonce_stalls;
+
+	nts_get_nonces(a, 4);
+	nts_get_nonces(b, 4);
+	TEST_ASSERT_NOT_EQUAL(0, memcmp(a, b, sizeof(a)));
+	/* run it dry, so it is full less one nonce */
+	while (stalls == nts_nonce_stalls)
+		nts_get_nonces(a, 1);
+	/* then take it past half and top up */
+	for (int i = 0; i < 64; i++)
+		nts_get_nonces(a, 1);
+	refills = nts_nonce_refills;
+	nts_nonce_refill();
+	TEST_ASSERT_EQUAL(refills + 1, nts_nonce_refills);
+	nts_nonce_refill();
+	TEST_ASSERT_EQUAL(refills + 1, nts_nonce_refills);
+}
+
+/* Derived secrets follow the cookie keys through a rotation */
+TEST(nts_cookie, cookie_derive) {
+	uint8_t cur[NTS_DERIVED_LENGTH], again[NTS_DERIVED_LENGTH];
+	uint8_t other[NTS_DERIVED_LENGTH], old[NTS_DERIVED_LENGTH];
+
+	nts_cookie_derive(false, "label", cur);
+	nts_cookie_derive(false, "label", again);
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(cur, again, NTS_DERIVED_LENGTH);
+	nts_cookie_derive(false, "other label", other);
+	TEST_ASSERT_NOT_EQUAL(0, memcmp(cur, other, NTS_DERIVED_LENGTH));
+
+	nts_make_cookie_key();
+	nts_cookie_derive(true, "label", old);
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(cur, old, NTS_DERIVED_LENGTH);
+	nts_cookie_derive(false, "label", again);
+	TEST_ASSERT_NOT_EQUAL(0, memcmp(cur, again, NTS_DERIVED_LENGTH));
+}
+
+/* Same seed, same day, same keys; cookies last into the next day */
+TEST(nts_cookie, ratchet) {
+	uint8_t cookie[NTS_MAX_COOKIELEN];
+	uint8_t c2s[16] = {0}, s2c[16] = {0};
+	uint8_t plain[NTS_COOKIE_PLAINLEN], *c2s_2, *s2c_2;
+	uint8_t k100[NTS_MAX_KEYLEN];
+	uint32_t i100;
+	uint16_t aead;
+	int len, keylen;
+
+	memset(K_seed, 0x5a, sizeof(K_seed));
+	nts_ratchet_cookie_key(100);
+	memcpy(k100, K, sizeof(k100));
+	i100 = I;
+	TEST_ASSERT_NOT_EQUAL(I, I2);
+	len = nts_make_cookie(cookie, AEAD_AES_SIV_CMAC_256, c2s, s2c, sizeof(c2s));
+
+	nts_ratchet_cookie_key(101);
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(k100, K2, K_length);
+	TEST_ASSERT_EQUAL(i100, I2);
+	TEST_ASSERT_NOT_EQUAL(0, memcmp(k100, K, K_length));
+	TEST_ASSERT_TRUE(nts_unpack_cookie(cookie, len, plain, &aead,
+					   &c2s_2, &s2c_2, &keylen));
+	nts_ratchet_cookie_key(102);
+	TEST_ASSERT_FALSE(nts_unpack_cookie(cookie, len, plain, &aead,
+					   &c2s_2, &s2c_2, &keylen));
+
+	nts_ratchet_cookie_key(100);
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(k100, K, K_length);
+	TEST_ASSERT_EQUAL(i100, I);
+	/* another seed, other keys */
+	K_seed[0] ^= 1;
+	nts_ratchet_cookie_key(100);
+	TEST_ASSERT_NOT_EQUAL(0, memcmp(k100, K, K_length));
+}
+
+/* The keys file keeps the seed, and reading it takes the new keys */
+TEST(nts_cookie, keys_file_seed) {
+	char name[] = "/tmp/nts-keys-XXXXXX";
+	uint8_t seed[NTS_SEED_LENGTH], key[NTS_MAX_KEYLEN];
+	int fd = mkstemp(name);
+
+	TEST_ASSERT_NOT_EQUAL(-1, fd);
+	close(fd);
+	ntsconfig.KI = name;
+	memset(K_seed, 0x33, sizeof(K_seed));
+	memcpy(seed, K_seed, sizeof(seed));
+	K_seeded = true;
+	nts_ratchet_cookie_key(200);
+	memcpy(key, K, sizeof(key));
+	TEST_ASSERT_TRUE(nts_write_cookie_keys());
+
+	nts_make_cookie_key();
+	memset(K_seed, 0, sizeof(K_seed));
+	K_seeded = false;
+	TEST_ASSERT_TRUE(nts_read_cookie_keys());
+	TEST_ASSERT_TRUE(K_seeded);
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(seed, K_seed, sizeof(seed));
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(key, K, K_length);
+
+	unlink(name);
+	ntsconfig.KI = NULL;
+	K_seeded = false;
+}
+
 TEST_GROUP_RUNNER(nts_cookie) {
 	RUN_TEST_CASE(nts_cookie, nts_make_unpack_cookie);
 	RUN_TEST_CASE(nts_cookie, nts_make_cookie_key);
+	RUN_TEST_CASE(nts_cookie, cookie_matches_one_shot);
+	RUN_TEST_CASE(nts_cookie, cookie_key_rotation);
+	RUN_TEST_CASE(nts_cookie, make_cookies_batch);
+	RUN_TEST_CASE(nts_cookie, nonce_pool);
+	RUN_TEST_CASE(nts_cookie, cookie_derive);
+	RUN_TEST_CASE(nts_cookie, ratchet);
+	RUN_TEST_CASE(nts_cookie, keys_file_seed);
 }
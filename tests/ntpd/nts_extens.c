@@ -225,7 +225,86 @@ TEST(nts_extens, extens_server_recv) {
 	/* TEST_ASSERT_EQUAL(true, ok); //disable */
 }
 
+/* Client request to server reply and back.  The reply echoes the UID
+ * from the request and carries cookies the server can unpack. */
+TEST(nts_extens, extens_round_trip) {
+	struct peer peer;
+	struct ntspacket_t ntspkt;
+	struct pkt req, reply;
+	uint8_t c2s[32], s2c[32];
+	uint8_t plain[NTS_COOKIE_PLAINLEN], *c2s_2, *s2c_2;
+	uint16_t aead;
+	int reqlen, replylen, keylen;
+
+	nts_cookie_init();
+	nts_make_cookie_key();
+	for (int i = 0; i < 32; i++) {
+		c2s[i] = i;
+		s2c[i] = 0x80 + i;
+	}
+	memset(&peer, 0, sizeof(peer));
+	memcpy(peer.nts_state.c2s, c2s, sizeof(c2s));
+	memcpy(peer.nts_state.s2c, s2c, sizeof(s2c));
+	peer.nts_state.keylen = sizeof(c2s);
+	peer.nts_state.cookielen = nts_make_cookie(peer.nts_state.cookies[0],
+		AEAD_AES_SIV_CMAC_256, c2s, s2c, sizeof(c2s));
+	peer.nts_state.count = 1;
+	peer.nts_state.writeIdx = 1;
+
+	/* one cookie and NTS_MAX_COOKIES-1 placeholders */
+	memset(&req, 0, sizeof(req));
+	memcpy(&req, base_pkt, sizeof(base_pkt));
+	reqlen = LEN_PKT_NOMAC + extens_client_send(&peer, &req);
+	memset(&ntspkt, 0, sizeof(ntspkt));
+	TEST_ASSERT_TRUE(extens_server_recv(&ntspkt, (uint8_t *)&req, reqlen));
+	TEST_ASSERT_EQUAL(NTS_MAX_COOKIES, ntspkt.needed);
+	TEST_ASSERT_EQUAL(NTS_UID_LENGTH, ntspkt.uidlen);
+	TEST_ASSERT_EQUAL_PTR(req.exten + NTP_EX_HDR_LNG, ntspkt.uid);
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(c2s, ntspkt.c2s, sizeof(c2s));
+
+	memset(&reply, 0, sizeof(reply));
+	memcpy(&reply, base_pkt, sizeof(base_pkt));
+	replylen = LEN_PKT_NOMAC + extens_server_send(&ntspkt, &reply);
+	TEST_ASSERT_EQUAL(reqlen, replylen);
+	TEST_ASSERT_TRUE(extens_client_recv(&peer, (uint8_t *)&reply,
+					    replylen));
+	TEST_ASSERT_EQUAL(NTS_MAX_COOKIES, peer.nts_state.count);
+	for (int i = 0; i < NTS_MAX_COOKIES; i++) {
+		TEST_ASSERT_TRUE(nts_unpack_cookie(peer.nts_state.cookies[i],
+			peer.nts_state.cookielen, plain, &aead,
+			&c2s_2, &s2c_2, &keylen));
+		TEST_ASSERT_EQUAL(AEAD_AES_SIV_CMAC_256, aead);
+		TEST_ASSERT_EQUAL_UINT8_ARRAY(s2c, s2c_2, sizeof(s2c));
+	}
+	/* more cookies than fit in a packet is refused, not overrun */
+	ntspkt.needed = MAX_EXT_LEN / NTP_EX_HDR_LNG;
+	TEST_ASSERT_EQUAL(-1, extens_server_send(&ntspkt, &reply));
+}
+
+TEST(nts_extens, nts_cookies_low) {
+	struct peer peer;
+
+	ZERO(peer);
+	peer.nts_state.count = 1;
+	/* Answered, nothing to do */
+	TEST_ASSERT_FALSE(nts_cookies_low(&peer));
+	/* Lost with one cookie left */
+	peer.nts_state.pending = true;
+	TEST_ASSERT_TRUE(nts_cookies_low(&peer));
+	/* Plenty left */
+	peer.nts_state.count = 3;
+	TEST_ASSERT_FALSE(nts_cookies_low(&peer));
+	/* but not when losing most requests */
+	peer.nts_state.loss = 200;
+	TEST_ASSERT_TRUE(nts_cookies_low(&peer));
+	/* Empty is a job for NTS-KE */
+	peer.nts_state.count = 0;
+	TEST_ASSERT_FALSE(nts_cookies_low(&peer));
+}
+
 TEST_GROUP_RUNNER(nts_extens) {
 	RUN_TEST_CASE(nts_extens, extens_client_send);
 	RUN_TEST_CASE(nts_extens, extens_server_recv);
+	RUN_TEST_CASE(nts_extens, extens_round_trip);
+	RUN_TEST_CASE(nts_extens, nts_cookies_low);
 }
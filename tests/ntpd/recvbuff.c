@@ -28,7 +28,68 @@ TEST(recvbuff, GetAndFree) {
 	TEST_ASSERT_EQUAL(initial, free_recvbuffs());
 }
 
+TEST(recvbuff, CacheAligned) {
+	recvbuf_t* a = get_free_recv_buffer();
+	recvbuf_t* b = get_free_recv_buffer();
+
+	TEST_ASSERT_EQUAL(0, (uintptr_t)a % 64);
+	TEST_ASSERT_EQUAL(0, (uintptr_t)b % 64);
+	freerecvbuf(b);
+	freerecvbuf(a);
+}
+
+TEST(recvbuff, ReuseResetsHeader) {
+	recvbuf_t* buf = get_free_recv_buffer();
+
+	buf->recv_length = 48;
+	buf->keyid_present = true;
+	buf->ntspacket.valid = true;
+	buf->recv_buffer[0] = 0x23;
+	freerecvbuf(buf);
+
+	buf = get_free_recv_buffer();
+	TEST_ASSERT_EQUAL(0, buf->recv_length);
+	TEST_ASSERT_FALSE(buf->keyid_present);
+	TEST_ASSERT_FALSE(buf->ntspacket.valid);
+	TEST_ASSERT_EQUAL(1, buf->used);
+	freerecvbuf(buf);
+}
+
+TEST(recvbuff, Statistics) {
+	recvbuf_t* a = get_free_recv_buffer();
+	recvbuf_t* b = get_free_recv_buffer();
+
+	freerecvbuf(a);
+	a = get_free_recv_buffer();
+	TEST_ASSERT_EQUAL(3, recvbuf_allocs());
+	TEST_ASSERT_EQUAL(2, recvbuf_hiwater());
+	freerecvbuf(a);
+	freerecvbuf(b);
+	TEST_ASSERT_EQUAL(2, recvbuf_hiwater());
+}
+
+TEST(recvbuff, PrivateList) {
+	recvbuf_list_t list;
+	recvbuf_t* buf;
+	unsigned long initial = free_recvbuffs();
+
+	ZERO(list);
+	grow_recvbuf_list(&list, 2);
+	TEST_ASSERT_EQUAL(2, list.free);
+	buf = recvbuf_list_get(&list);
+	TEST_ASSERT_NOT_NULL(buf);
+	TEST_ASSERT_NOT_NULL(recvbuf_list_get(&list));
+	TEST_ASSERT_NULL(recvbuf_list_get(&list));
+	recvbuf_list_put(&list, buf);
+	TEST_ASSERT_EQUAL(1, list.free);
+	TEST_ASSERT_EQUAL(initial, free_recvbuffs());
+}
+
 TEST_GROUP_RUNNER(recvbuff) {
 	RUN_TEST_CASE(recvbuff, Initialization);
 	RUN_TEST_CASE(recvbuff, GetAndFree);
+	RUN_TEST_CASE(recvbuff, CacheAligned);
+	RUN_TEST_CASE(recvbuff, ReuseResetsHeader);
+	RUN_TEST_CASE(recvbuff, Statistics);
+	RUN_TEST_CASE(recvbuff, PrivateList);
 }
@@ -21,6 +21,19 @@ create_sockaddr_u(unsigned short sin_port, const char* ip_addr)
 	return sockaddr;
 }
 
+static sockaddr_u
+create_sockaddr6_u(unsigned short sin_port, const char* ip_addr)
+{
+	sockaddr_u sockaddr;
+
+	memset(&sockaddr, 0, sizeof(sockaddr));
+	SET_AF(&sockaddr, AF_INET6);
+	NSRCPORT(&sockaddr) = htons(sin_port);
+	inet_pton(AF_INET6, ip_addr, PSOCK_ADDR6(&sockaddr));
+
+	return sockaddr;
+}
+
 TEST_GROUP(hackrestrict);
 
 TEST_SETUP(hackrestrict) {
@@ -186,6 +199,78 @@ TEST(hackrestrict, RestrictUnflagWorks) {
 	TEST_ASSERT_EQUAL(1, restrictions(&resaddr));
 }
 
+
+TEST(hackrestrict, NtpportEntryNeedsPort123) {
+	sockaddr_u resaddr = create_sockaddr_u(54321, "11.22.0.0");
+	sockaddr_u resmask = create_sockaddr_u(54321, "255.255.0.0");
+	sockaddr_u from_ntpport = create_sockaddr_u(123, "11.22.33.44");
+	sockaddr_u from_other = create_sockaddr_u(54321, "11.22.33.44");
+
+	hack_restrict(RESTRICT_FLAGS, &resaddr, &resmask, 0, 11, 0);
+	hack_restrict(RESTRICT_FLAGS, &resaddr, &resmask, RESM_NTPONLY, 22, 0);
+
+	TEST_ASSERT_EQUAL(22, restrictions(&from_ntpport));
+	TEST_ASSERT_EQUAL(11, restrictions(&from_other));
+}
+
+
+TEST(hackrestrict, MaskWithHolesIsMatched) {
+	sockaddr_u resaddr = create_sockaddr_u(54321, "11.0.33.0");
+	sockaddr_u resmask = create_sockaddr_u(54321, "255.0.255.0");
+	sockaddr_u prefaddr = create_sockaddr_u(54321, "11.22.0.0");
+	sockaddr_u prefmask = create_sockaddr_u(54321, "255.255.0.0");
+	sockaddr_u target = create_sockaddr_u(54321, "11.22.33.44");
+	sockaddr_u other = create_sockaddr_u(54321, "11.22.34.44");
+
+	hack_restrict(RESTRICT_FLAGS, &prefaddr, &prefmask, 0, 11, 0);
+	hack_restrict(RESTRICT_FLAGS, &resaddr, &resmask, 0, 22, 0);
+
+	/* 11.0.33.0 sorts below 11.22.0.0, so the /16 wins */
+	TEST_ASSERT_EQUAL(11, restrictions(&target));
+	TEST_ASSERT_EQUAL(11, restrictions(&other));
+
+	hack_restrict(RESTRICT_REMOVE, &prefaddr, &prefmask, 0, 0, 0);
+	TEST_ASSERT_EQUAL(22, restrictions(&target));
+	TEST_ASSERT_EQUAL(RES_Default, restrictions(&other));
+}
+
+
+TEST(hackrestrict, ExpiredEntryIsSwept) {
+	sockaddr_u resaddr = create_sockaddr_u(54321, "11.22.33.44");
+	sockaddr_u resmask = create_sockaddr_u(54321, "255.255.255.255");
+
+	current_time = 100;
+	hack_restrict(RESTRICT_FLAGS, &resaddr, &resmask, 0, 11, 110);
+	restrict_expire();
+	TEST_ASSERT_EQUAL(11, restrictions(&resaddr));
+
+	current_time = 110;
+	restrict_expire();
+	TEST_ASSERT_EQUAL(RES_Default, restrictions(&resaddr));
+	current_time = 0;
+}
+
+
+TEST(hackrestrict, LongestIPv6PrefixIsMatched) {
+	sockaddr_u short_addr = create_sockaddr6_u(54321, "2001:db8::");
+	sockaddr_u short_mask = create_sockaddr6_u(54321, "ffff:ffff::");
+	sockaddr_u long_addr = create_sockaddr6_u(54321, "2001:db8:1:2::");
+	sockaddr_u long_mask = create_sockaddr6_u(54321, "ffff:ffff:ffff:ffff::");
+	sockaddr_u inside = create_sockaddr6_u(54321, "2001:db8:1:2::5");
+	sockaddr_u beside = create_sockaddr6_u(54321, "2001:db8:1:3::5");
+	sockaddr_u outside = create_sockaddr6_u(54321, "2001:db9::5");
+
+	hack_restrict(RESTRICT_FLAGS, &long_addr, &long_mask, 0, 22, 0);
+	hack_restrict(RESTRICT_FLAGS, &short_addr, &short_mask, 0, 11, 0);
+
+	TEST_ASSERT_EQUAL(22, restrictions(&inside));
+	TEST_ASSERT_EQUAL(11, restrictions(&beside));
+	TEST_ASSERT_EQUAL(RES_Default, restrictions(&outside));
+
+	hack_restrict(RESTRICT_REMOVE, &long_addr, &long_mask, 0, 0, 0);
+	TEST_ASSERT_EQUAL(11, restrictions(&inside));
+}
+
 TEST_GROUP_RUNNER(hackrestrict) {
 	RUN_TEST_CASE(hackrestrict, RestrictionsAreEmptyAfterInit);
 	RUN_TEST_CASE(hackrestrict, ReturnsCorrectDefaultRestrictions);
@@ -195,4 +280,8 @@ TEST_GROUP_RUNNER(hackrestrict) {
 	RUN_TEST_CASE(hackrestrict, TheMostFittingRestrictionIsMatched);
 	RUN_TEST_CASE(hackrestrict, DeletedRestrictionIsNotMatched);
 	RUN_TEST_CASE(hackrestrict, RestrictUnflagWorks);
+	RUN_TEST_CASE(hackrestrict, NtpportEntryNeedsPort123);
+	RUN_TEST_CASE(hackrestrict, MaskWithHolesIsMatched);
+	RUN_TEST_CASE(hackrestrict, ExpiredEntryIsSwept);
+	RUN_TEST_CASE(hackrestrict, LongestIPv6PrefixIsMatched);
 }
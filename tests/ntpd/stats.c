@@ -0,0 +1,184 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "ntpd.h"
+#include "ntp_filegen.h"
+
+#include "unity.h"
+#include "unity_fixture.h"
+
+/*
+ * ntp_util.c is linked in without the rest of ntpd, so what it calls
+ * there is stood in for here.
+ */
+struct ntp_loop_data loop_data;
+
+void proto_clr_stats(void) {}
+uptime_t stat_stattime(void) { return 0; }
+uint64_t stat_received(void) { return 0; }
+uint64_t stat_processed(void) { return 0; }
+uint64_t stat_restricted(void) { return 0; }
+uint64_t stat_newversion(void) { return 0; }
+uint64_t stat_oldversion(void) { return 0; }
+uint64_t stat_badlength(void) { return 0; }
+uint64_t stat_badauth(void) { return 0; }
+uint64_t stat_declined(void) { return 0; }
+uint64_t stat_limitrejected(void) { return 0; }
+uint64_t stat_kodsent(void) { return 0; }
+uptime_t stat_use_stattime(void) { return 0; }
+
+void
+set_use_stattime(uptime_t stattime) {
+	UNUSED_ARG(stattime);
+}
+
+void
+loop_config(int item, double freq) {
+	UNUSED_ARG(item);
+	UNUSED_ARG(freq);
+}
+
+int
+mprintf_event(int evcode, struct peer *p, const char *fmt, ...) {
+	UNUSED_ARG(evcode);
+	UNUSED_ARG(p);
+	UNUSED_ARG(fmt);
+	return 0;
+}
+
+/*
+ * The statistics writer, with stats on and loopstats going to a plain
+ * file in a directory of our own.
+ */
+TEST_GROUP(stats);
+
+static char dir[] = "/tmp/ntpstatsXXXXXX";
+static char path[sizeof(dir) + 16];	/* the loopstats file */
+static FILEGEN *gen;
+
+TEST_SETUP(stats) {
+	static bool ready;
+
+	if (!ready) {
+		init_util();
+		ready = true;
+	}
+	TEST_ASSERT_NOT_NULL(mkdtemp(dir));
+	snprintf(path, sizeof(path), "%s/loopstats", dir);
+	stats_config(STATS_STATSDIR, dir);
+	gen = filegen_get("loopstats");
+	TEST_ASSERT_NOT_NULL(gen);
+	filegen_config(gen, statsdir, "loopstats", FILEGEN_NONE,
+		       FGEN_FLAG_ENABLED);
+	stats_ut_pristine();
+	stats_control = true;
+}
+
+TEST_TEAR_DOWN(stats) {
+	stats_ut_pristine();
+	stats_control = false;
+	filegen_config(gen, statsdir, "loopstats", FILEGEN_NONE, 0);
+	unlink(path);
+	strlcat(path, ".bin", sizeof(path));
+	unlink(path);	/* left by the switch to binary */
+	rmdir(dir);
+	strlcpy(dir, "/tmp/ntpstatsXXXXXX", sizeof(dir));
+}
+
+/* lines in the loopstats file */
+static unsigned int
+lines(void) {
+	FILE *fp;
+	unsigned int n = 0;
+	int c;
+
+	fp = fopen(path, "r");
+	if (NULL == fp)
+		return 0;
+	while (EOF != (c = getc(fp)))
+		if ('\n' == c)
+			n++;
+	fclose(fp);
+	return n;
+}
+
+TEST(stats, LoopStatsReachFile) {
+	char line[256];
+	FILE *fp;
+	uint64_t written = stats_written();
+
+	record_loop_stats(0.001234567, 1e-6, 0.000012345, 2e-6, 6);
+	stats_ut_shutdown();
+
+	TEST_ASSERT_EQUAL(written + 1, stats_written());
+	fp = fopen(path, "r");
+	TEST_ASSERT_NOT_NULL(fp);
+	TEST_ASSERT_NOT_NULL(fgets(line, sizeof(line), fp));
+	fclose(fp);
+	TEST_ASSERT_NOT_NULL(strstr(line, " 0.001234567 1.000000 "
+				    "0.000012345 2.000000 6\n"));
+}
+
+TEST(stats, FullRingOverflows) {
+	uint64_t written = stats_written();
+	uint64_t overflow = stats_overflow();
+	unsigned int queued = 0;
+
+	/* the writer waits for the filegen lock while the ring fills */
+	filegen_lock();
+	while (stats_overflow() == overflow && queued < 100000) {
+		record_loop_stats(0, 0, 0, 0, 6);
+		queued++;
+	}
+	TEST_ASSERT_EQUAL(overflow + 1, stats_overflow());
+	TEST_ASSERT_EQUAL(queued - 1, stats_ut_depth());
+	TEST_ASSERT_EQUAL(written, stats_written());
+	filegen_unlock();
+
+	/* what fitted is written, what overflowed is not */
+	stats_ut_shutdown();
+	TEST_ASSERT_EQUAL(written + queued - 1, stats_written());
+	TEST_ASSERT_EQUAL(queued - 1, lines());
+}
+
+TEST(stats, TextAfterBinaryDropped) {
+	uint64_t written = stats_written();
+	uint64_t dropped = stats_dropped();
+
+	filegen_lock();
+	record_loop_stats(0, 0, 0, 0, 6);
+	TEST_ASSERT_EQUAL(1, stats_ut_depth());
+	/* what "filegen loopstats binary" does under this lock */
+	gen->flag |= FGEN_FLAG_BINARY;
+	filegen_unlock();
+
+	stats_ut_shutdown();
+	TEST_ASSERT_EQUAL(dropped + 1, stats_dropped());
+	TEST_ASSERT_EQUAL(written, stats_written());
+	TEST_ASSERT_EQUAL(0, lines());
+}
+
+TEST(stats, ShutdownEmptiesQueue) {
+	uint64_t written = stats_written();
+
+	filegen_lock();
+	for (int i = 0; i < 10; i++)
+		record_loop_stats(0, 0, 0, 0, 6);
+	TEST_ASSERT_EQUAL(10, stats_ut_depth());
+	filegen_unlock();
+
+	stats_ut_shutdown();
+	TEST_ASSERT_EQUAL(0, stats_ut_depth());
+	TEST_ASSERT_EQUAL(written + 10, stats_written());
+	TEST_ASSERT_EQUAL(10, lines());
+}
+
+TEST_GROUP_RUNNER(stats) {
+	RUN_TEST_CASE(stats, LoopStatsReachFile);
+	RUN_TEST_CASE(stats, FullRingOverflows);
+	RUN_TEST_CASE(stats, TextAfterBinaryDropped);
+	RUN_TEST_CASE(stats, ShutdownEmptiesQueue);
+}
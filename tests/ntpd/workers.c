@@ -0,0 +1,239 @@
+#include "config.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include "ntpd.h"
+#include "ntp_dns.h"
+#include "recvbuff.h"
+
+#include "unity.h"
+#include "unity_fixture.h"
+
+/*
+ * ntp_io.c is linked in without the rest of ntpd, so what it calls
+ * there is stood in for here.  receive() and screen_request() note
+ * what the worker routing did with each packet.
+ */
+int		interface_interval;
+bool		listen_to_virtual_ips;
+
+void dns_try_again(void) {}
+void refresh_all_peerinterfaces(void) {}
+void timer_fd_expired(void) {}
+
+void
+timer_interfacetimeout(uptime_t timeout) {
+	UNUSED_ARG(timeout);
+}
+
+void
+set_peerdstadr(struct peer *peer, endpt *dstadr) {
+	UNUSED_ARG(peer);
+	UNUSED_ARG(dstadr);
+}
+
+void
+enable_packetstamps(int fd, sockaddr_u *addr) {
+	UNUSED_ARG(fd);
+	UNUSED_ARG(addr);
+}
+
+l_fp
+fetch_packetstamp(struct msghdr *msghdr) {
+	UNUSED_ARG(msghdr);
+	return 0;
+}
+
+static unsigned int on_worker;	/* receive() calls from a worker */
+static unsigned int on_main;	/* receive() calls from the main thread */
+static unsigned short screen_mask;	/* what screen_request() finds */
+
+void
+receive(struct recvbuf *rbufp) {
+	if (NULL != rbufp->worker)
+		on_worker++;
+	else
+		on_main++;
+}
+
+void
+screen_request(struct recvbuf *rbufp) {
+	rbufp->restrict_mask = screen_mask;
+	rbufp->screened = true;
+}
+
+TEST_GROUP(workers);
+
+static endpt ep;
+static sockaddr_u rxaddr;
+static SOCKET rx = -1;		/* the worker reads this */
+static SOCKET tx = -1;		/* ... what is sent from this */
+
+TEST_SETUP(workers) {
+	socklen_t len = sizeof(rxaddr);
+
+	io_workers_ut_pristine();
+	on_worker = 0;
+	on_main = 0;
+	screen_mask = 0;
+
+	ZERO(ep);
+	ep.family = AF_INET;
+	ZERO(rxaddr);
+	SET_AF(&rxaddr, AF_INET);
+	SET_ADDR4(&rxaddr, INADDR_LOOPBACK);
+	ep.sin = rxaddr;
+	rx = socket(AF_INET, SOCK_DGRAM, 0);
+	tx = socket(AF_INET, SOCK_DGRAM, 0);
+	TEST_ASSERT_TRUE(rx >= 0 && tx >= 0);
+	TEST_ASSERT_EQUAL(0, fcntl(rx, F_SETFL, O_NONBLOCK));
+	TEST_ASSERT_EQUAL(0, bind(rx, &rxaddr.sa, SOCKLEN(&rxaddr)));
+	TEST_ASSERT_EQUAL(0, getsockname(rx, &rxaddr.sa, &len));
+}
+
+TEST_TEAR_DOWN(workers) {
+	close(rx);
+	close(tx);
+	rx = tx = -1;
+	io_workers_ut_pristine();
+}
+
+/* set up one worker, false if this system has none */
+static bool
+one_worker(void) {
+	io_set_workers(1);
+	return 1 == io_workers_ut_count();
+}
+
+/* send a packet of the given mode and have the worker read it */
+static void
+hear(int mode) {
+	uint8_t pkt[LEN_PKT_NOMAC];
+
+	ZERO(pkt);
+	pkt[0] = VN_MODE(NTP_VERSION, mode);
+	TEST_ASSERT_EQUAL(sizeof(pkt),
+			  sendto(tx, pkt, sizeof(pkt), 0,
+				 &rxaddr.sa, SOCKLEN(&rxaddr)));
+	TEST_ASSERT_EQUAL(1, io_worker_ut_read(rx, &ep));
+}
+
+TEST(workers, ClientRequestAnsweredOnWorker) {
+	if (!one_worker())
+		TEST_IGNORE_MESSAGE("no server workers on this system");
+
+	hear(MODE_CLIENT);
+	TEST_ASSERT_EQUAL(1, on_worker);
+	TEST_ASSERT_EQUAL(1, worker_served_count());
+	TEST_ASSERT_EQUAL(0, worker_handoff_count());
+
+	io_handoff_ut_drain();
+	TEST_ASSERT_EQUAL(0, on_main);
+}
+
+TEST(workers, OtherModesHandedOff) {
+	if (!one_worker())
+		TEST_IGNORE_MESSAGE("no server workers on this system");
+
+	hear(MODE_ACTIVEx);
+	hear(MODE_SERVER);
+	hear(MODE_BROADCASTx);
+	hear(MODE_CONTROL);
+	TEST_ASSERT_EQUAL(0, on_worker);
+	TEST_ASSERT_EQUAL(0, worker_served_count());
+	TEST_ASSERT_EQUAL(4, worker_handoff_count());
+	TEST_ASSERT_EQUAL(0, on_main);
+
+	io_handoff_ut_drain();
+	TEST_ASSERT_EQUAL(4, on_main);
+}
+
+TEST(workers, MssntpHandedOff) {
+#ifdef ENABLE_MSSNTP
+	if (!one_worker())
+		TEST_IGNORE_MESSAGE("no server workers on this system");
+
+	screen_mask = RES_MSSNTP;
+	hear(MODE_CLIENT);
+	TEST_ASSERT_EQUAL(0, on_worker);
+	TEST_ASSERT_EQUAL(1, worker_handoff_count());
+
+	io_handoff_ut_drain();
+	TEST_ASSERT_EQUAL(1, on_main);
+#else
+	TEST_IGNORE_MESSAGE("built without mssntp");
+#endif
+}
+
+TEST(workers, FullHandoffDrops) {
+	uint64_t dropped;
+
+	if (!one_worker())
+		TEST_IGNORE_MESSAGE("no server workers on this system");
+
+	for (int i = 0; i < HANDOFF_MAX; i++)
+		hear(MODE_SERVER);
+	TEST_ASSERT_EQUAL(HANDOFF_MAX, worker_handoff_count());
+
+	dropped = dropped_count();
+	hear(MODE_SERVER);
+	TEST_ASSERT_EQUAL(HANDOFF_MAX, worker_handoff_count());
+	TEST_ASSERT_EQUAL(dropped + 1, dropped_count());
+	TEST_ASSERT_EQUAL(0, on_main);
+
+	/* the main thread gets what was queued, not what was dropped */
+	io_handoff_ut_drain();
+	TEST_ASSERT_EQUAL(HANDOFF_MAX, on_main);
+}
+
+TEST(workers, DrainEmptiesQueue) {
+	uint64_t dropped;
+
+	if (!one_worker())
+		TEST_IGNORE_MESSAGE("no server workers on this system");
+
+	for (int i = 0; i < HANDOFF_MAX; i++)
+		hear(MODE_SERVER);
+	io_handoff_ut_drain();
+	TEST_ASSERT_EQUAL(HANDOFF_MAX, on_main);
+
+	/* every copy is off the queue, so it takes a full load again */
+	dropped = dropped_count();
+	for (int i = 0; i < HANDOFF_MAX; i++)
+		hear(MODE_SERVER);
+	TEST_ASSERT_EQUAL(2 * HANDOFF_MAX, worker_handoff_count());
+	TEST_ASSERT_EQUAL(dropped, dropped_count());
+
+	io_handoff_ut_drain();
+	TEST_ASSERT_EQUAL(2 * HANDOFF_MAX, on_main);
+
+	/* nothing left to run */
+	io_handoff_ut_drain();
+	TEST_ASSERT_EQUAL(2 * HANDOFF_MAX, on_main);
+}
+
+TEST(workers, SetWorkersClamped) {
+	io_set_workers(1);
+	if (1 != io_workers_ut_count())
+		TEST_IGNORE_MESSAGE("no server workers on this system");
+	io_workers_ut_pristine();
+
+	io_set_workers(WORKERS_MAX + 1);
+	TEST_ASSERT_EQUAL(WORKERS_MAX, io_workers_ut_count());
+	io_workers_ut_pristine();
+
+	io_set_workers(-1);
+	TEST_ASSERT_EQUAL(0, io_workers_ut_count());
+}
+
+TEST_GROUP_RUNNER(workers) {
+	RUN_TEST_CASE(workers, ClientRequestAnsweredOnWorker);
+	RUN_TEST_CASE(workers, OtherModesHandedOff);
+	RUN_TEST_CASE(workers, MssntpHandedOff);
+	RUN_TEST_CASE(workers, FullHandoffDrops);
+	RUN_TEST_CASE(workers, DrainEmptiesQueue);
+	RUN_TEST_CASE(workers, SetWorkersClamped);
+}
@@ -26,6 +26,47 @@ class TestPylibNtpc(unittest.TestCase):
             self.assertEqual(ntp.ntpc.prettydate(in_string), to_string);
             self.assertAlmostEqual(ntp.ntpc.lfptofloat(in_string), to_float);
 
+    def test_statrows(self):
+        lines = ["40587 0.0 foo bar\n",
+                 "40587 3600.5 baz\n",
+                 "heeeey duuuude!\n",
+                 "40587\n",
+                 "40588 0.0 quux\n"]
+        self.assertEqual(ntp.ntpc.statrows(lines, 0, 3600.5),
+                         [[0, "0.0", "foo", "bar"],
+                          [3600500, "3600.5", "baz"]])
+        self.assertEqual(ntp.ntpc.statrows(lines, 3601, 86400),
+                         [[86400000, "86400.0", "quux"]])
+        lines = ["# comment\n",
+                 "1471208400.5 42.0 /dev/sda\n",
+                 "1471208401 43.0\n"]
+        self.assertEqual(ntp.ntpc.statrows(lines, 0, 2e9, True),
+                         [[1471208400500, "1471208400.5", "42.0",
+                           "/dev/sda"]])
+
+    def test_statgroup(self):
+        rows = [[1, "0.001", "1.2.3.4"],
+                [2, "0.002", "5.6.7.8"],
+                [3, "0.003"],
+                [4, "0.004", "1.2.3.4"]]
+        self.assertEqual(ntp.ntpc.statgroup(rows, 2),
+                         {"1.2.3.4": [rows[0], rows[3]],
+                          "5.6.7.8": [rows[1]]})
+
+    def test_statslice(self):
+        rows = [[1000, "1.0", "0.5", "7"],
+                [2000, "2.0", "0.25"],
+                [3000000, "3000.0", "-1", "8"]]
+        self.assertEqual(ntp.ntpc.statslice(rows, 2),
+                         ("1.0 0.5\n2.0 0.25\n\n3000.0 -1\ne\n",
+                          [0.5, 0.25, -1.0]))
+        # a short row still leaves its first value behind
+        self.assertEqual(ntp.ntpc.statslice(rows, 2, 3),
+                         ("1.0 0.5 7\n\n3000.0 -1 8\ne\n",
+                          [0.5, 0.25, -1.0], [7.0, 8.0]))
+        self.assertRaises(ValueError, ntp.ntpc.statslice,
+                          [[1000, "1.0", "bogus"]], 2)
+
 
 if __name__ == '__main__':
     unittest.main()
@@ -6,11 +6,13 @@ from __future__ import print_function, division
 import getpass
 import select
 import socket
+import struct
 import sys
 import unittest
 import jigs
 import ntp.control
 import ntp.magic
+import ntp.ntpc
 import ntp.packet
 import ntp.poly
 import ntp.util
@@ -228,6 +230,43 @@ class TestPacket(unittest.TestCase):
                               "addr.1=2.0.0.1:23, last.1=2019-12-31T03:30:00Z"
         self.assertEqual(buf, expected)
 
+    def test_parse_mru_bin(self):
+        f = ntpp.parse_mru_bin
+        hdr = struct.pack("!BBHIIIIII", 1, 52, 0, 77, 9, 4, 2,
+                          0xe1d3a000, 0x80000000)
+        rec4 = struct.pack("!BBHHH16sIIIIIIf", 4, 0x23, 0x20, 123, 0,
+                           b"\x0a\x01\x02\x03" + b"\0" * 12,
+                           0xe1d39000, 0, 0xe1d39f00, 0, 17, 3, 1.5)
+        rec6 = struct.pack("!BBHHH16sIIIIIIf", 6, 0x1b, 0, 4460, 0,
+                           b"\x20\x01\x0d\xb8" + b"\0" * 11 + b"\x01",
+                           0xe1d3a000, 0, 0xe1d3a000, 0, 1, 0, 0.0)
+        (snap, total, first, now, entries) = f(hdr + rec4 + rec6)
+        self.assertEqual((snap, total, first), (77, 9, 4))
+        self.assertEqual(now, ntp.ntpc.lfptofloat("0xe1d3a000.80000000"))
+        self.assertEqual(entries[0].addr, "10.1.2.3:123")
+        self.assertEqual(entries[0].last, "0xe1d39f00.00000000")
+        self.assertEqual((entries[0].ct, entries[0].dr, entries[0].sc,
+                          entries[0].rs, entries[0].mv),
+                         (17, 3, 1.5, 0x20, 0x23))
+        self.assertEqual(entries[1].addr, "[2001:db8::1]:4460")
+        # Short response
+        try:
+            f(hdr + rec4)
+            errored = False
+        except ntpp.ControlException as e:
+            errored = e.message
+        self.assertEqual(errored, ntpp.SERR_BADMRU)
+        # Filters
+        m = ntpp.mru_bin_match
+        self.assertEqual(m(entries[0], {}, now), True)
+        self.assertEqual(m(entries[0], {"mincount": 18}, now), False)
+        self.assertEqual(m(entries[0], {"resany": ntp.magic.RES_LIMITED},
+                           now), True)
+        self.assertEqual(m(entries[1], {"resany": ntp.magic.RES_LIMITED},
+                           now), False)
+        self.assertEqual(m(entries[0], {"maxlstint": 60}, now), False)
+        self.assertEqual(m(entries[1], {"minlstint": 60}, now), False)
+
 
 class TestSyncPacket(unittest.TestCase):
     target = ntpp.SyncPacket
@@ -1564,6 +1603,15 @@ class TestControlSession(unittest.TestCase):
         self.assertEqual(queries,
                          [(ntp.control.CTL_OP_READVAR,
                            0, "foo,bar,quux", False)])
+        # Test varlist too long for one packet
+        queries = []
+        names = ["variable%03d" % i for i in range(60)]
+        result = cls.readvar(varlist=names)
+        self.assertEqual(result, odict((("foo", "bar"), ("murphy", 42))))
+        self.assertEqual(len(queries), 2)
+        for query in queries:
+            self.assertTrue(len(query[2]) <= ntp.control.CTL_MAX_DATA_LEN)
+        self.assertEqual(",".join(q[2] for q in queries), ",".join(names))
 
     def test_config(self):
         queries = []
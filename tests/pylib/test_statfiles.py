@@ -4,7 +4,11 @@
 import unittest
 import ntp.statfiles
 import jigs
+import os
+import shutil
+import struct
 import sys
+import tempfile
 
 
 class TestPylibStatfiles(unittest.TestCase):
@@ -30,6 +34,107 @@ class TestPylibStatfiles(unittest.TestCase):
             "2016-12-06T04:49:46")
 
 
+class TestStatsBinFile(unittest.TestCase):
+    target = ntp.statfiles.StatsBinFile
+
+    @staticmethod
+    def make(records, days, slots=366):
+        "Build a binary loopstats-like file: time, offset, status, peer"
+        cols = ((b"time", b"d", 8), (b"offset", b"d", 8),
+                (b"status", b"x", 4), (b"peer", b"s", 8))
+        hdr = bytearray(4096)
+        struct.pack_into("<8sHHHHHH", hdr, 0, b"NTPSTATS", 1, 4096, 28,
+                         len(cols), slots, len(days))
+        offset = 0
+        for i, (name, ctype, size) in enumerate(cols):
+            struct.pack_into("<16sHcB", hdr, 32 + i * 24,
+                             name, offset, ctype, size)
+            offset += size
+        for i, (day, first) in enumerate(days):
+            struct.pack_into("<II", hdr, 800 + i * 8, day, first)
+        body = b"".join(struct.pack("<ddI8s", *rec) for rec in records)
+        return bytes(hdr) + body
+
+    def test_rows(self):
+        day = 86400
+        records = [(day + 10.5, 0.25, 0x9614, b"a"),
+                   (day + 20.5, -0.5, 0x9614, b"b"),
+                   (2 * day + 1.0, 1.5, 0x1a, b"a"),
+                   (2 * day + 2.0, 2.5, 0x1a, b"b")]
+        cls = self.target(self.make(records, [(1, 0), (2, 2)]))
+        self.assertEqual(cls.names, ["time", "offset", "status", "peer"])
+        self.assertEqual(cls.nrec, 4)
+        # one day decodes only its own records
+        self.assertEqual(list(cls.segments(2 * day, 2 * day + 5)),
+                         [(2, 4)])
+        self.assertEqual(cls.rows(day, day + 15),
+                         [[86410500, "86410.5", "0.25", "9614", "a"]])
+        self.assertEqual(len(cls.rows(0, 3 * day)), 4)
+        self.assertEqual([rec[1] for rec in cls.records(2 * day, 3 * day)],
+                         [1.5, 2.5])
+        # no index, or a full one, falls back to reading everything
+        cls = self.target(self.make(records, []))
+        self.assertEqual(list(cls.segments(2 * day, 2 * day)), [(0, 4)])
+        cls = self.target(self.make(records, [(1, 0)], slots=1))
+        self.assertEqual(len(cls.rows(2 * day, 3 * day)), 2)
+        # text is refused
+        self.assertRaises(ValueError, self.target, b"40594 10 foo\n" * 400)
+
+
+class TestStatsCache(unittest.TestCase):
+    target = ntp.statfiles.NTPStats
+
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        self.statsdir = os.path.join(self.tmpdir, "stats")
+        self.cachedir = os.path.join(self.tmpdir, "cache")
+        os.mkdir(self.statsdir)
+        self.converted = []
+        self.unixize = ntp.statfiles.NTPStats.unixize
+
+        def unixize(lines, starttime, endtime):
+            self.converted.extend(lines)
+            return self.unixize(lines, starttime, endtime)
+        ntp.statfiles.NTPStats.unixize = staticmethod(unixize)
+
+    def tearDown(self):
+        ntp.statfiles.NTPStats.unixize = staticmethod(self.unixize)
+        shutil.rmtree(self.tmpdir)
+
+    def append(self, text):
+        with open(os.path.join(self.statsdir, "loopstats.20160814"),
+                  "a") as fp:
+            fp.write(text)
+
+    def load(self, starttime, endtime):
+        return self.target(self.statsdir, "site", starttime=starttime,
+                           endtime=endtime, cachedir=self.cachedir)
+
+    def test_cache(self):
+        self.append("57614 10.5 0.25\n57614 20.5 0.5\n57614 30")
+        cls = self.load(1471132800, 1471132820)
+        self.assertEqual(cls.loopstats,
+                         [[1471132810500, "1471132810.5", "0.25"]])
+        self.assertEqual(len(os.listdir(self.cachedir)), 1)
+        # nothing changed, nothing parsed
+        del self.converted[:]
+        cls = self.load(1471132800, 1471132900)
+        self.assertEqual(len(cls.loopstats), 2)
+        self.assertEqual(self.converted, [])
+        # only the new tail is parsed, with the partial line
+        self.append(".5 0.75\n57614 40.5 1.0\n")
+        cls = self.load(1471132800, 1471132900)
+        self.assertEqual(self.converted,
+                         ["57614 30.5 0.75", "57614 40.5 1.0"])
+        self.assertEqual([row[2] for row in cls.loopstats],
+                         ["0.25", "0.5", "0.75", "1.0"])
+        # the same rows as without the cache
+        self.assertEqual(cls.loopstats,
+                         self.target(self.statsdir, "site",
+                                     starttime=1471132800,
+                                     endtime=1471132900).loopstats)
+
+
 class TestNTPStats(unittest.TestCase):
     target = ntp.statfiles.NTPStats
 
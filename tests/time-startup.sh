@@ -1,5 +1,7 @@
 #!/bin/sh
 # Hack to measure startup timing
+# Prints the time from starting ntpd to the first sync.
+# That's mostly DNS and NTS-KE with many servers, see dnsworkers.
 
 if test "$#" -ge 1
 then
@@ -13,8 +15,10 @@ fi
 killall ntpd
 sleep 5
 
+START=$(date +%s)
 time /usr/local/sbin/ntpd -u ntp:ntp -g -c $CONF
 /usr/local/bin/ntpwait -v -n 999 -s 1
+SYNC=$(date +%s)
 
 /usr/local/bin/ntpq -np
-
+echo "time to first sync: $((SYNC - START)) seconds"